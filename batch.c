@@ -0,0 +1,211 @@
+/*
+    Evaluation of many finished hands at once
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <string.h>
+
+#include "batch.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAS_X86 1
+#else
+#define HAS_X86 0
+#endif
+
+///// LOCAL FUNCTION DECLARATIONS
+static code_t handStatus(int total, int numCards);
+static int settle(int bet, int playerTotal, code_t playerStatus, int dealerTotal, code_t dealerStatus);
+
+///// FUNCTION DEFINITIONS
+
+/*
+    Copy a finished game to the position indicated of the batch
+*/
+void loadBatch(hand_batch_t * batch, int index, const game_t * game)
+{
+    batch->playerHard[index] = (game->player.hardTotal < MAX_HARD_TOTAL) ? game->player.hardTotal : MAX_HARD_TOTAL;
+    batch->playerAce[index] = game->player.rankCount[ACE] > 0;
+    batch->playerCards[index] = game->player.numCards;
+    batch->dealerHard[index] = (game->dealer.hardTotal < MAX_HARD_TOTAL) ? game->dealer.hardTotal : MAX_HARD_TOTAL;
+    batch->dealerAce[index] = game->dealer.rankCount[ACE] > 0;
+    batch->dealerCards[index] = game->dealer.numCards;
+    batch->bets[index] = game->playerBet;
+}
+
+/*
+    Get the fastest evaluator supported by the processor
+*/
+evaluator_t selectEvaluator()
+{
+    return supportsAVX2() ? evaluateAVX2 : evaluateScalar;
+}
+
+/*
+    Get the name of an evaluator, for the reports
+*/
+const char * evaluatorName(evaluator_t evaluator)
+{
+    return (evaluator == evaluateAVX2) ? "AVX2" : "scalar";
+}
+
+/*
+    Evaluate the batch one hand at a time
+*/
+void evaluateScalar(hand_batch_t * batch)
+{
+    for (int i=0; i<BATCH_SIZE; i++)
+    {
+        batch->playerTotal[i] = bestTotals[batch->playerAce[i]][batch->playerHard[i]];
+        batch->dealerTotal[i] = bestTotals[batch->dealerAce[i]][batch->dealerHard[i]];
+        batch->playerStatus[i] = handStatus(batch->playerTotal[i], batch->playerCards[i]);
+        batch->dealerStatus[i] = handStatus(batch->dealerTotal[i], batch->dealerCards[i]);
+        batch->results[i] = settle(batch->bets[i], batch->playerTotal[i], batch->playerStatus[i], batch->dealerTotal[i], batch->dealerStatus[i]);
+    }
+}
+
+/*
+    Tell if the processor supports the AVX2 evaluator
+*/
+int supportsAVX2()
+{
+#if HAS_X86
+    return __builtin_cpu_supports("avx2");
+#else
+    return 0;
+#endif
+}
+
+#if HAS_X86
+
+/*
+    Best totals of 32 hands: an ace adds 10 while the hard total is 11 or less
+*/
+__attribute__((target("avx2")))
+static inline __m256i vectorTotals(__m256i hard, __m256i ace)
+{
+    __m256i soft = _mm256_and_si256(_mm256_cmpgt_epi8(ace, _mm256_setzero_si256()), _mm256_cmpgt_epi8(_mm256_set1_epi8(12), hard));
+
+    return _mm256_add_epi8(hard, _mm256_and_si256(soft, _mm256_set1_epi8(10)));
+}
+
+/*
+    Statuses of 32 hands, with the same rules of handStatus
+*/
+__attribute__((target("avx2")))
+static inline __m256i vectorStatus(__m256i total, __m256i cards)
+{
+    __m256i is21 = _mm256_cmpeq_epi8(total, _mm256_set1_epi8(21));
+    __m256i natural = _mm256_and_si256(is21, _mm256_cmpeq_epi8(cards, _mm256_set1_epi8(2)));
+    __m256i bust = _mm256_cmpgt_epi8(total, _mm256_set1_epi8(21));
+    __m256i status = _mm256_set1_epi8(STAND);
+
+    status = _mm256_blendv_epi8(status, _mm256_set1_epi8(TWENTYONE), is21);
+    status = _mm256_blendv_epi8(status, _mm256_set1_epi8(NATURAL), natural);
+    return _mm256_blendv_epi8(status, _mm256_set1_epi8(BUST), bust);
+}
+
+/*
+    Evaluate the batch with AVX2 instructions
+    The settlement is computed as a number of half bets per hand,
+    and each rule of calculateResults overwrites the ones with less priority
+*/
+__attribute__((target("avx2")))
+void evaluateAVX2(hand_batch_t * batch)
+{
+    __m256i playerTotal = vectorTotals(_mm256_loadu_si256((__m256i *) batch->playerHard), _mm256_loadu_si256((__m256i *) batch->playerAce));
+    __m256i dealerTotal = vectorTotals(_mm256_loadu_si256((__m256i *) batch->dealerHard), _mm256_loadu_si256((__m256i *) batch->dealerAce));
+    __m256i playerStatus = vectorStatus(playerTotal, _mm256_loadu_si256((__m256i *) batch->playerCards));
+    __m256i dealerStatus = vectorStatus(dealerTotal, _mm256_loadu_si256((__m256i *) batch->dealerCards));
+    __m256i playerNatural = _mm256_cmpeq_epi8(playerStatus, _mm256_set1_epi8(NATURAL));
+    __m256i dealerNatural = _mm256_cmpeq_epi8(dealerStatus, _mm256_set1_epi8(NATURAL));
+    __m256i lose = _mm256_set1_epi8(-2);
+    __m256i halves = _mm256_setzero_si256();
+    __m256i win;
+
+    _mm256_storeu_si256((__m256i *) batch->playerTotal, playerTotal);
+    _mm256_storeu_si256((__m256i *) batch->dealerTotal, dealerTotal);
+    _mm256_storeu_si256((__m256i *) batch->playerStatus, playerStatus);
+    _mm256_storeu_si256((__m256i *) batch->dealerStatus, dealerStatus);
+
+    win = _mm256_or_si256(_mm256_cmpeq_epi8(dealerStatus, _mm256_set1_epi8(BUST)), _mm256_cmpgt_epi8(playerTotal, dealerTotal));
+    halves = _mm256_blendv_epi8(halves, lose, _mm256_cmpgt_epi8(dealerTotal, playerTotal));
+    halves = _mm256_blendv_epi8(halves, _mm256_set1_epi8(2), win);
+    halves = _mm256_blendv_epi8(halves, _mm256_set1_epi8(3), playerNatural);
+    halves = _mm256_blendv_epi8(halves, lose, dealerNatural);
+    halves = _mm256_blendv_epi8(halves, _mm256_setzero_si256(), _mm256_and_si256(playerNatural, dealerNatural));
+    halves = _mm256_blendv_epi8(halves, lose, _mm256_cmpeq_epi8(playerStatus, _mm256_set1_epi8(BUST)));
+
+    // Multiply the bets by the half bets, 8 hands at a time
+    for (int i=0; i<BATCH_SIZE; i+=8)
+    {
+        __m128i bytes = _mm_loadl_epi64((__m128i *) ((char *) &halves + i));
+        __m256i bets = _mm256_loadu_si256((__m256i *) (batch->bets + i));
+        __m256i results = _mm256_srai_epi32(_mm256_mullo_epi32(bets, _mm256_cvtepi8_epi32(bytes)), 1);
+
+        _mm256_storeu_si256((__m256i *) (batch->results + i), results);
+    }
+}
+
+#else
+
+/*
+    Evaluate the batch with AVX2 instructions
+    Processors without them use the scalar version
+*/
+void evaluateAVX2(hand_batch_t * batch)
+{
+    evaluateScalar(batch);
+}
+
+#endif
+
+/*
+    Status of a finished hand, with the same rules used while playing
+*/
+static code_t handStatus(int total, int numCards)
+{
+    if (total > 21)
+    {
+        return BUST;
+    }
+    if (total == 21)
+    {
+        return (numCards == 2) ? NATURAL : TWENTYONE;
+    }
+    return STAND;
+}
+
+/*
+    Chips won or lost by the player, with the same rules of calculateResults
+*/
+static int settle(int bet, int playerTotal, code_t playerStatus, int dealerTotal, code_t dealerStatus)
+{
+    if (playerStatus == BUST)
+    {
+        return -bet;
+    }
+    if ((dealerStatus == NATURAL) && (playerStatus == NATURAL))
+    {
+        return 0;
+    }
+    if (dealerStatus == NATURAL)
+    {
+        return -bet;
+    }
+    if (playerStatus == NATURAL)
+    {
+        return bet * 3 / 2;
+    }
+    if ((dealerStatus == BUST) || (playerTotal > dealerTotal))
+    {
+        return bet;
+    }
+    if (playerTotal < dealerTotal)
+    {
+        return -bet;
+    }
+    return 0;
+}
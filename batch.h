@@ -0,0 +1,73 @@
+/*
+    Evaluation of many finished hands at once
+    The hands are stored as a structure of arrays, one byte per hand in every field,
+    so the totals, statuses and settlement of a whole batch are computed together.
+    The AVX2 version evaluates the 32 hands with a few vector instructions,
+    and the scalar version is used when the processor does not support it.
+    Both give the same results as the rules in blackjack.c.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "blackjack.h"
+
+// Number of hands evaluated in a single call, the bytes of an AVX2 register
+#define BATCH_SIZE 32
+
+// Finished hands of the player and the dealer, and the results of evaluating them
+typedef struct hand_batch_struct {
+    // Input: the hard totals, whether there is an ace, and the number of cards of every hand
+    unsigned char playerHard[BATCH_SIZE];
+    unsigned char playerAce[BATCH_SIZE];
+    unsigned char playerCards[BATCH_SIZE];
+    unsigned char dealerHard[BATCH_SIZE];
+    unsigned char dealerAce[BATCH_SIZE];
+    unsigned char dealerCards[BATCH_SIZE];
+    int bets[BATCH_SIZE];
+    // Output: best totals, statuses as code_t values and chips won or lost
+    unsigned char playerTotal[BATCH_SIZE];
+    unsigned char dealerTotal[BATCH_SIZE];
+    unsigned char playerStatus[BATCH_SIZE];
+    unsigned char dealerStatus[BATCH_SIZE];
+    int results[BATCH_SIZE];
+} hand_batch_t;
+
+// Function that evaluates all the hands of a batch
+typedef void (* evaluator_t)(hand_batch_t * batch);
+
+/*
+    Copy a finished game to the position indicated of the batch
+    The unused positions must be filled with hands of bet 0
+*/
+void loadBatch(hand_batch_t * batch, int index, const game_t * game);
+
+/*
+    Get the fastest evaluator supported by the processor
+*/
+evaluator_t selectEvaluator();
+
+/*
+    Get the name of an evaluator, for the reports
+*/
+const char * evaluatorName(evaluator_t evaluator);
+
+/*
+    Evaluate the batch one hand at a time
+*/
+void evaluateScalar(hand_batch_t * batch);
+
+/*
+    Evaluate the batch with AVX2 instructions
+    Must only be called when the processor supports them
+*/
+void evaluateAVX2(hand_batch_t * batch);
+
+/*
+    Tell if the processor supports the AVX2 evaluator
+*/
+int supportsAVX2();
+
+#endif
@@ -0,0 +1,736 @@
+/*
+    Benchmarks of the functions used in every round
+    Every benchmark repeats a function enough times to run for a while,
+    and the fastest of several runs is kept, in nanoseconds per operation.
+    The allocations are counted by wrapping malloc, calloc and realloc at link time
+    (see the Makefile), so only the calls made by the code of the project are seen.
+
+    The results are written to a file with one line per benchmark, that can be kept
+    as a baseline: the next runs are compared with it, and any benchmark slower than
+    the threshold, or with more allocations, is reported as a regression.
+    The benchmarks of the sockets mostly measure the kernel and vary more between runs,
+    so they are allowed twice the threshold. A benchmark slower than the threshold is
+    measured again a few times before it is reported, since the machine can be busy for a while.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "blackjack.h"
+#include "policy.h"
+#include "protocol.h"
+#include "rng.h"
+#include "shoe.h"
+#include "sockets.h"
+#include "stats.h"
+
+// Games prepared at once for the benchmarks that need dealt hands
+#define BENCH_GAMES 256
+// Most benchmarks read from a baseline
+#define MAX_BENCHMARKS 32
+// Length of the names of the benchmarks
+#define NAME_SIZE 64
+#define SEED 0x5EEDULL
+// Times a benchmark slower than the baseline is measured again, keeping the fastest result
+#define BENCH_RETRIES 3
+
+// A function measured, it runs the operations indicated between startTimer and stopTimer
+typedef struct benchmark_struct {
+    const char * name;
+    void (* run)(long long operations);
+    // Times the threshold allowed before reporting a regression
+    double tolerance;
+} benchmark_t;
+
+// Result of a benchmark, as written in the files
+typedef struct bench_result_struct {
+    char name[NAME_SIZE];
+    double nanoseconds;
+    double allocations;
+    long long operations;
+    // Copied from the benchmark, not kept in the files
+    double tolerance;
+} bench_result_t;
+
+// Time and allocations of the parts measured of the current run
+typedef struct bench_timer_struct {
+    uint64_t start;
+    uint64_t elapsed;
+    unsigned long long allocationsStart;
+    unsigned long long allocations;
+} bench_timer_t;
+
+// Connection where the messages are sent back, and the number of messages expected
+typedef struct echo_struct {
+    int connection_fd;
+    int protocol;
+    long long operations;
+} echo_t;
+
+// Allocations made by the program, counted by the wrappers
+static unsigned long long allocationCount = 0;
+static bench_timer_t timer;
+// Values computed by the benchmarks, so the compiler can not remove their work
+static volatile long long sink;
+// Shuffler of the benchmarks that deal from shoes, shared by all their runs
+static shuffler_t * shuffler = NULL;
+
+void * __real_malloc(size_t size);
+void * __real_calloc(size_t count, size_t size);
+void * __real_realloc(void * pointer, size_t size);
+
+///// FUNCTION DECLARATIONS
+void usage(char * program);
+void * __wrap_malloc(size_t size);
+void * __wrap_calloc(size_t count, size_t size);
+void * __wrap_realloc(void * pointer, size_t size);
+void startTimer();
+void stopTimer();
+void measure(const benchmark_t * benchmark, int runs, double minimum, bench_result_t * result);
+int readResults(const char * path, bench_result_t * results);
+int writeResults(const char * path, const bench_result_t * results, int count);
+int compareResults(const bench_result_t * results, int count, const bench_result_t * baseline, int baselineCount, double threshold);
+const bench_result_t * findResult(const char * name, const bench_result_t * results, int count);
+int isSlower(const bench_result_t * result, const bench_result_t * baseline, int baselineCount, double threshold);
+void benchRandomCard(long long operations);
+void benchFirstDeal(long long operations);
+void benchFirstDealShoe(long long operations);
+void benchDealerTurn(long long operations);
+void benchResults(long long operations);
+void benchRoundTrip(long long operations);
+void benchFrameRoundTrip(long long operations);
+void dealGames(game_t * games, uint64_t * stream, int finish);
+void openLoopback(int * client_fd, int * server_fd);
+void * echoThread(void * arg);
+
+// The benchmarks, in the order they run
+static const benchmark_t benchmarks[] = {
+    {"getRandomCard", benchRandomCard, 1},
+    {"completeFirstDeal", benchFirstDeal, 1},
+    {"completeFirstDeal_shoe", benchFirstDealShoe, 1},
+    {"dealerTurn", benchDealerTurn, 1},
+    {"calculateResults", benchResults, 1},
+    {"sendData_recvData_loopback", benchRoundTrip, 2},
+    {"sendMessage_frame_loopback", benchFrameRoundTrip, 2},
+};
+
+#define NUM_BENCHMARKS (int) (sizeof benchmarks / sizeof benchmarks[0])
+
+///// MAIN FUNCTION
+int main(int argc, char * argv[])
+{
+    bench_result_t results[NUM_BENCHMARKS];
+    bench_result_t baseline[MAX_BENCHMARKS];
+    bench_result_t again;
+    const char * outputPath = NULL;
+    const char * baselinePath = NULL;
+    const char * filter = NULL;
+    double threshold = 25;
+    double minimum = 200;
+    int runs = 15;
+    int baselineCount = 0;
+    int count = 0;
+    int option;
+
+    printf("\n=== BENCHMARK PROGRAM ===\n");
+
+    while ((option = getopt(argc, argv, "o:c:T:m:r:f:")) != -1)
+    {
+        switch (option)
+        {
+            case 'o':
+                outputPath = optarg;
+                break;
+            case 'c':
+                baselinePath = optarg;
+                break;
+            case 'T':
+                threshold = atof(optarg);
+                break;
+            case 'm':
+                minimum = atof(optarg);
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc || runs < 1 || minimum <= 0 || threshold < 0)
+    {
+        usage(argv[0]);
+    }
+
+    if (baselinePath != NULL)
+    {
+        baselineCount = readResults(baselinePath, baseline);
+        if (baselineCount == -1)
+        {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Nothing is printed by the games
+    gameMessages = 0;
+    shuffler = createShuffler(6, 75, 2, SEED);
+
+    printf("%-28s %12s %12s %14s\n", "benchmark", "ns/op", "allocs/op", "operations");
+    for (int i=0; i<NUM_BENCHMARKS; i++)
+    {
+        if (filter != NULL && strstr(benchmarks[i].name, filter) == NULL)
+        {
+            continue;
+        }
+        measure(&benchmarks[i], runs, minimum, &results[count]);
+        for (int retry=0; retry<BENCH_RETRIES && isSlower(&results[count], baseline, baselineCount, threshold); retry++)
+        {
+            measure(&benchmarks[i], runs, minimum, &again);
+            if (again.nanoseconds < results[count].nanoseconds)
+            {
+                results[count] = again;
+            }
+        }
+        printf("%-28s %12.2f %12.3f %14lld\n", results[count].name, results[count].nanoseconds, results[count].allocations, results[count].operations);
+        count++;
+    }
+
+    destroyShuffler(shuffler);
+
+    if (outputPath != NULL && !writeResults(outputPath, results, count))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    if (baselinePath != NULL && compareResults(results, count, baseline, baselineCount, threshold) > 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
+
+///// FUNCTION DEFINITIONS
+
+/*
+    Explanation to the user of the parameters required to run the program
+*/
+void usage(char * program)
+{
+    printf("Usage:\n");
+    printf("\t%s [-o output_file] [-c baseline_file] [-T threshold] [-m milliseconds] [-r runs] [-f filter]\n", program);
+    printf("\t-o: write the results to this file, in the format used by the baselines\n");
+    printf("\t-c: compare the results with a baseline, and fail if any benchmark regressed\n");
+    printf("\t-T: percentage slower than the baseline reported as a regression, 25 by default, twice for the sockets\n");
+    printf("\t-m: shortest time of every run, in milliseconds, 200 by default\n");
+    printf("\t-r: runs of every benchmark, the fastest is kept, 15 by default\n");
+    printf("\t-f: only run the benchmarks with this text in their name\n");
+    exit(EXIT_FAILURE);
+}
+
+/*
+    Count the allocations and use the real malloc
+*/
+void * __wrap_malloc(size_t size)
+{
+    allocationCount++;
+    return __real_malloc(size);
+}
+
+/*
+    Count the allocations and use the real calloc
+*/
+void * __wrap_calloc(size_t count, size_t size)
+{
+    allocationCount++;
+    return __real_calloc(count, size);
+}
+
+/*
+    Count the allocations and use the real realloc
+*/
+void * __wrap_realloc(void * pointer, size_t size)
+{
+    allocationCount++;
+    return __real_realloc(pointer, size);
+}
+
+/*
+    Start measuring the part of the benchmark that runs the operations
+*/
+void startTimer()
+{
+    timer.allocationsStart = allocationCount;
+    timer.start = statsNow();
+}
+
+/*
+    Stop measuring, adding the time and allocations since startTimer
+*/
+void stopTimer()
+{
+    timer.elapsed += statsNow() - timer.start;
+    timer.allocations += allocationCount - timer.allocationsStart;
+}
+
+/*
+    Find the number of operations that lasts the minimum time, then keep the fastest of the runs
+*/
+void measure(const benchmark_t * benchmark, int runs, double minimum, bench_result_t * result)
+{
+    long long operations = 1;
+    double best = 0;
+    double allocations = 0;
+    double nanoseconds;
+
+    // Grow the number of operations until a run takes the minimum time
+    while (1)
+    {
+        bzero(&timer, sizeof timer);
+        benchmark->run(operations);
+        if (timer.elapsed >= minimum * 1000000 || operations >= (1LL << 40))
+        {
+            break;
+        }
+        operations = (timer.elapsed > 0 && timer.elapsed * 100 > minimum * 1000000) ? operations * minimum * 1200000 / timer.elapsed : operations * 100;
+    }
+
+    for (int i=0; i<runs; i++)
+    {
+        bzero(&timer, sizeof timer);
+        benchmark->run(operations);
+        nanoseconds = (double) timer.elapsed / operations;
+        if (i == 0 || nanoseconds < best)
+        {
+            best = nanoseconds;
+            allocations = (double) timer.allocations / operations;
+        }
+    }
+
+    strncpy(result->name, benchmark->name, NAME_SIZE - 1);
+    result->name[NAME_SIZE - 1] = '\0';
+    result->nanoseconds = best;
+    result->allocations = allocations;
+    result->operations = operations;
+    result->tolerance = benchmark->tolerance;
+}
+
+/*
+    Read the results of a previous run, ignoring the lines of comments
+    Returns the number of results read, or -1 if the file could not be read
+*/
+int readResults(const char * path, bench_result_t * results)
+{
+    FILE * file = fopen(path, "r");
+    char line[256];
+    int count = 0;
+
+    if (file == NULL)
+    {
+        perror("ERROR: fopen");
+        return -1;
+    }
+    while (count < MAX_BENCHMARKS && fgets(line, sizeof line, file) != NULL)
+    {
+        if (line[0] == '#')
+        {
+            continue;
+        }
+        if (sscanf(line, "%63s %lf %lf %lld", results[count].name, &results[count].nanoseconds, &results[count].allocations, &results[count].operations) == 4)
+        {
+            count++;
+        }
+    }
+    fclose(file);
+
+    return count;
+}
+
+/*
+    Write the results, one benchmark per line: name, ns/op, allocations/op and operations
+    Returns 1 on success, or 0 if the file could not be written
+*/
+int writeResults(const char * path, const bench_result_t * results, int count)
+{
+    FILE * file = fopen(path, "w");
+
+    if (file == NULL)
+    {
+        perror("ERROR: fopen");
+        return 0;
+    }
+    fprintf(file, "# name ns_per_op allocations_per_op operations\n");
+    for (int i=0; i<count; i++)
+    {
+        fprintf(file, "%s %.3f %.6f %lld\n", results[i].name, results[i].nanoseconds, results[i].allocations, results[i].operations);
+    }
+    if (fclose(file) != 0)
+    {
+        perror("ERROR: fclose");
+        return 0;
+    }
+
+    printf("Results written to %s\n", path);
+    return 1;
+}
+
+/*
+    Show the change of every benchmark against the baseline
+    Returns the number of regressions: slower than the threshold, or with more allocations
+*/
+int compareResults(const bench_result_t * results, int count, const bench_result_t * baseline, int baselineCount, double threshold)
+{
+    const bench_result_t * previous = NULL;
+    double change;
+    int regressions = 0;
+
+    printf("\nCompared with the baseline, regressions above %.1f%%:\n", threshold);
+    printf("%-28s %12s %12s %9s\n", "benchmark", "baseline", "ns/op", "change");
+    for (int i=0; i<count; i++)
+    {
+        previous = findResult(results[i].name, baseline, baselineCount);
+        if (previous == NULL)
+        {
+            printf("%-28s %12s %12.2f %9s\n", results[i].name, "-", results[i].nanoseconds, "new");
+            continue;
+        }
+
+        change = (previous->nanoseconds > 0) ? (results[i].nanoseconds / previous->nanoseconds - 1) * 100 : 0;
+        printf("%-28s %12.2f %12.2f %+8.1f%%", results[i].name, previous->nanoseconds, results[i].nanoseconds, change);
+        if (change > threshold * results[i].tolerance)
+        {
+            printf("  REGRESSION");
+            regressions++;
+        }
+        // Small differences come from the operations that allocate once per run
+        if (results[i].allocations > previous->allocations + 0.001)
+        {
+            printf("  MORE ALLOCATIONS (%.3f before)", previous->allocations);
+            regressions++;
+        }
+        printf("\n");
+    }
+
+    printf("%d regressions\n", regressions);
+    return regressions;
+}
+
+/*
+    Find the result of a benchmark by its name, the last one if there are several
+    Returns NULL if it is not there
+*/
+const bench_result_t * findResult(const char * name, const bench_result_t * results, int count)
+{
+    const bench_result_t * found = NULL;
+
+    for (int i=0; i<count; i++)
+    {
+        if (strcmp(name, results[i].name) == 0)
+        {
+            found = &results[i];
+        }
+    }
+    return found;
+}
+
+/*
+    Check if a result is slower than its baseline by more than the threshold allowed to the benchmark
+*/
+int isSlower(const bench_result_t * result, const bench_result_t * baseline, int baselineCount, double threshold)
+{
+    const bench_result_t * previous = findResult(result->name, baseline, baselineCount);
+
+    return previous != NULL && previous->nanoseconds > 0
+        && (result->nanoseconds / previous->nanoseconds - 1) * 100 > threshold * result->tolerance;
+}
+
+/*
+    Pick random cards from the infinite deck
+*/
+void benchRandomCard(long long operations)
+{
+    rng_t rng;
+    long long total = 0;
+
+    seedRandom(&rng, SEED, 0);
+    startTimer();
+    for (long long i=0; i<operations; i++)
+    {
+        total += getRandomCard(&rng);
+    }
+    stopTimer();
+    sink = total;
+}
+
+/*
+    Deal the first cards of a game from the infinite deck
+*/
+void benchFirstDeal(long long operations)
+{
+    game_t game;
+    long long total = 0;
+
+    bzero(&game, sizeof game);
+    seedRandom(&game.rng, SEED, 0);
+    startTimer();
+    for (long long i=0; i<operations; i++)
+    {
+        completeFirstDeal(&game);
+        total += game.player.hardTotal;
+    }
+    stopTimer();
+    sink = total;
+}
+
+/*
+    Deal the first cards of a game from shoes of 6 decks, replaced at the cut card
+*/
+void benchFirstDealShoe(long long operations)
+{
+    game_t game;
+    long long total = 0;
+
+    bzero(&game, sizeof game);
+    seedRandom(&game.rng, SEED, 0);
+    game.shuffler = shuffler;
+    startTimer();
+    for (long long i=0; i<operations; i++)
+    {
+        completeFirstDeal(&game);
+        total += game.player.hardTotal;
+    }
+    stopTimer();
+    sink = total;
+
+    releaseShoe(&game);
+}
+
+/*
+    Play the turn of the dealer in games already dealt
+*/
+void benchDealerTurn(long long operations)
+{
+    static game_t games[BENCH_GAMES];
+    uint64_t stream = 0;
+    long long total = 0;
+    long long done = 0;
+    int size;
+
+    while (done < operations)
+    {
+        size = (operations - done < BENCH_GAMES) ? operations - done : BENCH_GAMES;
+        dealGames(games, &stream, 0);
+
+        startTimer();
+        for (int i=0; i<size; i++)
+        {
+            dealerTurn(&games[i]);
+            total += games[i].dealer.hardTotal;
+        }
+        stopTimer();
+        done += size;
+    }
+    sink = total;
+}
+
+/*
+    Settle games already finished
+*/
+void benchResults(long long operations)
+{
+    static game_t games[BENCH_GAMES];
+    uint64_t stream = 0;
+    long long total = 0;
+
+    dealGames(games, &stream, 1);
+
+    startTimer();
+    for (long long i=0; i<operations; i++)
+    {
+        total += calculateResults(&games[i % BENCH_GAMES]);
+    }
+    stopTimer();
+    sink = total;
+}
+
+/*
+    Send a message of the original protocol through a loopback connection and receive it back
+*/
+void benchRoundTrip(long long operations)
+{
+    pthread_t tid;
+    message_t message;
+    int protocol = PROTOCOL_LEGACY;
+    int client_fd;
+    echo_t echo;
+
+    bzero(&message, sizeof message);
+    message.msg_code = BET;
+    message.playerBet = 10;
+
+    openLoopback(&client_fd, &echo.connection_fd);
+    echo.protocol = protocol;
+    echo.operations = operations;
+    pthread_create(&tid, NULL, echoThread, &echo);
+
+    startTimer();
+    for (long long i=0; i<operations; i++)
+    {
+        if (!sendData(client_fd, &message, sizeof message) || !recvData(client_fd, &message, sizeof message))
+        {
+            break;
+        }
+    }
+    stopTimer();
+
+    // Let the echo thread finish even if the loop stopped early
+    shutdown(client_fd, SHUT_RDWR);
+    pthread_join(tid, NULL);
+    close(client_fd);
+    close(echo.connection_fd);
+}
+
+/*
+    Send a frame of the compact protocol through a loopback connection and receive it back
+*/
+void benchFrameRoundTrip(long long operations)
+{
+    pthread_t tid;
+    message_t message;
+    int protocol = PROTOCOL_VERSION;
+    int client_fd;
+    echo_t echo;
+
+    bzero(&message, sizeof message);
+    message.msg_code = BET;
+    message.playerBet = 10;
+
+    openLoopback(&client_fd, &echo.connection_fd);
+    echo.protocol = protocol;
+    echo.operations = operations;
+    pthread_create(&tid, NULL, echoThread, &echo);
+
+    startTimer();
+    for (long long i=0; i<operations; i++)
+    {
+        sendMessage(client_fd, protocol, FRAME_BET, &message);
+        if (!receiveMessage(client_fd, protocol, &message))
+        {
+            break;
+        }
+    }
+    stopTimer();
+
+    // Let the echo thread finish even if the loop stopped early
+    shutdown(client_fd, SHUT_RDWR);
+    pthread_join(tid, NULL);
+    close(client_fd);
+    close(echo.connection_fd);
+}
+
+/*
+    Deal the first cards of a group of games, playing the player with basic strategy,
+    and the dealer too if the games must be finished
+    Every game uses the next stream of the seed, counted in stream
+*/
+void dealGames(game_t * games, uint64_t * stream, int finish)
+{
+    game_t * game = NULL;
+
+    for (int i=0; i<BENCH_GAMES; i++)
+    {
+        game = &games[i];
+        bzero(game, sizeof (game_t));
+        seedRandom(&game->rng, SEED, *stream);
+        (*stream)++;
+        game->playerBet = 10;
+        game->playerAmount = 1000;
+
+        completeFirstDeal(game);
+        if ((game->playerStatus != NATURAL) && (game->dealerStatus != NATURAL))
+        {
+            do
+            {
+                game->playerStatus = basicPolicy(game);
+                playerTurn(game);
+            } while (game->playerStatus == HIT);
+
+            if (finish)
+            {
+                dealerTurn(game);
+            }
+        }
+    }
+}
+
+/*
+    Connect two sockets through the loopback interface, using a port chosen by the system
+*/
+void openLoopback(int * client_fd, int * server_fd)
+{
+    struct sockaddr_in address;
+    socklen_t size = sizeof address;
+    int listen_fd;
+
+    bzero(&address, sizeof address);
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    *client_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd == -1 || *client_fd == -1)
+    {
+        perror("ERROR: socket");
+        exit(EXIT_FAILURE);
+    }
+    if (bind(listen_fd, (struct sockaddr *) &address, sizeof address) == -1 || listen(listen_fd, 1) == -1
+        || getsockname(listen_fd, (struct sockaddr *) &address, &size) == -1)
+    {
+        perror("ERROR: bind");
+        exit(EXIT_FAILURE);
+    }
+    if (connect(*client_fd, (struct sockaddr *) &address, sizeof address) == -1)
+    {
+        perror("ERROR: connect");
+        exit(EXIT_FAILURE);
+    }
+    *server_fd = accept(listen_fd, NULL, NULL);
+    if (*server_fd == -1)
+    {
+        perror("ERROR: accept");
+        exit(EXIT_FAILURE);
+    }
+    close(listen_fd);
+}
+
+/*
+    Send back the number of messages expected, or until the connection finishes
+*/
+void * echoThread(void * arg)
+{
+    echo_t * echo = arg;
+    message_t message;
+
+    bzero(&message, sizeof message);
+    for (long long i=0; i<echo->operations; i++)
+    {
+        if (!receiveMessage(echo->connection_fd, echo->protocol, &message))
+        {
+            break;
+        }
+        sendMessage(echo->connection_fd, echo->protocol, FRAME_BET, &message);
+    }
+
+    return NULL;
+}
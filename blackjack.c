@@ -0,0 +1,220 @@
+/*
+    Rules of the blackjack game played by the server
+    Every function is a single step of a round that only updates the game,
+    without doing any communication with the client.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blackjack.h"
+#include "logger.h"
+
+// Print a step of the game, only when the messages are enabled
+#define report(...) do { if (gameMessages) { logDebug(__VA_ARGS__); } } while (0)
+
+int gameMessages = 1;
+
+card_t getRandomCard(rng_t * rng){
+
+    int randomCard = randomBelow(rng, CARD_RANKS * CARD_SUITS); //Pick a random card of the deck
+
+    return makeCard(randomCard % CARD_RANKS, randomCard / CARD_RANKS);
+}
+
+card_t dealCard(game_t * game){
+
+    //The players seated at a table share its cards
+    if (game->house != NULL) {
+        return dealCard(game->house);
+    }
+
+    if (game->shuffler == NULL) {
+        return getRandomCard(&game->rng);
+    }
+
+    //A round that goes on after the end of the shoe continues with a new one
+    if (game->shoe == NULL || shoeEmpty(game->shoe)) {
+        returnShoe(game->shuffler, game->shoe);
+        game->shoe = takeShoe(game->shuffler);
+    }
+
+    return drawCard(game->shoe);
+}
+
+void checkShoe(game_t * game){
+
+    if (game->shuffler == NULL) {
+        return;
+    }
+
+    if (game->shoe != NULL && !shoeFinished(game->shoe)) {
+        return;
+    }
+
+    if (game->shoe != NULL) {
+        report("The shoe reached the cut card after %d cards.\n", game->shoe->next);
+    }
+    returnShoe(game->shuffler, game->shoe);
+    game->shoe = takeShoe(game->shuffler);
+    report("Dealing from the shoe of the shuffle %llu.\n", (unsigned long long) game->shoe->shuffle);
+}
+
+void releaseShoe(game_t * game){
+
+    if (game->shuffler != NULL) {
+        returnShoe(game->shuffler, game->shoe);
+    }
+    game->shoe = NULL;
+}
+
+//Generates the first 2 cards of the Player and Dealer and tells if someone got a Natural Blackjack
+void completeFirstDeal(game_t * game){
+
+    //Change the shoe before the round if the cut card was reached
+    checkShoe(game);
+
+    //Reset the cards of the player and dealer from the previous round
+    resetHand(&game->player);
+    resetHand(&game->dealer);
+
+    //Reset the status of the player and dealer from the previous round
+    game->playerStatus = START;
+    game->dealerStatus = START;
+
+    for(int i = 0; i<2; i++){
+        addCard(&game->player, dealCard(game));
+        addCard(&game->dealer, dealCard(game));
+    }
+
+    //Check for Natural blackjacks
+    if(isNatural(&game->player)) {
+        report("The player got a Natural Blackjack with the cards [%s] and [%s]!\n", cardName(game->player.cards[0]), cardName(game->player.cards[1]));
+        game->playerStatus = NATURAL;
+    }
+
+    if(isNatural(&game->dealer)) {
+        game->dealerStatus = NATURAL;
+        report("The dealer got a Natural Blackjack with the cards [%s] and [%s]!\n", cardName(game->dealer.cards[0]), cardName(game->dealer.cards[1]));
+    }
+}
+
+void playerTurn(game_t * game){
+
+    card_t newCard;
+    int total;
+
+    if (game->playerStatus != HIT)
+    {
+        //Anything different from a HIT finishes the turn of the player
+        game->playerStatus = STAND;
+        report("Player chose to stay with %d.\n", handTotal(&game->player));
+        return;
+    }
+
+    report("The player with a total of %d chose to get a card.\n", handTotal(&game->player));
+    newCard = dealCard(game);
+    addCard(&game->player, newCard);
+    total = handTotal(&game->player);
+    report("New card is: [%s]. The new total of this player is: %d.\n", cardName(newCard), total);
+
+    if (total == 21) {
+        game->playerStatus = TWENTYONE;
+        report("The current player got 21!\n");
+    } else if (total > 21) {
+        game->playerStatus = BUST;
+        report("The current player busted, he is over 21.\n");
+    }
+}
+
+void dealerTurn(game_t * game){ //Automatic deicisions based on Blackjack rules
+
+    card_t newCard;
+    int total = handTotal(&game->dealer);
+
+    //if the player turn is over
+    if((game->playerStatus == STAND) || (game->playerStatus == NATURAL) || (game->playerStatus == TWENTYONE)) {
+
+        report("Initial dealer's hand: [%s] [%s] making a total of: %d\n", cardName(game->dealer.cards[0]), cardName(game->dealer.cards[1]), total);
+
+        //The dealer gets cards until having 17 or more
+        while(total < 17){
+            newCard = dealCard(game);
+            addCard(&game->dealer, newCard);
+            total = handTotal(&game->dealer);
+            report("Dealer gets new card: [%s]. New dealer's total: %d\n", cardName(newCard), total);
+        }
+
+        if (total > 21) {
+            report("The dealer exceeds 21 with %d and busts.\n", total);
+            game->dealerStatus = BUST;
+        } else if(total == 21) {
+            report("The dealer got %d!\n", total);
+            game->dealerStatus = TWENTYONE;
+        } else {
+            report("The dealer stays with a total of: %d\n", total);
+            game->dealerStatus = STAND;
+        }
+    }
+
+    report("After completing the turn dealer accumulated the cards:");
+    for(int i = 0; i<game->dealer.numCards; i++){
+        report(" [%s]", cardName(game->dealer.cards[i]));
+    }
+    report(" which sum a total of: %d\n", total);
+}
+
+int calculateResults(game_t * game){
+
+    int playerTotal = handTotal(&game->player);
+    int dealerTotal = handTotal(&game->dealer);
+    int result = 0;
+
+    if (game->playerStatus == BUST){
+        report("The dealer gets the player's bet.\n");
+        result = -game->playerBet;
+    } else if ((game->dealerStatus == NATURAL) && (game->playerStatus == NATURAL)){
+        report("This is PUSH. The player gets his bet back.\n");
+    } else if (game->dealerStatus == NATURAL){
+        report("The dealer gets the player's bet.\n");
+        result = -game->playerBet;
+    } else if (game->playerStatus == NATURAL){
+        report("The dealer gives the player his bet plus 1.5x the amount of his bet.\n");
+        result = game->playerBet * 3 / 2;
+    } else if ((game->dealerStatus == BUST) || (playerTotal > dealerTotal)){
+        report("The dealer gives the player his bet plus the amount of his bet.\n");
+        result = game->playerBet;
+    } else if (playerTotal < dealerTotal) {
+        report("The dealer gets the player's bet.\n");
+        result = -game->playerBet;
+    } else {
+        report("This is stand-off. The player gets his bet back.\n");
+    }
+
+    game->playerAmount += result;
+
+    return result;
+}
+
+void fillMessage(const game_t * game, message_t * message){
+
+    message->playerStatus = game->playerStatus;
+    message->dealerStatus = game->dealerStatus;
+    message->playerAmount = game->playerAmount;
+    message->playerBet = game->playerBet;
+
+    message->numPlayerCards = game->player.numCards;
+    for(int i = 0; i<game->player.numCards; i++){
+        strcpy(message->playerCards[i], cardName(game->player.cards[i]));
+    }
+    message->totalPlayer = handTotal(&game->player);
+
+    message->numDealerCards = game->dealer.numCards;
+    for(int i = 0; i<game->dealer.numCards; i++){
+        strcpy(message->dealerCards[i], cardName(game->dealer.cards[i]));
+    }
+    message->totalDealer = handTotal(&game->dealer);
+}
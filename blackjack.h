@@ -0,0 +1,91 @@
+/*
+    Rules of the blackjack game played by the server
+    Every function is a single step of a round that only updates the game,
+    without doing any communication with the client.
+    The callers are responsible of sending the results after each step.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#ifndef BLACKJACK_H
+#define BLACKJACK_H
+
+#include "codes.h"
+#include "cards.h"
+#include "rng.h"
+#include "shoe.h"
+
+// State of the game of a player against the dealer
+typedef struct game_struct {
+    code_t playerStatus;
+    code_t dealerStatus;
+    int playerAmount;
+    int playerBet;
+    hand_t player;
+    hand_t dealer;
+    // Generator used to deal the cards of this game only
+    rng_t rng;
+    // Shoe that deals the cards, taken from the shuffler
+    // Without a shuffler the cards are drawn from an infinite deck with the generator
+    shuffler_t * shuffler;
+    shoe_t * shoe;
+    // Game of the table where the player is seated, its shoe deals the cards of this game
+    struct game_struct * house;
+} game_t;
+
+// Print every step of the games, disabled by the programs that play many hands
+extern int gameMessages;
+
+/*
+    Pick a random card with the generator indicated
+*/
+card_t getRandomCard(rng_t * rng);
+
+/*
+    Deal the next card of the game, from the house of its table, its shoe or its generator
+*/
+card_t dealCard(game_t * game);
+
+/*
+    Replace the shoe of the game if it reached the cut card
+    Must be called only between rounds
+*/
+void checkShoe(game_t * game);
+
+/*
+    Give back the shoe of the game, when the game is over
+*/
+void releaseShoe(game_t * game);
+
+/*
+    Generate the first 2 cards of the player and the dealer
+    Sets the status NATURAL to whoever got a Natural Blackjack
+*/
+void completeFirstDeal(game_t * game);
+
+/*
+    Apply a single decision of the player, stored in game->playerStatus
+    A HIT adds a card and can turn the status into TWENTYONE or BUST
+    Any other decision is taken as a STAND
+*/
+void playerTurn(game_t * game);
+
+/*
+    Automatic decisions of the dealer, based on the Blackjack rules
+    The dealer only plays when the player is still in the game
+*/
+void dealerTurn(game_t * game);
+
+/*
+    Update the amount of the player depending on the status of both hands
+    Returns the amount won or lost by the player
+*/
+int calculateResults(game_t * game);
+
+/*
+    Copy the state of the game to the fields of a message of the original protocol
+    The msg_code of the message is not modified
+*/
+void fillMessage(const game_t * game, message_t * message);
+
+#endif
@@ -0,0 +1,61 @@
+/*
+    Cards and hands of the blackjack game
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <string.h>
+
+#include "cards.h"
+
+// Values of the ranks of a suit, followed by the bytes not used by any card
+#define SUIT_VALUES 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 10, 10, 10, 0, 0, 0
+
+// Value of every card, counting the aces as 1
+const unsigned char cardValues[CARD_BYTES] = {
+    SUIT_VALUES, SUIT_VALUES, SUIT_VALUES, SUIT_VALUES
+};
+
+// Best total of a hand, indexed by [has an ace][hard total]
+// An ace adds 10 more while the hard total is 11 or less
+const unsigned char bestTotals[2][MAX_HARD_TOTAL + 1] = {
+    { 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+     16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31},
+    {10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 12, 13, 14, 15,
+     16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31}
+};
+
+// Names of the cards, indexed by the rank
+static const char cardNames[CARD_RANKS][MAXLENGTH] = {"A","2","3","4","5","6","7","8","9","10","J","Q","K"};
+
+/*
+    Get the name of a card, as shown to the players
+*/
+const char * cardName(card_t card)
+{
+    return cardNames[cardRank(card) % CARD_RANKS];
+}
+
+/*
+    Get a card of the first suit with the name indicated, used to rebuild the hands of a message
+    Returns -1 if no card has that name
+*/
+int cardFromName(const char * name)
+{
+    for (int rank=0; rank<CARD_RANKS; rank++)
+    {
+        if (strncmp(cardNames[rank], name, MAXLENGTH) == 0)
+        {
+            return makeCard(rank, 0);
+        }
+    }
+    return -1;
+}
+
+/*
+    Remove all the cards of a hand
+*/
+void resetHand(hand_t * hand)
+{
+    bzero(hand, sizeof (hand_t));
+}
@@ -0,0 +1,100 @@
+/*
+    Cards and hands of the blackjack game
+    A card is a single byte with the suit in the high bits and the rank in the low bits.
+    The value of the cards is taken from tables built at compile time,
+    and a hand keeps the count of every rank and its hard total (aces as 1),
+    so its best total and softness are a couple of table lookups.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#ifndef CARDS_H
+#define CARDS_H
+
+#include "codes.h"
+
+#define CARD_RANKS 13
+#define CARD_SUITS 4
+// Every byte of a valid card is below this value
+#define CARD_BYTES 64
+// Largest hard total that a hand can reach: 20 plus a card of 10
+#define MAX_HARD_TOTAL 31
+
+// Ranks of the cards, the value of the ace is 1 in the hard total
+typedef enum {ACE, TWO, THREE, FOUR, FIVE, SIX, SEVEN, EIGHT, NINE, TEN, JACK, QUEEN, KING} rank_t;
+
+typedef unsigned char card_t;
+
+// The cards of a player or the dealer
+typedef struct hand_struct {
+    card_t cards[MAXCARDS];
+    unsigned char numCards;
+    // Total counting every ace as 1
+    unsigned char hardTotal;
+    // Number of cards of every rank
+    unsigned char rankCount[CARD_RANKS];
+} hand_t;
+
+// Value of every card, counting the aces as 1
+extern const unsigned char cardValues[CARD_BYTES];
+// Best total of a hand, indexed by [has an ace][hard total]
+extern const unsigned char bestTotals[2][MAX_HARD_TOTAL + 1];
+
+#define makeCard(rank, suit) ((card_t) (((suit) << 4) | (rank)))
+#define cardRank(card) ((card) & 0x0F)
+#define cardSuit(card) ((card) >> 4)
+
+/*
+    Get the name of a card, as shown to the players
+*/
+const char * cardName(card_t card);
+
+/*
+    Get a card of the first suit with the name indicated, used to rebuild the hands of a message
+    Returns -1 if no card has that name
+*/
+int cardFromName(const char * name);
+
+/*
+    Remove all the cards of a hand
+*/
+void resetHand(hand_t * hand);
+
+/*
+    Add a card to a hand, updating the counts and the hard total
+*/
+static inline void addCard(hand_t * hand, card_t card)
+{
+    if (hand->numCards < MAXCARDS)
+    {
+        hand->cards[hand->numCards++] = card;
+    }
+    hand->rankCount[cardRank(card)]++;
+    hand->hardTotal += cardValues[card];
+}
+
+/*
+    Best total of the hand, counting an ace as 11 when it does not go over 21
+*/
+static inline int handTotal(const hand_t * hand)
+{
+    return bestTotals[hand->rankCount[ACE] > 0][hand->hardTotal < MAX_HARD_TOTAL ? hand->hardTotal : MAX_HARD_TOTAL];
+}
+
+/*
+    Tell if the hand has an ace counted as 11
+*/
+static inline int isSoft(const hand_t * hand)
+{
+    return handTotal(hand) != hand->hardTotal;
+}
+
+/*
+    Tell if the hand is a Natural Blackjack: 21 with the first two cards
+*/
+static inline int isNatural(const hand_t * hand)
+{
+    return hand->numCards == 2 && handTotal(hand) == 21;
+}
+
+#endif
@@ -18,35 +18,49 @@
 // Custom libraries
 #include "codes.h"
 #include "sockets.h"
+#include "protocol.h"
 
 #define BUFFER_SIZE 1024
 
 ///// FUNCTION DECLARATIONS
 void usage(char * program);
-void communicationLoop(int connection_fd);
+void communicationLoop(int connection_fd, int protocol);
 void showResults( message_t * message);
-void playerTurn( message_t * message, int connection_fd);
+void playerTurn( message_t * message, int connection_fd, int protocol);
 
 ///// MAIN FUNCTION
 int main(int argc, char * argv[])
 {
     int connection_fd;
+    int protocol = PROTOCOL_VERSION;
+    int option;
 
     printf("\n=== CLIENT PROGRAM ===\n");
 
     // Check the correct arguments
-    if (argc != 3)
+    while ((option = getopt(argc, argv, "l")) != -1)
+    {
+        switch (option)
+        {
+            case 'l':
+                protocol = PROTOCOL_LEGACY;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2)
     {
         usage(argv[0]);
     }
 
     // Start the server
-    connection_fd = connectSocket(argv[1], argv[2]);
+    connection_fd = connectSocket(argv[optind], argv[optind + 1]);
 	// // Use the bank operations available
     // bankOperations(connection_fd);
 
     // Establish the communication
-    communicationLoop(connection_fd);
+    communicationLoop(connection_fd, protocol);
 
     // Close the socket
     close(connection_fd);
@@ -62,11 +76,12 @@ int main(int argc, char * argv[])
 void usage(char * program)
 {
     printf("Usage:\n");
-    printf("\t%s {server_address} {port_number}\n", program);
+    printf("\t%s [-l] {server_address} {port_number}\n", program);
+    printf("\t-l: use the original messages, for servers without the compact protocol\n");
     exit(EXIT_FAILURE);
 }
 
-void playerTurn( message_t * message, int connection_fd) { //Update status of the player to get more cards or stay
+void playerTurn( message_t * message, int connection_fd, int protocol) { //Update status of the player to get more cards or stay
 
     int playerOption;
 
@@ -104,11 +119,11 @@ void playerTurn( message_t * message, int connection_fd) { //Update status of th
             }
 
             // Send the status chosen by the player
-            send(connection_fd, message, sizeof (*message), 0);
+            sendMessage(connection_fd, protocol, (message->playerStatus == HIT) ? FRAME_HIT : FRAME_STAND, message);
             
              if(message->playerStatus == HIT){
                 // Gets the status calculated by the server
-                if (!recvData(connection_fd, message, sizeof (*message)))
+                if (!receiveMessage(connection_fd, protocol, message))
                 {
                     return;
                 }
@@ -163,22 +178,29 @@ void showResults( message_t * message) { //Show the results and messages dependi
 }
 
 // Do the actual receiving and sending of data
-void communicationLoop(int connection_fd)
+void communicationLoop(int connection_fd, int protocol)
 {
     message_t message; //message with the information that will be updated between server and client
     int round = 0;
     int askBet;
 
+    bzero(&message, sizeof message);
+
     // Handshake
     message.msg_code = PLAY;
-    send(connection_fd, &message, sizeof message, 0);
+    sendMessage(connection_fd, protocol, FRAME_HELLO, &message);
 
     //Check reply, receive AMOUNT
-    if (!recvData(connection_fd, &message, sizeof message)) //The final results are received from the server
+    if (!receiveMessage(connection_fd, protocol, &message)) //The final results are received from the server
     {
         printf("Connection refused by the server");
         return;
     }
+    if (message.msg_code == BUSY)
+    {
+        printf("The server is busy, try again in %d seconds\n", message.playerAmount);
+        return;
+    }
     if (message.msg_code != AMOUNT)
     {
         printf("Invalid server\n");
@@ -188,10 +210,10 @@ void communicationLoop(int connection_fd)
     // Ask user for his total amount of chips to play
     printf("Enter the amount of chips that you have to play: ");
     scanf("%d", &message.playerAmount);
-    send(connection_fd, &message, sizeof message, 0);
+    sendMessage(connection_fd, protocol, FRAME_AMOUNT, &message);
 
     // Get the OK to start the game loop, receive STARTs
-    recvData(connection_fd, &message, sizeof message);
+    receiveMessage(connection_fd, protocol, &message);
 
     while(message.playerAmount >= 2) //While the player has enough money to bet
     {
@@ -215,19 +237,19 @@ void communicationLoop(int connection_fd)
         }
         
         message.msg_code = BET; //Send bet amount
-        send(connection_fd, &message, sizeof message, 0);
+        sendMessage(connection_fd, protocol, FRAME_BET, &message);
 
         //Receives the total hand accumulated by the player
-        if (!recvData(connection_fd, &message, sizeof message))
+        if (!receiveMessage(connection_fd, protocol, &message))
         {
             return;
         }
 
         printf("\n/////PLAYER'S TURN/////\n\n");
-        playerTurn(&message, connection_fd); //Here is where the player decides to stay or get more cards
+        playerTurn(&message, connection_fd, protocol); //Here is where the player decides to stay or get more cards
         
         //Receive results made by the dealer
-        if (!recvData(connection_fd, &message, sizeof message)) //The final results are received from the server
+        if (!receiveMessage(connection_fd, protocol, &message)) //The final results are received from the server
         {
             return;
         }
@@ -247,6 +269,6 @@ void communicationLoop(int connection_fd)
 
     // Finish the communication
     message.msg_code = BYE;
-    send(connection_fd, &message, sizeof message, 0);
-    recvData(connection_fd, &message, sizeof message);
+    sendMessage(connection_fd, protocol, FRAME_BYE, &message);
+    receiveMessage(connection_fd, protocol, &message);
 }
@@ -1,3 +1,6 @@
+#ifndef CODES_H
+#define CODES_H
+
 #define MAXCARDS 21 //A player can get at most 21 cards (21 A's)
 #define MAXLENGTH 3 // Needed to save strings in the array, '10' having the most characters
 
@@ -8,7 +11,8 @@ typedef enum valid_operations {CHECK, DEPOSIT, WITHDRAW, TRANSFER, EXIT} operati
 // typedef enum valid_responses {OK, INSUFFICIENT, NO_ACCOUNT, BYE, ERROR} response_t;
 
 // Define constants for the messages in the protocol
-typedef enum {PLAY, START, AMOUNT, BET, BYE, BUST, NATURAL, HIT, STAND, TWENTYONE, HI} code_t;
+// BUSY answers the PLAY of a client that the server can not take now, with the seconds to wait before trying again in playerAmount
+typedef enum {PLAY, START, AMOUNT, BET, BYE, BUST, NATURAL, HIT, STAND, TWENTYONE, HI, BUSY} code_t;
 
 // Structure to be sent between client and server
 typedef struct {
@@ -24,3 +28,5 @@ typedef struct {
     char dealerCards[MAXCARDS][MAXLENGTH]; 
     int totalDealer;
 } message_t;
+
+#endif
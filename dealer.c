@@ -0,0 +1,418 @@
+/*
+    Exact probabilities of the final hand of the dealer
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "dealer.h"
+
+// Places in the table of hands remembered while solving a shoe
+#define MEMO_CAPACITY (1 << 15)
+// Bits used to count the cards of every value drawn by the dealer
+#define DRAWN_BITS 5
+
+// Outcomes of a hand of the dealer already solved
+typedef struct dealer_state_struct {
+    int solved;
+    double outcomes[DEALER_OUTCOMES];
+} dealer_state_t;
+
+// Hands solved for a shoe, identified by the cards drawn by the dealer
+typedef struct dealer_memo_struct {
+    uint64_t * keys;
+    double (* outcomes)[DEALER_OUTCOMES];
+    int stored;
+} dealer_memo_t;
+
+// Probability of every value in an infinite deck, the 10, J, Q and K count as 10
+static const double valueProbability[CARD_VALUES] = {
+    1/13.0, 1/13.0, 1/13.0, 1/13.0, 1/13.0, 1/13.0, 1/13.0, 1/13.0, 1/13.0, 4/13.0
+};
+
+static dealer_table_t infiniteTable;
+static dealer_state_t infiniteStates[MAX_HARD_TOTAL + 1][2];
+static pthread_once_t infiniteOnce = PTHREAD_ONCE_INIT;
+
+///// LOCAL FUNCTION DECLARATIONS
+static void computeInfiniteTable();
+static const double * solveInfinite(int hard, int ace);
+static void solveFinite(dealer_memo_t * memo, int counts[CARD_VALUES], int remaining, uint64_t drawn, int hard, int ace, double outcomes[DEALER_OUTCOMES]);
+static double * findMemo(dealer_memo_t * memo, uint64_t drawn, int * found);
+static int finishedHand(int hard, int ace, double outcomes[DEALER_OUTCOMES]);
+static unsigned long hashCounts(const int counts[CARD_VALUES]);
+
+///// FUNCTION DEFINITIONS
+
+/*
+    Fill the counts with the cards of a new shoe of the number of decks indicated
+*/
+void freshComposition(int counts[CARD_VALUES], int decks)
+{
+    for (int i=0; i<CARD_VALUES; i++)
+    {
+        counts[i] = CARD_SUITS * decks;
+    }
+    // The 10, J, Q and K
+    counts[CARD_VALUES - 1] = 4 * CARD_SUITS * decks;
+}
+
+/*
+    Fill the counts with the cards not dealt yet from a shoe
+*/
+void shoeComposition(const shoe_t * shoe, int counts[CARD_VALUES])
+{
+    bzero(counts, CARD_VALUES * sizeof (int));
+    for (int i=shoe->next; i<shoe->numCards; i++)
+    {
+        counts[cardValues[shoe->cards[i]] - 1]++;
+    }
+}
+
+/*
+    Get the outcomes of the dealer when every card has the same probability of an infinite deck
+    They are computed only by the first call
+*/
+const dealer_table_t * infiniteDealerTable()
+{
+    pthread_once(&infiniteOnce, computeInfiniteTable);
+    return &infiniteTable;
+}
+
+/*
+    Compute the outcomes of the dealer when the cards come from a shoe with the counts indicated
+    When the shoe could run out of cards the probabilities of the table add to less than 1
+*/
+void finiteDealerTable(dealer_table_t * table, const int counts[CARD_VALUES])
+{
+    dealer_memo_t memo;
+    double outcomes[DEALER_OUTCOMES];
+    int left[CARD_VALUES];
+    int remaining = 0;
+    double probability;
+
+    bzero(table, sizeof (dealer_table_t));
+    memcpy(table->counts, counts, sizeof table->counts);
+    memcpy(left, counts, sizeof left);
+    for (int i=0; i<CARD_VALUES; i++)
+    {
+        remaining += counts[i];
+    }
+
+    memo.keys = calloc(MEMO_CAPACITY, sizeof (uint64_t));
+    memo.outcomes = malloc(MEMO_CAPACITY * sizeof (double [DEALER_OUTCOMES]));
+    memo.stored = 0;
+    if (memo.keys == NULL || memo.outcomes == NULL)
+    {
+        perror("ERROR: malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int up=1; up<=CARD_VALUES; up++)
+    {
+        if (left[up - 1] == 0 || remaining < 2)
+        {
+            continue;
+        }
+        left[up - 1]--;
+
+        for (int hole=1; hole<=CARD_VALUES; hole++)
+        {
+            if (left[hole - 1] == 0)
+            {
+                continue;
+            }
+            probability = (double) left[hole - 1] / (remaining - 1);
+
+            // The only two cards that add 21 are an ace and a 10
+            if (up + hole == 11 && (up == 1 || hole == 1))
+            {
+                table->outcomes[up - 1][DEALER_NATURAL] += probability;
+                continue;
+            }
+
+            left[hole - 1]--;
+            solveFinite(&memo, left, remaining - 2, ((uint64_t) 1 << (DRAWN_BITS * (up - 1))) + ((uint64_t) 1 << (DRAWN_BITS * (hole - 1))), up + hole, up == 1 || hole == 1, outcomes);
+            left[hole - 1]++;
+
+            for (int k=0; k<DEALER_OUTCOMES; k++)
+            {
+                table->outcomes[up - 1][k] += probability * outcomes[k];
+            }
+        }
+
+        left[up - 1]++;
+    }
+
+    free(memo.keys);
+    free(memo.outcomes);
+}
+
+/*
+    Prepare a cache for the number of tables indicated
+*/
+dealer_cache_t * createDealerCache(int capacity)
+{
+    dealer_cache_t * cache = NULL;
+
+    cache = malloc(sizeof (dealer_cache_t));
+    if (cache == NULL)
+    {
+        perror("ERROR: malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    cache->capacity = (capacity < 1) ? 1 : capacity;
+    cache->entries = calloc(cache->capacity, sizeof (dealer_entry_t));
+    if (cache->entries == NULL)
+    {
+        perror("ERROR: calloc");
+        exit(EXIT_FAILURE);
+    }
+    cache->hits = 0;
+    cache->misses = 0;
+    pthread_mutex_init(&cache->cache_mutex, NULL);
+
+    return cache;
+}
+
+/*
+    Copy to the table the outcomes for the counts indicated, computing them if they are not in the cache
+    The table is computed without the lock, so other threads can keep using the cache
+*/
+void lookupDealerTable(dealer_cache_t * cache, const int counts[CARD_VALUES], dealer_table_t * table)
+{
+    dealer_entry_t * entry = &cache->entries[hashCounts(counts) % cache->capacity];
+
+    pthread_mutex_lock(&cache->cache_mutex);
+    if (entry->used && memcmp(entry->table.counts, counts, sizeof entry->table.counts) == 0)
+    {
+        *table = entry->table;
+        cache->hits++;
+        pthread_mutex_unlock(&cache->cache_mutex);
+        return;
+    }
+    cache->misses++;
+    pthread_mutex_unlock(&cache->cache_mutex);
+
+    finiteDealerTable(table, counts);
+
+    // Replace whatever was in the same place
+    pthread_mutex_lock(&cache->cache_mutex);
+    entry->table = *table;
+    entry->used = 1;
+    pthread_mutex_unlock(&cache->cache_mutex);
+}
+
+/*
+    Print the counters of the cache
+*/
+void printDealerCacheStats(dealer_cache_t * cache)
+{
+    pthread_mutex_lock(&cache->cache_mutex);
+    printf("Dealer tables: %ld found in the cache, %ld computed\n", cache->hits, cache->misses);
+    pthread_mutex_unlock(&cache->cache_mutex);
+}
+
+/*
+    Free the memory of the cache
+*/
+void destroyDealerCache(dealer_cache_t * cache)
+{
+    pthread_mutex_destroy(&cache->cache_mutex);
+    free(cache->entries);
+    free(cache);
+}
+
+/*
+    Show the probabilities of a table, one line per up card
+*/
+void printDealerTable(const dealer_table_t * table)
+{
+    printf("Up       17       18       19       20       21  Natural     Bust\n");
+    for (int up=1; up<=CARD_VALUES; up++)
+    {
+        printf("%-3s", (up == 1) ? "A" : cardName(makeCard(up - 1, 0)));
+        for (int k=0; k<DEALER_OUTCOMES; k++)
+        {
+            printf(" %8.5f", table->outcomes[up - 1][k]);
+        }
+        printf("\n");
+    }
+}
+
+/*
+    Fill the table of the infinite deck, called only once
+*/
+static void computeInfiniteTable()
+{
+    const double * outcomes = NULL;
+
+    freshComposition(infiniteTable.counts, 0);
+
+    for (int up=1; up<=CARD_VALUES; up++)
+    {
+        for (int hole=1; hole<=CARD_VALUES; hole++)
+        {
+            if (up + hole == 11 && (up == 1 || hole == 1))
+            {
+                infiniteTable.outcomes[up - 1][DEALER_NATURAL] += valueProbability[hole - 1];
+                continue;
+            }
+
+            outcomes = solveInfinite(up + hole, up == 1 || hole == 1);
+            for (int k=0; k<DEALER_OUTCOMES; k++)
+            {
+                infiniteTable.outcomes[up - 1][k] += valueProbability[hole - 1] * outcomes[k];
+            }
+        }
+    }
+}
+
+/*
+    Outcomes of a hand of the dealer with two or more cards, drawing from an infinite deck
+    With an infinite deck the hard total and the ace are all that matters
+*/
+static const double * solveInfinite(int hard, int ace)
+{
+    dealer_state_t * state = &infiniteStates[hard][ace];
+    const double * next = NULL;
+
+    if (state->solved)
+    {
+        return state->outcomes;
+    }
+
+    if (!finishedHand(hard, ace, state->outcomes))
+    {
+        for (int value=1; value<=CARD_VALUES; value++)
+        {
+            next = solveInfinite(hard + value, ace || value == 1);
+            for (int k=0; k<DEALER_OUTCOMES; k++)
+            {
+                state->outcomes[k] += valueProbability[value - 1] * next[k];
+            }
+        }
+    }
+    state->solved = 1;
+
+    return state->outcomes;
+}
+
+/*
+    Outcomes of a hand of the dealer with two or more cards, drawing from the cards left
+    The cards drawn identify the hand and the cards left, so they are the key of the hands solved
+*/
+static void solveFinite(dealer_memo_t * memo, int counts[CARD_VALUES], int remaining, uint64_t drawn, int hard, int ace, double outcomes[DEALER_OUTCOMES])
+{
+    double next[DEALER_OUTCOMES];
+    double * stored = NULL;
+    double probability;
+    int found;
+
+    bzero(outcomes, DEALER_OUTCOMES * sizeof (double));
+    if (finishedHand(hard, ace, outcomes))
+    {
+        return;
+    }
+
+    stored = findMemo(memo, drawn, &found);
+    if (found)
+    {
+        memcpy(outcomes, stored, DEALER_OUTCOMES * sizeof (double));
+        return;
+    }
+
+    for (int value=1; value<=CARD_VALUES && remaining > 0; value++)
+    {
+        if (counts[value - 1] == 0)
+        {
+            continue;
+        }
+        probability = (double) counts[value - 1] / remaining;
+
+        counts[value - 1]--;
+        solveFinite(memo, counts, remaining - 1, drawn + ((uint64_t) 1 << (DRAWN_BITS * (value - 1))), hard + value, ace || value == 1, next);
+        counts[value - 1]++;
+
+        for (int k=0; k<DEALER_OUTCOMES; k++)
+        {
+            outcomes[k] += probability * next[k];
+        }
+    }
+
+    if (stored != NULL)
+    {
+        memcpy(stored, outcomes, DEALER_OUTCOMES * sizeof (double));
+    }
+}
+
+/*
+    Find the place of a hand in the table of hands solved, with linear probing
+    Returns NULL when the table is full, and the hand is not remembered
+*/
+static double * findMemo(dealer_memo_t * memo, uint64_t drawn, int * found)
+{
+    unsigned long index = (drawn * 0x9E3779B97F4A7C15ULL) >> 49;
+
+    *found = 0;
+    for (int i=0; i<MEMO_CAPACITY; i++, index = (index + 1) % MEMO_CAPACITY)
+    {
+        if (memo->keys[index] == drawn)
+        {
+            *found = 1;
+            return memo->outcomes[index];
+        }
+        if (memo->keys[index] == 0)
+        {
+            // Keep some space free, so the searches of the hands not stored always finish soon
+            if (memo->stored >= MEMO_CAPACITY * 3 / 4)
+            {
+                return NULL;
+            }
+            memo->keys[index] = drawn;
+            memo->stored++;
+            return memo->outcomes[index];
+        }
+    }
+    return NULL;
+}
+
+/*
+    Fill the outcomes of a hand where the dealer stops taking cards
+    Returns 0 if the dealer must take another card
+*/
+static int finishedHand(int hard, int ace, double outcomes[DEALER_OUTCOMES])
+{
+    int total = bestTotals[ace][(hard < MAX_HARD_TOTAL) ? hard : MAX_HARD_TOTAL];
+
+    if (total > 21)
+    {
+        outcomes[DEALER_BUST] = 1;
+        return 1;
+    }
+    if (total >= 17)
+    {
+        outcomes[DEALER_17 + total - 17] = 1;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+    Mix the counts of a composition, to choose its place in the cache
+*/
+static unsigned long hashCounts(const int counts[CARD_VALUES])
+{
+    unsigned long hash = 1469598103934665603UL;
+
+    for (int i=0; i<CARD_VALUES; i++)
+    {
+        hash = (hash ^ (unsigned) counts[i]) * 1099511628211UL;
+    }
+    return hash;
+}
@@ -0,0 +1,97 @@
+/*
+    Exact probabilities of the final hand of the dealer
+    The dealer always plays with the same rules (hit below 17), so the distribution
+    of its final total for every up card can be computed instead of sampled.
+    The distributions are computed by recursion over the hands of the dealer,
+    remembering the hands already solved, for an infinite deck or for the exact cards left in a shoe.
+    The tables of the shoes are cached by the number of cards of every value,
+    so asking again for the same composition is a single lookup.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#ifndef DEALER_H
+#define DEALER_H
+
+#include <pthread.h>
+
+#include "cards.h"
+#include "shoe.h"
+
+// Different values of the cards, from the ace (1) to 10
+#define CARD_VALUES 10
+
+// The ways a hand of the dealer can finish
+typedef enum {DEALER_17, DEALER_18, DEALER_19, DEALER_20, DEALER_21, DEALER_NATURAL, DEALER_BUST, DEALER_OUTCOMES} dealer_outcome_t;
+
+// Probabilities of every final hand of the dealer, indexed by [value of the up card - 1][outcome]
+typedef struct dealer_table_struct {
+    // Cards of every value in the shoe, before the up card is dealt
+    int counts[CARD_VALUES];
+    double outcomes[CARD_VALUES][DEALER_OUTCOMES];
+} dealer_table_t;
+
+// A table stored in the cache
+typedef struct dealer_entry_struct {
+    int used;
+    dealer_table_t table;
+} dealer_entry_t;
+
+// Tables already computed, each composition has a single place in the cache
+typedef struct dealer_cache_struct {
+    dealer_entry_t * entries;
+    int capacity;
+    pthread_mutex_t cache_mutex;
+    // Counters for the reports
+    long hits;
+    long misses;
+} dealer_cache_t;
+
+/*
+    Fill the counts with the cards of a new shoe of the number of decks indicated
+*/
+void freshComposition(int counts[CARD_VALUES], int decks);
+
+/*
+    Fill the counts with the cards not dealt yet from a shoe
+*/
+void shoeComposition(const shoe_t * shoe, int counts[CARD_VALUES]);
+
+/*
+    Get the outcomes of the dealer when every card has the same probability of an infinite deck
+    They are computed only by the first call
+*/
+const dealer_table_t * infiniteDealerTable();
+
+/*
+    Compute the outcomes of the dealer when the cards come from a shoe with the counts indicated
+    When the shoe could run out of cards the probabilities of the table add to less than 1
+*/
+void finiteDealerTable(dealer_table_t * table, const int counts[CARD_VALUES]);
+
+/*
+    Prepare a cache for the number of tables indicated
+*/
+dealer_cache_t * createDealerCache(int capacity);
+
+/*
+    Copy to the table the outcomes for the counts indicated, computing them if they are not in the cache
+*/
+void lookupDealerTable(dealer_cache_t * cache, const int counts[CARD_VALUES], dealer_table_t * table);
+
+/*
+    Print the counters of the cache
+*/
+void printDealerCacheStats(dealer_cache_t * cache);
+
+/*
+    Free the memory of the cache
+*/
+void destroyDealerCache(dealer_cache_t * cache);
+
+/*
+    Show the probabilities of a table, one line per up card
+*/
+void printDealerTable(const dealer_table_t * table);
+
+#endif
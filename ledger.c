@@ -0,0 +1,970 @@
+/*
+    Durable record of the chips of the players
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/stat.h>
+
+#include "ledger.h"
+
+// Records read at once during the recovery
+#define RECOVERY_RECORDS 4096
+// Smallest size of the table of the accounts, always a power of 2
+#define ACCOUNTS_MIN 1024
+// Number used in the table for the slots without an account
+#define NO_ACCOUNT UINT64_MAX
+
+// Account as stored in the snapshots of the version 1, for every account ever opened
+typedef struct ledger_account_v1_struct {
+    int64_t balance;
+    uint32_t open;
+    uint32_t reserved;
+} ledger_account_v1_t;
+
+// Table of the CRC-32 of every byte, created the first time it is needed
+static uint32_t crcTable[256];
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+///// LOCAL FUNCTION DECLARATIONS
+static void createCrcTable();
+static uint32_t crc32(uint32_t crc, const void * data, size_t length);
+static uint32_t recordCrc(const ledger_record_t * record);
+static void appendRecord(ledger_t * ledger, ledger_type_t type, uint64_t account, int64_t amount);
+static void * ledgerThread(void * arg);
+static void * snapshotThread(void * arg);
+static void startSnapshot(ledger_t * ledger);
+static void copyAccounts(ledger_t * ledger);
+static void applyRecord(ledger_t * ledger, const ledger_record_t * record);
+static uint64_t accountSlot(ledger_t * ledger, uint64_t account);
+static ledger_account_t * findAccount(ledger_t * ledger, uint64_t account);
+static void insertAccount(ledger_t * ledger, uint64_t account, int64_t balance);
+static void removeAccount(ledger_t * ledger, uint64_t account);
+static void recoverLedger(ledger_t * ledger);
+static long closeInterrupted(ledger_t * ledger);
+static long replayLog(ledger_t * ledger, int fd, uint64_t * lastLsn, off_t * valid);
+static int loadSnapshot(ledger_t * ledger);
+static void writeSnapshot(ledger_t * ledger);
+static void archiveLog(ledger_t * ledger, const char * path, uint64_t lastLsn);
+static void writeAll(int fd, const void * data, size_t length);
+static void syncDirectory(const char * path);
+
+///// FUNCTION DEFINITIONS
+
+/*
+    Open the files of the ledger with the prefix indicated, recover the balances and start its thread
+    The log and the snapshot are the prefix with the extensions .wal and .snap
+*/
+ledger_t * openLedger(const char * prefix)
+{
+    ledger_t * ledger = NULL;
+
+    pthread_once(&crcOnce, createCrcTable);
+
+    ledger = malloc(sizeof (ledger_t));
+    if (ledger == NULL)
+    {
+        perror("ERROR: malloc");
+        exit(EXIT_FAILURE);
+    }
+    bzero(ledger, sizeof (ledger_t));
+
+    snprintf(ledger->logPath, sizeof ledger->logPath, "%s.wal", prefix);
+    snprintf(ledger->oldLogPath, sizeof ledger->oldLogPath, "%s.wal.old", prefix);
+    snprintf(ledger->snapshotPath, sizeof ledger->snapshotPath, "%s.snap", prefix);
+    ledger->pending = malloc(LEDGER_BUFFER * sizeof (ledger_record_t));
+    ledger->writing = malloc(LEDGER_BUFFER * sizeof (ledger_record_t));
+    if (ledger->pending == NULL || ledger->writing == NULL)
+    {
+        perror("ERROR: malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    recoverLedger(ledger);
+    ledger->nextLsn = ledger->appliedLsn + 1;
+    ledger->nextAccount = ledger->appliedAccounts;
+
+    pthread_mutex_init(&ledger->ledger_mutex, NULL);
+    pthread_cond_init(&ledger->records_cond, NULL);
+    pthread_cond_init(&ledger->space_cond, NULL);
+    pthread_mutex_init(&ledger->snapshot_mutex, NULL);
+    pthread_cond_init(&ledger->snapshot_cond, NULL);
+    ledger->running = 1;
+    ledger->snapshotRunning = 1;
+    if (pthread_create(&ledger->tid, NULL, ledgerThread, ledger) != 0
+        || pthread_create(&ledger->snapshot_tid, NULL, snapshotThread, ledger) != 0)
+    {
+        perror("ERROR: pthread_create");
+        exit(EXIT_FAILURE);
+    }
+
+    return ledger;
+}
+
+/*
+    Register a new account with its starting balance
+    Returns the number of the account
+*/
+uint64_t ledgerOpenAccount(ledger_t * ledger, int amount)
+{
+    uint64_t account;
+
+    pthread_mutex_lock(&ledger->ledger_mutex);
+    account = ledger->nextAccount++;
+    appendRecord(ledger, LEDGER_OPEN, account, amount);
+    pthread_mutex_unlock(&ledger->ledger_mutex);
+
+    return account;
+}
+
+/*
+    Register the chips won or lost by an account in a round
+*/
+void ledgerSettle(ledger_t * ledger, uint64_t account, int result)
+{
+    pthread_mutex_lock(&ledger->ledger_mutex);
+    appendRecord(ledger, LEDGER_SETTLE, account, result);
+    pthread_mutex_unlock(&ledger->ledger_mutex);
+}
+
+/*
+    Register the final balance of an account that will not be used anymore
+*/
+void ledgerCloseAccount(ledger_t * ledger, uint64_t account, int balance)
+{
+    pthread_mutex_lock(&ledger->ledger_mutex);
+    appendRecord(ledger, LEDGER_CLOSE, account, balance);
+    pthread_mutex_unlock(&ledger->ledger_mutex);
+}
+
+/*
+    Print the counters of the writes of the ledger
+    The counters of the thread are read without the lock, they are only for the reports
+*/
+void printLedgerStats(ledger_t * ledger)
+{
+    long stalls;
+
+    pthread_mutex_lock(&ledger->ledger_mutex);
+    stalls = ledger->stalls;
+    pthread_mutex_unlock(&ledger->ledger_mutex);
+
+    printf("Ledger: %ld records in %ld commits (%.1f records per fsync, %ld at most), %ld snapshots (%ld delayed), %" PRIu64 " open accounts, %ld waits for space\n", ledger->records, ledger->commits, (ledger->commits > 0) ? (double) ledger->records / ledger->commits : 0.0, ledger->largestCommit, ledger->snapshots, ledger->snapshotsDelayed, ledger->numAccounts, stalls);
+}
+
+/*
+    Write the records pending and a last snapshot, and stop the threads of the ledger
+    The snapshot being written, if any, is finished before the last one
+*/
+void closeLedger(ledger_t * ledger)
+{
+    pthread_mutex_lock(&ledger->ledger_mutex);
+    ledger->running = 0;
+    pthread_cond_signal(&ledger->records_cond);
+    pthread_mutex_unlock(&ledger->ledger_mutex);
+    pthread_join(ledger->tid, NULL);
+
+    pthread_mutex_lock(&ledger->snapshot_mutex);
+    ledger->snapshotRunning = 0;
+    pthread_cond_signal(&ledger->snapshot_cond);
+    pthread_mutex_unlock(&ledger->snapshot_mutex);
+    pthread_join(ledger->snapshot_tid, NULL);
+
+    // With the balances in the snapshot, the next start does not need the log, it is kept with the others
+    copyAccounts(ledger);
+    writeSnapshot(ledger);
+    if (lseek(ledger->log_fd, 0, SEEK_END) > 0)
+    {
+        archiveLog(ledger, ledger->logPath, ledger->appliedLsn);
+    }
+    ledger->snapshots++;
+    printLedgerStats(ledger);
+
+    close(ledger->log_fd);
+    pthread_mutex_destroy(&ledger->ledger_mutex);
+    pthread_cond_destroy(&ledger->records_cond);
+    pthread_cond_destroy(&ledger->space_cond);
+    pthread_mutex_destroy(&ledger->snapshot_mutex);
+    pthread_cond_destroy(&ledger->snapshot_cond);
+    free(ledger->pending);
+    free(ledger->writing);
+    free(ledger->accounts);
+    free(ledger->copy);
+    free(ledger);
+}
+
+/*
+    Fill the table of the CRC-32 used by zlib and ethernet
+*/
+static void createCrcTable()
+{
+    uint32_t crc;
+
+    for (uint32_t i=0; i<256; i++)
+    {
+        crc = i;
+        for (int bit=0; bit<8; bit++)
+        {
+            crc = (crc & 1) ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+        }
+        crcTable[i] = crc;
+    }
+}
+
+/*
+    Continue a CRC-32 with more bytes, starting with 0
+*/
+static uint32_t crc32(uint32_t crc, const void * data, size_t length)
+{
+    const unsigned char * bytes = data;
+
+    crc = ~crc;
+    for (size_t i=0; i<length; i++)
+    {
+        crc = crcTable[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/*
+    CRC-32 of a record, without its own field
+*/
+static uint32_t recordCrc(const ledger_record_t * record)
+{
+    return crc32(0, (const char *) record + sizeof record->crc, sizeof (ledger_record_t) - sizeof record->crc);
+}
+
+/*
+    Copy a record to the buffer of the records pending, waiting only when it is full
+    Must be called with the lock of the ledger
+*/
+static void appendRecord(ledger_t * ledger, ledger_type_t type, uint64_t account, int64_t amount)
+{
+    ledger_record_t * record = NULL;
+
+    while (ledger->numPending == LEDGER_BUFFER)
+    {
+        ledger->stalls++;
+        pthread_cond_wait(&ledger->space_cond, &ledger->ledger_mutex);
+    }
+
+    record = &ledger->pending[ledger->numPending++];
+    record->type = type;
+    record->lsn = ledger->nextLsn++;
+    record->account = account;
+    record->amount = amount;
+    record->crc = recordCrc(record);
+
+    // The thread only sleeps when there was nothing to write
+    if (ledger->numPending == 1)
+    {
+        pthread_cond_signal(&ledger->records_cond);
+    }
+}
+
+/*
+    Function of the thread of the ledger
+    Takes all the records pending at once, so the sessions fill the other buffer
+    while these are written and synced with a single fsync
+*/
+static void * ledgerThread(void * arg)
+{
+    ledger_t * ledger = arg;
+    ledger_record_t * records = NULL;
+    int count;
+
+    while (1)
+    {
+        pthread_mutex_lock(&ledger->ledger_mutex);
+        while (ledger->numPending == 0 && ledger->running)
+        {
+            pthread_cond_wait(&ledger->records_cond, &ledger->ledger_mutex);
+        }
+        if (ledger->numPending == 0)
+        {
+            pthread_mutex_unlock(&ledger->ledger_mutex);
+            break;
+        }
+        records = ledger->pending;
+        count = ledger->numPending;
+        ledger->pending = ledger->writing;
+        ledger->writing = records;
+        ledger->numPending = 0;
+        pthread_cond_broadcast(&ledger->space_cond);
+        pthread_mutex_unlock(&ledger->ledger_mutex);
+
+        writeAll(ledger->log_fd, records, count * sizeof (ledger_record_t));
+        if (fdatasync(ledger->log_fd) == -1)
+        {
+            perror("ERROR: fdatasync");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i=0; i<count; i++)
+        {
+            applyRecord(ledger, &records[i]);
+        }
+        ledger->records += count;
+        ledger->commits++;
+        if (count > ledger->largestCommit)
+        {
+            ledger->largestCommit = count;
+        }
+
+        ledger->sinceSnapshot += count;
+        if (ledger->sinceSnapshot >= LEDGER_SNAPSHOT)
+        {
+            startSnapshot(ledger);
+        }
+    }
+
+    pthread_exit(NULL);
+}
+
+/*
+    Function of the thread of the snapshots
+    Writes every copy of the balances given by the thread of the ledger, and then
+    archives the old log, whose records are all in the snapshot
+*/
+static void * snapshotThread(void * arg)
+{
+    ledger_t * ledger = arg;
+
+    while (1)
+    {
+        pthread_mutex_lock(&ledger->snapshot_mutex);
+        while (!ledger->snapshotPending && ledger->snapshotRunning)
+        {
+            pthread_cond_wait(&ledger->snapshot_cond, &ledger->snapshot_mutex);
+        }
+        if (!ledger->snapshotPending)
+        {
+            pthread_mutex_unlock(&ledger->snapshot_mutex);
+            break;
+        }
+        pthread_mutex_unlock(&ledger->snapshot_mutex);
+
+        // The copy is not touched by the thread of the ledger while the snapshot is pending
+        writeSnapshot(ledger);
+        // The old log ends with the last record copied, when it was renamed
+        archiveLog(ledger, ledger->oldLogPath, ledger->copyLsn);
+
+        pthread_mutex_lock(&ledger->snapshot_mutex);
+        ledger->snapshotPending = 0;
+        ledger->snapshots++;
+        pthread_mutex_unlock(&ledger->snapshot_mutex);
+    }
+
+    pthread_exit(NULL);
+}
+
+/*
+    Give a copy of the balances to the thread of the snapshots, and continue the log in a new file
+    The current log only has records already applied, so after the snapshot the recovery does not need it
+    If the previous snapshot is still being written, this one waits for the next commit
+    Called by the thread of the ledger, between two commits
+*/
+static void startSnapshot(ledger_t * ledger)
+{
+    pthread_mutex_lock(&ledger->snapshot_mutex);
+    if (ledger->snapshotPending)
+    {
+        pthread_mutex_unlock(&ledger->snapshot_mutex);
+        ledger->snapshotsDelayed++;
+        return;
+    }
+    pthread_mutex_unlock(&ledger->snapshot_mutex);
+
+    copyAccounts(ledger);
+
+    if (rename(ledger->logPath, ledger->oldLogPath) == -1)
+    {
+        perror("ERROR: rename");
+        exit(EXIT_FAILURE);
+    }
+    close(ledger->log_fd);
+    ledger->log_fd = open(ledger->logPath, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (ledger->log_fd == -1)
+    {
+        perror("ERROR: open");
+        exit(EXIT_FAILURE);
+    }
+    // The records synced in the new log must not be lost with its name
+    syncDirectory(ledger->logPath);
+    ledger->sinceSnapshot = 0;
+
+    pthread_mutex_lock(&ledger->snapshot_mutex);
+    ledger->snapshotPending = 1;
+    pthread_cond_signal(&ledger->snapshot_cond);
+    pthread_mutex_unlock(&ledger->snapshot_mutex);
+}
+
+/*
+    Copy the open accounts to the buffer of the snapshots, without the empty slots of the table
+*/
+static void copyAccounts(ledger_t * ledger)
+{
+    if (ledger->copyCapacity < ledger->numAccounts)
+    {
+        ledger->copyCapacity = ledger->capacity;
+        free(ledger->copy);
+        ledger->copy = malloc(ledger->copyCapacity * sizeof (ledger_account_t));
+        if (ledger->copy == NULL)
+        {
+            perror("ERROR: malloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    ledger->copyCount = 0;
+    for (uint64_t i=0; i<ledger->capacity; i++)
+    {
+        if (ledger->accounts[i].account != NO_ACCOUNT)
+        {
+            ledger->copy[ledger->copyCount++] = ledger->accounts[i];
+        }
+    }
+    ledger->copyLsn = ledger->appliedLsn;
+    ledger->copyNext = ledger->appliedAccounts;
+}
+
+/*
+    Update the balance of the account of a record
+    A closed account leaves the table, its final balance is only kept in the log
+*/
+static void applyRecord(ledger_t * ledger, const ledger_record_t * record)
+{
+    ledger_account_t * account = NULL;
+
+    switch (record->type)
+    {
+        case LEDGER_OPEN:
+            insertAccount(ledger, record->account, record->amount);
+            if (record->account >= ledger->appliedAccounts)
+            {
+                ledger->appliedAccounts = record->account + 1;
+            }
+            break;
+        case LEDGER_SETTLE:
+            account = findAccount(ledger, record->account);
+            if (account != NULL)
+            {
+                account->balance += record->amount;
+            }
+            break;
+        case LEDGER_CLOSE:
+            removeAccount(ledger, record->account);
+            break;
+    }
+    ledger->appliedLsn = record->lsn;
+}
+
+/*
+    First slot of the table where an account can be
+*/
+static uint64_t accountSlot(ledger_t * ledger, uint64_t account)
+{
+    // The accounts are consecutive numbers, the multiplication spreads them in the table
+    return ((account * 0x9E3779B97F4A7C15ULL) >> 32) & (ledger->capacity - 1);
+}
+
+/*
+    Get the balance of an open account
+    Returns NULL if the account is not open
+*/
+static ledger_account_t * findAccount(ledger_t * ledger, uint64_t account)
+{
+    uint64_t slot;
+
+    if (ledger->capacity == 0)
+    {
+        return NULL;
+    }
+    for (slot=accountSlot(ledger, account); ledger->accounts[slot].account != NO_ACCOUNT; slot=(slot + 1) & (ledger->capacity - 1))
+    {
+        if (ledger->accounts[slot].account == account)
+        {
+            return &ledger->accounts[slot];
+        }
+    }
+    return NULL;
+}
+
+/*
+    Add an open account to the table, or replace its balance if it is already there
+    The table doubles its size when it is half full
+*/
+static void insertAccount(ledger_t * ledger, uint64_t account, int64_t balance)
+{
+    ledger_account_t * previous = NULL;
+    ledger_account_t * found = NULL;
+    uint64_t previousCapacity;
+    uint64_t slot;
+
+    found = findAccount(ledger, account);
+    if (found != NULL)
+    {
+        found->balance = balance;
+        return;
+    }
+
+    if (2 * (ledger->numAccounts + 1) > ledger->capacity)
+    {
+        previous = ledger->accounts;
+        previousCapacity = ledger->capacity;
+        ledger->capacity = (previousCapacity > 0) ? 2 * previousCapacity : ACCOUNTS_MIN;
+        ledger->accounts = malloc(ledger->capacity * sizeof (ledger_account_t));
+        if (ledger->accounts == NULL)
+        {
+            perror("ERROR: malloc");
+            exit(EXIT_FAILURE);
+        }
+        for (uint64_t i=0; i<ledger->capacity; i++)
+        {
+            ledger->accounts[i].account = NO_ACCOUNT;
+        }
+        ledger->numAccounts = 0;
+        for (uint64_t i=0; i<previousCapacity; i++)
+        {
+            if (previous[i].account != NO_ACCOUNT)
+            {
+                insertAccount(ledger, previous[i].account, previous[i].balance);
+            }
+        }
+        free(previous);
+    }
+
+    slot = accountSlot(ledger, account);
+    while (ledger->accounts[slot].account != NO_ACCOUNT)
+    {
+        slot = (slot + 1) & (ledger->capacity - 1);
+    }
+    ledger->accounts[slot].account = account;
+    ledger->accounts[slot].balance = balance;
+    ledger->numAccounts++;
+}
+
+/*
+    Take an account out of the table
+    The accounts after it in the same run are moved back, so the searches do not stop at the empty slot
+*/
+static void removeAccount(ledger_t * ledger, uint64_t account)
+{
+    ledger_account_t * found = findAccount(ledger, account);
+    uint64_t mask = ledger->capacity - 1;
+    uint64_t empty;
+    uint64_t slot;
+    uint64_t home;
+
+    if (found == NULL)
+    {
+        return;
+    }
+
+    empty = found - ledger->accounts;
+    slot = empty;
+    while (1)
+    {
+        slot = (slot + 1) & mask;
+        if (ledger->accounts[slot].account == NO_ACCOUNT)
+        {
+            break;
+        }
+        // An account stays if its first slot is after the empty one, going around the table
+        home = accountSlot(ledger, ledger->accounts[slot].account);
+        if (((slot - home) & mask) < ((slot - empty) & mask))
+        {
+            continue;
+        }
+        ledger->accounts[empty] = ledger->accounts[slot];
+        empty = slot;
+    }
+    ledger->accounts[empty].account = NO_ACCOUNT;
+    ledger->numAccounts--;
+}
+
+/*
+    Get the balances from the snapshot and the records of the logs written after it
+    The log is cut after the last valid record, so the new records follow it
+    An old log left by a snapshot that did not finish is replayed first, and then
+    a new snapshot lets it be archived
+*/
+static void recoverLedger(ledger_t * ledger)
+{
+    uint64_t lastLsn = 0;
+    off_t valid = 0;
+    off_t size;
+    long replayed = 0;
+    uint64_t oldLast = 0;
+    long interrupted;
+    int fromSnapshot;
+    int old_fd;
+
+    fromSnapshot = loadSnapshot(ledger);
+
+    // The old log was complete when it was renamed, any invalid record in it is a real corruption
+    old_fd = open(ledger->oldLogPath, O_RDONLY);
+    if (old_fd != -1)
+    {
+        replayed += replayLog(ledger, old_fd, &lastLsn, &valid);
+        oldLast = lastLsn;
+        size = lseek(old_fd, 0, SEEK_END);
+        close(old_fd);
+        if (size != valid)
+        {
+            printf("Error: the log %s is corrupt\n", ledger->oldLogPath);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    ledger->log_fd = open(ledger->logPath, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (ledger->log_fd == -1)
+    {
+        perror("ERROR: open");
+        exit(EXIT_FAILURE);
+    }
+    replayed += replayLog(ledger, ledger->log_fd, &lastLsn, &valid);
+
+    size = lseek(ledger->log_fd, 0, SEEK_END);
+    if (size > valid)
+    {
+        printf("Discarding %lld bytes at the end of the log %s\n", (long long) (size - valid), ledger->logPath);
+        if (ftruncate(ledger->log_fd, valid) == -1)
+        {
+            perror("ERROR: ftruncate");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // The players connected during a crash are closed with the last balance recorded in the log
+    interrupted = closeInterrupted(ledger);
+
+    printf("Ledger recovered %s and %ld records of %s", fromSnapshot ? ledger->snapshotPath : "no snapshot", replayed, ledger->logPath);
+    printf(", %ld accounts were open when the server stopped, the next account is %" PRIu64 "\n", interrupted, ledger->appliedAccounts);
+
+    if (old_fd != -1)
+    {
+        copyAccounts(ledger);
+        writeSnapshot(ledger);
+        if (oldLast > 0)
+        {
+            archiveLog(ledger, ledger->oldLogPath, oldLast);
+        }
+        else if (unlink(ledger->oldLogPath) == -1)
+        {
+            perror("ERROR: unlink");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/*
+    Close the accounts that were open when the server stopped, with their last balance
+    The records are synced before the accounts leave the table, so the snapshots do not lose them
+    Returns the number of accounts closed
+*/
+static long closeInterrupted(ledger_t * ledger)
+{
+    ledger_record_t * records = NULL;
+    long count = 0;
+
+    if (ledger->numAccounts == 0)
+    {
+        return 0;
+    }
+
+    records = malloc(ledger->numAccounts * sizeof (ledger_record_t));
+    if (records == NULL)
+    {
+        perror("ERROR: malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (uint64_t i=0; i<ledger->capacity; i++)
+    {
+        if (ledger->accounts[i].account != NO_ACCOUNT)
+        {
+            ledger_record_t * record = &records[count];
+            record->type = LEDGER_CLOSE;
+            record->lsn = ledger->appliedLsn + count + 1;
+            record->account = ledger->accounts[i].account;
+            record->amount = ledger->accounts[i].balance;
+            record->crc = recordCrc(record);
+            count++;
+        }
+    }
+
+    writeAll(ledger->log_fd, records, count * sizeof (ledger_record_t));
+    if (fdatasync(ledger->log_fd) == -1)
+    {
+        perror("ERROR: fdatasync");
+        exit(EXIT_FAILURE);
+    }
+    for (long i=0; i<count; i++)
+    {
+        applyRecord(ledger, &records[i]);
+    }
+    free(records);
+
+    return count;
+}
+
+/*
+    Apply the records of a log that are newer than the balances, from the start of the file
+    Stops at the first record that is incomplete, does not match its CRC or is out of order
+    Updates the last number of record read, and the bytes of the file that are valid
+    Returns the number of records applied
+*/
+static long replayLog(ledger_t * ledger, int fd, uint64_t * lastLsn, off_t * valid)
+{
+    ledger_record_t * records = NULL;
+    ssize_t bytes;
+    long replayed = 0;
+    int corrupt = 0;
+
+    records = malloc(RECOVERY_RECORDS * sizeof (ledger_record_t));
+    if (records == NULL)
+    {
+        perror("ERROR: malloc");
+        exit(EXIT_FAILURE);
+    }
+    *valid = 0;
+    while (!corrupt && (bytes = read(fd, records, RECOVERY_RECORDS * sizeof (ledger_record_t))) > 0)
+    {
+        for (int i=0; i<bytes / (ssize_t) sizeof (ledger_record_t) && !corrupt; i++)
+        {
+            // A record that does not match its CRC, or out of order, was never completed
+            if (records[i].crc != recordCrc(&records[i]) || records[i].lsn <= *lastLsn)
+            {
+                corrupt = 1;
+                break;
+            }
+            *lastLsn = records[i].lsn;
+            // The records already in the snapshot were left by a crash before emptying the log
+            if (records[i].lsn > ledger->appliedLsn)
+            {
+                applyRecord(ledger, &records[i]);
+                replayed++;
+            }
+            *valid += sizeof (ledger_record_t);
+        }
+        // An incomplete record at the end of the file
+        if (bytes % sizeof (ledger_record_t) != 0)
+        {
+            corrupt = 1;
+        }
+    }
+    free(records);
+
+    return replayed;
+}
+
+/*
+    Read the balances of the snapshot file, if there is a valid one
+    The snapshots of the version 1 have every account ever opened, only the open ones are taken
+    Returns 1 if the balances were loaded, 0 otherwise
+*/
+static int loadSnapshot(ledger_t * ledger)
+{
+    ledger_header_t header;
+    struct stat status;
+    size_t headerSize = offsetof(ledger_header_t, nextAccount);
+    size_t accountSize = sizeof (ledger_account_t);
+    char * accounts = NULL;
+    uint32_t crc;
+    uint32_t stored;
+    int fd;
+
+    fd = open(ledger->snapshotPath, O_RDONLY);
+    if (fd == -1)
+    {
+        return 0;
+    }
+
+    bzero(&header, sizeof header);
+    if (fstat(fd, &status) == -1 || read(fd, &header, headerSize) != (ssize_t) headerSize
+        || memcmp(header.magic, LEDGER_MAGIC, sizeof LEDGER_MAGIC) != 0
+        || (header.version != LEDGER_VERSION && header.version != 1))
+    {
+        printf("Error: invalid snapshot %s\n", ledger->snapshotPath);
+        exit(EXIT_FAILURE);
+    }
+    if (header.version == 1)
+    {
+        accountSize = sizeof (ledger_account_v1_t);
+        header.nextAccount = header.accounts;
+    }
+    else
+    {
+        if (read(fd, &header.nextAccount, sizeof header.nextAccount) != sizeof header.nextAccount)
+        {
+            printf("Error: invalid snapshot %s\n", ledger->snapshotPath);
+            exit(EXIT_FAILURE);
+        }
+        headerSize = sizeof header;
+    }
+    if (status.st_size != (off_t) (headerSize + header.accounts * accountSize))
+    {
+        printf("Error: invalid snapshot %s\n", ledger->snapshotPath);
+        exit(EXIT_FAILURE);
+    }
+
+    accounts = malloc((header.accounts > 0) ? header.accounts * accountSize : 1);
+    if (accounts == NULL)
+    {
+        perror("ERROR: malloc");
+        exit(EXIT_FAILURE);
+    }
+    if (read(fd, accounts, header.accounts * accountSize) != (ssize_t) (header.accounts * accountSize))
+    {
+        perror("ERROR: read");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    stored = header.crc;
+    header.crc = 0;
+    crc = crc32(0, &header, headerSize);
+    crc = crc32(crc, accounts, header.accounts * accountSize);
+    if (crc != stored)
+    {
+        // The snapshot is only renamed after it is complete, so it cannot be fixed with the log
+        printf("Error: the snapshot %s does not match its CRC\n", ledger->snapshotPath);
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint64_t i=0; i<header.accounts; i++)
+    {
+        if (header.version == 1)
+        {
+            ledger_account_v1_t * old = (ledger_account_v1_t *) accounts + i;
+            if (old->open)
+            {
+                insertAccount(ledger, i, old->balance);
+            }
+        }
+        else
+        {
+            ledger_account_t * account = (ledger_account_t *) accounts + i;
+            insertAccount(ledger, account->account, account->balance);
+        }
+    }
+    free(accounts);
+
+    ledger->appliedLsn = header.lsn;
+    ledger->appliedAccounts = header.nextAccount;
+
+    return 1;
+}
+
+/*
+    Store the copy of the balances in a new snapshot
+    The snapshot replaces the previous one only after it is on the disk
+*/
+static void writeSnapshot(ledger_t * ledger)
+{
+    char temporary[FILENAME_MAX + 4];
+    ledger_header_t header;
+    int fd;
+
+    bzero(&header, sizeof header);
+    memcpy(header.magic, LEDGER_MAGIC, sizeof LEDGER_MAGIC);
+    header.version = LEDGER_VERSION;
+    header.lsn = ledger->copyLsn;
+    header.accounts = ledger->copyCount;
+    header.nextAccount = ledger->copyNext;
+    header.crc = crc32(0, &header, sizeof header);
+    header.crc = crc32(header.crc, ledger->copy, ledger->copyCount * sizeof (ledger_account_t));
+
+    snprintf(temporary, sizeof temporary, "%s.tmp", ledger->snapshotPath);
+    fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        perror("ERROR: open");
+        exit(EXIT_FAILURE);
+    }
+    writeAll(fd, &header, sizeof header);
+    writeAll(fd, ledger->copy, ledger->copyCount * sizeof (ledger_account_t));
+    if (fsync(fd) == -1)
+    {
+        perror("ERROR: fsync");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    if (rename(temporary, ledger->snapshotPath) == -1)
+    {
+        perror("ERROR: rename");
+        exit(EXIT_FAILURE);
+    }
+    syncDirectory(ledger->snapshotPath);
+}
+
+/*
+    Keep a log whose records are all in a snapshot, named after the log with the number of its last record
+    The archives keep every settlement of the players, the recovery only reads the newest logs
+*/
+static void archiveLog(ledger_t * ledger, const char * path, uint64_t lastLsn)
+{
+    char archive[FILENAME_MAX + 24];
+
+    snprintf(archive, sizeof archive, "%s.%020" PRIu64, ledger->logPath, lastLsn);
+    if (rename(path, archive) == -1)
+    {
+        perror("ERROR: rename");
+        exit(EXIT_FAILURE);
+    }
+    syncDirectory(archive);
+}
+
+/*
+    Write all the bytes indicated, retrying the partial writes
+*/
+static void writeAll(int fd, const void * data, size_t length)
+{
+    const char * bytes = data;
+    ssize_t written;
+
+    while (length > 0)
+    {
+        written = write(fd, bytes, length);
+        if (written == -1)
+        {
+            perror("ERROR: write");
+            exit(EXIT_FAILURE);
+        }
+        bytes += written;
+        length -= written;
+    }
+}
+
+/*
+    Make the name of a file renamed permanent, syncing its directory
+*/
+static void syncDirectory(const char * path)
+{
+    char copy[FILENAME_MAX];
+    int fd;
+
+    snprintf(copy, sizeof copy, "%s", path);
+    fd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+    if (fd == -1)
+    {
+        perror("ERROR: open");
+        exit(EXIT_FAILURE);
+    }
+    if (fsync(fd) == -1)
+    {
+        perror("ERROR: fsync");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+}
@@ -0,0 +1,155 @@
+/*
+    Durable record of the chips of the players
+    Every account opened, bet settled and account closed is a record appended to a log file.
+    The sessions only copy the record to a buffer in memory; a thread of the ledger
+    writes all the records gathered while the previous write was on the disk,
+    and syncs them with a single fsync (group commit).
+
+    The same thread keeps the balance of every open account; a closed account is
+    forgotten once its final balance is in the log, so the memory and the snapshots
+    only grow with the players connected. From time to time the thread copies the
+    balances and starts a new log, renaming the current one to .wal.old, and a second
+    thread writes the copy to a snapshot file and archives the old log, so the sessions
+    never wait for a snapshot. The archives are named after the log with the number of
+    their last record (.wal.00000000000000065536), and keep every settlement and final balance.
+    When the ledger is opened, the balances are recovered from the snapshot
+    and the records of the logs written after it. Every record has a CRC,
+    so a record left incomplete by a crash ends the log and is discarded.
+    The accounts that were open when the server stopped are closed with their last balance.
+    The files use the byte order of the computer that created them.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#ifndef LEDGER_H
+#define LEDGER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Identification of the snapshot files
+#define LEDGER_MAGIC "BJLEDGR"
+// Version of the layout of the files, the snapshots of the version 1 are still read
+#define LEDGER_VERSION 2
+// Records that fit in each of the buffers in memory
+#define LEDGER_BUFFER 8192
+// Records written to the log before taking a new snapshot
+#define LEDGER_SNAPSHOT 65536
+
+// The changes stored in the log
+typedef enum {LEDGER_OPEN = 1, LEDGER_SETTLE, LEDGER_CLOSE} ledger_type_t;
+
+// A change of an account, as stored in the log
+typedef struct ledger_record_struct {
+    // CRC-32 of the rest of the record
+    uint32_t crc;
+    uint32_t type;
+    // Number of the record, always increasing
+    uint64_t lsn;
+    uint64_t account;
+    // Starting balance when the account is opened, chips won or lost in a settlement, final balance when it is closed
+    int64_t amount;
+} ledger_record_t;
+
+// First bytes of the snapshot file, followed by the balance of every open account
+typedef struct ledger_header_struct {
+    char magic[8];
+    uint32_t version;
+    // CRC-32 of the whole file, computed with this field in 0
+    uint32_t crc;
+    // Last record included in the balances
+    uint64_t lsn;
+    uint64_t accounts;
+    // Number of the next account opened, the version 1 ends before this field
+    uint64_t nextAccount;
+} ledger_header_t;
+
+// The chips of an open account, in the table of the thread and in the snapshot
+typedef struct ledger_account_struct {
+    uint64_t account;
+    int64_t balance;
+} ledger_account_t;
+
+// The files of the ledger and the thread that writes them
+typedef struct ledger_struct {
+    char logPath[FILENAME_MAX];
+    char oldLogPath[FILENAME_MAX];
+    char snapshotPath[FILENAME_MAX];
+    int log_fd;
+    // Records waiting to be written, and the buffer being written by the thread
+    ledger_record_t * pending;
+    ledger_record_t * writing;
+    int numPending;
+    uint64_t nextLsn;
+    uint64_t nextAccount;
+    pthread_mutex_t ledger_mutex;
+    // Signaled when there are records to write, and when there is space in the buffer
+    pthread_cond_t records_cond;
+    pthread_cond_t space_cond;
+    pthread_t tid;
+    int running;
+    // Open accounts known by the thread, in a hash table with linear probing
+    ledger_account_t * accounts;
+    uint64_t numAccounts;
+    uint64_t capacity;
+    // Last record applied to the balances, and the next account after the ones applied
+    uint64_t appliedLsn;
+    uint64_t appliedAccounts;
+    long sinceSnapshot;
+    // Copy of the balances written by the thread of the snapshots, while the log continues in a new file
+    pthread_t snapshot_tid;
+    pthread_mutex_t snapshot_mutex;
+    pthread_cond_t snapshot_cond;
+    ledger_account_t * copy;
+    uint64_t copyCount;
+    uint64_t copyCapacity;
+    uint64_t copyLsn;
+    uint64_t copyNext;
+    // 1 while the copy waits for its snapshot or is being written, protected by the lock of the snapshots
+    int snapshotPending;
+    int snapshotRunning;
+    // Counters for the reports, written by the thread
+    long records;
+    long commits;
+    long largestCommit;
+    long snapshots;
+    // Snapshots delayed because the previous one was still being written
+    long snapshotsDelayed;
+    // Times a session waited because the buffer was full, protected by the lock
+    long stalls;
+} ledger_t;
+
+/*
+    Open the files of the ledger with the prefix indicated, recover the balances and start its threads
+    The log and the snapshot are the prefix with the extensions .wal and .snap
+*/
+ledger_t * openLedger(const char * prefix);
+
+/*
+    Register a new account with its starting balance
+    Returns the number of the account
+*/
+uint64_t ledgerOpenAccount(ledger_t * ledger, int amount);
+
+/*
+    Register the chips won or lost by an account in a round
+*/
+void ledgerSettle(ledger_t * ledger, uint64_t account, int result);
+
+/*
+    Register the final balance of an account that will not be used anymore
+*/
+void ledgerCloseAccount(ledger_t * ledger, uint64_t account, int balance);
+
+/*
+    Print the counters of the writes of the ledger
+*/
+void printLedgerStats(ledger_t * ledger);
+
+/*
+    Write the records pending and a last snapshot, and stop the threads of the ledger
+*/
+void closeLedger(ledger_t * ledger);
+
+#endif
@@ -0,0 +1,1096 @@
+/*
+    Generator of load for the server
+    Opens many connections at the same time from a single thread, using epoll,
+    and plays on every one of them the same sequence of messages of the client:
+    PLAY, AMOUNT, then BET, HIT and STAND in every round, until saying BYE.
+    With the compact protocol the HELLO already carries the amount and the first bet,
+    unless the server only knows the version 1.
+    The decisions are taken by a policy, after a random time to think.
+
+    In the closed loop a fixed number of sessions is kept open, and a new one starts
+    every time another finishes. In the open loop the sessions arrive at a fixed rate,
+    no matter how fast the server attends them, and their times are measured from the
+    moment they should have arrived, so a slow server can not hide its delays.
+    The time of every step, from the message sent to the reply that completes it,
+    is kept in a histogram like the ones of the server.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+#include "blackjack.h"
+#include "policy.h"
+#include "protocol.h"
+#include "rng.h"
+#include "sockets.h"
+#include "stats.h"
+
+// Bytes received that are kept until a message is complete
+#define INPUT_SIZE 1024
+// Bytes of the messages waiting to be sent
+#define OUTPUT_SIZE 512
+// Events taken from epoll at once
+#define MAX_EVENTS 256
+// Milliseconds between the reports of the progress
+#define REPORT_INTERVAL 1000
+// Seconds given to the sessions to finish after the end of the test
+#define DRAIN_SECONDS 10
+#define NANOSECONDS 1000000000ULL
+
+// Steps of a session, named by the reply that completes them
+typedef enum {STEP_CONNECT, STEP_WELCOME, STEP_START, STEP_DEAL, STEP_CARD, STEP_RESULT, STEP_ROUND, STEPS} step_t;
+
+// Problems found by the sessions
+typedef enum {ERROR_CONNECT, ERROR_CLOSED, ERROR_PROTOCOL, ERROR_UNFINISHED, ERROR_MISSED, ERROR_BUSY, ERRORS} load_error_t;
+
+// Message expected by a session, or the action it is thinking about
+typedef enum {LOAD_CONNECTING, LOAD_WELCOME, LOAD_START, LOAD_BET, LOAD_DEAL, LOAD_DECISION, LOAD_CARD, LOAD_RESULT, LOAD_BYE, LOAD_FREE} load_state_t;
+
+// Distributions of the time that the players think before betting or deciding
+typedef enum {THINK_NONE, THINK_FIXED, THINK_UNIFORM, THINK_EXPONENTIAL} think_t;
+
+// Times measured for a step, kept by a single thread
+typedef struct latency_struct {
+    unsigned long long buckets[STATS_BUCKETS];
+    unsigned long long count;
+    unsigned long long total;
+    unsigned long long max;
+} latency_t;
+
+// A connection to the server, playing like a client
+typedef struct player_struct {
+    int connection_fd;
+    load_state_t state;
+    // Data of the protocol, updated with every reply
+    message_t message;
+    // Hands rebuilt from the message, for the policy
+    game_t game;
+    int roundsLeft;
+    // Version of the compact protocol accepted by the server
+    int version;
+    // Time when the current step started, and when the current round started
+    uint64_t sent;
+    uint64_t roundStart;
+    // Time when the player stops thinking, and its position in the heap of timers
+    uint64_t wake;
+    int timer;
+    char input[INPUT_SIZE];
+    int inputLength;
+    outbox_t outbox;
+    char outputData[OUTPUT_SIZE];
+    // Next player not in use
+    struct player_struct * nextFree;
+} player_t;
+
+// Parameters and results of the test
+typedef struct load_struct {
+    struct addrinfo * server_info;
+    int protocol;
+    int epoll_fd;
+    // Sessions open at the same time in the closed loop, and the limit of the open loop
+    int concurrency;
+    // Sessions started every second, 0 for the closed loop
+    double rate;
+    int rounds;
+    int amount;
+    int bet;
+    policy_t policy;
+    think_t think;
+    double thinkMean;
+    rng_t rng;
+    // Memory of all the sessions, and the ones not in use
+    player_t * players;
+    player_t * freePlayers;
+    int active;
+    // Sessions waiting to stop thinking, ordered by the time they wake
+    player_t ** timers;
+    int numTimers;
+    // Times of the test, in nanoseconds of the monotonic clock
+    uint64_t start;
+    uint64_t end;
+    uint64_t finish;
+    long long arrivals;
+    long long started;
+    long long finished;
+    long long roundsPlayed;
+    long long roundsReported;
+    long long errors[ERRORS];
+    latency_t steps[STEPS];
+} load_t;
+
+// Names used in the report
+static const char * stepNames[STEPS] = {"connect", "welcome", "start", "deal", "card", "result", "round"};
+static const char * errorNames[ERRORS] = {"connect", "closed", "protocol", "unfinished", "missed", "busy"};
+static const char * thinkNames[] = {"none", "fixed", "uniform", "exponential"};
+
+// Global variable for the signal handler
+int interrupt_exit = 0;
+
+///// FUNCTION DECLARATIONS
+void usage(char * program);
+void setupHandlers();
+void detectInterruption(int signal);
+int raiseFileLimit(int sessions);
+void runLoad(load_t * load);
+void startSession(load_t * load, uint64_t arrival);
+void finishSession(load_t * load, player_t * player, int error);
+void handleEvent(load_t * load, player_t * player, uint32_t events);
+void readReplies(load_t * load, player_t * player);
+void handleReply(load_t * load, player_t * player, int type);
+void sendStep(load_t * load, player_t * player, int type, load_state_t next);
+void thinkOrAct(load_t * load, player_t * player, load_state_t action);
+void act(load_t * load, player_t * player);
+void nextRound(load_t * load, player_t * player);
+int rebuildHands(player_t * player);
+uint64_t thinkTime(load_t * load);
+void pushTimer(load_t * load, player_t * player);
+player_t * popTimer(load_t * load);
+void removeTimer(load_t * load, player_t * player);
+void siftTimer(load_t * load, int index);
+void recordStep(load_t * load, step_t step, uint64_t start);
+void printProgress(load_t * load, uint64_t now);
+void printReport(load_t * load);
+
+///// MAIN FUNCTION
+int main(int argc, char * argv[])
+{
+    load_t load;
+    struct addrinfo hints;
+    const strategy_file_t * strategy = NULL;
+    uint64_t seed = randomSeed();
+    double duration = 10;
+    int option;
+
+    bzero(&load, sizeof load);
+    load.protocol = PROTOCOL_VERSION;
+    load.concurrency = 100;
+    load.rounds = 10;
+    load.amount = 1000;
+    load.bet = 10;
+    load.policy = basicPolicy;
+    load.think = THINK_NONE;
+
+    printf("\n=== LOADGEN PROGRAM ===\n");
+
+    while ((option = getopt(argc, argv, "n:r:R:t:P:S:k:m:a:b:s:l")) != -1)
+    {
+        switch (option)
+        {
+            case 'n':
+                load.concurrency = atoi(optarg);
+                break;
+            case 'r':
+                load.rate = atof(optarg);
+                break;
+            case 'R':
+                load.rounds = atoi(optarg);
+                break;
+            case 't':
+                duration = atof(optarg);
+                break;
+            case 'P':
+                load.policy = findPolicy(optarg);
+                if (load.policy == NULL)
+                {
+                    printf("Unknown policy: %s\n", optarg);
+                    usage(argv[0]);
+                }
+                break;
+            case 'S':
+                strategy = loadStrategy(optarg);
+                if (strategy == NULL)
+                {
+                    usage(argv[0]);
+                }
+                useStrategy(strategy);
+                break;
+            case 'k':
+                load.think = -1;
+                for (int i=0; i<(int) (sizeof thinkNames / sizeof thinkNames[0]); i++)
+                {
+                    if (strcmp(thinkNames[i], optarg) == 0)
+                    {
+                        load.think = i;
+                    }
+                }
+                if ((int) load.think == -1)
+                {
+                    printf("Unknown distribution of the think time: %s\n", optarg);
+                    usage(argv[0]);
+                }
+                break;
+            case 'm':
+                load.thinkMean = atof(optarg);
+                break;
+            case 'a':
+                load.amount = atoi(optarg);
+                break;
+            case 'b':
+                load.bet = atoi(optarg);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'l':
+                load.protocol = PROTOCOL_LEGACY;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2 || load.concurrency < 1 || load.rounds < 1 || load.rate < 0 || duration <= 0)
+    {
+        usage(argv[0]);
+    }
+    // The table policy can not play without its table
+    if (load.policy == tablePolicy && strategy == NULL)
+    {
+        printf("The table policy needs the file of the solver, given with -S\n");
+        usage(argv[0]);
+    }
+    if (load.bet < 2 || load.bet > 500 || load.amount < load.bet)
+    {
+        printf("The bet must be between 2 and 500 chips, and not above the amount\n");
+        usage(argv[0]);
+    }
+    // Without a mean the think time is zero
+    if (load.thinkMean <= 0)
+    {
+        load.think = THINK_NONE;
+    }
+
+    // The address is resolved once for all the connections
+    bzero(&hints, sizeof hints);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(argv[optind], argv[optind + 1], &hints, &load.server_info) != 0)
+    {
+        printf("Error: could not find the address of the server\n");
+        exit(EXIT_FAILURE);
+    }
+
+    load.concurrency = raiseFileLimit(load.concurrency);
+    seedRandom(&load.rng, seed, 0);
+    setupHandlers();
+
+    if (load.rate > 0)
+    {
+        printf("Open loop: %.1f sessions per second, at most %d at the same time\n", load.rate, load.concurrency);
+    }
+    else
+    {
+        printf("Closed loop: %d sessions at the same time\n", load.concurrency);
+    }
+    printf("%d rounds per session of %d chips betting %d, during %.1f seconds, thinking %s %.1f ms, using the %s protocol\n",
+        load.rounds, load.amount, load.bet, duration, thinkNames[load.think], load.thinkMean,
+        (load.protocol == PROTOCOL_LEGACY) ? "original" : "compact");
+
+    load.start = statsNow();
+    load.end = load.start + (uint64_t) (duration * NANOSECONDS);
+    runLoad(&load);
+    printReport(&load);
+
+    freeaddrinfo(load.server_info);
+    if (strategy != NULL)
+    {
+        unloadStrategy(strategy);
+    }
+    return 0;
+}
+
+///// FUNCTION DEFINITIONS
+
+/*
+    Explanation to the user of the parameters required to run the program
+*/
+void usage(char * program)
+{
+    printf("Usage:\n");
+    printf("\t%s [-n sessions] [-r rate] [-R rounds] [-t seconds] [-P policy] [-S strategy_file] [-k think] [-m milliseconds] [-a amount] [-b bet] [-s seed] [-l] {server_address} {port_number}\n", program);
+    printf("\t-n: sessions open at the same time, 100 by default. In the open loop, the most allowed before missing arrivals\n");
+    printf("\t-r: start this number of sessions every second (open loop), instead of replacing the ones that finish (closed loop)\n");
+    printf("\t-R: rounds played by every session before saying goodbye, 10 by default\n");
+    printf("\t-t: seconds starting new sessions, 10 by default. The sessions open then finish their current round\n");
+    printf("\t-P: decisions of the players, basic by default. The policies available are:\n");
+    printPolicies();
+    printf("\t-S: table created by the solver, needed by the table policy\n");
+    printf("\t-k: distribution of the time thinking before every bet and decision: none, fixed, uniform or exponential\n");
+    printf("\t-m: mean of the time thinking, in milliseconds\n");
+    printf("\t-a: starting amount of chips of every session, 1000 by default\n");
+    printf("\t-b: bet of every round, from 2 to 500 chips, 10 by default\n");
+    printf("\t-s: seed of the think times, taken from the clock by default\n");
+    printf("\t-l: use the original messages, for servers without the compact protocol\n");
+    printf("\tSend SIGINT to stop starting sessions and show the results\n");
+    exit(EXIT_FAILURE);
+}
+
+/*
+    Modify the signal handlers for specific events
+*/
+void setupHandlers()
+{
+    struct sigaction new_action;
+
+    new_action.sa_handler = detectInterruption;
+    sigemptyset(&new_action.sa_mask);
+    new_action.sa_flags = 0;
+    sigaction(SIGINT, &new_action, NULL);
+}
+
+/*
+    Signal handler for Ctrl-C
+*/
+void detectInterruption(int signal)
+{
+    // Change the global variable
+    interrupt_exit = 1;
+}
+
+/*
+    Allow the process to open a file descriptor for every session
+    Returns the number of sessions that fit in the limit
+*/
+int raiseFileLimit(int sessions)
+{
+    struct rlimit limit;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1)
+    {
+        perror("ERROR: getrlimit");
+        return sessions;
+    }
+    limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) == -1)
+    {
+        perror("ERROR: setrlimit");
+    }
+    getrlimit(RLIMIT_NOFILE, &limit);
+
+    // Leave some descriptors for the standard streams and epoll
+    if ((rlim_t) sessions + 16 > limit.rlim_cur)
+    {
+        printf("Only %d sessions fit in the limit of open files\n", (int) limit.rlim_cur - 16);
+        return limit.rlim_cur - 16;
+    }
+    return sessions;
+}
+
+/*
+    Start sessions and attend their events until the end of the test
+    After the end no session starts, and the ones open finish their round and say goodbye
+*/
+void runLoad(load_t * load)
+{
+    struct epoll_event events[MAX_EVENTS];
+    player_t * player = NULL;
+    uint64_t now = load->start;
+    uint64_t nextReport = load->start + REPORT_INTERVAL * 1000000ULL;
+    uint64_t wait;
+    uint64_t arrival;
+    int stopping = 0;
+    int count;
+
+    load->players = calloc(load->concurrency, sizeof (player_t));
+    load->timers = calloc(load->concurrency, sizeof (player_t *));
+    if (load->players == NULL || load->timers == NULL)
+    {
+        perror("ERROR: calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i=load->concurrency - 1; i>=0; i--)
+    {
+        load->players[i].state = LOAD_FREE;
+        load->players[i].nextFree = load->freePlayers;
+        load->freePlayers = &load->players[i];
+    }
+
+    load->epoll_fd = epoll_create1(0);
+    if (load->epoll_fd == -1)
+    {
+        perror("ERROR: epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+
+    while (1)
+    {
+        now = statsNow();
+        if (!stopping && (interrupt_exit || now >= load->end))
+        {
+            // Stop starting sessions, the ones open leave after their round
+            stopping = 1;
+            load->end = now;
+        }
+        if (stopping && (load->active == 0 || now >= load->end + DRAIN_SECONDS * NANOSECONDS))
+        {
+            break;
+        }
+
+        if (!stopping)
+        {
+            if (load->rate > 0)
+            {
+                // Every arrival is measured from its scheduled time, even if it comes late
+                while ((arrival = load->start + (uint64_t) (load->arrivals * NANOSECONDS / load->rate)) <= now)
+                {
+                    load->arrivals++;
+                    if (load->freePlayers == NULL)
+                    {
+                        load->errors[ERROR_MISSED]++;
+                    }
+                    else
+                    {
+                        startSession(load, arrival);
+                    }
+                }
+            }
+            else
+            {
+                // Connections that fail immediately are retried in the next turn
+                for (count = load->concurrency - load->active; count > 0; count--)
+                {
+                    load->arrivals++;
+                    startSession(load, now);
+                }
+            }
+        }
+
+        // Players that finished thinking
+        while (load->numTimers > 0 && load->timers[0]->wake <= now)
+        {
+            act(load, popTimer(load));
+        }
+
+        if (now >= nextReport)
+        {
+            printProgress(load, now);
+            nextReport += REPORT_INTERVAL * 1000000ULL;
+        }
+
+        // Sleep until the next event, timer, arrival or report
+        wait = nextReport;
+        if (load->numTimers > 0 && load->timers[0]->wake < wait)
+        {
+            wait = load->timers[0]->wake;
+        }
+        if (!stopping && load->end < wait)
+        {
+            wait = load->end;
+        }
+        if (!stopping && load->rate > 0)
+        {
+            arrival = load->start + (uint64_t) (load->arrivals * NANOSECONDS / load->rate);
+            if (arrival < wait)
+            {
+                wait = arrival;
+            }
+        }
+        now = statsNow();
+        count = epoll_wait(load->epoll_fd, events, MAX_EVENTS, (wait > now) ? (wait - now + 999999) / 1000000 : 0);
+        if (count == -1 && errno != EINTR)
+        {
+            perror("ERROR: epoll_wait");
+            exit(EXIT_FAILURE);
+        }
+        for (int i=0; i<count; i++)
+        {
+            handleEvent(load, events[i].data.ptr, events[i].events);
+        }
+    }
+
+    // The sessions still open did not finish in time
+    for (int i=0; i<load->concurrency; i++)
+    {
+        player = &load->players[i];
+        if (player->state != LOAD_FREE)
+        {
+            finishSession(load, player, ERROR_UNFINISHED);
+        }
+    }
+
+    load->finish = statsNow();
+    close(load->epoll_fd);
+    free(load->players);
+    free(load->timers);
+}
+
+/*
+    Open a new connection without waiting for it
+    The time of the connection is measured from the arrival indicated
+*/
+void startSession(load_t * load, uint64_t arrival)
+{
+    player_t * player = load->freePlayers;
+    struct epoll_event event;
+
+    load->freePlayers = player->nextFree;
+    load->active++;
+    load->started++;
+
+    bzero(&player->message, sizeof player->message);
+    player->state = LOAD_CONNECTING;
+    player->roundsLeft = load->rounds;
+    player->version = 0;
+    player->sent = arrival;
+    player->timer = -1;
+    player->inputLength = 0;
+    initOutbox(&player->outbox, player->outputData, OUTPUT_SIZE);
+
+    player->connection_fd = socket(load->server_info->ai_family, load->server_info->ai_socktype | SOCK_NONBLOCK, load->server_info->ai_protocol);
+    if (player->connection_fd == -1)
+    {
+        perror("ERROR: socket");
+        finishSession(load, player, ERROR_CONNECT);
+        return;
+    }
+    if (connect(player->connection_fd, load->server_info->ai_addr, load->server_info->ai_addrlen) == -1 && errno != EINPROGRESS)
+    {
+        finishSession(load, player, ERROR_CONNECT);
+        return;
+    }
+
+    // The socket becomes writable when the connection is established
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = player;
+    if (epoll_ctl(load->epoll_fd, EPOLL_CTL_ADD, player->connection_fd, &event) == -1)
+    {
+        perror("ERROR: epoll_ctl");
+        finishSession(load, player, ERROR_CONNECT);
+    }
+}
+
+/*
+    Close the connection of a session and count it, with the error indicated or -1 if it finished well
+*/
+void finishSession(load_t * load, player_t * player, int error)
+{
+    if (player->connection_fd != -1)
+    {
+        // Closing the descriptor also removes it from epoll
+        close(player->connection_fd);
+        player->connection_fd = -1;
+    }
+    if (error >= 0)
+    {
+        load->errors[error]++;
+    }
+    else
+    {
+        load->finished++;
+    }
+
+    if (player->timer >= 0)
+    {
+        removeTimer(load, player);
+    }
+
+    player->state = LOAD_FREE;
+    player->nextFree = load->freePlayers;
+    load->freePlayers = player;
+    load->active--;
+}
+
+/*
+    Attend the events of the connection of a session
+*/
+void handleEvent(load_t * load, player_t * player, uint32_t events)
+{
+    int error = 0;
+    socklen_t length = sizeof error;
+
+    // Finished by an earlier event of the same batch
+    if (player->state == LOAD_FREE)
+    {
+        return;
+    }
+
+    if (player->state == LOAD_CONNECTING)
+    {
+        if (getsockopt(player->connection_fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1 || error != 0 || (events & (EPOLLERR | EPOLLHUP)))
+        {
+            finishSession(load, player, ERROR_CONNECT);
+            return;
+        }
+        recordStep(load, STEP_CONNECT, player->sent);
+
+        // Handshake, with the amount and the first bet, ignored by the servers of the version 1
+        player->message.msg_code = PLAY;
+        if (load->protocol >= PROTOCOL_QUICK_START)
+        {
+            player->message.playerAmount = load->amount;
+            player->message.playerBet = load->bet;
+            player->roundStart = statsNow();
+        }
+        sendStep(load, player, FRAME_HELLO, LOAD_WELCOME);
+        return;
+    }
+
+    if ((events & EPOLLOUT) && !flushOutput(player->connection_fd, &player->outbox))
+    {
+        finishSession(load, player, ERROR_CLOSED);
+        return;
+    }
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP))
+    {
+        readReplies(load, player);
+    }
+}
+
+/*
+    Read everything available in the connection and attend every complete reply
+*/
+void readReplies(load_t * load, player_t * player)
+{
+    int chars_read;
+    int consumed;
+    int length;
+    int type;
+
+    while (1)
+    {
+        chars_read = recv(player->connection_fd, player->input + player->inputLength, INPUT_SIZE - player->inputLength, 0);
+        if (chars_read == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        // Nothing else to read for now
+        if (chars_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return;
+        }
+        // The server closed the connection before saying goodbye
+        if (chars_read <= 0)
+        {
+            finishSession(load, player, ERROR_CLOSED);
+            return;
+        }
+        player->inputLength += chars_read;
+
+        consumed = 0;
+        while (1)
+        {
+            if (load->protocol == PROTOCOL_LEGACY)
+            {
+                if (player->inputLength - consumed < (int) sizeof (message_t))
+                {
+                    break;
+                }
+                memcpy(&player->message, player->input + consumed, sizeof (message_t));
+                consumed += sizeof (message_t);
+                type = -1;
+            }
+            else
+            {
+                length = frameLength((unsigned char *) player->input + consumed, player->inputLength - consumed);
+                if (length == 0)
+                {
+                    break;
+                }
+                type = decodeFrame((unsigned char *) player->input + consumed, &player->message);
+                if (type == FRAME_WELCOME)
+                {
+                    player->version = frameVersion((unsigned char *) player->input + consumed);
+                }
+                consumed += length;
+            }
+
+            handleReply(load, player, type);
+            if (player->state == LOAD_FREE)
+            {
+                return;
+            }
+        }
+
+        // Keep the part of a message not received yet
+        memmove(player->input, player->input + consumed, player->inputLength - consumed);
+        player->inputLength -= consumed;
+    }
+}
+
+/*
+    Take the reply of the server for the current step and continue with the next one
+    The type of the frame is -1 for the original messages
+*/
+void handleReply(load_t * load, player_t * player, int type)
+{
+    // Frame expected in every state, 0 when the session does not wait for the server
+    static const int expected[] = {0, FRAME_WELCOME, FRAME_START, 0, FRAME_DEAL, 0, FRAME_CARD, FRAME_RESULT, FRAME_BYE, 0};
+
+    // The server can refuse the session instead of welcoming the player
+    if (player->state == LOAD_WELCOME && (type == FRAME_BUSY || (type == -1 && player->message.msg_code == BUSY)))
+    {
+        finishSession(load, player, ERROR_BUSY);
+        return;
+    }
+
+    if (expected[player->state] == 0 || (load->protocol != PROTOCOL_LEGACY && type != expected[player->state]))
+    {
+        finishSession(load, player, ERROR_PROTOCOL);
+        return;
+    }
+
+    switch (player->state)
+    {
+        case LOAD_WELCOME:
+            if (player->message.msg_code != AMOUNT)
+            {
+                finishSession(load, player, ERROR_PROTOCOL);
+                return;
+            }
+            recordStep(load, STEP_WELCOME, player->sent);
+            // The START and the first DEAL come next, the HELLO was also the bet
+            if (player->version >= PROTOCOL_QUICK_START)
+            {
+                player->state = LOAD_START;
+                break;
+            }
+            player->message.msg_code = AMOUNT;
+            player->message.playerAmount = load->amount;
+            sendStep(load, player, FRAME_AMOUNT, LOAD_START);
+            break;
+        case LOAD_START:
+            recordStep(load, STEP_START, player->sent);
+            if (player->version >= PROTOCOL_QUICK_START)
+            {
+                player->state = LOAD_DEAL;
+                break;
+            }
+            nextRound(load, player);
+            break;
+        case LOAD_DEAL:
+            recordStep(load, STEP_DEAL, player->sent);
+            if (!rebuildHands(player))
+            {
+                finishSession(load, player, ERROR_PROTOCOL);
+                return;
+            }
+            // With a natural there are no decisions, the result comes next
+            if ((player->message.playerStatus == NATURAL) || (player->message.dealerStatus == NATURAL))
+            {
+                player->state = LOAD_RESULT;
+                player->sent = statsNow();
+                break;
+            }
+            thinkOrAct(load, player, LOAD_DECISION);
+            break;
+        case LOAD_CARD:
+            recordStep(load, STEP_CARD, player->sent);
+            if (!rebuildHands(player))
+            {
+                finishSession(load, player, ERROR_PROTOCOL);
+                return;
+            }
+            if ((player->message.playerStatus == BUST) || (player->message.playerStatus == TWENTYONE))
+            {
+                player->state = LOAD_RESULT;
+                player->sent = statsNow();
+                break;
+            }
+            thinkOrAct(load, player, LOAD_DECISION);
+            break;
+        case LOAD_RESULT:
+            recordStep(load, STEP_RESULT, player->sent);
+            recordStep(load, STEP_ROUND, player->roundStart);
+            load->roundsPlayed++;
+            player->roundsLeft--;
+            //Reset status of dealer and player for next round
+            player->message.playerStatus = START;
+            player->message.dealerStatus = START;
+            nextRound(load, player);
+            break;
+        case LOAD_BYE:
+            finishSession(load, player, -1);
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+    Send the message of a step and wait for the state indicated
+    The original protocol sends the whole message, the compact one a frame of the type indicated
+*/
+void sendStep(load_t * load, player_t * player, int type, load_state_t next)
+{
+    unsigned char frame[MAX_FRAME];
+    int length;
+    int queued;
+
+    if (load->protocol == PROTOCOL_LEGACY)
+    {
+        queued = queueOutput(&player->outbox, &player->message, sizeof (message_t));
+    }
+    else
+    {
+        length = encodeFrame(frame, type, load->protocol, &player->message);
+        queued = queueOutput(&player->outbox, frame, length);
+    }
+
+    player->state = next;
+    player->sent = statsNow();
+    if (!queued || !flushOutput(player->connection_fd, &player->outbox))
+    {
+        finishSession(load, player, ERROR_CLOSED);
+    }
+}
+
+/*
+    Wait the time to think before the action indicated, or take it now if there is no time to wait
+*/
+void thinkOrAct(load_t * load, player_t * player, load_state_t action)
+{
+    uint64_t delay = thinkTime(load);
+
+    player->state = action;
+    if (delay == 0)
+    {
+        act(load, player);
+        return;
+    }
+    player->wake = statsNow() + delay;
+    pushTimer(load, player);
+}
+
+/*
+    Send the bet or the decision of the policy, after thinking about it
+*/
+void act(load_t * load, player_t * player)
+{
+    message_t * message = &player->message;
+
+    if (player->state == LOAD_BET)
+    {
+        message->msg_code = BET;
+        message->playerBet = (load->bet < message->playerAmount) ? load->bet : message->playerAmount;
+        player->roundStart = statsNow();
+        sendStep(load, player, FRAME_BET, LOAD_DEAL);
+    }
+    else if (player->state == LOAD_DECISION)
+    {
+        message->playerStatus = load->policy(&player->game);
+        if (message->playerStatus == HIT)
+        {
+            sendStep(load, player, FRAME_HIT, LOAD_CARD);
+        }
+        else
+        {
+            sendStep(load, player, FRAME_STAND, LOAD_RESULT);
+        }
+    }
+}
+
+/*
+    Bet in another round, or say goodbye when the session has played all its rounds,
+    the chips are not enough or the test finished
+*/
+void nextRound(load_t * load, player_t * player)
+{
+    if ((player->roundsLeft > 0) && (player->message.playerAmount >= 2) && (statsNow() < load->end))
+    {
+        thinkOrAct(load, player, LOAD_BET);
+        return;
+    }
+
+    // Finish the communication
+    player->message.msg_code = BYE;
+    sendStep(load, player, FRAME_BYE, LOAD_BYE);
+}
+
+/*
+    Rebuild the hand of the player and the up card of the dealer from the names in the message
+    Returns 0 if a card is not valid
+*/
+int rebuildHands(player_t * player)
+{
+    message_t * message = &player->message;
+    int card;
+
+    resetHand(&player->game.player);
+    resetHand(&player->game.dealer);
+    if ((message->numPlayerCards < 1) || (message->numPlayerCards > MAXCARDS) || (message->numDealerCards < 1))
+    {
+        return 0;
+    }
+
+    for (int i=0; i<message->numPlayerCards; i++)
+    {
+        card = cardFromName(message->playerCards[i]);
+        if (card == -1)
+        {
+            return 0;
+        }
+        addCard(&player->game.player, card);
+    }
+    card = cardFromName(message->dealerCards[0]);
+    if (card == -1)
+    {
+        return 0;
+    }
+    addCard(&player->game.dealer, card);
+
+    return 1;
+}
+
+/*
+    Get a random time to think, in nanoseconds, with the distribution chosen
+*/
+uint64_t thinkTime(load_t * load)
+{
+    double mean = load->thinkMean * 1000000.0;
+    // Uniform value from 0 to 1, without reaching 1
+    double fraction = (nextRandom(&load->rng) >> 11) * 0x1.0p-53;
+
+    switch (load->think)
+    {
+        case THINK_FIXED:
+            return mean;
+        case THINK_UNIFORM:
+            return 2 * mean * fraction;
+        case THINK_EXPONENTIAL:
+            return -mean * log(1 - fraction);
+        default:
+            return 0;
+    }
+}
+
+/*
+    Add the timer of a player that is thinking
+*/
+void pushTimer(load_t * load, player_t * player)
+{
+    player->timer = load->numTimers;
+    load->timers[load->numTimers] = player;
+    load->numTimers++;
+    siftTimer(load, player->timer);
+}
+
+/*
+    Remove and return the player that stops thinking first
+*/
+player_t * popTimer(load_t * load)
+{
+    player_t * player = load->timers[0];
+
+    removeTimer(load, player);
+    return player;
+}
+
+/*
+    Remove the timer of a player, moving the last timer to its place
+*/
+void removeTimer(load_t * load, player_t * player)
+{
+    int index = player->timer;
+
+    load->numTimers--;
+    if (index < load->numTimers)
+    {
+        load->timers[index] = load->timers[load->numTimers];
+        load->timers[index]->timer = index;
+        siftTimer(load, index);
+    }
+    player->timer = -1;
+}
+
+/*
+    Move the timer at the position indicated up or down the heap, until it is in order
+*/
+void siftTimer(load_t * load, int index)
+{
+    player_t ** timers = load->timers;
+    player_t * player = timers[index];
+    int child;
+
+    // Up while it wakes before its parent
+    while ((index > 0) && (player->wake < timers[(index - 1) / 2]->wake))
+    {
+        timers[index] = timers[(index - 1) / 2];
+        timers[index]->timer = index;
+        index = (index - 1) / 2;
+    }
+    // Down while a child wakes before it
+    while ((child = 2 * index + 1) < load->numTimers)
+    {
+        if ((child + 1 < load->numTimers) && (timers[child + 1]->wake < timers[child]->wake))
+        {
+            child++;
+        }
+        if (player->wake <= timers[child]->wake)
+        {
+            break;
+        }
+        timers[index] = timers[child];
+        timers[index]->timer = index;
+        index = child;
+    }
+
+    timers[index] = player;
+    player->timer = index;
+}
+
+/*
+    Add the time elapsed since the start indicated to the histogram of a step
+*/
+void recordStep(load_t * load, step_t step, uint64_t start)
+{
+    latency_t * latency = &load->steps[step];
+    uint64_t now = statsNow();
+    uint64_t nanoseconds = (now > start) ? now - start : 0;
+
+    latency->buckets[statsBucket(nanoseconds)]++;
+    latency->count++;
+    latency->total += nanoseconds;
+    if (nanoseconds > latency->max)
+    {
+        latency->max = nanoseconds;
+    }
+}
+
+/*
+    Print the sessions open and the rounds played since the last report
+*/
+void printProgress(load_t * load, uint64_t now)
+{
+    printf("%6.1f s: %d sessions open, %lld rounds, %.0f rounds per second\n", (now - load->start) / 1e9, load->active,
+        load->roundsPlayed, (load->roundsPlayed - load->roundsReported) * 1000.0 / REPORT_INTERVAL);
+    load->roundsReported = load->roundsPlayed;
+}
+
+/*
+    Print the rounds per second, the errors and the percentiles of every step, in microseconds
+*/
+void printReport(load_t * load)
+{
+    double seconds = (load->finish - load->start) / 1e9;
+    latency_t * latency = NULL;
+
+    printf("\nSessions: %lld arrived, %lld started, %lld finished\n", load->arrivals, load->started, load->finished);
+    printf("Rounds: %lld in %.2f seconds, %.1f rounds per second\n", load->roundsPlayed, seconds, (seconds > 0) ? load->roundsPlayed / seconds : 0.0);
+    printf("Errors:");
+    for (int i=0; i<ERRORS; i++)
+    {
+        printf(" %s %lld", errorNames[i], load->errors[i]);
+    }
+    printf("\n");
+
+    printf("%-10s %10s %10s %10s %10s %10s %10s\n", "step_us", "count", "mean", "p50", "p99", "p999", "max");
+    for (int step=0; step<STEPS; step++)
+    {
+        latency = &load->steps[step];
+        printf("%-10s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", stepNames[step], latency->count,
+            (latency->count > 0) ? latency->total / 1000.0 / latency->count : 0.0,
+            statsPercentile(latency->buckets, latency->count, latency->max, 0.5) / 1000.0,
+            statsPercentile(latency->buckets, latency->count, latency->max, 0.99) / 1000.0,
+            statsPercentile(latency->buckets, latency->count, latency->max, 0.999) / 1000.0, latency->max / 1000.0);
+    }
+}
@@ -0,0 +1,546 @@
+/*
+    Messages of the server written by a thread of their own
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "logger.h"
+
+// Time the thread of the logger sleeps when there are no messages
+#define LOG_SLEEP_NS 1000000
+
+// Length modifiers of a conversion of printf
+typedef enum {LENGTH_NONE, LENGTH_HH, LENGTH_H, LENGTH_L, LENGTH_LL, LENGTH_Z, LENGTH_J, LENGTH_T, LENGTH_LONG_DOUBLE} log_length_t;
+
+// Names of the levels, as used in the options of the programs
+static const char * levelNames[LOG_LEVELS] = {"debug", "info", "warn", "error"};
+
+log_level_t logLevel = LOG_DEBUG;
+
+// Ring of the current thread, created with its first message
+static __thread log_ring_t * threadRing = NULL;
+// All the rings, new ones are added at the start
+static _Atomic(log_ring_t *) rings = NULL;
+static atomic_int running = 0;
+static pthread_t loggerTid;
+// Counters for the reports, written by the thread of the logger
+static long printed = 0;
+static long reportedDrops = 0;
+
+///// LOCAL FUNCTION DECLARATIONS
+static log_ring_t * createRing();
+static const char * parseConversion(const char * spec, log_length_t * length);
+static int captureArgs(log_record_t * record, const char * format, va_list args);
+static void printRecord(FILE * output, const log_record_t * record);
+static void printArgument(FILE * output, const char * spec, log_length_t length, char conversion, const log_record_t * record, const log_arg_t * arg);
+static int drainRings();
+static long countDropped();
+static void * loggerThread(void * arg);
+
+///// FUNCTION DEFINITIONS
+
+/*
+    Start the thread that prints the messages
+*/
+void startLogger()
+{
+    int status;
+
+    atomic_store(&running, 1);
+    status = pthread_create(&loggerTid, NULL, loggerThread, NULL);
+    if (status != 0)
+    {
+        fprintf(stderr, "ERROR: pthread_create: %s\n", strerror(status));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+    Print all the messages pending and stop the thread of the logger
+    The messages created later are printed immediately
+    Must be called after the other threads stopped creating messages
+*/
+void stopLogger()
+{
+    log_ring_t * ring = NULL;
+
+    atomic_store(&running, 0);
+    pthread_join(loggerTid, NULL);
+    printLoggerStats();
+
+    ring = atomic_exchange(&rings, NULL);
+    while (ring != NULL)
+    {
+        log_ring_t * next = ring->next;
+        free(ring);
+        ring = next;
+    }
+    threadRing = NULL;
+}
+
+/*
+    Get the level with the name indicated: debug, info, warn or error
+    Returns -1 if there is no level with that name
+*/
+int findLogLevel(const char * name)
+{
+    for (int i=0; i<LOG_LEVELS; i++)
+    {
+        if (strcmp(levelNames[i], name) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+    Keep a message to be printed by the thread of the logger
+    Only the values of the arguments are copied; a format that cannot be kept that way
+    is formatted here, in the text of the record
+*/
+void logWrite(log_level_t level, const char * format, ...)
+{
+    log_ring_t * ring = threadRing;
+    log_record_t * record = NULL;
+    struct timespec now;
+    unsigned int head;
+    va_list args;
+    va_list copy;
+
+    if (!atomic_load_explicit(&running, memory_order_acquire))
+    {
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+        return;
+    }
+
+    if (ring == NULL)
+    {
+        ring = createRing();
+    }
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == LOG_RING)
+    {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    record = &ring->records[head & (LOG_RING - 1)];
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    record->time = now.tv_sec * 1000000000ULL + now.tv_nsec;
+    record->level = level;
+    record->format = format;
+
+    va_start(args, format);
+    va_copy(copy, args);
+    if (!captureArgs(record, format, args))
+    {
+        vsnprintf(record->text, LOG_TEXT, format, copy);
+        record->format = NULL;
+    }
+    va_end(copy);
+    va_end(args);
+
+    // Publish the record to the thread of the logger
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/*
+    Print the number of messages printed and dropped
+*/
+void printLoggerStats()
+{
+    int count = 0;
+
+    for (log_ring_t * ring = atomic_load(&rings); ring != NULL; ring = ring->next)
+    {
+        count++;
+    }
+    printf("Logger: %ld messages printed from %d threads, %ld dropped because the ring of the thread was full\n", printed, count, countDropped());
+}
+
+/*
+    Create the ring of the current thread and add it to the list
+*/
+static log_ring_t * createRing()
+{
+    log_ring_t * ring = NULL;
+
+    ring = aligned_alloc(_Alignof (log_ring_t), sizeof (log_ring_t));
+    if (ring == NULL)
+    {
+        perror("ERROR: aligned_alloc");
+        exit(EXIT_FAILURE);
+    }
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->dropped, 0);
+
+    ring->next = atomic_load(&rings);
+    while (!atomic_compare_exchange_weak(&rings, &ring->next, ring));
+
+    threadRing = ring;
+    return ring;
+}
+
+/*
+    Skip the flags, width, precision and length of a conversion, starting after the %
+    Returns the position of the conversion character, or NULL if it cannot be kept in a record
+*/
+static const char * parseConversion(const char * spec, log_length_t * length)
+{
+    while (*spec != '\0' && strchr("-+ #0'", *spec) != NULL)
+    {
+        spec++;
+    }
+    // The widths given as arguments are not supported
+    while (*spec >= '0' && *spec <= '9')
+    {
+        spec++;
+    }
+    if (*spec == '.')
+    {
+        spec++;
+        while (*spec >= '0' && *spec <= '9')
+        {
+            spec++;
+        }
+    }
+
+    *length = LENGTH_NONE;
+    switch (*spec)
+    {
+        case 'h':
+            *length = (spec[1] == 'h') ? LENGTH_HH : LENGTH_H;
+            spec += (spec[1] == 'h') ? 2 : 1;
+            break;
+        case 'l':
+            *length = (spec[1] == 'l') ? LENGTH_LL : LENGTH_L;
+            spec += (spec[1] == 'l') ? 2 : 1;
+            break;
+        case 'q':
+            *length = LENGTH_LL;
+            spec++;
+            break;
+        case 'z':
+            *length = LENGTH_Z;
+            spec++;
+            break;
+        case 'j':
+            *length = LENGTH_J;
+            spec++;
+            break;
+        case 't':
+            *length = LENGTH_T;
+            spec++;
+            break;
+        case 'L':
+            *length = LENGTH_LONG_DOUBLE;
+            spec++;
+            break;
+    }
+
+    if (*spec == '\0' || strchr("diouxXcseEfFgGaAp%", *spec) == NULL)
+    {
+        return NULL;
+    }
+    // Wide characters are not supported
+    if ((*spec == 'c' || *spec == 's') && *length != LENGTH_NONE)
+    {
+        return NULL;
+    }
+    return spec;
+}
+
+/*
+    Copy the values of the arguments of the format to the record, and their strings to its text
+    Returns 0 if the format uses conversions that are not supported, or too many arguments
+*/
+static int captureArgs(log_record_t * record, const char * format, va_list args)
+{
+    log_length_t length;
+    const char * string = NULL;
+    int used = 0;
+    int count = 0;
+    size_t size;
+
+    for (const char * p = format; *p != '\0'; p++)
+    {
+        if (*p != '%')
+        {
+            continue;
+        }
+        p = parseConversion(p + 1, &length);
+        if (p == NULL)
+        {
+            return 0;
+        }
+        if (*p == '%')
+        {
+            continue;
+        }
+        if (count == LOG_MAX_ARGS)
+        {
+            return 0;
+        }
+
+        switch (*p)
+        {
+            case 'd':
+            case 'i':
+                switch (length)
+                {
+                    case LENGTH_L: record->args[count].integer = va_arg(args, long); break;
+                    case LENGTH_LL: record->args[count].integer = va_arg(args, long long); break;
+                    case LENGTH_Z: record->args[count].integer = va_arg(args, ssize_t); break;
+                    case LENGTH_J: record->args[count].integer = va_arg(args, intmax_t); break;
+                    case LENGTH_T: record->args[count].integer = va_arg(args, ptrdiff_t); break;
+                    default: record->args[count].integer = va_arg(args, int); break;
+                }
+                break;
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                switch (length)
+                {
+                    case LENGTH_L: record->args[count].natural = va_arg(args, unsigned long); break;
+                    case LENGTH_LL: record->args[count].natural = va_arg(args, unsigned long long); break;
+                    case LENGTH_Z: record->args[count].natural = va_arg(args, size_t); break;
+                    case LENGTH_J: record->args[count].natural = va_arg(args, uintmax_t); break;
+                    case LENGTH_T: record->args[count].natural = va_arg(args, ptrdiff_t); break;
+                    default: record->args[count].natural = va_arg(args, unsigned int); break;
+                }
+                break;
+            case 'c':
+                record->args[count].integer = va_arg(args, int);
+                break;
+            case 's':
+                string = va_arg(args, const char *);
+                if (string == NULL)
+                {
+                    string = "(null)";
+                }
+                // The strings that do not fit are cut
+                size = strnlen(string, LOG_TEXT - 1 - used);
+                memcpy(record->text + used, string, size);
+                record->text[used + size] = '\0';
+                record->args[count].offset = used;
+                used += size + ((used + size < LOG_TEXT - 1) ? 1 : 0);
+                break;
+            case 'p':
+                record->args[count].pointer = va_arg(args, void *);
+                break;
+            default:
+                record->args[count].real = (length == LENGTH_LONG_DOUBLE) ? (double) va_arg(args, long double) : va_arg(args, double);
+                break;
+        }
+        count++;
+    }
+
+    return 1;
+}
+
+/*
+    Format a record with the values kept
+*/
+static void printRecord(FILE * output, const log_record_t * record)
+{
+    char spec[32];
+    const char * start = NULL;
+    const char * end = NULL;
+    const char * literal = record->format;
+    log_length_t length;
+    int count = 0;
+
+    if (record->format == NULL)
+    {
+        fputs(record->text, output);
+        return;
+    }
+
+    for (const char * p = record->format; *p != '\0'; p++)
+    {
+        if (*p != '%')
+        {
+            continue;
+        }
+        fwrite(literal, 1, p - literal, output);
+
+        start = p;
+        end = parseConversion(p + 1, &length);
+        p = end;
+        literal = end + 1;
+        if (*end == '%')
+        {
+            fputc('%', output);
+            continue;
+        }
+
+        // The same conversion, used with a single argument
+        snprintf(spec, sizeof spec, "%.*s", (int) (end - start + 1), start);
+        printArgument(output, spec, length, *end, record, &record->args[count++]);
+    }
+    fputs(literal, output);
+}
+
+/*
+    Print a single argument with its conversion, passing the value with the type expected
+*/
+static void printArgument(FILE * output, const char * spec, log_length_t length, char conversion, const log_record_t * record, const log_arg_t * arg)
+{
+    switch (conversion)
+    {
+        case 'd':
+        case 'i':
+        case 'c':
+            switch (length)
+            {
+                case LENGTH_L: fprintf(output, spec, (long) arg->integer); break;
+                case LENGTH_LL: fprintf(output, spec, (long long) arg->integer); break;
+                case LENGTH_Z: fprintf(output, spec, (ssize_t) arg->integer); break;
+                case LENGTH_J: fprintf(output, spec, (intmax_t) arg->integer); break;
+                case LENGTH_T: fprintf(output, spec, (ptrdiff_t) arg->integer); break;
+                default: fprintf(output, spec, (int) arg->integer); break;
+            }
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            switch (length)
+            {
+                case LENGTH_L: fprintf(output, spec, (unsigned long) arg->natural); break;
+                case LENGTH_LL: fprintf(output, spec, (unsigned long long) arg->natural); break;
+                case LENGTH_Z: fprintf(output, spec, (size_t) arg->natural); break;
+                case LENGTH_J: fprintf(output, spec, (uintmax_t) arg->natural); break;
+                case LENGTH_T: fprintf(output, spec, (ptrdiff_t) arg->natural); break;
+                default: fprintf(output, spec, (unsigned int) arg->natural); break;
+            }
+            break;
+        case 's':
+            fprintf(output, spec, record->text + arg->offset);
+            break;
+        case 'p':
+            fprintf(output, spec, arg->pointer);
+            break;
+        default:
+            if (length == LENGTH_LONG_DOUBLE)
+            {
+                fprintf(output, spec, (long double) arg->real);
+            }
+            else
+            {
+                fprintf(output, spec, arg->real);
+            }
+            break;
+    }
+}
+
+/*
+    Print all the records in the rings, always taking the oldest first
+    Returns the number of records printed
+*/
+static int drainRings()
+{
+    log_ring_t * oldest = NULL;
+    const log_record_t * record = NULL;
+    const log_record_t * first = NULL;
+    unsigned int tail;
+    long dropped;
+    int count = 0;
+
+    while (1)
+    {
+        oldest = NULL;
+        for (log_ring_t * ring = atomic_load(&rings); ring != NULL; ring = ring->next)
+        {
+            tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+            if (tail == atomic_load_explicit(&ring->head, memory_order_acquire))
+            {
+                continue;
+            }
+            record = &ring->records[tail & (LOG_RING - 1)];
+            if (oldest == NULL || record->time < first->time)
+            {
+                oldest = ring;
+                first = record;
+            }
+        }
+        if (oldest == NULL)
+        {
+            break;
+        }
+
+        printRecord(stdout, first);
+        // Give the record back to the thread
+        atomic_store_explicit(&oldest->tail, atomic_load_explicit(&oldest->tail, memory_order_relaxed) + 1, memory_order_release);
+        count++;
+    }
+
+    dropped = countDropped();
+    if (dropped > reportedDrops)
+    {
+        printf("\nLogger: %ld messages dropped because the ring of the thread was full\n", dropped - reportedDrops);
+        reportedDrops = dropped;
+    }
+    if (count > 0)
+    {
+        printed += count;
+        fflush(stdout);
+    }
+
+    return count;
+}
+
+/*
+    Sum of the messages dropped by all the threads
+*/
+static long countDropped()
+{
+    long dropped = 0;
+
+    for (log_ring_t * ring = atomic_load(&rings); ring != NULL; ring = ring->next)
+    {
+        dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    }
+    return dropped;
+}
+
+/*
+    Function of the thread of the logger
+    Prints the records as they arrive, and sleeps a little when there are none
+*/
+static void * loggerThread(void * arg)
+{
+    struct timespec pause = {0, LOG_SLEEP_NS};
+    int stopping;
+
+    while (1)
+    {
+        // Read the flag before draining, so nothing created before the stop is left
+        stopping = !atomic_load(&running);
+        if (drainRings() == 0)
+        {
+            if (stopping)
+            {
+                break;
+            }
+            nanosleep(&pause, NULL);
+        }
+    }
+
+    pthread_exit(NULL);
+}
@@ -0,0 +1,106 @@
+/*
+    Messages of the server written by a thread of their own
+    The threads that play the games do not format the messages: they copy the format
+    and the values of the arguments to a ring of records of their own, without locks,
+    and the thread of the logger formats and prints them, in the order they were created.
+    When the ring of a thread is full the message is dropped and counted,
+    the game never waits for the output.
+
+    The format is taken like printf, and it must be a literal string,
+    because the record only keeps its address. The strings of the arguments are copied.
+    The messages are filtered by level when they are created, and the debug messages
+    are removed from the program when it is compiled with LOG_NO_DEBUG defined.
+    Without the thread running, the messages are printed immediately.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Records in the ring of every thread, must be a power of 2
+#define LOG_RING 2048
+// Most arguments kept for a message
+#define LOG_MAX_ARGS 12
+// Bytes for the strings of the arguments of a message
+#define LOG_TEXT 120
+
+// Importance of the messages, only the ones at the current level or above are kept
+typedef enum {LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR, LOG_LEVELS} log_level_t;
+
+// A value of an argument, as read from the arguments of the call
+typedef union log_arg_union {
+    long long integer;
+    unsigned long long natural;
+    double real;
+    const void * pointer;
+    // Position of a string in the text of the record
+    int offset;
+} log_arg_t;
+
+// A message waiting to be formatted
+typedef struct log_record_struct {
+    // Nanoseconds of the monotonic clock when the message was created, to print in order
+    uint64_t time;
+    const char * format;
+    log_arg_t args[LOG_MAX_ARGS];
+    unsigned char level;
+    char text[LOG_TEXT];
+} log_record_t;
+
+// Records of a single thread, written only by it and read only by the thread of the logger
+typedef struct log_ring_struct {
+    log_record_t records[LOG_RING];
+    // Next record to write, and next record to read, in different cache lines
+    _Alignas(64) atomic_uint head;
+    _Alignas(64) atomic_uint tail;
+    atomic_long dropped;
+    // Link of the list of all the rings
+    struct log_ring_struct * next;
+} log_ring_t;
+
+// Lowest level of the messages kept, can be changed at any time
+extern log_level_t logLevel;
+
+// Build with LOG_NO_DEBUG defined to remove the debug messages completely
+#ifdef LOG_NO_DEBUG
+#define logDebug(...) ((void) 0)
+#else
+#define logDebug(...) do { if (logLevel <= LOG_DEBUG) { logWrite(LOG_DEBUG, __VA_ARGS__); } } while (0)
+#endif
+#define logInfo(...) do { if (logLevel <= LOG_INFO) { logWrite(LOG_INFO, __VA_ARGS__); } } while (0)
+#define logWarn(...) do { if (logLevel <= LOG_WARN) { logWrite(LOG_WARN, __VA_ARGS__); } } while (0)
+#define logError(...) do { if (logLevel <= LOG_ERROR) { logWrite(LOG_ERROR, __VA_ARGS__); } } while (0)
+
+/*
+    Start the thread that prints the messages
+*/
+void startLogger();
+
+/*
+    Print all the messages pending and stop the thread of the logger
+    The messages created later are printed immediately
+*/
+void stopLogger();
+
+/*
+    Get the level with the name indicated: debug, info, warn or error
+    Returns -1 if there is no level with that name
+*/
+int findLogLevel(const char * name);
+
+/*
+    Keep a message to be printed by the thread of the logger
+    Use the macros of every level instead, to skip the messages filtered without a call
+*/
+void logWrite(log_level_t level, const char * format, ...) __attribute__((format(printf, 2, 3)));
+
+/*
+    Print the number of messages printed and dropped
+*/
+void printLoggerStats();
+
+#endif
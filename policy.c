@@ -0,0 +1,134 @@
+/*
+    Decisions of a player that plays without a person
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "policy.h"
+
+// A policy and the name used to choose it
+typedef struct policy_entry_struct {
+    const char * name;
+    const char * description;
+    policy_t policy;
+} policy_entry_t;
+
+static const policy_entry_t policies[] = {
+    {"basic", "basic strategy against the up card of the dealer", basicPolicy},
+    {"dealer", "hit until reaching 17, like the dealer", dealerPolicy},
+    {"cautious", "never hit with 12 or more", cautiousPolicy},
+    {"table", "decisions of the table created by the solver", tablePolicy},
+};
+
+// Table of the table policy, mapped by the program
+static const strategy_file_t * currentStrategy = NULL;
+
+#define NUM_POLICIES (int) (sizeof policies / sizeof policies[0])
+
+///// FUNCTION DEFINITIONS
+
+/*
+    Get the policy with the name indicated
+    Returns NULL if there is no policy with that name
+*/
+policy_t findPolicy(const char * name)
+{
+    for (int i=0; i<NUM_POLICIES; i++)
+    {
+        if (strcmp(policies[i].name, name) == 0)
+        {
+            return policies[i].policy;
+        }
+    }
+    return NULL;
+}
+
+/*
+    Print the names of the policies available, with a short description
+*/
+void printPolicies()
+{
+    for (int i=0; i<NUM_POLICIES; i++)
+    {
+        printf("\t\t%s: %s\n", policies[i].name, policies[i].description);
+    }
+}
+
+/*
+    Take cards with the rules of the dealer: hit until reaching 17
+*/
+code_t dealerPolicy(const game_t * game)
+{
+    return (handTotal(&game->player) < 17) ? HIT : STAND;
+}
+
+/*
+    Never risk busting: stay with 12 or more
+*/
+code_t cautiousPolicy(const game_t * game)
+{
+    return (handTotal(&game->player) < 12) ? HIT : STAND;
+}
+
+/*
+    Basic strategy for hitting or standing, using the up card of the dealer
+    The game has no doubling or splitting, so only the totals matter
+*/
+code_t basicPolicy(const game_t * game)
+{
+    int total = handTotal(&game->player);
+    // Value of the up card of the dealer, with the ace as 11
+    int up = cardValues[game->dealer.cards[0]];
+
+    if (up == 1)
+    {
+        up = 11;
+    }
+
+    if (isSoft(&game->player))
+    {
+        // Soft 18 only stays against a weak up card
+        if (total == 18)
+        {
+            return (up >= 9) ? HIT : STAND;
+        }
+        return (total < 18) ? HIT : STAND;
+    }
+
+    if (total <= 11)
+    {
+        return HIT;
+    }
+    if (total == 12)
+    {
+        return (up >= 4 && up <= 6) ? STAND : HIT;
+    }
+    if (total <= 16)
+    {
+        return (up <= 6) ? STAND : HIT;
+    }
+    return STAND;
+}
+
+/*
+    Set the table used by the table policy
+*/
+void useStrategy(const strategy_file_t * strategy)
+{
+    currentStrategy = strategy;
+}
+
+/*
+    Decisions of the table created by the solver, or basic strategy if no table was set
+*/
+code_t tablePolicy(const game_t * game)
+{
+    if (currentStrategy == NULL)
+    {
+        return basicPolicy(game);
+    }
+    return strategyDecision(currentStrategy, game);
+}
@@ -0,0 +1,54 @@
+/*
+    Decisions of a player that plays without a person
+    A policy looks at the game and tells if the player takes another card (HIT) or stays (STAND).
+    They are used by the simulation to measure the results of the rules of the table.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#ifndef POLICY_H
+#define POLICY_H
+
+#include "blackjack.h"
+#include "strategy.h"
+
+// Function that decides the next move of the player: HIT or STAND
+typedef code_t (* policy_t)(const game_t * game);
+
+/*
+    Get the policy with the name indicated
+    Returns NULL if there is no policy with that name
+*/
+policy_t findPolicy(const char * name);
+
+/*
+    Print the names of the policies available, with a short description
+*/
+void printPolicies();
+
+/*
+    Take cards with the rules of the dealer: hit until reaching 17
+*/
+code_t dealerPolicy(const game_t * game);
+
+/*
+    Never risk busting: stay with 12 or more
+*/
+code_t cautiousPolicy(const game_t * game);
+
+/*
+    Basic strategy for hitting or standing, using the up card of the dealer
+*/
+code_t basicPolicy(const game_t * game);
+
+/*
+    Set the table used by the table policy
+*/
+void useStrategy(const strategy_file_t * strategy);
+
+/*
+    Decisions of the table created by the solver, or basic strategy if no table was set
+*/
+code_t tablePolicy(const game_t * game);
+
+#endif
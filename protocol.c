@@ -0,0 +1,343 @@
+/*
+    Compact binary protocol between the client and the server
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "blackjack.h"
+#include "protocol.h"
+#include "sockets.h"
+
+///// LOCAL FUNCTION DECLARATIONS
+static unsigned char * putInt(unsigned char * buffer, int value);
+static int getInt(const unsigned char * buffer);
+static int payloadSize(int type, int length, const unsigned char * payload);
+
+///// FUNCTION DEFINITIONS
+
+/*
+    Write in the buffer the frame of the type indicated, using the data in the message
+    Used by the client, the server builds its frames from the game, except BUSY
+    Returns the number of bytes written
+*/
+int encodeFrame(unsigned char * buffer, int type, int version, const message_t * message)
+{
+    unsigned char * payload = buffer + FRAME_HEADER;
+    unsigned char * end = payload;
+
+    switch (type)
+    {
+        case FRAME_HELLO:
+            *end++ = version;
+            if (version >= PROTOCOL_QUICK_START)
+            {
+                end = putInt(end, message->playerAmount);
+                end = putInt(end, message->playerBet);
+            }
+            break;
+        case FRAME_AMOUNT:
+            end = putInt(end, message->playerAmount);
+            break;
+        case FRAME_BET:
+            end = putInt(end, message->playerBet);
+            break;
+        case FRAME_BUSY:
+            end = putInt(end, message->playerAmount);
+            break;
+        default:
+            // HIT, STAND and BYE have no payload
+            break;
+    }
+
+    buffer[0] = type;
+    buffer[1] = end - payload;
+
+    return end - buffer;
+}
+
+/*
+    Write in the buffer the frame of the type indicated, using the state of the game
+    The cards are sent with the same byte used by the server
+    Returns the number of bytes written
+*/
+int encodeGameFrame(unsigned char * buffer, int type, int version, const struct game_struct * game)
+{
+    unsigned char * payload = buffer + FRAME_HEADER;
+    unsigned char * end = payload;
+
+    switch (type)
+    {
+        case FRAME_WELCOME:
+            *end++ = version;
+            break;
+        case FRAME_START:
+            end = putInt(end, game->playerAmount);
+            break;
+        case FRAME_DEAL:
+            *end++ = game->player.cards[0];
+            *end++ = game->player.cards[1];
+            *end++ = game->dealer.cards[0];
+            *end++ = handTotal(&game->player);
+            *end++ = game->playerStatus;
+            *end++ = game->dealerStatus;
+            // The card faced-down is only shown when the round finishes with a natural
+            if ((game->playerStatus == NATURAL) || (game->dealerStatus == NATURAL))
+            {
+                *end++ = game->dealer.cards[1];
+                *end++ = handTotal(&game->dealer);
+            }
+            break;
+        case FRAME_CARD:
+            *end++ = game->player.cards[game->player.numCards - 1];
+            *end++ = handTotal(&game->player);
+            *end++ = game->playerStatus;
+            break;
+        case FRAME_RESULT:
+            // Only the cards of the dealer after the up card are unknown to the client
+            *end++ = game->dealer.numCards - 1;
+            for (int i=1; i<game->dealer.numCards; i++)
+            {
+                *end++ = game->dealer.cards[i];
+            }
+            *end++ = handTotal(&game->dealer);
+            *end++ = game->playerStatus;
+            *end++ = game->dealerStatus;
+            end = putInt(end, game->playerAmount);
+            break;
+        default:
+            // BYE has no payload
+            break;
+    }
+
+    buffer[0] = type;
+    buffer[1] = end - payload;
+
+    return end - buffer;
+}
+
+/*
+    Get the size of the complete frame at the start of the buffer
+    Returns 0 if the bytes available do not complete the frame yet
+*/
+int frameLength(const unsigned char * buffer, int available)
+{
+    if (available < FRAME_HEADER || available < FRAME_HEADER + buffer[1])
+    {
+        return 0;
+    }
+    return FRAME_HEADER + buffer[1];
+}
+
+/*
+    Update the message with the data of a complete frame
+    Returns the type of the frame, or -1 if the frame is too short for its type
+*/
+int decodeFrame(const unsigned char * buffer, message_t * message)
+{
+    const unsigned char * payload = buffer + FRAME_HEADER;
+    int type = buffer[0];
+    int count;
+
+    if (buffer[1] < payloadSize(type, buffer[1], payload))
+    {
+        return -1;
+    }
+
+    switch (type)
+    {
+        case FRAME_HELLO:
+            message->msg_code = PLAY;
+            // The amount and the first bet, sent since the version 2
+            if (buffer[1] >= 1 + 4 + 4)
+            {
+                message->playerAmount = getInt(payload + 1);
+                message->playerBet = getInt(payload + 5);
+            }
+            break;
+        case FRAME_AMOUNT:
+            message->msg_code = AMOUNT;
+            message->playerAmount = getInt(payload);
+            break;
+        case FRAME_BET:
+            message->msg_code = BET;
+            message->playerBet = getInt(payload);
+            break;
+        case FRAME_HIT:
+            message->playerStatus = HIT;
+            break;
+        case FRAME_STAND:
+            message->playerStatus = STAND;
+            break;
+        case FRAME_WELCOME:
+            message->msg_code = AMOUNT;
+            break;
+        case FRAME_START:
+            message->playerAmount = getInt(payload);
+            message->playerStatus = START;
+            message->dealerStatus = START;
+            break;
+        case FRAME_DEAL:
+            message->numPlayerCards = 2;
+            strcpy(message->playerCards[0], cardName(payload[0]));
+            strcpy(message->playerCards[1], cardName(payload[1]));
+            message->numDealerCards = 1;
+            strcpy(message->dealerCards[0], cardName(payload[2]));
+            message->totalPlayer = payload[3];
+            message->playerStatus = payload[4];
+            message->dealerStatus = payload[5];
+            if (buffer[1] >= 8)
+            {
+                message->numDealerCards = 2;
+                strcpy(message->dealerCards[1], cardName(payload[6]));
+                message->totalDealer = payload[7];
+            }
+            break;
+        case FRAME_CARD:
+            if (message->numPlayerCards < MAXCARDS)
+            {
+                strcpy(message->playerCards[message->numPlayerCards], cardName(payload[0]));
+                message->numPlayerCards++;
+            }
+            message->totalPlayer = payload[1];
+            message->playerStatus = payload[2];
+            break;
+        case FRAME_RESULT:
+            count = payload[0];
+            if (count > MAXCARDS - 1)
+            {
+                return -1;
+            }
+            for (int i=0; i<count; i++)
+            {
+                strcpy(message->dealerCards[i + 1], cardName(payload[1 + i]));
+            }
+            message->numDealerCards = count + 1;
+            payload += count + 1;
+            message->totalDealer = payload[0];
+            message->playerStatus = payload[1];
+            message->dealerStatus = payload[2];
+            message->playerAmount = getInt(payload + 3);
+            break;
+        case FRAME_BYE:
+            message->msg_code = BYE;
+            break;
+        case FRAME_BUSY:
+            message->msg_code = BUSY;
+            message->playerAmount = getInt(payload);
+            break;
+        default:
+            return -1;
+    }
+
+    return type;
+}
+
+/*
+    Get the version of the protocol requested in a HELLO frame
+*/
+int frameVersion(const unsigned char * buffer)
+{
+    return (buffer[1] >= 1) ? buffer[FRAME_HEADER] : 0;
+}
+
+/*
+    Send the message to the other side, with the protocol used in the connection
+*/
+void sendMessage(int connection_fd, int protocol, int type, message_t * message)
+{
+    unsigned char frame[MAX_FRAME];
+    int length;
+
+    if (protocol == PROTOCOL_LEGACY)
+    {
+        sendData(connection_fd, message, sizeof (*message));
+        return;
+    }
+
+    length = encodeFrame(frame, type, protocol, message);
+    sendData(connection_fd, frame, length);
+}
+
+/*
+    Receive the next message, with the protocol used in the connection
+    Returns 1 on successful receipt, or 0 if the connection has finished
+*/
+int receiveMessage(int connection_fd, int protocol, message_t * message)
+{
+    unsigned char frame[MAX_FRAME];
+
+    if (protocol == PROTOCOL_LEGACY)
+    {
+        return recvData(connection_fd, message, sizeof (*message));
+    }
+
+    if (!recvData(connection_fd, frame, FRAME_HEADER))
+    {
+        return 0;
+    }
+    if (frame[1] > 0 && !recvData(connection_fd, frame + FRAME_HEADER, frame[1]))
+    {
+        return 0;
+    }
+    if (decodeFrame(frame, message) == -1)
+    {
+        printf("Invalid frame received\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+    Write an integer in network byte order
+    Returns the position after the integer
+*/
+static unsigned char * putInt(unsigned char * buffer, int value)
+{
+    unsigned int bits = value;
+
+    buffer[0] = bits >> 24;
+    buffer[1] = bits >> 16;
+    buffer[2] = bits >> 8;
+    buffer[3] = bits;
+
+    return buffer + 4;
+}
+
+/*
+    Read an integer in network byte order
+*/
+static int getInt(const unsigned char * buffer)
+{
+    return (int) (((unsigned int) buffer[0] << 24) | ((unsigned int) buffer[1] << 16) | ((unsigned int) buffer[2] << 8) | buffer[3]);
+}
+
+/*
+    Smallest payload valid for every type of frame
+*/
+static int payloadSize(int type, int length, const unsigned char * payload)
+{
+    switch (type)
+    {
+        case FRAME_HELLO:
+        case FRAME_WELCOME:
+            return 1;
+        case FRAME_AMOUNT:
+        case FRAME_START:
+        case FRAME_BET:
+        case FRAME_BUSY:
+            return 4;
+        case FRAME_DEAL:
+            return 6;
+        case FRAME_CARD:
+            return 3;
+        case FRAME_RESULT:
+            // The number of cards is only read if the payload has at least one byte
+            return 1 + 3 + 4 + ((length >= 1) ? payload[0] : 0);
+        default:
+            return 0;
+    }
+}
@@ -0,0 +1,108 @@
+/*
+    Compact binary protocol between the client and the server
+    Instead of sending the whole message_t structure, every step sends a small frame:
+        [type: 1 byte][length of the payload: 1 byte][payload]
+    The frames only contain what changed in the step, the cards use a single byte (see cards.h),
+    and the numbers are written in network byte order,
+    so the protocol does not depend on the padding or endianness of the structures.
+
+    The client asks for the compact protocol by sending a HELLO frame instead of PLAY.
+    The type of every frame is 0x80 or more, while the first byte of a PLAY message is 0,
+    so the server can still attend the clients that send the original messages.
+
+    Since the version 2 the HELLO also carries the starting amount and the first bet,
+    and the server answers WELCOME, START and the first DEAL together, so the first hand
+    arrives after a single round trip instead of three. A server of the version 1 ignores
+    them and answers only WELCOME with its version, and the client continues with AMOUNT and BET.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include "codes.h"
+
+// State of a game, defined in blackjack.h
+struct game_struct;
+
+// Newest version of the compact protocol known by this program
+#define PROTOCOL_VERSION 2
+// First version where the HELLO has the amount and the first bet
+#define PROTOCOL_QUICK_START 2
+// Values used for the protocol of a connection
+#define PROTOCOL_UNKNOWN -1
+#define PROTOCOL_LEGACY 0
+
+// Bytes used by the header of a frame
+#define FRAME_HEADER 2
+// Largest size of a complete frame
+#define MAX_FRAME (FRAME_HEADER + 255)
+
+// Types of frames. The names indicate the code_t equivalent in the original protocol
+typedef enum {
+    // Sent by the client
+    FRAME_HELLO = 0x80, // PLAY, with the version wanted by the client, and the amount and first bet since the version 2
+    FRAME_AMOUNT,       // AMOUNT, with the starting amount of chips
+    FRAME_BET,          // BET, with the amount to bet
+    FRAME_HIT,          // The player wants another card
+    FRAME_STAND,        // The player stays with the current cards
+    // Sent by the server
+    FRAME_WELCOME,      // AMOUNT, with the version accepted by the server
+    FRAME_START,        // START, with the amount accepted
+    FRAME_DEAL,         // The first cards of the round and the status of both hands
+    FRAME_CARD,         // The player drew a card, with the new total and status
+    FRAME_RESULT,       // The cards of the dealer after the up card, the totals and the new amount
+    // Sent by both
+    FRAME_BYE,
+    // Sent by the server instead of WELCOME when it can not take the client, with the seconds to wait before trying again
+    FRAME_BUSY
+} frame_type_t;
+
+/*
+    Write in the buffer the frame of the type indicated, using the data in the message
+    Used by the client, the server builds its frames from the game, except BUSY
+    The buffer must have space for MAX_FRAME bytes
+    Returns the number of bytes written
+*/
+int encodeFrame(unsigned char * buffer, int type, int version, const message_t * message);
+
+/*
+    Write in the buffer the frame of the type indicated, using the state of the game
+    The cards are sent with the same byte used by the server
+    The buffer must have space for MAX_FRAME bytes
+    Returns the number of bytes written
+*/
+int encodeGameFrame(unsigned char * buffer, int type, int version, const struct game_struct * game);
+
+/*
+    Get the size of the complete frame at the start of the buffer
+    Returns 0 if the bytes available do not complete the frame yet
+*/
+int frameLength(const unsigned char * buffer, int available);
+
+/*
+    Update the message with the data of a complete frame
+    Returns the type of the frame
+*/
+int decodeFrame(const unsigned char * buffer, message_t * message);
+
+/*
+    Get the version of the protocol requested in a HELLO frame
+*/
+int frameVersion(const unsigned char * buffer);
+
+/*
+    Send the message to the other side, with the protocol used in the connection
+    Legacy connections send the whole structure, the others send a frame of the type indicated
+*/
+void sendMessage(int connection_fd, int protocol, int type, message_t * message);
+
+/*
+    Receive the next message, with the protocol used in the connection
+    Compact frames only update the fields of the message that they contain
+    Returns 1 on successful receipt, or 0 if the connection has finished
+*/
+int receiveMessage(int connection_fd, int protocol, message_t * message);
+
+#endif
@@ -0,0 +1,91 @@
+/*
+    Random number generator used to deal the cards
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <time.h>
+#include <unistd.h>
+
+#include "rng.h"
+
+///// LOCAL FUNCTION DECLARATIONS
+static uint64_t splitMix(uint64_t * value);
+
+///// FUNCTION DEFINITIONS
+
+/*
+    Get a master seed that changes every time the program runs
+*/
+uint64_t randomSeed()
+{
+    struct timespec now;
+    uint64_t value;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    value = ((uint64_t) now.tv_sec << 32) ^ (uint64_t) now.tv_nsec ^ ((uint64_t) getpid() << 16);
+
+    return splitMix(&value);
+}
+
+/*
+    Prepare the generator for the stream indicated of a master seed
+    The state is filled with SplitMix64, starting from a value different for every stream
+*/
+void seedRandom(rng_t * rng, uint64_t seed, uint64_t stream)
+{
+    uint64_t value = seed ^ (stream * 0xD1B54A32D192ED03ULL);
+
+    rng->seed = seed;
+    rng->stream = stream;
+    // Mix the stream first, so consecutive streams start far apart
+    splitMix(&value);
+    for (int i=0; i<4; i++)
+    {
+        rng->state[i] = splitMix(&value);
+    }
+}
+
+/*
+    Create in child a generator independent of the parent
+    The parent advances 2^128 values, so the sequences of both never overlap
+*/
+void splitRandom(rng_t * parent, rng_t * child)
+{
+    static const uint64_t jump[4] = {0x180EC6D33CFD0ABAULL, 0xD5A61266F0C9392CULL, 0xA9582618E03FC9AAULL, 0x39ABDC4529B1661CULL};
+    uint64_t state[4] = {0, 0, 0, 0};
+
+    *child = *parent;
+
+    for (int i=0; i<4; i++)
+    {
+        for (int bit=0; bit<64; bit++)
+        {
+            if (jump[i] & ((uint64_t) 1 << bit))
+            {
+                for (int j=0; j<4; j++)
+                {
+                    state[j] ^= parent->state[j];
+                }
+            }
+            nextRandom(parent);
+        }
+    }
+
+    for (int j=0; j<4; j++)
+    {
+        parent->state[j] = state[j];
+    }
+}
+
+/*
+    Advance the value and get the next number of a SplitMix64 sequence
+*/
+static uint64_t splitMix(uint64_t * value)
+{
+    uint64_t result = (*value += 0x9E3779B97F4A7C15ULL);
+
+    result = (result ^ (result >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    result = (result ^ (result >> 27)) * 0x94D049BB133111EBULL;
+    return result ^ (result >> 31);
+}
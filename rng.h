@@ -0,0 +1,85 @@
+/*
+    Random number generator used to deal the cards
+    Every game has its own xoshiro256** generator, so no lock is shared between threads.
+    A generator is identified by a master seed and a stream number:
+    the same pair always produces the same sequence, so any round can be reproduced,
+    and different streams of the same seed give independent sequences.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+// State of a single generator
+typedef struct rng_struct {
+    uint64_t state[4];
+    // Values used to create the generator, kept to reproduce its sequence
+    uint64_t seed;
+    uint64_t stream;
+} rng_t;
+
+/*
+    Get a master seed that changes every time the program runs
+*/
+uint64_t randomSeed();
+
+/*
+    Prepare the generator for the stream indicated of a master seed
+*/
+void seedRandom(rng_t * rng, uint64_t seed, uint64_t stream);
+
+/*
+    Create in child a generator independent of the parent
+    The parent advances 2^128 values, so the sequences of both never overlap
+*/
+void splitRandom(rng_t * parent, rng_t * child);
+
+static inline uint64_t rotateLeft(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+/*
+    Get the next 64 random bits of the generator
+*/
+static inline uint64_t nextRandom(rng_t * rng)
+{
+    uint64_t * s = rng->state;
+    uint64_t result = rotateLeft(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotateLeft(s[3], 45);
+
+    return result;
+}
+
+/*
+    Get a random number from 0 to limit - 1, with the same probability for every value
+    Uses a multiplication instead of a division, and only retries in the rare biased cases
+*/
+static inline uint32_t randomBelow(rng_t * rng, uint32_t limit)
+{
+    uint64_t product = (nextRandom(rng) >> 32) * limit;
+    uint32_t threshold;
+
+    if ((uint32_t) product < limit)
+    {
+        threshold = -limit % limit;
+        while ((uint32_t) product < threshold)
+        {
+            product = (nextRandom(rng) >> 32) * limit;
+        }
+    }
+
+    return product >> 32;
+}
+
+#endif
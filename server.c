@@ -1,156 +1,375 @@
 /*
-    Program for a simple bank server
+    Program for the blackjack server
     It uses sockets and threads
-    The server will process simple transactions on a limited number of accounts
+    The chips of the players can be recorded in a durable ledger
 
     Raziel Nicolás Martínez Castillo A01410695
 */
 
+// Needed for the affinity of the threads
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <time.h>
 // Signals library
 #include <errno.h>
 #include <signal.h>
 // Sockets libraries
 #include <netdb.h>
 #include <sys/poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 // Posix threads library
 #include <pthread.h>
 
 // Custom libraries
 #include "codes.h"
 #include "sockets.h"
-
-#define MAX_ACCOUNTS 5
-#define BUFFER_SIZE 1024
-#define MAX_QUEUE 5
-#define MAX_PLAYERS 8
+#include "session.h"
+#include "workers.h"
+#include "rng.h"
+#include "shoe.h"
+#include "table.h"
+#include "ledger.h"
+#include "logger.h"
+#include "stats.h"
+#include "slab.h"
+#include "wheel.h"
+#include "policy.h"
+#include "uring.h"
+
+#define MAX_EVENTS 64
+// The unsharded server, with a single listening socket
+#define NO_SHARD -1
+// Streams of the master seed used to get the seed of every shard
+#define SHARD_STREAMS 0x2000000000000000ULL
+// Data of the requests of the ring that are not of a session, lower than the address of any session
+#define RING_ACCEPT 1
+#define RING_STATS 2
+#define RING_WAKE 3
+#define RING_CANCEL 4
+// Requests of a session use its address, with the lowest bit set for the wait to write
+#define RING_WRITABLE 1
+// Shoes kept shuffled in advance
+#define SPARE_SHOES 2
 
 ///// Structure definitions
 
-// Data for a single bank account
-typedef struct account_struct {
+// Parameters of the server, chosen with the options of the program
+typedef struct options_struct {
+    int num_workers;
+    uint64_t seed;
+    int decks;
+    int penetration;
+    int seats;
+    const char * ledgerPrefix;
+    const char * statsPath;
+    // Most sessions kept in memory at the same time, 0 for no limit
+    long maxSessions;
+    int hugePages;
+    // Bytes of the stacks of the workers, 0 for the default of the system
+    size_t stackSize;
+    // Time allowed to the clients in every phase, and the decisions taken when they do not decide
+    session_limits_t limits;
+    // Use io_uring instead of epoll, when the system supports it
+    int useRing;
+    // Connections waiting to be accepted by every listening socket
+    int backlog;
+    // Listening sockets on the same port, each attended by its own shard, 0 for a single one without shards
+    int shards;
+    // Keep every shard in its own processor
+    int pinShards;
+    // Most sessions playing and in the handshake at the same time, the new clients above them are
+    // answered with BUSY, 0 for no limit
+    long maxPlayers;
+    long maxHandshakes;
+    // Seconds that the clients refused are told to wait before trying again
+    int retryAfter;
+    // Nanoseconds that the sessions can wait for a worker before the new clients are refused, 0 to ignore it
+    uint64_t overloadLag;
+} options_t;
+
+// A listening socket and the thread that attends its connections, with its own event loop,
+// workers, tables, shoes and memory for the sessions
+typedef struct shard_struct {
     int id;
-    int pin;
-    float balance;
-} account_t;
-
-// Data for the bank operations
-typedef struct bank_struct {
-    // Store the total number of operations performed
-    int total_transactions;
-    // An array of the accounts
-    account_t * account_array;
-} bank_t;
-
-// Structure for the mutexes to keep the data consistent
-typedef struct locks_struct {
-    // Mutex for the number of transactions variable
-    pthread_mutex_t transactions_mutex;
-    // Mutex array for the operations on the accounts
-    pthread_mutex_t * account_mutex;
-} locks_t;
-
-// // Data that will be sent to each thread
-// typedef struct data_struct {
-//     // The file descriptor for the socket
-//     int connection_fd;
-//     // A pointer to a bank data structure
-//     bank_t * bank_data;
-//     // A pointer to a locks structure
-//     locks_t * data_locks;
-// } thread_data_t;
-
-typedef struct viuda_struct {
-
-    int bet;
-    int betAgreement;
-    int lowestAmount;
-
-} viuda_t;
-
-// Data that will be sent to each thread
-typedef struct data_struct {
-    // The file descriptor for the socket
-    message_t message;
-    int connection_fd;
-    int connectionNumber;
-    int player;
-    int agreeBet;
-    int prize; //The amount to give to the winner
-    // // A pointer to a bank data structure
-    // bank_t * bank_data;
-    viuda_t * viuda_data;
-    // // A pointer to a locks structure
-    // locks_t * data_locks;
-} thread_data_t;
+    pthread_t tid;
+    int server_fd;
+    const options_t * options;
+    // Shared by all the shards, the chips of a player are recorded in the same file
+    ledger_t * ledger;
+} shard_t;
 
+// Data of the event loop, shared with the workers that attend the sessions
+typedef struct server_struct {
+    int server_fd;
+    int epoll_fd;
+    pool_t * pool;
+    int connectionsNum;
+    // Master seed of the generators of the sessions
+    uint64_t seed;
+    // Owner of the shoes used by all the sessions
+    shuffler_t * shuffler;
+    // Tables where the players of the sessions are seated
+    tables_t * tables;
+    // Record of the chips of the players, NULL when it is not kept
+    ledger_t * ledger;
+    // Unix socket where the stats are read, -1 without it
+    int stats_fd;
+    // Memory of the sessions, only used by the event loop
+    slab_t * sessions;
+    // Deadlines of the sessions, expired by the event loop
+    const session_limits_t * limits;
+    // Ring used instead of epoll, NULL when epoll is used
+    ring_t * ring;
+    // Counter written by the workers to wake up the ring, and the sessions waiting to write
+    int wake_fd;
+    uint64_t wakeCount;
+    pthread_mutex_t writers_mutex;
+    session_t * writers;
+    // Sessions finished by the workers, to be freed by the event loop
+    pthread_mutex_t graveyard_mutex;
+    session_t * graveyard;
+    // Sessions not finished yet, only used by the event loop
+    session_t * live;
+    // Admission of the new clients: the sessions admitted, the ones among them in the handshake,
+    // and the limits of the options
+    const options_t * options;
+    long players;
+    atomic_long handshakes;
+    // Time waited by the sessions for a worker since the last check, added by the workers,
+    // and the average of the last checks, in nanoseconds
+    atomic_ullong lagTotal;
+    atomic_ullong lagCount;
+    uint64_t lag;
+    uint64_t lagChecked;
+    // The workers are late, the new clients are refused until they catch up
+    int shedding;
+    long long refused;
+} server_t;
 
 // Global variables for signal handlers
 int interrupt_exit = 0;
+// Number of reports requested, every thread that prints a part of them keeps the last one printed
+int report_stats = 0;
 
 
 ///// FUNCTION DECLARATIONS
 void usage(char * program);
 void setupHandlers();
 void detectInterruption(int signal);
-void initBank(bank_t * bank_data, locks_t * data_locks);
-void readBankFile(bank_t * bank_data);
-// void waitForConnections(int server_fd, bank_t * bank_data, locks_t * data_locks);
-void waitForConnections(int server_fd, viuda_t * viuda_data);
-void * attentionThread(void * arg);
-void closeBank(bank_t * bank_data, locks_t * data_locks);
-int checkValidAccount(int account);
-void storeChanges(bank_t * bank_data);
-void completeFirstDeal(message_t * message, int connection_fd);
-/*
-    TODO: Add your function declarations here
-*/
-void calculateResults(message_t * message);
-void dealerTurn(message_t * message, int connection_fd);
-void playerTurn(message_t * message, int connection_fd);
-int getRandomCard(message_t * message, char pord);
+void detectReport(int signal);
+void serveShards(char * port, const options_t * options, ledger_t * ledger);
+void * runShard(void * arg);
+void pinThread(int shard);
+void waitForConnections(int server_fd, const options_t * options, int shard, ledger_t * ledger);
+void printServerStats(ledger_t * ledger);
+void watchEpoll(server_t * server);
+int attendEvents(server_t * server, int timeout);
+void watchRing(server_t * server);
+int attendCompletions(server_t * server, int timeout);
+void attendCompletion(server_t * server, struct io_uring_cqe * cqe);
+void startSession(server_t * server, int client_fd);
+void admitConnection(server_t * server, session_t * session);
+void checkOverload(server_t * server);
+void printAdmissionStats(server_t * server);
+void receiveData(server_t * server, session_t * session, struct io_uring_cqe * cqe);
+void watchOutput(server_t * server, session_t * session);
+void watchWriters(server_t * server);
+void acceptConnections(server_t * server);
+void scheduleSession(server_t * server, session_t * session);
+void wakeSession(session_t * session);
+void expireSession(void * data);
+void runSession(void * item);
+int attendSession(session_t * session);
+void buryDeadSessions(server_t * server);
+void addLiveSession(server_t * server, session_t * session);
+void removeLiveSession(server_t * server, session_t * session);
+void closeLiveSessions(server_t * server);
 
 
 ///// MAIN FUNCTION
 int main(int argc, char * argv[])
 {
     int server_fd;
-    // bank_t bank_data;
-    // locks_t data_locks;
-
-    viuda_t viuda_data;
+    options_t options;
+    ledger_t * ledger = NULL;
+    const strategy_file_t * strategy = NULL;
+    sigset_t signal_mask;
+    sigset_t previous_mask;
+    int level;
+    int option;
+
+    bzero(&options, sizeof options);
+    options.seed = randomSeed();
+    options.decks = 6;
+    options.penetration = 75;
+    options.seats = MAX_SEATS;
+    options.limits.handshake = 10000;
+    options.limits.bet = 60000;
+    options.limits.decision = 30000;
+    options.backlog = SOMAXCONN;
+    options.retryAfter = 5;
 
     printf("\n=== SERVER PROGRAM ===\n");
 
     // Check the correct arguments
-    if (argc != 2)
+    while ((option = getopt(argc, argv, "w:s:d:p:T:l:L:S:M:Hk:I:B:D:A:F:Uq:C:aP:W:r:O:")) != -1)
+    {
+        switch (option)
+        {
+            case 'w':
+                options.num_workers = atoi(optarg);
+                break;
+            case 's':
+                options.seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'd':
+                options.decks = atoi(optarg);
+                break;
+            case 'p':
+                options.penetration = atoi(optarg);
+                break;
+            case 'T':
+                options.seats = atoi(optarg);
+                break;
+            case 'l':
+                options.ledgerPrefix = optarg;
+                break;
+            case 'S':
+                options.statsPath = optarg;
+                break;
+            case 'M':
+                options.maxSessions = atol(optarg);
+                break;
+            case 'H':
+                options.hugePages = 1;
+                break;
+            case 'k':
+                options.stackSize = atol(optarg) * 1024;
+                break;
+            case 'I':
+                options.limits.handshake = atof(optarg) * 1000;
+                break;
+            case 'B':
+                options.limits.bet = atof(optarg) * 1000;
+                break;
+            case 'D':
+                options.limits.decision = atof(optarg) * 1000;
+                break;
+            case 'U':
+                options.useRing = 1;
+                break;
+            case 'q':
+                options.backlog = atoi(optarg);
+                break;
+            case 'C':
+                options.shards = atoi(optarg);
+                break;
+            case 'a':
+                options.pinShards = 1;
+                break;
+            case 'P':
+                options.maxPlayers = atol(optarg);
+                break;
+            case 'W':
+                options.maxHandshakes = atol(optarg);
+                break;
+            case 'r':
+                options.retryAfter = atoi(optarg);
+                break;
+            case 'O':
+                options.overloadLag = atof(optarg) * 1000000;
+                break;
+            case 'A':
+                options.limits.policy = findPolicy(optarg);
+                if (options.limits.policy == NULL)
+                {
+                    printf("Unknown policy: %s\n", optarg);
+                    printPolicies();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'F':
+                strategy = loadStrategy(optarg);
+                if (strategy == NULL)
+                {
+                    usage(argv[0]);
+                }
+                useStrategy(strategy);
+                break;
+            case 'L':
+                level = findLogLevel(optarg);
+                if (level == -1)
+                {
+                    usage(argv[0]);
+                }
+                logLevel = level;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (argc - optind != 1)
     {
         usage(argv[0]);
     }
+    // The table policy can not play without its table
+    if (options.limits.policy == tablePolicy && strategy == NULL)
+    {
+        printf("The table policy needs the file of the solver, given with -F\n");
+        usage(argv[0]);
+    }
 
-    // Configure the handler to catch SIGINT
-    // setupHandlers();
+    // Show the seed, to be able to repeat the same games with -s
+    printf("Dealing the cards with the seed %#" PRIx64 "\n", options.seed);
 
-    // Initialize the data structures
-    // initBank(&bank_data, &data_locks);
+    // Configure the handler to catch SIGINT
+    setupHandlers();
 
 	// Show the IPs assigned to this computer
 	printLocalIPs();
-    // Start the server
-    server_fd = initServer(argv[1], MAX_QUEUE);
-	// Listen for connections from the clients
-    // waitForConnections(server_fd, &bank_data, &data_locks);
-    waitForConnections(server_fd, &viuda_data);
 
-    printf("Closing the server socket\n");
-    // Close the socket
-    close(server_fd);
+    // The threads started from here inherit a mask without the signals, so they are always received by this thread
+    sigemptyset(&signal_mask);
+    sigaddset(&signal_mask, SIGINT);
+    sigaddset(&signal_mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signal_mask, &previous_mask);
+    startLogger();
+    ledger = (options.ledgerPrefix != NULL) ? openLedger(options.ledgerPrefix) : NULL;
+    pthread_sigmask(SIG_SETMASK, &previous_mask, NULL);
 
-    // Clean the memory used
-    // closeBank(&bank_data, &data_locks);
+    if (options.shards > 0)
+    {
+        serveShards(argv[optind], &options, ledger);
+    }
+    else
+    {
+        // Start the server
+        server_fd = initServer(argv[optind], options.backlog, 0);
+        // Listen for connections from the clients
+        waitForConnections(server_fd, &options, NO_SHARD, ledger);
+
+        printf("Closing the server socket\n");
+        // Close the socket
+        close(server_fd);
+    }
+
+    if (ledger != NULL)
+    {
+        closeLedger(ledger);
+    }
+    if (strategy != NULL)
+    {
+        unloadStrategy(strategy);
+    }
+    stopLogger();
 
     printf("byeeeeee\n");
     // Finish the main thread
@@ -169,7 +388,32 @@ int main(int argc, char * argv[])
 void usage(char * program)
 {
     printf("Usage:\n");
-    printf("\t%s {port_number}\n", program);
+    printf("\t%s [-w num_workers] [-s seed] [-d decks] [-p penetration] [-T seats] [-l ledger] [-L log_level] [-S stats_socket] [-M max_sessions] [-H] [-k stack_kb] [-I handshake_seconds] [-B bet_seconds] [-D decision_seconds] [-A policy] [-F strategy_file] [-U] [-q backlog] [-C shards] [-a] [-P max_players] [-W max_handshakes] [-r retry_seconds] [-O lag_ms] {port_number}\n", program);
+    printf("\t-w: number of threads attending the clients, one per processor by default. With shards, the threads of every shard, 1 by default\n");
+    printf("\t-s: master seed used to deal the cards, taken from the clock by default\n");
+    printf("\t-d: number of decks in a shoe, from 1 to %d, 6 by default. Use 0 to deal from an infinite deck\n", MAX_DECKS);
+    printf("\t-p: percentage of the shoe dealt before the cut card, 75 by default\n");
+    printf("\t-T: number of seats at every table, from 1 to %d, %d by default\n", MAX_SEATS, MAX_SEATS);
+    printf("\t-l: prefix of the files of the ledger of the chips of the players (.wal and .snap), not kept by default\n");
+    printf("\t-L: lowest level of the messages printed: debug, info, warn or error, debug by default\n");
+    printf("\t-S: path of a Unix socket where the counters and the times of the phases of the rounds can be read\n");
+    printf("\t-M: most sessions kept in memory at the same time, the connections above it are closed. No limit by default. With shards, the limit of every shard\n");
+    printf("\t-H: take the memory of the sessions from huge pages, when the system has them reserved\n");
+    printf("\t-k: size of the stacks of the workers in KB, the default of the system by default\n");
+    printf("\t-I: seconds to finish the handshake before the connection is closed, 10 by default. Use 0 for no limit\n");
+    printf("\t-B: seconds to bet before the player sits out of the table, and then before it is disconnected, 60 by default. Use 0 for no limit\n");
+    printf("\t-D: seconds to decide before the rest of the turn is played for the player, 30 by default. Use 0 for no limit\n");
+    printf("\t-U: use io_uring for the sockets instead of epoll, if the system supports it\n");
+    printf("\t-A: policy that plays the turns of the players that do not decide in time, they stand by default\n");
+    printf("\t-F: table created by the solver, needed by the table policy\n");
+    printf("\t-q: connections waiting to be accepted by every listening socket, %d by default\n", SOMAXCONN);
+    printf("\t-C: number of shards, each with its own listening socket on the port, event loop, workers, tables and memory. Without shards by default\n");
+    printf("\t-a: keep every shard and its workers in its own processor\n");
+    printf("\t-P: most sessions playing at the same time, the new clients above it are answered with BUSY. No limit by default. With shards, the limit of every shard\n");
+    printf("\t-W: most sessions in the handshake at the same time, the new clients above it are answered with BUSY. No limit by default. With shards, the limit of every shard\n");
+    printf("\t-r: seconds that the clients answered with BUSY are told to wait before trying again, 5 by default\n");
+    printf("\t-O: milliseconds that the sessions can wait for a worker, on average, before the new clients are answered with BUSY. Not checked by default\n");
+    printf("\tSend SIGUSR1 to the server to print the depth of the queue of every worker and the counters of the shoes and the tables\n");
     exit(EXIT_FAILURE);
 }
 
@@ -179,6 +423,11 @@ void detectInterruption(int signal)
     interrupt_exit = 1;
 }
 
+void detectReport(int signal)
+{
+    report_stats++;
+}
+
 /*
     Modify the signal handlers for specific events
 */
@@ -196,529 +445,965 @@ void setupHandlers()
     // Establish the handler in my program
     sigaction(SIGINT, &new_action, NULL);
 
+    // Print the statistics of the workers on demand
+    new_action.sa_handler = detectReport;
+    sigaction(SIGUSR1, &new_action, NULL);
+
 }
 
 
 
 /*
-    Function to initialize all the information necessary
-    This will allocate memory for the accounts, and for the mutexes
+    Open a listening socket for every shard on the same port, and attend each one in its own thread
+    The connections are spread by the kernel among the sockets, so every shard accepts its own clients
+    This thread only receives the signals and prints the parts of the reports shared by the shards
 */
-void initBank(bank_t * bank_data, locks_t * data_locks)
+void serveShards(char * port, const options_t * options, ledger_t * ledger)
 {
-    // Set the number of transactions
-    bank_data->total_transactions = 0;
+    shard_t * shards = NULL;
+    struct timespec pause = {0, WHEEL_TICK * 1000000L};
+    sigset_t signal_mask;
+    sigset_t previous_mask;
+    int reported = 0;
+    int status;
 
-    // Allocate the arrays in the structures
-    bank_data->account_array = malloc(MAX_ACCOUNTS * sizeof (account_t));
-    // Allocate the arrays for the mutexes
-    data_locks->account_mutex = malloc(MAX_ACCOUNTS * sizeof (pthread_mutex_t));
+    shards = malloc(options->shards * sizeof (shard_t));
+    if (shards == NULL)
+    {
+        perror("ERROR: malloc");
+        exit(EXIT_FAILURE);
+    }
 
-    // Initialize the mutexes, using a different method for dynamically created ones
-    //data_locks->transactions_mutex = PTHREAD_MUTEX_INITIALIZER;
-    pthread_mutex_init(&data_locks->transactions_mutex, NULL);
-    for (int i=0; i<MAX_ACCOUNTS; i++)
+    // The shards and their workers never receive the signals
+    sigemptyset(&signal_mask);
+    sigaddset(&signal_mask, SIGINT);
+    sigaddset(&signal_mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signal_mask, &previous_mask);
+    for (int i=0; i<options->shards; i++)
     {
-        //data_locks->account_mutex[i] = PTHREAD_MUTEX_INITIALIZER;
-        pthread_mutex_init(&data_locks->account_mutex[i], NULL);
-        // Initialize the account balances too
-        bank_data->account_array[i].balance = 0.0;
+        shards[i].id = i;
+        shards[i].options = options;
+        shards[i].ledger = ledger;
+        shards[i].server_fd = initServer(port, options->backlog, 1);
+        status = pthread_create(&shards[i].tid, NULL, runShard, &shards[i]);
+        if (status != 0)
+        {
+            fprintf(stderr, "ERROR: pthread_create: %s\n", strerror(status));
+            exit(EXIT_FAILURE);
+        }
     }
+    pthread_sigmask(SIG_SETMASK, &previous_mask, NULL);
+    printf("Started %d shards listening on the port %s\n", options->shards, port);
 
-    // Read the data from the file
-    readBankFile(bank_data);
-}
+    // The shards see the flags of the signals in their next turn
+    while (!interrupt_exit)
+    {
+        nanosleep(&pause, NULL);
+        if (report_stats != reported)
+        {
+            reported = report_stats;
+            flockfile(stdout);
+            printServerStats(ledger);
+            funlockfile(stdout);
+        }
+    }
 
+    for (int i=0; i<options->shards; i++)
+    {
+        pthread_join(shards[i].tid, NULL);
+        close(shards[i].server_fd);
+    }
+    printf("Closed the sockets of the %d shards\n", options->shards);
+    free(shards);
+}
 
 /*
-    Get the data from the file to initialize the accounts
+    Thread of a shard, that attends the connections of its listening socket
 */
-void readBankFile(bank_t * bank_data)
+void * runShard(void * arg)
 {
-    FILE * file_ptr = NULL;
-    char buffer[BUFFER_SIZE];
-    int account = 0;
-    char * filename = "accounts.txt";
+    shard_t * shard = arg;
 
-    file_ptr = fopen(filename, "r");
-    if (!file_ptr)
+    // The workers are created by this thread, so they inherit its processor
+    if (shard->options->pinShards)
     {
-        perror("ERROR: fopen");
+        pinThread(shard->id);
     }
+    waitForConnections(shard->server_fd, shard->options, shard->id, shard->ledger);
 
-    // Ignore the first line with the headers
-    fgets(buffer, BUFFER_SIZE, file_ptr);
-    // Read the rest of the account data
-    while( fgets(buffer, BUFFER_SIZE, file_ptr) )
-    {
-        sscanf(buffer, "%d %d %f", &bank_data->account_array[account].id, &bank_data->account_array[account].pin, &bank_data->account_array[account].balance); 
-        account++;
-    }
-    
-    fclose(file_ptr);
+    return NULL;
 }
 
-
 /*
-    Main loop to wait for incomming connections
+    Keep the current thread in a single processor, chosen by the number of the shard
 */
-// void waitForConnections(int server_fd, bank_t * bank_data, locks_t * data_locks)
-void waitForConnections(int server_fd, viuda_t * viuda_data)
+void pinThread(int shard)
 {
-    struct sockaddr_in client_address;
-    socklen_t client_address_size;
-    char client_presentation[INET_ADDRSTRLEN];
-    int client_fd;
-    // pthread_t new_tid;
-    // int poll_response;
-	// int timeout = 500;		// Time in milliseconds (0.5 seconds)
-    int connectionsNum = 0;
+    cpu_set_t processors;
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    int processor = shard % ((count > 0) ? count : 1);
     int status;
 
-    // Create a structure array to hold the file descriptors to poll
-    // struct pollfd test_fds[1];
-    // // Fill in the structure
-    // test_fds[0].fd = server_fd;
-    // test_fds[0].events = POLLIN;    // Check for incomming data
+    CPU_ZERO(&processors);
+    CPU_SET(processor, &processors);
+    status = pthread_setaffinity_np(pthread_self(), sizeof processors, &processors);
+    if (status != 0)
+    {
+        fprintf(stderr, "ERROR: pthread_setaffinity_np: %s\n", strerror(status));
+        return;
+    }
+    printf("Shard %d runs in the processor %d\n", shard, processor);
+}
 
-    // Get the size of the structure to store client information
-    // connection_data = malloc(MAX_PLAYERS * sizeof(thread_data_t));
+/*
+    Main loop to wait for incomming connections
+    This thread only waits for the events reported by epoll, or the completions of the ring,
+    the sessions with events are processed by a fixed pool of workers
+    The workers also attend the sessions woken up by their tables
+    A shard deals with its own seed, derived from the master seed, and does not share its
+    workers, tables, shoes or sessions with the other shards
+*/
+void waitForConnections(int server_fd, const options_t * options, int shard, ledger_t * ledger)
+{
+    server_t server;
+    sigset_t signal_mask;
+    sigset_t previous_mask;
+    session_limits_t limits = options->limits;
+    rng_t rng;
+    int workers = options->num_workers;
+    int reported = 0;
+    int timeout;
+
+    server.server_fd = server_fd;
+    server.connectionsNum = 0;
+    server.seed = options->seed;
+    if (shard != NO_SHARD)
+    {
+        seedRandom(&rng, options->seed, SHARD_STREAMS | shard);
+        server.seed = nextRandom(&rng);
+        printf("Shard %d deals the cards with the seed %#" PRIx64 "\n", shard, server.seed);
+        if (workers == 0)
+        {
+            workers = 1;
+        }
+    }
+    server.graveyard = NULL;
+    server.live = NULL;
+    pthread_mutex_init(&server.graveyard_mutex, NULL);
+    server.writers = NULL;
+    pthread_mutex_init(&server.writers_mutex, NULL);
+    server.sessions = createSlab(sizeof (session_t), options->maxSessions, options->hugePages);
+    limits.wheel = createWheel(expireSession);
+    server.limits = &limits;
+    server.options = options;
+    server.players = 0;
+    atomic_init(&server.handshakes, 0);
+    atomic_init(&server.lagTotal, 0);
+    atomic_init(&server.lagCount, 0);
+    server.lag = 0;
+    server.lagChecked = statsNow();
+    server.shedding = 0;
+    server.refused = 0;
+    // Without deadlines the event loop only wakes up for events, the shards also to see the signals,
+    // and the lag of the workers is checked in every tick
+    timeout = (limits.handshake || limits.bet || limits.decision || shard != NO_SHARD || options->overloadLag) ? WHEEL_TICK : -1;
+
+    // The stats socket is watched by the event loop too, the one of the first shard with shards
+    server.stats_fd = (options->statsPath != NULL && shard <= 0) ? openStatsSocket(options->statsPath) : -1;
+
+    server.ring = NULL;
+    server.epoll_fd = -1;
+    if (options->useRing)
+    {
+        server.ring = createRing();
+        if (server.ring == NULL)
+        {
+            printf("The system does not support io_uring, using epoll\n");
+        }
+    }
+    if (server.ring != NULL)
+    {
+        watchRing(&server);
+    }
+    else
+    {
+        watchEpoll(&server);
+    }
 
-    while (1)
+    // The workers inherit a mask without the signals, so they are always received by this thread
+    sigemptyset(&signal_mask);
+    sigaddset(&signal_mask, SIGINT);
+    sigaddset(&signal_mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signal_mask, &previous_mask);
+    server.pool = createPool(workers, options->stackSize, runSession);
+    server.shuffler = (options->decks > 0) ? createShuffler(options->decks, options->penetration, SPARE_SHOES, server.seed) : NULL;
+    server.tables = createTables(options->seats, server.shuffler, server.seed, wakeSession);
+    server.ledger = ledger;
+    pthread_sigmask(SIG_SETMASK, &previous_mask, NULL);
+
+    while (!interrupt_exit)
     {
-        // if(interrupt_exit) {
-        //     printf("Interrupted\n");
-        //     break;
-        // } 
-
-        // poll_response = poll(test_fds, 1, timeout);
-        // if (poll_response == 0)
-        // {
-        //     printf(". ");
-        //     fflush(stdout);
-        // }
-        // else if (poll_response > 0) //if something was received
-        // {
-            client_address_size = sizeof client_address;
-
-            // ACCEPT
-            // Wait for a client connection
-            client_fd = accept(server_fd, (struct sockaddr *)&client_address, &client_address_size);
-            if (client_fd == -1)
+        if (report_stats != reported)
+        {
+            reported = report_stats;
+            // The report of a shard is not mixed with the others
+            flockfile(stdout);
+            if (shard != NO_SHARD)
             {
-                perror("ERROR: accept");
-                close(client_fd);
+                printf("Shard %d:\n", shard);
+            }
+            printPoolStats(server.pool);
+            if (server.shuffler != NULL)
+            {
+                printShufflerStats(server.shuffler);
+            }
+            printTablesStats(server.tables);
+            printSlabStats(server.sessions, "sessions");
+            printWheelStats(limits.wheel);
+            printAdmissionStats(&server);
+            if (server.ring != NULL)
+            {
+                printRingStats(server.ring);
             }
-            
-            // Get the data from the client
-            inet_ntop(client_address.sin_family, &client_address.sin_addr, client_presentation, sizeof client_presentation);
-            printf("Received incomming connection from %s on port %d\n", client_presentation, client_address.sin_port);
-
-            printf("CLIENT_FD: %d\n", client_fd);
-            pthread_t tid;
-            thread_data_t * connection_data = NULL;
-            connection_data = malloc (sizeof (thread_data_t));
-            // Prepare the structure to send to the thread
-            connection_data->connection_fd = client_fd;
-            connection_data->connectionNumber = connectionsNum;
-            connection_data->viuda_data = viuda_data;
-            connection_data->player = connectionsNum;
-            
-            // CREATE A THREAD
-            status = pthread_create(&tid, NULL, attentionThread, connection_data);
-
-            if (status == -1)
+            if (shard == NO_SHARD)
             {
-                perror("ERROR: pthread_create");
-                close(client_fd);
-            }    
-            connectionsNum++;  
-        // }
-        // else
-        // {
-        //     if (errno == EINTR) // if the poll gets interrupted, break while
-        //     {
-        //         printf("Error Interrupt\n");
-        //         break;
-                
-        //     }
-        //     else
-        //     {
-        //         perror("ERROR: poll");
-        //         exit(EXIT_FAILURE);
-        //     }
-        // }
-    }
-    // Show the number of total transactions
-    // printf("Transactions made: %d\n", bank_data->total_transactions);
-
-    // free(connection_data);
-
-    // Store any changes in the file
-    // storeChanges(bank_data);
+                printServerStats(server.ledger);
+            }
+            funlockfile(stdout);
+        }
+
+        if (!((server.ring != NULL) ? attendCompletions(&server, timeout) : attendEvents(&server, timeout)))
+        {
+            break;
+        }
+
+        // The sessions that missed a deadline are attended like the ones with events
+        advanceWheel(limits.wheel);
+
+        if (options->overloadLag)
+        {
+            checkOverload(&server);
+        }
+
+        // None of the sessions finished so far can appear in the next events
+        buryDeadSessions(&server);
+    }
+
+    printf("Interrupted\n");
+    destroyPool(server.pool);
+    buryDeadSessions(&server);
+    // The accounts of the players still connected are closed while the ledger is running
+    closeLiveSessions(&server);
+    destroyWheel(limits.wheel);
+    // The shoes of the tables go back to the shuffler before it is destroyed
+    destroyTables(server.tables);
+    if (server.shuffler != NULL)
+    {
+        destroyShuffler(server.shuffler);
+    }
+    if (server.stats_fd != -1)
+    {
+        close(server.stats_fd);
+        unlink(options->statsPath);
+    }
+    flockfile(stdout);
+    if (shard != NO_SHARD)
+    {
+        printf("Shard %d:\n", shard);
+    }
+    if (server.ring != NULL)
+    {
+        printRingStats(server.ring);
+        destroyRing(server.ring);
+        close(server.wake_fd);
+    }
+    else
+    {
+        close(server.epoll_fd);
+    }
+    printSlabStats(server.sessions, "sessions");
+    funlockfile(stdout);
+    destroySlab(server.sessions);
 }
 
 /*
-    Hear the request from the client and send an answer
+    Print the parts of the report shared by all the shards: the ledger, the logger and the stats
 */
-void * attentionThread(void * arg)
-{  
-    // Receive the data for the bank, mutexes and socket file descriptor
-    thread_data_t * info = arg;
-    int round = 0;
-    printf("\nSTARTED THREAD WITH CONNECTION: %d\n", info->connection_fd);
-    // response_t response;
-    // // Create a structure array to hold the file descriptors to poll
-    // struct pollfd test_fds[1];
-    // // Fill in the structure
-    // test_fds[0].fd = info->connection_fd;
-    // test_fds[0].events = POLLIN;    // Check for incomming data
-    // int poll_response;
-    // int timeout = 500;
+void printServerStats(ledger_t * ledger)
+{
+    if (ledger != NULL)
+    {
+        printLedgerStats(ledger);
+    }
+    printLoggerStats();
+    printStats();
+}
 
-    recvData(info->connection_fd, &info->message, sizeof info->message); //receive PLAY
-    // Validate that the client corresponds to this server
-    if (info->message.msg_code != PLAY)
+/*
+    Register the listening socket and the stats socket in a new epoll set
+*/
+void watchEpoll(server_t * server)
+{
+    struct epoll_event event;
+
+    server->epoll_fd = epoll_create1(0);
+    if (server->epoll_fd == -1)
     {
-        printf("Error: unrecognized client\n");
-        send(info->connection_fd, &info->message, sizeof info->message, 0);
-        pthread_exit(NULL);
+        perror("ERROR: epoll_create1");
+        exit(EXIT_FAILURE);
     }
 
-    // Prepare a reply
-    info->message.msg_code = AMOUNT;
-    send(info->connection_fd, &info->message, sizeof info->message, 0);
+    // The listening socket is identified with a NULL pointer
+    setNonBlocking(server->server_fd);
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->server_fd, &event) == -1)
+    {
+        perror("ERROR: epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
 
-    // Get the reply and validate again receives AMOUNT
-    recvData(info->connection_fd, &info->message, sizeof info->message);
-    if (info->message.msg_code != AMOUNT)
+    // The stats socket is identified with the address of its descriptor
+    if (server->stats_fd != -1)
     {
-        printf("Error: unrecognized client\n");
-        close(info->connection_fd);
-        pthread_exit(NULL);
+        event.events = EPOLLIN;
+        event.data.ptr = &server->stats_fd;
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->stats_fd, &event) == -1)
+        {
+            perror("ERROR: epoll_ctl");
+            exit(EXIT_FAILURE);
+        }
     }
+}
 
-    printf("The starting amount of the player is: %d\n", info->message.playerAmount);
+/*
+    Wait for the events of the sockets, for the milliseconds indicated at most,
+    and give the sessions with events to the workers
+    Returns 0 if the events can not be waited for anymore, 1 otherwise
+*/
+int attendEvents(server_t * server, int timeout)
+{
+    struct epoll_event events[MAX_EVENTS];
+    int num_events;
 
-    if(info->viuda_data->lowestAmount > info->message.playerAmount) {
-        info->viuda_data->lowestAmount = info->message.playerAmount;
+    num_events = epoll_wait(server->epoll_fd, events, MAX_EVENTS, timeout);
+    if (num_events == -1)
+    {
+        if (errno == EINTR) // if the wait gets interrupted, check the flags
+        {
+            return 1;
+        }
+        perror("ERROR: epoll_wait");
+        return 0;
     }
 
-    printf("The players can bet at most %d.\n", info->viuda_data->lowestAmount);
+    for (int i=0; i<num_events; i++)
+    {
+        if (events[i].data.ptr == NULL)
+        {
+            acceptConnections(server);
+        }
+        else if (events[i].data.ptr == &server->stats_fd)
+        {
+            serveStats(server->stats_fd);
+        }
+        else
+        {
+            scheduleSession(server, events[i].data.ptr);
+        }
+    }
 
-    // Prepare a reply
-    info->message.playerStatus = START;
-    info->message.dealerStatus = START;
-    send(info->connection_fd, &info->message, sizeof info->message, 0);
+    return 1;
+}
+
+/*
+    Make the first requests of the ring: accept the clients, read the stats socket
+    and hear the workers that wait to write
+*/
+void watchRing(server_t * server)
+{
+    server->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (server->wake_fd == -1)
+    {
+        perror("ERROR: eventfd");
+        exit(EXIT_FAILURE);
+    }
 
-    // printf("\tRunning thread with connection_fd: %d\n", info->connection_fd);
+    ringAccept(server->ring, server->server_fd, RING_ACCEPT);
+    if (server->stats_fd != -1)
+    {
+        ringPoll(server->ring, server->stats_fd, POLLIN, 1, RING_STATS);
+    }
+    ringRead(server->ring, server->wake_fd, &server->wakeCount, sizeof server->wakeCount, RING_WAKE);
+    printf("Using io_uring with %d buffers of %d bytes for the data received\n", RING_BUFFERS, RING_BUFFER_SIZE);
+}
 
-    // Loop to listen for messages from the client
-    while(info->message.playerAmount >= 2){
+/*
+    Submit the requests prepared and wait for completions, for the milliseconds indicated at most
+    The data received is given to the sessions, and the sessions with news to the workers
+    Returns 0 if the completions can not be waited for anymore, 1 otherwise
+*/
+int attendCompletions(server_t * server, int timeout)
+{
+    struct io_uring_cqe * cqe = NULL;
+    int result;
 
-        round++;
+    result = ringWait(server->ring, timeout);
+    if (result < 0 && result != -EINTR && result != -ETIME)
+    {
+        errno = -result;
+        perror("ERROR: io_uring_enter");
+        return 0;
+    }
 
-        printf("\n|||||||||||||||ROUND %d|||||||||||||||\n", round);
+    while ((cqe = ringNext(server->ring)) != NULL)
+    {
+        attendCompletion(server, cqe);
+        ringSeen(server->ring);
+    }
 
-        //Get the bet and player status from the client
-        printf("\n/////Getting player's bet/////\n");
+    return 1;
+}
 
-        // if(interrupt_exit) {
-        //     printf("Interrupted\n");
-        //     break;
-        // } 
+/*
+    Act on the completion of a request of the ring
+    The requests of the sessions are identified by their address, the others by small numbers
+*/
+void attendCompletion(server_t * server, struct io_uring_cqe * cqe)
+{
+    session_t * session = NULL;
+    int more = cqe->flags & IORING_CQE_F_MORE;
 
-        // poll_response = poll(test_fds, 1, timeout);
-        // if (poll_response == 0)
-        // {
-        //     printf(". ");
-        //     fflush(stdout);
-        // }
-        // else if (poll_response > 0) //if something was received
-        // {
-            // Receive the request
-            if (!recvData(info->connection_fd, &info->message, sizeof info->message)){
-                pthread_exit(NULL);
-                // return;
+    switch (cqe->user_data)
+    {
+        case RING_ACCEPT:
+            if (cqe->res >= 0)
+            {
+                startSession(server, cqe->res);
+            }
+            else
+            {
+                printf("Error: accept: %s\n", strerror(-cqe->res));
             }
+            // The request stops after some errors, like running out of descriptors
+            if (!more)
+            {
+                ringAccept(server->ring, server->server_fd, RING_ACCEPT);
+            }
+            return;
+        case RING_STATS:
+            serveStats(server->stats_fd);
+            if (!more)
+            {
+                ringPoll(server->ring, server->stats_fd, POLLIN, 1, RING_STATS);
+            }
+            return;
+        case RING_WAKE:
+            // The sessions waiting to write are attended in every turn of the loop
+            ringRead(server->ring, server->wake_fd, &server->wakeCount, sizeof server->wakeCount, RING_WAKE);
+            return;
+        case RING_CANCEL:
+            return;
+    }
 
-            printf("The bet of the player is: %d\n", info->message.playerBet);
+    session = (session_t *) (uintptr_t) (cqe->user_data & ~(uint64_t) RING_WRITABLE);
+    if (cqe->user_data & RING_WRITABLE)
+    {
+        session->pollingOutput = 0;
+        atomic_store(&session->outputWait, 0);
+    }
+    else
+    {
+        receiveData(server, session, cqe);
+    }
 
-            completeFirstDeal(&info->message, info->connection_fd); //Generates the first 2 cards of the Player and Dealer
+    if (session->buried)
+    {
+        // The last request of a finished session frees it
+        if (!session->receiving && !session->pollingOutput)
+        {
+            destroySession(session);
+        }
+        return;
+    }
+    scheduleSession(server, session);
+}
 
-            if((info->message.dealerStatus != NATURAL) && (info->message.playerStatus != NATURAL)){ // if no one got a natural blackjack
-                printf("\n/////PLAYER'S TURN/////\n");
-                playerTurn(&info->message, info->connection_fd); //Update player info based on the options chosen by the user
+/*
+    Create the session of a connection accepted by the ring, and start receiving its data
+*/
+void startSession(server_t * server, int client_fd)
+{
+    session_t * session = NULL;
 
-                //Calculate dealers hands and total accumulated
-                printf("\n/////DEALER'S TURN/////\n");
-                dealerTurn(&info->message, info->connection_fd); //Update dealer's info when player's turn is over
-            }
+    logDebug("CLIENT_FD: %d\n", client_fd);
+    session = createSession(server->sessions, client_fd, server->connectionsNum, server->tables, server->ledger, server->limits);
+    if (session == NULL)
+    {
+        close(client_fd);
+        return;
+    }
+    session->owner = server;
+    session->ringInput = 1;
+    addLiveSession(server, session);
+    admitConnection(server, session);
+
+    session->receiving = 1;
+    ringRecv(server->ring, client_fd, (uintptr_t) session);
+    server->connectionsNum++;
+}
 
-            //Take decision based on the status 
-            printf("\n/////TAKING DECISION BASED ON THE STATUS/////\n");
-            calculateResults(&info->message);
+/*
+    Let the session of a new client play, or make it answer BUSY if the server is full or overloaded
+    The clients refused still get a session, to reply with the protocol of their first message
+*/
+void admitConnection(server_t * server, session_t * session)
+{
+    const options_t * options = server->options;
 
-            if(info->message.playerAmount < 2){ //The client disconnects when the player doesn't have enough chips
-                printf("The player doesn't have enough money to keep playing. The player will exit now.\n");
-            } 
+    if (server->shedding
+        || (options->maxPlayers > 0 && server->players >= options->maxPlayers)
+        || (options->maxHandshakes > 0 && atomic_load(&server->handshakes) >= options->maxHandshakes))
+    {
+        rejectSession(session, options->retryAfter);
+        server->refused++;
+        statsCount(COUNT_REJECTED, 1);
+        return;
+    }
 
-            send(info->connection_fd, &info->message, sizeof info->message, 0);
+    admitSession(session, &server->handshakes);
+    server->players++;
+}
 
+/*
+    Update the average time that the sessions wait for a worker, once every tick,
+    and refuse the new clients while it is above the limit
+    The new clients are admitted again when the lag drops below half of the limit
+*/
+void checkOverload(server_t * server)
+{
+    uint64_t now = statsNow();
+    unsigned long long total;
+    unsigned long long count;
 
-    //         // Update the number of transactions
-    //         if(response == OK){
-    //             pthread_mutex_lock(&info->data_locks->transactions_mutex);
-    //             info->bank_data->total_transactions++;
-    //             pthread_mutex_unlock(&info->data_locks->transactions_mutex);
-    //         } else if(response == NO_ACCOUNT){
-    //             printf("Invalid acount number received.\n");
-    //         }
+    if (now - server->lagChecked < WHEEL_TICK * 1000000ULL)
+    {
+        return;
+    }
+    server->lagChecked = now;
 
-    //         // Prepare the message to the client
-    //         sprintf(buffer, "%d %f", response, balance);
+    total = atomic_exchange(&server->lagTotal, 0);
+    count = atomic_exchange(&server->lagCount, 0);
+    // Without sessions waiting, the lag decays to 0
+    server->lag = (server->lag * 3 + ((count > 0) ? total / count : 0)) / 4;
 
-    //         // Send a reply
-    //         sendData(info->connection_fd, buffer, strlen(buffer)+1);
-    //     }
-    //     else
-    //     {
-    //         if (errno == EINTR) // if the poll gets interrupted, break while
-    //         {
-    //             printf("Error Interrupt\n");
-    //             break;
-                
-    //         }
-    //         else
-    //         {
-    //             perror("ERROR: poll");
-    //             exit(EXIT_FAILURE);
-    //         }
-    //     }
+    if (!server->shedding && server->lag > server->options->overloadLag)
+    {
+        server->shedding = 1;
+        logWarn("The sessions wait %.1f ms for a worker, refusing the new clients\n", server->lag / 1e6);
     }
+    else if (server->shedding && server->lag < server->options->overloadLag / 2)
+    {
+        server->shedding = 0;
+        logInfo("The sessions wait %.1f ms for a worker, admitting the new clients again\n", server->lag / 1e6);
+    }
+}
 
-    printf("SALIOO\n");
+/*
+    Print the sessions admitted, the clients refused and the lag of the workers
+*/
+void printAdmissionStats(server_t * server)
+{
+    printf("Admission: %ld playing, %ld in the handshake, %lld refused, %.2f ms of lag of the workers%s\n",
+        server->players, atomic_load(&server->handshakes), server->refused, server->lag / 1e6,
+        server->shedding ? ", refusing the new clients" : "");
+}
 
-    printf("\nENDING THREAD WITH CONNECTION: %d\n", info->connection_fd);
+/*
+    Copy the data received by the ring to the inbox of the session, and give back the buffer
+    The end of the connection is also left in the inbox, for the worker
+*/
+void receiveData(server_t * server, session_t * session, struct io_uring_cqe * cqe)
+{
+    char * data = NULL;
+    int id;
 
-    // Finish the connection
-    if (!recvData(info->connection_fd, &info->message, sizeof info->message))
+    if (!(cqe->flags & IORING_CQE_F_MORE))
     {
-        printf("DENTRO DE FUNCION\n");
-        printf("Client disconnected\n");
+        session->receiving = 0;
     }
-    info->message.msg_code = BYE;
-    send(info->connection_fd, &info->message, sizeof info->message, 0);
-    close(info->connection_fd);
 
-    pthread_exit(NULL);
-}
+    data = ringBuffer(server->ring, cqe, &id);
+    if (data != NULL)
+    {
+        // The clients wait for the replies, so only a broken client sends more than the session keeps
+        if (!session->buried && !atomic_load(&session->inbox.closed) && !storeInput(&session->inbox, data, cqe->res))
+        {
+            logWarn("Error: the client sent more data than the session can keep\n");
+            closeInbox(&session->inbox);
+        }
+        ringRecycle(server->ring, id);
+    }
 
-int getRandomCard(message_t * message, char pord){ //pord stands for player or dealer
+    if (session->buried || session->receiving)
+    {
+        return;
+    }
+    // Receive again if the request only stopped, the connection is still valid
+    if (cqe->res > 0 || cqe->res == -ENOBUFS)
+    {
+        session->receiving = 1;
+        ringRecv(server->ring, session->connection_fd, (uintptr_t) session);
+        return;
+    }
+    closeInbox(&session->inbox);
+}
 
-    int newCard;
-    char randomCard[3]; 
+/*
+    Ask the event loop to tell when the socket of a session can be written again
+    Called by the worker that could not send all the output, when the ring is used
+*/
+void watchOutput(server_t * server, session_t * session)
+{
+    uint64_t one = 1;
+    int waiting = 0;
 
-    const char cardsArray[13][3]= {"A","2","3","4","5","6","7","8","9","10","J","Q","K"};
+    if (!atomic_compare_exchange_strong(&session->outputWait, &waiting, 1))
+    {
+        return;
+    }
 
-    strcpy(randomCard, cardsArray[rand() % 13]); //Pick a random card from the array
+    pthread_mutex_lock(&server->writers_mutex);
+    session->nextWriter = server->writers;
+    server->writers = session;
+    pthread_mutex_unlock(&server->writers_mutex);
 
-    if(strcmp(randomCard, "A") == 0){
-        newCard = 11; //Ace is equal to 11
-    } else if ((strcmp(randomCard, "10") == 0) || (strcmp(randomCard, "J") == 0) || (strcmp(randomCard, "Q") == 0) || (strcmp(randomCard, "K") == 0)) {
-        newCard = 10; //10, J, Q, and K are equal to 10
-    } else {
-        newCard = atol(randomCard); //Convert string to integer
+    // Wake up the event loop, that could be waiting for completions
+    if (write(server->wake_fd, &one, sizeof one) == -1)
+    {
+        perror("ERROR: write");
     }
+}
 
-    if(pord == 'p'){ //If the player called the function
-        strcpy((message->playerCards)[message->numPlayerCards], randomCard);
-        if(message->numPlayerCards >= 2){
-            printf("New card is: [%s].", randomCard);
-        }
-        (message->numPlayerCards)++;
-        if((newCard == 11) && (message->totalPlayer + 11 > 21)){ //If ace + current amount > 21, then ace value is 1
-            newCard = 1;
-        }
-    } else if(pord == 'd'){ //If the dealer called the function
-        if(message->numDealerCards >= 2){
-            printf("Dealer gets new card: [%s].", randomCard);
+/*
+    Make a request of the ring for every session that waits to write
+*/
+void watchWriters(server_t * server)
+{
+    session_t * session = NULL;
+
+    pthread_mutex_lock(&server->writers_mutex);
+    session = server->writers;
+    server->writers = NULL;
+    pthread_mutex_unlock(&server->writers_mutex);
+
+    while (session != NULL)
+    {
+        session_t * next = session->nextWriter;
+        if (atomic_load(&session->scheduleState) == SCHEDULE_DEAD)
+        {
+            atomic_store(&session->outputWait, 0);
         }
-        strcpy((message->dealerCards)[message->numDealerCards], randomCard);
-        (message->numDealerCards)++;
-        if((newCard == 11) && (message->totalDealer + 11 > 21)){ //If ace + current amount > 21, then ace value is 1
-            newCard = 1;
+        else
+        {
+            session->pollingOutput = 1;
+            ringPoll(server->ring, session->connection_fd, POLLOUT, 0, (uintptr_t) session | RING_WRITABLE);
         }
+        session = next;
     }
-
-    return newCard;
 }
 
-//Generates the first 2 cards of the Player and Dealer and tells if someone got a Natural Blackjack
-void completeFirstDeal(message_t * message, int connection_fd){
+/*
+    Accept all the clients waiting in the queue of the listening socket
+    Each new client gets a session registered in the event loop
+*/
+void acceptConnections(server_t * server)
+{
+    struct sockaddr_in client_address;
+    socklen_t client_address_size;
+    char client_presentation[INET_ADDRSTRLEN];
+    struct epoll_event event;
+    session_t * session = NULL;
+    int client_fd;
 
-    //Reset number of cards of the player and dealer from the previous round
-    message->numPlayerCards = 0;
-    message->numDealerCards = 0;
- 
-    message->totalPlayer = 0;
-    message->totalDealer = 0;
+    while (1)
+    {
+        client_address_size = sizeof client_address;
+
+        // ACCEPT
+        // Get the next client connection, without blocking
+        client_fd = accept(server->server_fd, (struct sockaddr *)&client_address, &client_address_size);
+        if (client_fd == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                perror("ERROR: accept");
+            }
+            return;
+        }
 
-    srand(time(NULL));
+        // Get the data from the client
+        inet_ntop(client_address.sin_family, &client_address.sin_addr, client_presentation, sizeof client_presentation);
+        logInfo("Received incomming connection from %s on port %d\n", client_presentation, client_address.sin_port);
 
-    for(int i = 0; i<2; i++){
-        message->totalPlayer += getRandomCard(message, 'p');
-        message->totalDealer += getRandomCard(message, 'd');
-    }
+        logDebug("CLIENT_FD: %d\n", client_fd);
+        if (setNonBlocking(client_fd) == -1)
+        {
+            close(client_fd);
+            continue;
+        }
 
-    //Check for Natural blackjacks
-    if(message->totalPlayer == 21) {
-        printf("The player got a Natural Blackjack with the cards [%s] and [%s]!\n", message->playerCards[0], message->playerCards[1]);
-        message->playerStatus = NATURAL;
+        session = createSession(server->sessions, client_fd, server->connectionsNum, server->tables, server->ledger, server->limits);
+        if (session == NULL)
+        {
+            close(client_fd);
+            continue;
+        }
+        session->owner = server;
+
+        // Edge triggered events, the workers read and write until the socket would block
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = session;
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, client_fd, &event) == -1)
+        {
+            perror("ERROR: epoll_ctl");
+            closeSession(session);
+            destroySession(session);
+            continue;
+        }
+        addLiveSession(server, session);
+        admitConnection(server, session);
+        server->connectionsNum++;
     }
+}
 
-    if(message->totalDealer == 21) {
-        message->dealerStatus = NATURAL;
-        printf("The dealer got a Natural Blackjack with the cards [%s] and [%s]!\n", message->dealerCards[0], message->dealerCards[1]);
-    }
+/*
+    Put a session with new events in the queue of a worker
+    If a worker is already attending the session, tell it to check the socket again
+*/
+void scheduleSession(server_t * server, session_t * session)
+{
+    int state = atomic_load(&session->scheduleState);
 
-    //If there is send the status to the client
-    if((message->totalPlayer == 21) || (message->totalDealer == 21)) {
-        send(connection_fd, message, sizeof (*message), 0);
+    while (1)
+    {
+        switch (state)
+        {
+            case SCHEDULE_IDLE:
+                if (atomic_compare_exchange_weak(&session->scheduleState, &state, SCHEDULE_QUEUED))
+                {
+                    if (server->options->overloadLag)
+                    {
+                        session->scheduled = statsNow();
+                    }
+                    // Sessions always go to the worker of their table, unless it is stolen by another
+                    poolSubmit(server->pool, atomic_load(&session->affinity) % server->pool->size, session);
+                    return;
+                }
+                break;
+            case SCHEDULE_RUNNING:
+                if (atomic_compare_exchange_weak(&session->scheduleState, &state, SCHEDULE_RERUN))
+                {
+                    return;
+                }
+                break;
+            default:
+                // Already pending, or finished
+                return;
+        }
     }
+}
 
+/*
+    Make a worker attend a session that has news from its table
+    Called by the worker that advanced the round, with the lock of the table
+*/
+void wakeSession(session_t * session)
+{
+    scheduleSession(session->owner, session);
 }
 
-void playerTurn(message_t * message, int connection_fd){
+/*
+    Make a worker attend a session that missed its deadline
+    Called by the event loop when the timer of the session expires
+*/
+void expireSession(void * data)
+{
+    session_t * session = data;
 
-    int newCard = 0;
+    scheduleSession(session->owner, session);
+}
 
-    //Initial deal
-    printf("Initial hand of the player: [%s] [%s] ", message->playerCards[0], message->playerCards[1]);
-    printf("summing a total of: %d\n", message->totalPlayer);
+/*
+    Function executed by the workers for every session with events
+    Repeats while new events arrive during the processing
+*/
+void runSession(void * item)
+{
+    session_t * session = item;
+    server_t * server = session->owner;
+    int state;
 
-    //Sends the total hand accumulated by the player
-    send(connection_fd, message, sizeof (*message), 0);
-    //Gets the status chosen by the player
-    recvData(connection_fd, message, sizeof (* message));
-    // Send the corresponding reply
-    while (message->playerStatus == HIT)
+    // The time waited in the queue tells how late the workers are
+    if (server->options->overloadLag)
     {
-        printf("The player with a total of %d chose to get a card.\n", message->totalPlayer);
-        newCard = getRandomCard(message, 'p');
-        message->totalPlayer += newCard;
-        printf(" The new total of this player is: %d.\n", message->totalPlayer);
+        atomic_fetch_add(&server->lagTotal, statsNow() - session->scheduled);
+        atomic_fetch_add(&server->lagCount, 1);
+    }
 
-        if (message->totalPlayer == 21) {
-            message->playerStatus = TWENTYONE;
-            printf("The current player got 21!\n");
-            send(connection_fd, message, sizeof (*message), 0);
-            break;
-        } else if (message->totalPlayer > 21) {
-            message->playerStatus = BUST;
-            printf("The current player busted, he is over 21.\n");
-            send(connection_fd, message, sizeof (*message), 0);
-            break;
+    atomic_store(&session->scheduleState, SCHEDULE_RUNNING);
+    while (1)
+    {
+        if (!attendSession(session))
+        {
+            // Closing the socket also removes it from the epoll set
+            atomic_store(&session->scheduleState, SCHEDULE_DEAD);
+            closeSession(session);
+
+            pthread_mutex_lock(&server->graveyard_mutex);
+            session->next = server->graveyard;
+            server->graveyard = session;
+            pthread_mutex_unlock(&server->graveyard_mutex);
+            return;
         }
 
-        //Sends the status calculated by the server
-        send(connection_fd, message, sizeof (*message), 0);
-
-        //Gets the status chosen by the player
-        recvData(connection_fd, message, sizeof (*message));
-
-        if(message->playerStatus == STAND) {
-            printf("Player chose to stay with %d.\n", message->totalPlayer);
+        // With the ring, the event loop must be asked to tell when the socket can be written
+        if (server->ring != NULL && sessionPendingOutput(session))
+        {
+            watchOutput(server, session);
         }
-    }
 
-    printf("After completing his/her turn the player accumulated the cards:");
-    for(int i = 0; i<message->numPlayerCards; i++){
-        printf(" [%s]", message->playerCards[i]);
+        state = SCHEDULE_RUNNING;
+        if (atomic_compare_exchange_strong(&session->scheduleState, &state, SCHEDULE_IDLE))
+        {
+            return;
+        }
+        // Events arrived while processing, attend the session again
+        atomic_store(&session->scheduleState, SCHEDULE_RUNNING);
     }
-    printf(" which sum a total of: %d\n", message->totalPlayer);
 }
 
-void dealerTurn(message_t * message, int connection_fd){ //Automatic deicisions based on Blackjack rules
+/*
+    Hear the requests from the client and send the answers
+    Returns 0 when the session is finished
+*/
+int attendSession(session_t * session)
+{
+    int alive;
 
-    int newCard = 0;
+    // Read again if the input was stopped while the replies could not be sent
+    do
+    {
+        alive = sessionRead(session) && sessionWrite(session);
+    } while (alive && session->inputStalled && session->inLength < (int) sizeof session->inBuffer);
 
-    //if the player turn is over
-    if((message->playerStatus == STAND) || (message->playerStatus == NATURAL) || (message->playerStatus == TWENTYONE)) {
+    return alive && !(session->state == SESSION_CLOSED && !sessionPendingOutput(session));
+}
 
-        printf("Initial dealer's hand: [%s] [%s] making a total of: %d\n", message->dealerCards[0], message->dealerCards[1], message->totalDealer);
+/*
+    Free the memory of the sessions finished by the workers
+    With the ring, the requests still in flight for a session are cancelled first,
+    and the session is freed when the last one completes
+*/
+void buryDeadSessions(server_t * server)
+{
+    session_t * session = NULL;
 
-        message->dealerStatus = HIT;
-        while((message->dealerStatus != STAND) && (message->dealerStatus != BUST) && (message->dealerStatus != TWENTYONE)){
-            if((message->totalDealer >= 17) && (message->totalDealer < 21)){
-                printf("The dealer stays with a total of: %d\n", message->totalDealer);
-                message->dealerStatus = STAND;
-            } else if (message->totalDealer > 21) {
-                printf("The dealer exceeds 21 with %d and busts.\n", message->totalDealer);
-                message->dealerStatus = BUST;
-            } else if(message->totalDealer == 21) {
-                printf("The dealer got %d!\n", message->totalDealer);
-                message->dealerStatus = TWENTYONE;
-            } else {
-                newCard = getRandomCard(message, 'd'); //If dealer status == HIT
-                message->totalDealer += newCard;
-                printf(" New dealer's total: %d\n", message->totalDealer);
-            }
-        }
-    }
+    pthread_mutex_lock(&server->graveyard_mutex);
+    session = server->graveyard;
+    server->graveyard = NULL;
+    pthread_mutex_unlock(&server->graveyard_mutex);
 
-    printf("After completing the turn dealer accumulated the cards:");
-    for(int i = 0; i<message->numDealerCards; i++){
-        printf(" [%s]", message->dealerCards[i]);
+    // A session asks to wait for writing before it finishes, so after this none of them is in that list
+    if (server->ring != NULL)
+    {
+        watchWriters(server);
     }
-    printf(" which sum a total of: %d\n", message->totalDealer);
-}
-
-void calculateResults(message_t * message){
 
-    if (message->playerStatus == BUST){
-        printf("The dealer gets the player's bet.\n");
-        message->playerAmount -= message->playerBet;
-    } else if((message->dealerStatus == BUST) && (message->playerStatus == STAND)){
-        printf("The dealer gives the player his bet plus the amount of his bet.\n");
-        message->playerAmount += message->playerBet;
-    } else if (((message->dealerStatus == STAND) || (message->dealerStatus == TWENTYONE)) && ((message->playerStatus == STAND) || (message->playerStatus == TWENTYONE))){
-        if(message->totalPlayer > message->totalDealer){
-            printf("The dealer gives the player his bet plus the amount of his bet.\n");
-            message->playerAmount += message->playerBet;
-        }else if (message->totalPlayer < message->totalDealer) {
-            printf("The dealer gets the player's bet.\n");
-            message->playerAmount -= message->playerBet;
-        } else if (message->totalPlayer == message->totalDealer){
-            printf("This is stand-off. The player gets his bet back.\n");
+    while (session != NULL)
+    {
+        session_t * next = session->next;
+        removeLiveSession(server, session);
+        if (!session->refused)
+        {
+            server->players--;
         }
-    } else if ((message->dealerStatus == NATURAL) && (message->playerStatus != NATURAL)){
-        printf("The dealer gets the player's bet.\n");
-        message->playerAmount -= message->playerBet;
-    } else if ((message->dealerStatus != NATURAL) && (message->playerStatus == NATURAL)){
-        printf("The dealer gives the player his bet plus 1.5x the amount of his bet.\n");
-        message->playerAmount += (message->playerBet * 1.5);
-    } else if ((message->dealerStatus == NATURAL) && (message->playerStatus == NATURAL)){
-        printf("This is PUSH. The player gets his bet back.\n");
+        if (session->receiving || session->pollingOutput)
+        {
+            session->buried = 1;
+            if (session->receiving)
+            {
+                ringCancel(server->ring, (uintptr_t) session, RING_CANCEL);
+            }
+            if (session->pollingOutput)
+            {
+                ringCancel(server->ring, (uintptr_t) session | RING_WRITABLE, RING_CANCEL);
+            }
+        }
+        else
+        {
+            destroySession(session);
+        }
+        session = next;
     }
 }
 
 /*
-    Free all the memory used for the bank data
+    Add a new session to the list of the sessions not finished
 */
-void closeBank(bank_t * bank_data, locks_t * data_locks)
+void addLiveSession(server_t * server, session_t * session)
 {
-    printf("DEBUG: Clearing the memory for the thread\n");
-    free(bank_data->account_array);
-    free(data_locks->account_mutex);
+    session->previousLive = NULL;
+    session->nextLive = server->live;
+    if (server->live != NULL)
+    {
+        server->live->previousLive = session;
+    }
+    server->live = session;
 }
 
+/*
+    Take a session finished by the workers out of the list of the sessions not finished
+*/
+void removeLiveSession(server_t * server, session_t * session)
+{
+    if (session->previousLive != NULL)
+    {
+        session->previousLive->nextLive = session->nextLive;
+    }
+    else
+    {
+        server->live = session->nextLive;
+    }
+    if (session->nextLive != NULL)
+    {
+        session->nextLive->previousLive = session->previousLive;
+    }
+}
 
 /*
-    Return true if the account provided is within the valid range,
-    return false otherwise
+    Close the sessions still connected when the server stops, so their players leave the tables
+    and their accounts are closed with the current balance
+    Must be called after the workers stopped; the memory is given back with the slab
 */
-int checkValidAccount(int account)
+void closeLiveSessions(server_t * server)
 {
-    return (account >= 0 && account < MAX_ACCOUNTS);
+    long closed = 0;
+
+    // The players that leave wake up the others at their tables, that are not attended anymore
+    for (session_t * session = server->live; session != NULL; session = session->nextLive)
+    {
+        atomic_store(&session->scheduleState, SCHEDULE_DEAD);
+    }
+    for (session_t * session = server->live; session != NULL; session = session->nextLive)
+    {
+        closeSession(session);
+        closed++;
+    }
+    server->live = NULL;
+
+    if (closed > 0)
+    {
+        logInfo("Closed %ld sessions still connected\n", closed);
+    }
 }
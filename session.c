@@ -0,0 +1,784 @@
+/*
+    State of the game with a single client
+    The messages of the protocol are the same used by the original blocking server,
+    but every step is done as soon as the message arrives, without waiting on the socket.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blackjack.h"
+#include "logger.h"
+#include "session.h"
+#include "stats.h"
+
+// Most messages that a single step of the game can produce
+#define MAX_STEP_REPLIES 2
+
+///// LOCAL FUNCTION DECLARATIONS
+static int sessionProcess(session_t * session);
+static int nextMessage(session_t * session, message_t * incoming);
+static void handleMessage(session_t * session, message_t * incoming);
+static void handlePlay(session_t * session, message_t * incoming);
+static void refuseClient(session_t * session);
+static void handleAmount(session_t * session, message_t * incoming);
+static void handleBet(session_t * session, message_t * incoming);
+static void handleDecision(session_t * session, message_t * incoming);
+static int syncTable(session_t * session);
+static void finishRound(session_t * session);
+static void leaveSeat(session_t * session);
+static void finishHandshake(session_t * session);
+static void setDeadline(session_t * session, uint64_t milliseconds);
+static void expireDeadline(session_t * session);
+static void autoDecision(session_t * session);
+static void queueReply(session_t * session, int type);
+
+///// FUNCTION DEFINITIONS
+
+/*
+    Prepare a new session for a connection already accepted, with memory of the slab indicated
+    The player sits at one of the tables after telling its amount
+    The deadline of the handshake starts now, if the limits have one
+    The socket must be in non-blocking mode
+    Returns NULL if the slab has no space for another session
+*/
+session_t * createSession(slab_t * slab, int connection_fd, int connectionNumber, tables_t * tables, ledger_t * ledger, const session_limits_t * limits)
+{
+    session_t * session = NULL;
+
+    session = slabAlloc(slab);
+    if (session == NULL)
+    {
+        logWarn("Error: no memory for another session\n");
+        return NULL;
+    }
+    bzero(session, sizeof (session_t));
+
+    session->slab = slab;
+    session->connection_fd = connection_fd;
+    session->connectionNumber = connectionNumber;
+    clock_gettime(CLOCK_MONOTONIC, &session->arrival);
+    session->tables = tables;
+    session->table = NULL;
+    session->ledger = ledger;
+    session->state = SESSION_PLAY;
+    session->protocol = PROTOCOL_UNKNOWN;
+    atomic_init(&session->scheduleState, SCHEDULE_IDLE);
+    atomic_init(&session->affinity, connectionNumber);
+    initOutbox(&session->outbox, session->outBuffer, sizeof session->outBuffer);
+    // The replies of every step are already joined, waiting for more would only delay them
+    setNoDelay(connection_fd);
+    initInbox(&session->inbox, session->arrived, sizeof session->arrived);
+    atomic_init(&session->outputWait, 0);
+    session->limits = limits;
+    initTimer(&session->timer, session);
+    setDeadline(session, limits->handshake);
+
+    statsCount(COUNT_SESSIONS, 1);
+
+    logInfo("\nSTARTED SESSION WITH CONNECTION: %d\n", session->connection_fd);
+
+    return session;
+}
+
+/*
+    Count the session among the ones that did not finish the handshake, until the player sits at a table
+*/
+void admitSession(session_t * session, atomic_long * handshakes)
+{
+    session->handshakes = handshakes;
+    atomic_fetch_add(handshakes, 1);
+}
+
+/*
+    Make the session answer the first message of the client with BUSY and close
+    The client is told to try again after the seconds indicated
+*/
+void rejectSession(session_t * session, int retryAfter)
+{
+    session->refused = 1;
+    session->retryAfter = retryAfter;
+    logInfo("The server is busy, refusing the connection %d\n", session->connection_fd);
+}
+
+/*
+    Close the socket of the session, leave its table and close the account of the player
+    Also stops the deadline of the session
+*/
+void closeSession(session_t * session)
+{
+    setDeadline(session, 0);
+    finishHandshake(session);
+    leaveSeat(session);
+    if (session->accountOpen)
+    {
+        ledgerCloseAccount(session->ledger, session->account, session->game.playerAmount);
+        session->accountOpen = 0;
+    }
+    logInfo("\nENDING SESSION WITH CONNECTION: %d\n", session->connection_fd);
+    close(session->connection_fd);
+}
+
+/*
+    Give back the memory of the session to its slab, after it is closed
+    Must be called by the thread that owns the slab
+*/
+void destroySession(session_t * session)
+{
+    statsCount(COUNT_SESSIONS, -1);
+    slabFree(session->slab, session);
+}
+
+/*
+    Read all the data available in the socket and process the complete messages
+    With the ring of the event loop the data is taken from the inbox instead of the socket
+    Returns 0 when the connection must be closed, 1 otherwise
+*/
+int sessionRead(session_t * session)
+{
+    int result;
+    int before;
+
+    // Finish any message left from a previous read
+    sessionProcess(session);
+
+    do
+    {
+        before = session->inLength;
+        if (session->ringInput)
+        {
+            result = takeInput(&session->inbox, session->inBuffer, &session->inLength, sizeof session->inBuffer);
+        }
+        else
+        {
+            result = recvAvailable(session->connection_fd, session->inBuffer, &session->inLength, sizeof session->inBuffer);
+        }
+        statsCount(COUNT_BYTES_IN, session->inLength - before);
+        // Process the messages complete before checking for the end of the connection
+        sessionProcess(session);
+    // Continue while processing made space for more data
+    } while (result == RECV_FULL && session->inLength < (int) sizeof session->inBuffer);
+
+    // Leave the rest of the data in the socket until there is space again
+    session->inputStalled = (result == RECV_FULL);
+
+    return result != RECV_CLOSED;
+}
+
+/*
+    Send as much of the pending output as the socket accepts
+    After everything is sent, process the messages that were waiting for space
+    While more messages wait to be processed the socket is corked, and the cork is removed at the end
+    The packets sent are counted: one for every write, or for every time the cork is removed
+    Returns 0 when the connection must be closed, 1 otherwise
+*/
+int sessionWrite(session_t * session)
+{
+    int before;
+    long long sends;
+
+    do
+    {
+        // The replies of the next messages can go in the same packets
+        if (session->inLength > 0 && !session->corked)
+        {
+            session->corked = (setCork(session->connection_fd, 1) == 0);
+        }
+
+        before = session->outbox.length;
+        sends = session->outbox.sends;
+        if (!flushOutput(session->connection_fd, &session->outbox))
+        {
+            return 0;
+        }
+        statsCount(COUNT_BYTES_OUT, before - session->outbox.length);
+        if (session->corked)
+        {
+            session->corkedBytes += before - session->outbox.length;
+        }
+        else
+        {
+            statsCount(COUNT_PACKETS_OUT, session->outbox.sends - sends);
+        }
+        // The socket is full, wait until it can be written again
+        if (sessionPendingOutput(session))
+        {
+            break;
+        }
+    } while (sessionProcess(session));
+
+    // Send everything held, nothing else is ready for now
+    if (session->corked)
+    {
+        setCork(session->connection_fd, 0);
+        session->corked = 0;
+        if (session->corkedBytes > 0)
+        {
+            statsCount(COUNT_PACKETS_OUT, 1);
+            session->corkedBytes = 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+    Tell if there is output that could not be sent yet
+*/
+int sessionPendingOutput(session_t * session)
+{
+    return session->outbox.length > 0;
+}
+
+/*
+    Do the steps of the game for every complete message received
+    While waiting for the table no input is consumed, only the news of the round
+    A deadline that passed is applied before taking any message
+    Stops when there is no space to store the replies of another step
+    Returns the number of steps done
+*/
+static int sessionProcess(session_t * session)
+{
+    message_t incoming;
+    int processed = 0;
+
+    if (session->deadline != 0 && statsNow() >= session->deadline)
+    {
+        expireDeadline(session);
+    }
+
+    while (session->state != SESSION_CLOSED)
+    {
+        if (outboxSpace(&session->outbox) < MAX_STEP_REPLIES * (int) sizeof (message_t))
+        {
+            break;
+        }
+
+        if (session->state == SESSION_DECISION && session->autoPlay)
+        {
+            autoDecision(session);
+            processed++;
+            continue;
+        }
+
+        if (session->state == SESSION_DEAL || session->state == SESSION_RESULT)
+        {
+            if (!syncTable(session))
+            {
+                break;
+            }
+            processed++;
+            continue;
+        }
+
+        if (!nextMessage(session, &incoming))
+        {
+            break;
+        }
+
+        handleMessage(session, &incoming);
+        processed++;
+    }
+
+    return processed;
+}
+
+/*
+    Take the next complete message from the input buffer
+    Compact frames are translated to the fields of the original message
+    Returns 0 if there is no complete message yet
+*/
+static int nextMessage(session_t * session, message_t * incoming)
+{
+    unsigned char * buffer = (unsigned char *) session->inBuffer;
+    int length;
+
+    if (session->inLength == 0)
+    {
+        return 0;
+    }
+
+    // Original clients start with a PLAY message, the others with a HELLO frame
+    if (session->protocol == PROTOCOL_UNKNOWN)
+    {
+        session->protocol = (buffer[0] == FRAME_HELLO) ? PROTOCOL_VERSION : PROTOCOL_LEGACY;
+    }
+
+    bzero(incoming, sizeof (message_t));
+    if (session->protocol == PROTOCOL_LEGACY)
+    {
+        length = sizeof (message_t);
+        if (session->inLength < length)
+        {
+            return 0;
+        }
+        memcpy(incoming, buffer, length);
+    }
+    else
+    {
+        length = frameLength(buffer, session->inLength);
+        if (length == 0)
+        {
+            return 0;
+        }
+        // Use the newest version known by both sides
+        if (buffer[0] == FRAME_HELLO && frameVersion(buffer) < session->protocol)
+        {
+            session->protocol = frameVersion(buffer);
+        }
+        if (session->protocol < 1 || decodeFrame(buffer, incoming) == -1)
+        {
+            logWarn("Error: invalid frame received\n");
+            session->state = SESSION_CLOSED;
+            return 0;
+        }
+    }
+
+    session->inLength -= length;
+    memmove(buffer, buffer + length, session->inLength);
+
+    return 1;
+}
+
+/*
+    Advance the state machine with a message from the client
+*/
+static void handleMessage(session_t * session, message_t * incoming)
+{
+    switch (session->state)
+    {
+        case SESSION_PLAY:
+            handlePlay(session, incoming);
+            break;
+        case SESSION_AMOUNT:
+            handleAmount(session, incoming);
+            break;
+        case SESSION_BET:
+            handleBet(session, incoming);
+            break;
+        case SESSION_DECISION:
+            handleDecision(session, incoming);
+            break;
+        case SESSION_DEAL:
+        case SESSION_RESULT:
+            // Waiting for the table, the messages are not taken in these states
+            break;
+        case SESSION_BYE:
+            // Finish the connection
+            session->message.msg_code = BYE;
+            queueReply(session, FRAME_BYE);
+            session->state = SESSION_CLOSED;
+            break;
+        case SESSION_CLOSED:
+            break;
+    }
+}
+
+/*
+    Validate that the client corresponds to this server
+    A HELLO with the amount and the first bet also sits the player and places the bet
+*/
+static void handlePlay(session_t * session, message_t * incoming)
+{
+    if (session->refused)
+    {
+        refuseClient(session);
+        return;
+    }
+
+    if (incoming->msg_code != PLAY)
+    {
+        logWarn("Error: unrecognized client\n");
+        // Return the same message to the client
+        if (session->protocol == PROTOCOL_LEGACY)
+        {
+            queueOutput(&session->outbox, incoming, sizeof (message_t));
+        }
+        else
+        {
+            queueReply(session, FRAME_BYE);
+        }
+        session->state = SESSION_CLOSED;
+        return;
+    }
+
+    // Prepare a reply
+    session->message.msg_code = AMOUNT;
+    queueReply(session, FRAME_WELCOME);
+    session->state = SESSION_AMOUNT;
+
+    // A HELLO with the amount and the first bet does the rest of the handshake,
+    // so the first deal leaves with the WELCOME and the START
+    if (session->protocol >= PROTOCOL_QUICK_START && incoming->playerAmount > 0)
+    {
+        incoming->msg_code = AMOUNT;
+        handleAmount(session, incoming);
+        if (session->state == SESSION_BET && incoming->playerBet > 0)
+        {
+            incoming->msg_code = BET;
+            handleBet(session, incoming);
+        }
+    }
+}
+
+/*
+    Tell the client that the server is busy and when to try again, and finish the connection
+    The frame is built from the message, the refused sessions have no game
+*/
+static void refuseClient(session_t * session)
+{
+    unsigned char frame[MAX_FRAME];
+    int length;
+
+    session->message.msg_code = BUSY;
+    session->message.playerAmount = session->retryAfter;
+    if (session->protocol == PROTOCOL_LEGACY)
+    {
+        queueOutput(&session->outbox, &session->message, sizeof (message_t));
+    }
+    else
+    {
+        length = encodeFrame(frame, FRAME_BUSY, session->protocol, &session->message);
+        queueOutput(&session->outbox, frame, length);
+    }
+    session->state = SESSION_CLOSED;
+}
+
+/*
+    Get the amount of chips of the player, sit it at a table and tell the client to start
+*/
+static void handleAmount(session_t * session, message_t * incoming)
+{
+    if (incoming->msg_code != AMOUNT)
+    {
+        logWarn("Error: unrecognized client\n");
+        session->state = SESSION_CLOSED;
+        return;
+    }
+
+    session->game.playerAmount = incoming->playerAmount;
+    logDebug("The starting amount of the player is: %d\n", session->game.playerAmount);
+
+    if (session->ledger != NULL)
+    {
+        session->account = ledgerOpenAccount(session->ledger, session->game.playerAmount);
+        session->accountOpen = 1;
+        logInfo("The chips of the player are recorded in the account %" PRIu64 "\n", session->account);
+    }
+
+    if (session->game.playerAmount >= 2)
+    {
+        session->table = joinTable(session->tables, session, session->game.playerAmount, &session->arrival, &session->seat);
+        // The sessions of a table go to the same worker
+        atomic_store(&session->affinity, session->table->id);
+    }
+
+    // Prepare a reply
+    session->game.playerStatus = START;
+    session->game.dealerStatus = START;
+    queueReply(session, FRAME_START);
+    statsSince(STAT_HANDSHAKE, session->arrival.tv_sec * 1000000000ULL + session->arrival.tv_nsec);
+    finishHandshake(session);
+
+    session->state = (session->game.playerAmount >= 2) ? SESSION_BET : SESSION_BYE;
+    setDeadline(session, session->limits->bet);
+}
+
+/*
+    Get the bet of the player and wait for the first deal of the round at the table
+    A late decision is ignored, and any other message that is not a bet closes the session
+*/
+static void handleBet(session_t * session, message_t * incoming)
+{
+    game_t * game = &session->game;
+    struct timespec returned;
+
+    if (incoming->msg_code == BYE)
+    {
+        leaveSeat(session);
+        session->message.msg_code = BYE;
+        queueReply(session, FRAME_BYE);
+        session->state = SESSION_CLOSED;
+        return;
+    }
+
+    // A decision that arrives after the rest of the turn was played for the player is late, not a bet
+    // The original clients send it with the last code received, that is BET
+    if (incoming->playerStatus == HIT || incoming->playerStatus == STAND)
+    {
+        logInfo("The player with the connection %d decided after its turn, ignoring the decision\n", session->connection_fd);
+        return;
+    }
+    if (incoming->msg_code != BET)
+    {
+        logWarn("Error: unrecognized client\n");
+        session->state = SESSION_CLOSED;
+        return;
+    }
+
+    // A player that sat out for not betting in time goes back to a table
+    // The time to sit is counted from the bet, the time sitting out is not a wait for a seat
+    if (session->table == NULL)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &returned);
+        session->table = joinTable(session->tables, session, session->game.playerAmount, &returned, &session->seat);
+        atomic_store(&session->affinity, session->table->id);
+    }
+
+    session->round++;
+
+    //Get the bet and player status from the client
+    logDebug("\n/////Getting player's bet/////\n");
+    session->message.msg_code = incoming->msg_code;
+    game->playerBet = incoming->playerBet;
+    logDebug("The bet of the player at the table %d, seat %d for its round %d is: %d\n", session->table->id, session->seat, session->round, game->playerBet);
+
+    //The cards are dealt when all the players of the table have bet
+    setDeadline(session, 0);
+    session->state = SESSION_DEAL;
+    placeBet(session->table, session->seat, game->playerBet);
+}
+
+/*
+    Apply the option chosen by the player, to get another card or stay
+*/
+static void handleDecision(session_t * session, message_t * incoming)
+{
+    game_t * game = &session->game;
+
+    //The time since the player was asked includes the trip to the client and back
+    statsSince(STAT_DECISION, session->asked);
+
+    //Gets the status chosen by the player
+    game->playerStatus = incoming->playerStatus;
+    tableDecision(session->table, session->seat, game);
+
+    //Sends the status calculated by the server
+    if (game->playerStatus == HIT)
+    {
+        queueReply(session, FRAME_CARD);
+        session->asked = statsNow();
+        if (!session->autoPlay)
+        {
+            setDeadline(session, session->limits->decision);
+        }
+        return;
+    }
+    if ((game->playerStatus == TWENTYONE) || (game->playerStatus == BUST))
+    {
+        queueReply(session, FRAME_CARD);
+    }
+
+    logDebug("After completing his/her turn the player accumulated the cards:");
+    for(int i = 0; i<game->player.numCards; i++){
+        logDebug(" [%s]", cardName(game->player.cards[i]));
+    }
+    logDebug(" which sum a total of: %d\n", handTotal(&game->player));
+
+    //The dealer plays when all the players of the table finish their turns
+    setDeadline(session, 0);
+    session->state = SESSION_RESULT;
+}
+
+/*
+    Take the news of the table the session is waiting for: the first deal, or the results of the round
+    Returns 0 if the table has not reached that phase yet
+*/
+static int syncTable(session_t * session)
+{
+    game_t * game = &session->game;
+    int amount = game->playerAmount;
+
+    if (session->state == SESSION_DEAL)
+    {
+        if (!takeDeal(session->table, session->seat, game))
+        {
+            return 0;
+        }
+        // The cards are drawn from the shoe of the table
+        game->house = &session->table->house;
+
+        //If there is a natural send the status to the client and finish the round
+        if((game->dealerStatus == NATURAL) || (game->playerStatus == NATURAL)){
+            queueReply(session, FRAME_DEAL);
+            session->state = SESSION_RESULT;
+            return 1;
+        }
+
+        logDebug("\n/////PLAYER'S TURN/////\n");
+        logDebug("Initial hand of the player: [%s] [%s] ", cardName(game->player.cards[0]), cardName(game->player.cards[1]));
+        logDebug("summing a total of: %d\n", handTotal(&game->player));
+
+        //Sends the total hand accumulated by the player
+        queueReply(session, FRAME_DEAL);
+        session->asked = statsNow();
+        session->autoPlay = 0;
+        setDeadline(session, session->limits->decision);
+        session->state = SESSION_DECISION;
+        return 1;
+    }
+
+    if (!takeResult(session->table, session->seat, game))
+    {
+        return 0;
+    }
+    if (session->accountOpen)
+    {
+        ledgerSettle(session->ledger, session->account, game->playerAmount - amount);
+    }
+    finishRound(session);
+    return 1;
+}
+
+/*
+    Settle the bet and send the final results of the round
+*/
+static void finishRound(session_t * session)
+{
+    //The table already settled the bet based on the status
+    logDebug("\n/////RESULT OF THE PLAYER AT THE TABLE %d, SEAT %d/////\n", session->table->id, session->seat);
+    logDebug("The amount of the player is now: %d\n", session->game.playerAmount);
+
+    if(session->game.playerAmount < 2){ //The client disconnects when the player doesn't have enough chips
+        logDebug("The player doesn't have enough money to keep playing. The player will exit now.\n");
+        leaveSeat(session);
+        session->state = SESSION_BYE;
+    } else {
+        //Between rounds the player can be moved to a fuller table
+        session->table = rebalanceTable(session->table, session, session->game.playerAmount, &session->seat);
+        atomic_store(&session->affinity, session->table->id);
+        session->state = SESSION_BET;
+    }
+
+    queueReply(session, FRAME_RESULT);
+    // The player has the time to bet again, or to say goodbye
+    setDeadline(session, session->limits->bet);
+}
+
+/*
+    Leave the table, if the player is seated at one
+*/
+static void leaveSeat(session_t * session)
+{
+    if (session->table != NULL)
+    {
+        leaveTable(session->table, session->seat);
+        session->table = NULL;
+        session->game.house = NULL;
+    }
+}
+
+/*
+    Stop counting the session among the ones that did not finish the handshake
+    Called when the player sits at a table, or when the session closes before
+*/
+static void finishHandshake(session_t * session)
+{
+    if (session->handshakes != NULL)
+    {
+        atomic_fetch_sub(session->handshakes, 1);
+        session->handshakes = NULL;
+    }
+}
+
+/*
+    Add a reply to the output buffer
+    Original clients get the whole message with the current game, the others the frame of the type indicated
+*/
+static void queueReply(session_t * session, int type)
+{
+    unsigned char frame[MAX_FRAME];
+    int length;
+
+    if (session->protocol == PROTOCOL_LEGACY)
+    {
+        fillMessage(&session->game, &session->message);
+        queueOutput(&session->outbox, &session->message, sizeof (message_t));
+        return;
+    }
+
+    length = encodeGameFrame(frame, type, session->protocol, &session->game);
+    queueOutput(&session->outbox, frame, length);
+}
+
+/*
+    Start the deadline of the current phase, replacing the previous one
+    Without a limit for the phase the deadline is only stopped
+*/
+static void setDeadline(session_t * session, uint64_t milliseconds)
+{
+    if (milliseconds == 0)
+    {
+        if (session->deadline != 0)
+        {
+            session->deadline = 0;
+            cancelTimer(session->limits->wheel, &session->timer);
+        }
+        return;
+    }
+
+    session->deadline = statsNow() + milliseconds * 1000000ULL;
+    addTimer(session->limits->wheel, &session->timer, milliseconds);
+}
+
+/*
+    Act for a client that did not answer in time
+    An incomplete handshake closes the connection, a player without a bet sits out of its table
+    and is said goodbye if it does not bet in the next period, and a player without a decision
+    gets the rest of its turn played for it
+*/
+static void expireDeadline(session_t * session)
+{
+    session->deadline = 0;
+    statsCount(COUNT_TIMEOUTS, 1);
+
+    switch (session->state)
+    {
+        case SESSION_PLAY:
+        case SESSION_AMOUNT:
+            logWarn("Error: the client did not finish the handshake in time\n");
+            session->state = SESSION_CLOSED;
+            break;
+        case SESSION_BET:
+            if (session->table != NULL)
+            {
+                logInfo("The player at the table %d, seat %d did not bet in time and sits out\n", session->table->id, session->seat);
+                // The other players of the table do not wait for this one
+                leaveSeat(session);
+                setDeadline(session, session->limits->bet);
+                break;
+            }
+            // fall through
+        case SESSION_BYE:
+            logInfo("The player with the connection %d is gone, closing the session\n", session->connection_fd);
+            session->message.msg_code = BYE;
+            queueReply(session, FRAME_BYE);
+            session->state = SESSION_CLOSED;
+            break;
+        case SESSION_DECISION:
+            logInfo("The player at the table %d, seat %d did not decide in time\n", session->table->id, session->seat);
+            session->autoPlay = 1;
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+    Take a decision for a player that did not decide in time, with the policy of the limits
+    Without a policy the player stands
+*/
+static void autoDecision(session_t * session)
+{
+    message_t incoming;
+
+    bzero(&incoming, sizeof incoming);
+    incoming.playerStatus = (session->limits->policy != NULL) ? session->limits->policy(&session->game) : STAND;
+    handleDecision(session, &incoming);
+}
@@ -0,0 +1,186 @@
+/*
+    State of the game with a single client
+    Each session is a non-blocking state machine that advances one step
+    every time a complete message arrives from the client:
+        PLAY -> AMOUNT -> BET -> DEAL -> DECISION -> ... -> RESULT -> BET -> BYE
+    In DEAL and RESULT the session waits for the other players of its table,
+    and the table wakes it up when the round reaches the next phase.
+    A HELLO of the version 2 brings the amount and the first bet, and goes from PLAY to DEAL in a single step.
+    The replies are stored in an output buffer and all the ones of a step leave in a single write,
+    so the socket sends them without waiting (TCP_NODELAY). When the client sends several messages
+    at once, the socket is corked while they are processed, so their replies share the packets.
+    The first byte received tells if the client uses the original messages or compact frames.
+    Every phase where the server waits for the client can have a deadline: a client that
+    does not finish the handshake is disconnected, a player that does not bet sits out
+    of the table, and a player that does not decide stands or plays with a policy.
+    When the server is full, the session of a new client only answers its first message
+    with BUSY and the seconds to wait before trying again, and then closes.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "blackjack.h"
+#include "codes.h"
+#include "protocol.h"
+#include "sockets.h"
+#include "table.h"
+#include "ledger.h"
+#include "slab.h"
+#include "policy.h"
+#include "wheel.h"
+
+// Number of messages that can be waiting in the buffers of a session
+#define SESSION_QUEUE 4
+
+// The steps of the game with a client
+typedef enum {SESSION_PLAY, SESSION_AMOUNT, SESSION_BET, SESSION_DEAL, SESSION_DECISION, SESSION_RESULT, SESSION_BYE, SESSION_CLOSED} session_state_t;
+
+// Time allowed to the client in every phase, shared by all the sessions
+typedef struct session_limits_struct {
+    // Wheel with the deadlines, NULL when there are no limits
+    wheel_t * wheel;
+    // Milliseconds to finish the handshake, to bet and to decide, 0 for no limit
+    uint64_t handshake;
+    uint64_t bet;
+    uint64_t decision;
+    // Decisions taken for the players that do not decide in time, NULL to stand
+    policy_t policy;
+} session_limits_t;
+
+// Who is attending the session: waiting for events, in the queue of a worker,
+// being processed, being processed with new events that arrived meanwhile, or finished
+typedef enum {SCHEDULE_IDLE, SCHEDULE_QUEUED, SCHEDULE_RUNNING, SCHEDULE_RERUN, SCHEDULE_DEAD} schedule_state_t;
+
+// Data of the connection with a single client
+typedef struct session_struct {
+    // The file descriptor for the socket
+    int connection_fd;
+    int connectionNumber;
+    // Time when the connection was accepted
+    struct timespec arrival;
+    session_state_t state;
+    int round;
+    // Time when the player was asked for a decision
+    uint64_t asked;
+    // Limits of the phases, the timer of the current one and the time when it ends, 0 without it
+    const session_limits_t * limits;
+    wheel_timer_t timer;
+    uint64_t deadline;
+    // The player missed its decision, the rest of its turn is played for it
+    int autoPlay;
+    // Counter of the sessions of the server that did not finish the handshake, NULL when this one is not counted
+    atomic_long * handshakes;
+    // The server refused the session, the client is told to try again after the seconds indicated
+    int refused;
+    int retryAfter;
+    // Original message_t structures, or the version of the compact frames
+    int protocol;
+    // Tables of the server
+    tables_t * tables;
+    // Record of the chips of the player, NULL when it is not kept
+    ledger_t * ledger;
+    uint64_t account;
+    int accountOpen;
+    // State of the game, as known by the server
+    game_t game;
+    // Last message sent to the original clients
+    message_t message;
+    // Table where the player is seated, NULL before the amount arrives
+    table_t * table;
+    int seat;
+    // Bytes received that do not complete a message yet
+    char inBuffer[SESSION_QUEUE * sizeof (message_t)];
+    int inLength;
+    // Bytes waiting to be sent to the client
+    char outBuffer[SESSION_QUEUE * sizeof (message_t)];
+    outbox_t outbox;
+    // The socket holds the writes until the messages waiting are processed, and the bytes held
+    int corked;
+    int corkedBytes;
+    // The last read stopped because the input buffer was full
+    int inputStalled;
+    // Bytes received by the event loop, when it reads the socket instead of the workers
+    int ringInput;
+    inbox_t inbox;
+    char arrived[SESSION_QUEUE * sizeof (message_t)];
+    // Requests of the event loop in flight for the session, and whether the session already finished
+    int receiving;
+    int pollingOutput;
+    int buried;
+    // The worker asked the event loop to tell when the socket can be written again
+    atomic_int outputWait;
+    // Attention of the session by the workers, using the values of schedule_state_t
+    atomic_int scheduleState;
+    // Worker preferred by the session, the same for all the players of a table
+    atomic_int affinity;
+    // Time when the session was put in the queue of a worker
+    uint64_t scheduled;
+    // The event loop attending the session, and the slab where its memory was taken
+    void * owner;
+    slab_t * slab;
+    // Links used by the lists of the event loop
+    struct session_struct * next;
+    struct session_struct * nextWriter;
+    // The sessions not finished yet, closed by the event loop when the server stops
+    struct session_struct * nextLive;
+    struct session_struct * previousLive;
+} session_t;
+
+/*
+    Prepare a new session for a connection already accepted, with memory of the slab indicated
+    The player sits at one of the tables after telling its amount
+    The deadline of the handshake starts now, if the limits have one
+    The socket must be in non-blocking mode
+    Returns NULL if the slab has no space for another session
+*/
+session_t * createSession(slab_t * slab, int connection_fd, int connectionNumber, tables_t * tables, ledger_t * ledger, const session_limits_t * limits);
+
+/*
+    Count the session among the ones that did not finish the handshake, until the player sits at a table
+*/
+void admitSession(session_t * session, atomic_long * handshakes);
+
+/*
+    Make the session answer the first message of the client with BUSY and close
+    The client is told to try again after the seconds indicated
+*/
+void rejectSession(session_t * session, int retryAfter);
+
+/*
+    Close the socket of the session, leave its table and close the account of the player
+    Also stops the deadline of the session
+*/
+void closeSession(session_t * session);
+
+/*
+    Give back the memory of the session to its slab, after it is closed
+    Must be called by the thread that owns the slab
+*/
+void destroySession(session_t * session);
+
+/*
+    Read all the data available in the socket and process the complete messages
+    With the ring of the event loop the data is taken from the inbox instead of the socket
+    Returns 0 when the connection must be closed, 1 otherwise
+*/
+int sessionRead(session_t * session);
+
+/*
+    Send as much of the pending output as the socket accepts
+    The packets sent are counted: one for every write, or for every time the cork is removed
+    Returns 0 when the connection must be closed, 1 otherwise
+*/
+int sessionWrite(session_t * session);
+
+/*
+    Tell if there is output that could not be sent yet
+*/
+int sessionPendingOutput(session_t * session);
+
+#endif
@@ -0,0 +1,249 @@
+/*
+    Shoes of several decks used to deal the cards
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shoe.h"
+
+///// LOCAL FUNCTION DECLARATIONS
+static shoe_t * newShoe(shuffler_t * shuffler);
+static void shuffleShoe(shuffler_t * shuffler, shoe_t * shoe);
+static void * shufflerThread(void * arg);
+
+///// FUNCTION DEFINITIONS
+
+/*
+    Start the thread of a shuffler, with shoes of the number of decks indicated
+    The penetration is the percentage of the shoe dealt before the cut card
+*/
+shuffler_t * createShuffler(int decks, int penetration, int spares, uint64_t seed)
+{
+    shuffler_t * shuffler = NULL;
+    int status;
+
+    shuffler = malloc(sizeof (shuffler_t));
+    if (shuffler == NULL)
+    {
+        perror("ERROR: malloc");
+        exit(EXIT_FAILURE);
+    }
+    bzero(shuffler, sizeof (shuffler_t));
+
+    // Keep the values where a round can always be finished before the shoe is empty
+    shuffler->decks = (decks < 1) ? 1 : (decks > MAX_DECKS) ? MAX_DECKS : decks;
+    shuffler->penetration = (penetration < 10) ? 10 : (penetration > 90) ? 90 : penetration;
+    shuffler->spares = (spares < 1) ? 1 : spares;
+    shuffler->seed = seed;
+    shuffler->running = 1;
+    atomic_init(&shuffler->late, 0);
+    pthread_mutex_init(&shuffler->shoes_mutex, NULL);
+    pthread_cond_init(&shuffler->shoes_cond, NULL);
+
+    status = pthread_create(&shuffler->tid, NULL, shufflerThread, shuffler);
+    if (status != 0)
+    {
+        fprintf(stderr, "ERROR: pthread_create: %s\n", strerror(status));
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Dealing from shoes of %d decks with %d%% penetration\n", shuffler->decks, shuffler->penetration);
+
+    return shuffler;
+}
+
+/*
+    Get a shoe already shuffled
+    Only shuffles in the calling thread if there is no shoe ready
+*/
+shoe_t * takeShoe(shuffler_t * shuffler)
+{
+    shoe_t * shoe = NULL;
+
+    pthread_mutex_lock(&shuffler->shoes_mutex);
+    shoe = shuffler->ready;
+    if (shoe != NULL)
+    {
+        shuffler->ready = shoe->nextShoe;
+        shuffler->numReady--;
+    }
+    else if (shuffler->used != NULL)
+    {
+        shoe = shuffler->used;
+        shuffler->used = shoe->nextShoe;
+    }
+    else
+    {
+        shoe = newShoe(shuffler);
+    }
+    // Let the thread prepare the replacement
+    pthread_cond_signal(&shuffler->shoes_cond);
+    pthread_mutex_unlock(&shuffler->shoes_mutex);
+
+    // Only the shoes ready are already shuffled
+    if (shoe->next != 0)
+    {
+        atomic_fetch_add(&shuffler->late, 1);
+        shuffleShoe(shuffler, shoe);
+    }
+
+    return shoe;
+}
+
+/*
+    Give back a shoe that will not be used anymore, to be shuffled again
+*/
+void returnShoe(shuffler_t * shuffler, shoe_t * shoe)
+{
+    if (shoe == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&shuffler->shoes_mutex);
+    shoe->nextShoe = shuffler->used;
+    shuffler->used = shoe;
+    pthread_cond_signal(&shuffler->shoes_cond);
+    pthread_mutex_unlock(&shuffler->shoes_mutex);
+}
+
+/*
+    Print the counters of the shuffler
+*/
+void printShufflerStats(shuffler_t * shuffler)
+{
+    pthread_mutex_lock(&shuffler->shoes_mutex);
+    printf("Shoes: %ld created, %d ready, %ld shuffles, %ld of them done late by a dealer\n", shuffler->created, shuffler->numReady, shuffler->shuffles, atomic_load(&shuffler->late));
+    pthread_mutex_unlock(&shuffler->shoes_mutex);
+}
+
+/*
+    Stop the thread of the shuffler and free the shoes it has
+*/
+void destroyShuffler(shuffler_t * shuffler)
+{
+    shoe_t * shoe = NULL;
+
+    pthread_mutex_lock(&shuffler->shoes_mutex);
+    shuffler->running = 0;
+    pthread_cond_signal(&shuffler->shoes_cond);
+    pthread_mutex_unlock(&shuffler->shoes_mutex);
+
+    pthread_join(shuffler->tid, NULL);
+
+    while (shuffler->ready != NULL)
+    {
+        shoe = shuffler->ready;
+        shuffler->ready = shoe->nextShoe;
+        free(shoe);
+    }
+    while (shuffler->used != NULL)
+    {
+        shoe = shuffler->used;
+        shuffler->used = shoe->nextShoe;
+        free(shoe);
+    }
+
+    pthread_mutex_destroy(&shuffler->shoes_mutex);
+    pthread_cond_destroy(&shuffler->shoes_cond);
+    free(shuffler);
+}
+
+/*
+    Allocate a shoe with the cards of all the decks, marked as not shuffled
+    Must be called with the lock of the shuffler
+*/
+static shoe_t * newShoe(shuffler_t * shuffler)
+{
+    shoe_t * shoe = NULL;
+
+    shoe = malloc(sizeof (shoe_t));
+    if (shoe == NULL)
+    {
+        perror("ERROR: malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    shoe->numCards = shuffler->decks * DECK_CARDS;
+    for (int i=0; i<shoe->numCards; i++)
+    {
+        shoe->cards[i] = makeCard(i % CARD_RANKS, (i / CARD_RANKS) % CARD_SUITS);
+    }
+    shoe->cutCard = shoe->numCards * shuffler->penetration / 100;
+    // A shoe is shuffled when its next card is at the start
+    shoe->next = shoe->numCards;
+    shoe->nextShoe = NULL;
+    shuffler->created++;
+
+    return shoe;
+}
+
+/*
+    Order the cards of the shoe with the Fisher-Yates algorithm
+    Every shuffle uses its own stream of the seed, so it can be repeated from its number
+*/
+static void shuffleShoe(shuffler_t * shuffler, shoe_t * shoe)
+{
+    rng_t rng;
+    card_t card;
+    int other;
+
+    pthread_mutex_lock(&shuffler->shoes_mutex);
+    shoe->shuffle = shuffler->shuffles++;
+    pthread_mutex_unlock(&shuffler->shoes_mutex);
+
+    seedRandom(&rng, shuffler->seed, SHUFFLE_STREAMS | shoe->shuffle);
+    for (int i=shoe->numCards - 1; i>0; i--)
+    {
+        other = randomBelow(&rng, i + 1);
+        card = shoe->cards[i];
+        shoe->cards[i] = shoe->cards[other];
+        shoe->cards[other] = card;
+    }
+    shoe->next = 0;
+}
+
+/*
+    Keep the number of spare shoes ready, reusing the shoes given back
+*/
+static void * shufflerThread(void * arg)
+{
+    shuffler_t * shuffler = arg;
+    shoe_t * shoe = NULL;
+
+    pthread_mutex_lock(&shuffler->shoes_mutex);
+    while (shuffler->running)
+    {
+        if (shuffler->numReady >= shuffler->spares)
+        {
+            pthread_cond_wait(&shuffler->shoes_cond, &shuffler->shoes_mutex);
+            continue;
+        }
+
+        if (shuffler->used != NULL)
+        {
+            shoe = shuffler->used;
+            shuffler->used = shoe->nextShoe;
+        }
+        else
+        {
+            shoe = newShoe(shuffler);
+        }
+
+        // Shuffle without the lock, the dealers can keep taking the shoes ready
+        pthread_mutex_unlock(&shuffler->shoes_mutex);
+        shuffleShoe(shuffler, shoe);
+        pthread_mutex_lock(&shuffler->shoes_mutex);
+
+        shoe->nextShoe = shuffler->ready;
+        shuffler->ready = shoe;
+        shuffler->numReady++;
+    }
+    pthread_mutex_unlock(&shuffler->shoes_mutex);
+
+    return NULL;
+}
@@ -0,0 +1,115 @@
+/*
+    Shoes of several decks used to deal the cards
+    A shoe is dealt in order until it reaches the cut card, and then it is replaced.
+    The shoes are reused: the ones finished are given back to a shuffler,
+    whose own thread shuffles them and keeps them ready,
+    so the game never waits for a shuffle while dealing.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#ifndef SHOE_H
+#define SHOE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "cards.h"
+#include "rng.h"
+
+// Largest number of decks in a shoe
+#define MAX_DECKS 8
+#define DECK_CARDS (CARD_RANKS * CARD_SUITS)
+// Streams of the master seed used by the shuffles, apart from the streams of the sessions
+#define SHUFFLE_STREAMS 0x8000000000000000ULL
+
+// The cards of several decks, in the order they will be dealt
+typedef struct shoe_struct {
+    card_t cards[MAX_DECKS * DECK_CARDS];
+    int numCards;
+    // Position of the next card to deal
+    int next;
+    // Position of the cut card, the shoe is replaced when a round starts after it
+    int cutCard;
+    // Number of the shuffle, it is the stream of the seed used to order the cards
+    uint64_t shuffle;
+    // Link used by the lists of the shuffler
+    struct shoe_struct * nextShoe;
+} shoe_t;
+
+// Owner of all the shoes, and the thread that shuffles them
+typedef struct shuffler_struct {
+    int decks;
+    // Percentage of the shoe dealt before the cut card
+    int penetration;
+    // Number of shoes that should be always ready
+    int spares;
+    uint64_t seed;
+    // Shoes already shuffled, and shoes given back to be shuffled
+    shoe_t * ready;
+    int numReady;
+    shoe_t * used;
+    pthread_mutex_t shoes_mutex;
+    pthread_cond_t shoes_cond;
+    pthread_t tid;
+    int running;
+    // Counters for the reports
+    long shuffles;
+    long created;
+    // Shoes shuffled by the thread that needed them, because none was ready
+    atomic_long late;
+} shuffler_t;
+
+/*
+    Start the thread of a shuffler, with shoes of the number of decks indicated
+    The penetration is the percentage of the shoe dealt before the cut card
+*/
+shuffler_t * createShuffler(int decks, int penetration, int spares, uint64_t seed);
+
+/*
+    Get a shoe already shuffled
+    Only shuffles in the calling thread if there is no shoe ready
+*/
+shoe_t * takeShoe(shuffler_t * shuffler);
+
+/*
+    Give back a shoe that will not be used anymore, to be shuffled again
+*/
+void returnShoe(shuffler_t * shuffler, shoe_t * shoe);
+
+/*
+    Print the counters of the shuffler
+*/
+void printShufflerStats(shuffler_t * shuffler);
+
+/*
+    Stop the thread of the shuffler and free the shoes it has
+    The shoes that were not returned must be freed by the callers
+*/
+void destroyShuffler(shuffler_t * shuffler);
+
+/*
+    Tell if the shoe is past its cut card
+*/
+static inline int shoeFinished(const shoe_t * shoe)
+{
+    return shoe->next >= shoe->cutCard;
+}
+
+/*
+    Tell if the shoe has no more cards to deal
+*/
+static inline int shoeEmpty(const shoe_t * shoe)
+{
+    return shoe->next >= shoe->numCards;
+}
+
+/*
+    Take the next card of the shoe, it must not be empty
+*/
+static inline card_t drawCard(shoe_t * shoe)
+{
+    return shoe->cards[shoe->next++];
+}
+
+#endif
@@ -0,0 +1,664 @@
+/*
+    Simulation of many hands of blackjack, without clients
+    Every thread plays hands with the same rules used by the server,
+    taking the decisions of the player from a policy,
+    until the expected value is known with the precision requested.
+    The finished hands are settled in batches by the evaluator of batch.h.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "batch.h"
+#include "blackjack.h"
+#include "dealer.h"
+#include "policy.h"
+#include "rng.h"
+#include "shoe.h"
+#include "strategy.h"
+
+// Hands played by a thread before publishing its results
+#define BATCH_HANDS 4096
+// Milliseconds between the reports of the progress
+#define REPORT_INTERVAL 500
+// Hands needed before trusting the confidence interval to stop
+#define MIN_HANDS 100000
+// Bet of every hand, chosen so that a 3:2 payout is an integer
+#define UNIT_BET 2
+// Number of standard errors in a 95% confidence interval
+#define Z_95 1.959964
+// Batches of hands compared by the verification of the evaluators
+#define VERIFY_BATCHES 100000
+
+// Results accumulated, in chips of a bet of UNIT_BET
+typedef struct tally_struct {
+    long long hands;
+    long long sum;
+    long long squares;
+} tally_t;
+
+// Data of a single thread of the simulation
+typedef struct simulator_struct {
+    pthread_t tid;
+    int id;
+    struct simulation_struct * simulation;
+    game_t game;
+    // Results published by the thread, read by the main thread
+    pthread_mutex_t tally_mutex;
+    tally_t tally;
+} simulator_t;
+
+// Parameters of the simulation and the threads playing it
+typedef struct simulation_struct {
+    int numThreads;
+    simulator_t * simulators;
+    policy_t policy;
+    evaluator_t evaluator;
+    shuffler_t * shuffler;
+    uint64_t seed;
+    // Stop after this number of hands
+    long long maxHands;
+    // Stop when the half width of the confidence interval is this small
+    double precision;
+    // Hands taken by the threads so far, so they stop at maxHands
+    atomic_llong claimed;
+    atomic_int running;
+} simulation_t;
+
+// Global variable for the signal handler
+int interrupt_exit = 0;
+
+///// FUNCTION DECLARATIONS
+void usage(char * program);
+void setupHandlers();
+void detectInterruption(int signal);
+void runSimulation(simulation_t * simulation);
+void * simulatorThread(void * arg);
+void playHand(game_t * game, policy_t policy);
+int verifyEvaluators(simulation_t * simulation);
+int compareBatches(const hand_batch_t * expected, const hand_batch_t * batch, const char * name);
+void showDealerTables(int decks);
+void collectTally(simulation_t * simulation, tally_t * total);
+double halfWidth(const tally_t * tally);
+void printResults(const simulation_t * simulation, const tally_t * tally, double seconds);
+double elapsedSeconds(const struct timespec * start);
+
+///// MAIN FUNCTION
+int main(int argc, char * argv[])
+{
+    simulation_t simulation;
+    int decks = 6;
+    int penetration = 75;
+    int verify = 0;
+    int errors = 0;
+    int dealer = 0;
+    const strategy_file_t * strategy = NULL;
+    int option;
+
+    bzero(&simulation, sizeof simulation);
+    simulation.numThreads = 0;
+    simulation.policy = basicPolicy;
+    simulation.seed = randomSeed();
+    simulation.maxHands = 1000000000LL;
+    simulation.precision = 0.001;
+    simulation.evaluator = selectEvaluator();
+
+    printf("\n=== SIMULATION PROGRAM ===\n");
+
+    while ((option = getopt(argc, argv, "t:n:e:P:d:p:s:E:VDS:")) != -1)
+    {
+        switch (option)
+        {
+            case 't':
+                simulation.numThreads = atoi(optarg);
+                break;
+            case 'n':
+                simulation.maxHands = strtoll(optarg, NULL, 0);
+                break;
+            case 'e':
+                simulation.precision = atof(optarg);
+                break;
+            case 'P':
+                simulation.policy = findPolicy(optarg);
+                if (simulation.policy == NULL)
+                {
+                    printf("Unknown policy: %s\n", optarg);
+                    usage(argv[0]);
+                }
+                break;
+            case 'd':
+                decks = atoi(optarg);
+                break;
+            case 'p':
+                penetration = atoi(optarg);
+                break;
+            case 's':
+                simulation.seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'E':
+                if (strcmp(optarg, "scalar") == 0)
+                {
+                    simulation.evaluator = evaluateScalar;
+                }
+                else if (strcmp(optarg, "avx2") != 0 || !supportsAVX2())
+                {
+                    printf("Evaluator not available: %s\n", optarg);
+                    usage(argv[0]);
+                }
+                break;
+            case 'V':
+                verify = 1;
+                break;
+            case 'D':
+                dealer = 1;
+                break;
+            case 'S':
+                strategy = loadStrategy(optarg);
+                if (strategy == NULL)
+                {
+                    usage(argv[0]);
+                }
+                // The table is used by default when it is given
+                useStrategy(strategy);
+                simulation.policy = tablePolicy;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (argc - optind != 0)
+    {
+        usage(argv[0]);
+    }
+
+    if (simulation.numThreads <= 0)
+    {
+        simulation.numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (simulation.numThreads <= 0)
+        {
+            simulation.numThreads = 1;
+        }
+    }
+
+    if (dealer)
+    {
+        showDealerTables(decks);
+        return EXIT_SUCCESS;
+    }
+
+    // The steps of every hand are not shown
+    gameMessages = 0;
+
+    setupHandlers();
+
+    printf("Simulating with the seed %#" PRIx64 " on %d threads\n", simulation.seed, simulation.numThreads);
+    if (decks > 0)
+    {
+        // Keep enough shoes ready for all the threads
+        simulation.shuffler = createShuffler(decks, penetration, 2 * simulation.numThreads, simulation.seed);
+    }
+    else
+    {
+        printf("Dealing from an infinite deck\n");
+    }
+
+    if (verify)
+    {
+        errors = verifyEvaluators(&simulation);
+    }
+    else
+    {
+        printf("Settling the hands with the %s evaluator\n", evaluatorName(simulation.evaluator));
+        runSimulation(&simulation);
+    }
+
+    if (simulation.shuffler != NULL)
+    {
+        destroyShuffler(simulation.shuffler);
+    }
+    if (strategy != NULL)
+    {
+        unloadStrategy(strategy);
+    }
+
+    // The check fails when any evaluator differs, so it can be run by make test
+    return (errors > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+///// FUNCTION DEFINITIONS
+
+/*
+    Explanation to the user of the parameters required to run the program
+*/
+void usage(char * program)
+{
+    printf("Usage:\n");
+    printf("\t%s [-t threads] [-n max_hands] [-e precision] [-P policy] [-d decks] [-p penetration] [-s seed] [-E evaluator] [-V] [-D] [-S strategy_file]\n", program);
+    printf("\t-t: number of threads playing hands, one per processor by default\n");
+    printf("\t-n: largest number of hands to play, 1000000000 by default\n");
+    printf("\t-e: stop when the 95%% confidence interval of the expected value is within this distance, 0.001 by default\n");
+    printf("\t-P: decisions of the player, basic by default. The policies available are:\n");
+    printPolicies();
+    printf("\t-d: number of decks in a shoe, from 1 to %d, 6 by default. Use 0 to deal from an infinite deck\n", MAX_DECKS);
+    printf("\t-p: percentage of the shoe dealt before the cut card, 75 by default\n");
+    printf("\t-s: master seed used to deal the cards, taken from the clock by default\n");
+    printf("\t-E: evaluator that settles the hands, avx2 or scalar, the fastest supported by default\n");
+    printf("\t-V: instead of simulating, check that every evaluator gives the same results as the rules of the game\n");
+    printf("\t-D: instead of simulating, show the exact probabilities of the hands of the dealer\n");
+    printf("\t-S: table created by the solver, used by the table policy. Selects that policy unless -P comes later\n");
+    printf("\tSend SIGINT to stop early and show the results so far\n");
+    exit(EXIT_FAILURE);
+}
+
+/*
+    Modify the signal handlers for specific events
+*/
+void setupHandlers()
+{
+    struct sigaction new_action;
+
+    new_action.sa_handler = detectInterruption;
+    sigemptyset(&new_action.sa_mask);
+    new_action.sa_flags = 0;
+    sigaction(SIGINT, &new_action, NULL);
+}
+
+/*
+    Signal handler for Ctrl-C
+*/
+void detectInterruption(int signal)
+{
+    // Change the global variable
+    interrupt_exit = 1;
+}
+
+/*
+    Start the threads and report the progress until one of the conditions to stop is met
+*/
+void runSimulation(simulation_t * simulation)
+{
+    struct timespec start;
+    struct timespec pause = {REPORT_INTERVAL / 1000, (REPORT_INTERVAL % 1000) * 1000000L};
+    tally_t total;
+    sigset_t signal_mask;
+    sigset_t previous_mask;
+    double seconds;
+    double width;
+    int status;
+
+    atomic_init(&simulation->running, 1);
+    atomic_init(&simulation->claimed, 0);
+    simulation->simulators = malloc(simulation->numThreads * sizeof (simulator_t));
+    if (simulation->simulators == NULL)
+    {
+        perror("ERROR: malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // The threads inherit a mask without SIGINT, so it always interrupts the main thread
+    sigemptyset(&signal_mask);
+    sigaddset(&signal_mask, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &signal_mask, &previous_mask);
+    for (int i=0; i<simulation->numThreads; i++)
+    {
+        simulator_t * simulator = &simulation->simulators[i];
+
+        bzero(simulator, sizeof (simulator_t));
+        simulator->id = i;
+        simulator->simulation = simulation;
+        pthread_mutex_init(&simulator->tally_mutex, NULL);
+        seedRandom(&simulator->game.rng, simulation->seed, i);
+        simulator->game.shuffler = simulation->shuffler;
+
+        status = pthread_create(&simulator->tid, NULL, simulatorThread, simulator);
+        if (status != 0)
+        {
+            fprintf(stderr, "ERROR: pthread_create: %s\n", strerror(status));
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &previous_mask, NULL);
+
+    while (!interrupt_exit)
+    {
+        // Interrupted sleeps only need to check the flag again
+        if (nanosleep(&pause, NULL) == -1 && errno != EINTR)
+        {
+            perror("ERROR: nanosleep");
+            break;
+        }
+
+        collectTally(simulation, &total);
+        seconds = elapsedSeconds(&start);
+        width = halfWidth(&total) / UNIT_BET;
+        printf("%lld hands, EV %+.5f +- %.5f, %.0f hands per second\n", total.hands, (total.hands > 0) ? (double) total.sum / total.hands / UNIT_BET : 0.0, width, total.hands / seconds);
+
+        if (total.hands >= simulation->maxHands)
+        {
+            break;
+        }
+        if (total.hands >= MIN_HANDS && width <= simulation->precision)
+        {
+            printf("Reached the precision requested\n");
+            break;
+        }
+    }
+
+    atomic_store(&simulation->running, 0);
+    for (int i=0; i<simulation->numThreads; i++)
+    {
+        pthread_join(simulation->simulators[i].tid, NULL);
+        releaseShoe(&simulation->simulators[i].game);
+        pthread_mutex_destroy(&simulation->simulators[i].tally_mutex);
+    }
+
+    collectTally(simulation, &total);
+    printResults(simulation, &total, elapsedSeconds(&start));
+
+    free(simulation->simulators);
+}
+
+/*
+    Play batches of hands until the simulation stops, publishing the results after every batch
+*/
+void * simulatorThread(void * arg)
+{
+    simulator_t * simulator = arg;
+    simulation_t * simulation = simulator->simulation;
+    hand_batch_t batch;
+    tally_t tally;
+    long long first;
+    int hands;
+    int size;
+
+    bzero(&batch, sizeof batch);
+
+    while (atomic_load_explicit(&simulation->running, memory_order_relaxed))
+    {
+        // Take the hands of the batch, without going over the limit
+        first = atomic_fetch_add(&simulation->claimed, BATCH_HANDS);
+        if (first >= simulation->maxHands)
+        {
+            break;
+        }
+        hands = (simulation->maxHands - first < BATCH_HANDS) ? simulation->maxHands - first : BATCH_HANDS;
+
+        bzero(&tally, sizeof tally);
+        for (int i=0; i<hands; i+=BATCH_SIZE)
+        {
+            size = (hands - i < BATCH_SIZE) ? hands - i : BATCH_SIZE;
+            for (int j=0; j<size; j++)
+            {
+                playHand(&simulator->game, simulation->policy);
+                loadBatch(&batch, j, &simulator->game);
+            }
+            // The positions not played do not bet
+            for (int j=size; j<BATCH_SIZE; j++)
+            {
+                batch.bets[j] = 0;
+            }
+
+            simulation->evaluator(&batch);
+            for (int j=0; j<size; j++)
+            {
+                tally.sum += batch.results[j];
+                tally.squares += batch.results[j] * batch.results[j];
+            }
+        }
+        tally.hands = hands;
+
+        pthread_mutex_lock(&simulator->tally_mutex);
+        simulator->tally.hands += tally.hands;
+        simulator->tally.sum += tally.sum;
+        simulator->tally.squares += tally.squares;
+        pthread_mutex_unlock(&simulator->tally_mutex);
+    }
+
+    return NULL;
+}
+
+/*
+    Play a complete hand with the same steps used by the server, without settling the bet
+*/
+void playHand(game_t * game, policy_t policy)
+{
+    game->playerBet = UNIT_BET;
+    game->playerAmount = 0;
+
+    completeFirstDeal(game);
+
+    if ((game->playerStatus != NATURAL) && (game->dealerStatus != NATURAL))
+    {
+        // Keep asking the policy while the player can take more cards
+        do
+        {
+            game->playerStatus = policy(game);
+            playerTurn(game);
+        } while (game->playerStatus == HIT);
+
+        dealerTurn(game);
+    }
+}
+
+/*
+    Check the evaluators against calculateResults with hands played in a single thread,
+    and the AVX2 evaluator against the scalar one with random hands, including impossible ones
+    Returns the number of hands with different results
+*/
+int verifyEvaluators(simulation_t * simulation)
+{
+    hand_batch_t expected;
+    hand_batch_t batch;
+    game_t game;
+    rng_t rng;
+    int errors = 0;
+
+    bzero(&game, sizeof game);
+    bzero(&expected, sizeof expected);
+    seedRandom(&game.rng, simulation->seed, 0);
+    seedRandom(&rng, simulation->seed, 1);
+    game.shuffler = simulation->shuffler;
+
+    printf("Verifying the evaluators with %d batches of %d hands\n", VERIFY_BATCHES, BATCH_SIZE);
+
+    for (int i=0; i<VERIFY_BATCHES && !interrupt_exit; i++)
+    {
+        // Hands played, settled by the rules of the game
+        for (int j=0; j<BATCH_SIZE; j++)
+        {
+            playHand(&game, simulation->policy);
+            loadBatch(&expected, j, &game);
+            expected.playerTotal[j] = handTotal(&game.player);
+            expected.dealerTotal[j] = handTotal(&game.dealer);
+            // The statuses that were not decided while playing are not compared
+            expected.playerStatus[j] = (game.playerStatus == START) ? 0 : game.playerStatus;
+            expected.dealerStatus[j] = (game.dealerStatus == START) ? 0 : game.dealerStatus;
+            expected.results[j] = calculateResults(&game);
+        }
+
+        batch = expected;
+        evaluateScalar(&batch);
+        errors += compareBatches(&expected, &batch, "scalar");
+        if (supportsAVX2())
+        {
+            batch = expected;
+            evaluateAVX2(&batch);
+            errors += compareBatches(&expected, &batch, "AVX2");
+        }
+
+        // Random hands, only the two evaluators are compared
+        for (int j=0; j<BATCH_SIZE; j++)
+        {
+            expected.playerHard[j] = 2 + randomBelow(&rng, MAX_HARD_TOTAL - 1);
+            expected.playerAce[j] = randomBelow(&rng, 2);
+            expected.playerCards[j] = 2 + randomBelow(&rng, 4);
+            expected.dealerHard[j] = 2 + randomBelow(&rng, MAX_HARD_TOTAL - 1);
+            expected.dealerAce[j] = randomBelow(&rng, 2);
+            expected.dealerCards[j] = 2 + randomBelow(&rng, 4);
+            expected.bets[j] = randomBelow(&rng, 1000);
+        }
+        evaluateScalar(&expected);
+        if (supportsAVX2())
+        {
+            batch = expected;
+            evaluateAVX2(&batch);
+            errors += compareBatches(&expected, &batch, "AVX2 against scalar");
+        }
+    }
+
+    releaseShoe(&game);
+
+    printf("Evaluators checked: scalar%s. Hands with different results: %d\n", supportsAVX2() ? " and AVX2" : "", errors);
+
+    return errors;
+}
+
+/*
+    Compare the totals, statuses and results of an evaluation with the expected ones
+    A status of 0 in the expected batch is not compared
+    Returns the number of hands that are different
+*/
+int compareBatches(const hand_batch_t * expected, const hand_batch_t * batch, const char * name)
+{
+    int errors = 0;
+
+    for (int i=0; i<BATCH_SIZE; i++)
+    {
+        if ((expected->playerTotal[i] != batch->playerTotal[i]) || (expected->dealerTotal[i] != batch->dealerTotal[i])
+            || (expected->playerStatus[i] != 0 && expected->playerStatus[i] != batch->playerStatus[i])
+            || (expected->dealerStatus[i] != 0 && expected->dealerStatus[i] != batch->dealerStatus[i])
+            || (expected->results[i] != batch->results[i]))
+        {
+            printf("Different result of the %s evaluator: player %d (%d cards, status %d), dealer %d (%d cards, status %d), bet %d: expected %d, got %d\n",
+                name, batch->playerTotal[i], batch->playerCards[i], batch->playerStatus[i], batch->dealerTotal[i], batch->dealerCards[i], batch->dealerStatus[i],
+                batch->bets[i], expected->results[i], batch->results[i]);
+            errors++;
+        }
+    }
+
+    return errors;
+}
+
+/*
+    Show the outcomes of the dealer for an infinite deck and a new shoe,
+    with the time to compute the table of the shoe and to find it again in the cache
+*/
+void showDealerTables(int decks)
+{
+    dealer_cache_t * cache = createDealerCache(16);
+    dealer_table_t table;
+    struct timespec start;
+    int counts[CARD_VALUES];
+
+    printf("\n/////DEALER WITH AN INFINITE DECK/////\n");
+    printDealerTable(infiniteDealerTable());
+
+    if (decks <= 0)
+    {
+        destroyDealerCache(cache);
+        return;
+    }
+
+    freshComposition(counts, (decks > MAX_DECKS) ? MAX_DECKS : decks);
+
+    printf("\n/////DEALER WITH A NEW SHOE OF %d DECKS/////\n", (decks > MAX_DECKS) ? MAX_DECKS : decks);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    lookupDealerTable(cache, counts, &table);
+    printf("Computed in %.3f milliseconds\n", elapsedSeconds(&start) * 1000);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    lookupDealerTable(cache, counts, &table);
+    printf("Found again in the cache in %.3f microseconds\n", elapsedSeconds(&start) * 1000000);
+    printDealerTable(&table);
+    printDealerCacheStats(cache);
+
+    destroyDealerCache(cache);
+}
+
+/*
+    Add the results published by all the threads
+*/
+void collectTally(simulation_t * simulation, tally_t * total)
+{
+    bzero(total, sizeof (tally_t));
+
+    for (int i=0; i<simulation->numThreads; i++)
+    {
+        simulator_t * simulator = &simulation->simulators[i];
+
+        pthread_mutex_lock(&simulator->tally_mutex);
+        total->hands += simulator->tally.hands;
+        total->sum += simulator->tally.sum;
+        total->squares += simulator->tally.squares;
+        pthread_mutex_unlock(&simulator->tally_mutex);
+    }
+}
+
+/*
+    Half the width of the 95% confidence interval of the mean, in chips
+*/
+double halfWidth(const tally_t * tally)
+{
+    double mean;
+    double variance;
+
+    if (tally->hands < 2)
+    {
+        return INFINITY;
+    }
+
+    mean = (double) tally->sum / tally->hands;
+    variance = ((double) tally->squares / tally->hands - mean * mean) * tally->hands / (tally->hands - 1);
+
+    return Z_95 * sqrt(variance / tally->hands);
+}
+
+/*
+    Show the expected value and variance per unit bet, and the speed of the simulation
+*/
+void printResults(const simulation_t * simulation, const tally_t * tally, double seconds)
+{
+    double mean;
+    double variance;
+    double width;
+
+    if (tally->hands < 2)
+    {
+        printf("Not enough hands were played\n");
+        return;
+    }
+
+    mean = (double) tally->sum / tally->hands / UNIT_BET;
+    variance = ((double) tally->squares / tally->hands - ((double) tally->sum / tally->hands) * ((double) tally->sum / tally->hands)) * tally->hands / (tally->hands - 1) / (UNIT_BET * UNIT_BET);
+    width = halfWidth(tally) / UNIT_BET;
+
+    printf("\n/////RESULTS/////\n");
+    printf("Hands played: %lld\n", tally->hands);
+    printf("Expected value per unit bet: %+.5f (%+.3f%%)\n", mean, mean * 100);
+    printf("Variance: %.5f, standard deviation: %.5f\n", variance, sqrt(variance));
+    printf("95%% confidence interval: [%+.5f, %+.5f]\n", mean - width, mean + width);
+    printf("Time: %.2f seconds, %.0f hands per second on %d threads\n", seconds, tally->hands / seconds, simulation->numThreads);
+}
+
+/*
+    Seconds since the time indicated
+*/
+double elapsedSeconds(const struct timespec * start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
@@ -0,0 +1,185 @@
+/*
+    Memory for many objects of the same size, like the sessions of the clients
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "slab.h"
+
+// Space used by the header at the start of every chunk
+#define CHUNK_HEADER ((sizeof (slab_chunk_t) + SLAB_ALIGN - 1) / SLAB_ALIGN * SLAB_ALIGN)
+
+///// LOCAL FUNCTION DECLARATIONS
+static int addChunk(slab_t * slab);
+
+///// FUNCTION DEFINITIONS
+
+/*
+    Prepare an empty slab for objects of the size indicated
+    No memory is taken until the first object is requested
+*/
+slab_t * createSlab(size_t objectSize, long maxObjects, int hugePages)
+{
+    slab_t * slab = NULL;
+
+    slab = malloc(sizeof (slab_t));
+    if (slab == NULL)
+    {
+        perror("ERROR: malloc");
+        exit(EXIT_FAILURE);
+    }
+    bzero(slab, sizeof (slab_t));
+
+    slab->objectSize = objectSize;
+    slab->slotSize = (objectSize + SLAB_ALIGN - 1) / SLAB_ALIGN * SLAB_ALIGN;
+    slab->objectsPerChunk = (SLAB_CHUNK - CHUNK_HEADER) / slab->slotSize;
+    if (slab->objectsPerChunk < 1)
+    {
+        printf("Error: objects of %zu bytes do not fit in a chunk of the slab\n", objectSize);
+        exit(EXIT_FAILURE);
+    }
+    slab->maxObjects = maxObjects;
+    slab->hugePages = hugePages;
+
+    return slab;
+}
+
+/*
+    Get an object, reusing a freed one if possible
+    Returns NULL if the slab reached its limit or there is no more memory
+*/
+void * slabAlloc(slab_t * slab)
+{
+    void * object = NULL;
+
+    if (slab->maxObjects > 0 && slab->inUse >= slab->maxObjects)
+    {
+        slab->refused++;
+        return NULL;
+    }
+
+    if (slab->freeList != NULL)
+    {
+        object = slab->freeList;
+        slab->freeList = slab->freeList->next;
+    }
+    else
+    {
+        if (slab->next == NULL || slab->next + slab->slotSize > slab->end)
+        {
+            if (!addChunk(slab))
+            {
+                slab->refused++;
+                return NULL;
+            }
+        }
+        object = slab->next;
+        slab->next += slab->slotSize;
+    }
+
+    slab->inUse++;
+    slab->allocations++;
+    if (slab->inUse > slab->peak)
+    {
+        slab->peak = slab->inUse;
+    }
+    return object;
+}
+
+/*
+    Give back an object to be used again
+    The objects freed last are reused first, while their memory is still in the cache
+*/
+void slabFree(slab_t * slab, void * object)
+{
+    slab_free_t * entry = object;
+
+    entry->next = slab->freeList;
+    slab->freeList = entry;
+    slab->inUse--;
+}
+
+/*
+    Print the objects in use, the memory taken and the bytes used for every object
+*/
+void printSlabStats(slab_t * slab, const char * name)
+{
+    size_t mapped = slab->numChunks * (size_t) SLAB_CHUNK;
+
+    printf("Slab of %s: %ld in use, %ld at most, %lld allocations, %lld refused", name, slab->inUse, slab->peak, slab->allocations, slab->refused);
+    if (slab->maxObjects > 0)
+    {
+        printf(", limit of %ld", slab->maxObjects);
+    }
+    printf("\n");
+    printf("\t%zu bytes per object (%zu with alignment), %d per chunk, %ld chunks of %d KB (%ld in huge pages), %zu KB mapped",
+        slab->objectSize, slab->slotSize, slab->objectsPerChunk, slab->numChunks, SLAB_CHUNK / 1024, slab->hugeChunks, mapped / 1024);
+    if (slab->peak > 0)
+    {
+        printf(", %zu bytes per object at the peak", mapped / slab->peak);
+    }
+    printf("\n");
+}
+
+/*
+    Give back all the chunks to the system
+*/
+void destroySlab(slab_t * slab)
+{
+    slab_chunk_t * chunk = slab->chunks;
+    slab_chunk_t * next = NULL;
+
+    while (chunk != NULL)
+    {
+        next = chunk->next;
+        if (munmap(chunk, SLAB_CHUNK) == -1)
+        {
+            perror("ERROR: munmap");
+        }
+        chunk = next;
+    }
+    free(slab);
+}
+
+/*
+    Map a new chunk and start cutting the objects from it
+    Uses huge pages if they were requested and the system has them, normal pages otherwise
+    Returns 1 on success, or 0 if there is no memory
+*/
+static int addChunk(slab_t * slab)
+{
+    slab_chunk_t * chunk = MAP_FAILED;
+    int huge = 0;
+
+#ifdef MAP_HUGETLB
+    if (slab->hugePages)
+    {
+        chunk = mmap(NULL, SLAB_CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        huge = (chunk != MAP_FAILED);
+    }
+#endif
+    if (chunk == MAP_FAILED)
+    {
+        chunk = mmap(NULL, SLAB_CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (chunk == MAP_FAILED)
+        {
+            perror("ERROR: mmap");
+            return 0;
+        }
+    }
+
+    chunk->huge = huge;
+    chunk->next = slab->chunks;
+    slab->chunks = chunk;
+    slab->numChunks++;
+    slab->hugeChunks += huge;
+
+    slab->next = (char *) chunk + CHUNK_HEADER;
+    slab->end = slab->next + slab->objectsPerChunk * slab->slotSize;
+    return 1;
+}
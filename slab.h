@@ -0,0 +1,91 @@
+/*
+    Memory for many objects of the same size, like the sessions of the clients
+    The objects are cut from big chunks taken with mmap, and the ones freed are kept
+    in a list to be used again, so the memory never goes back to the system and
+    the server does not fragment the heap while the players connect and leave.
+    The chunks are cut as the objects are needed, so the pages not used are never touched.
+
+    The chunks can be backed by huge pages, when the system has them reserved
+    (see /proc/sys/vm/nr_hugepages), or by normal pages otherwise.
+    A limit of objects gives a fixed ceiling of the memory used.
+    A slab must be used by a single thread.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+// Size of every chunk, the size of a huge page
+#define SLAB_CHUNK (2 * 1024 * 1024)
+// The objects are aligned to the cache lines, so two threads never share a line
+#define SLAB_ALIGN 64
+
+// Start of every chunk, followed by its objects
+typedef struct slab_chunk_struct {
+    struct slab_chunk_struct * next;
+    // The chunk is backed by huge pages
+    int huge;
+} slab_chunk_t;
+
+// An object not in use, linked in the list of free objects
+typedef struct slab_free_struct {
+    struct slab_free_struct * next;
+} slab_free_t;
+
+// The chunks and the objects of a single size
+typedef struct slab_struct {
+    // Size requested, and size used by every object with its alignment
+    size_t objectSize;
+    size_t slotSize;
+    int objectsPerChunk;
+    // Most objects in use at the same time, 0 for no limit
+    long maxObjects;
+    int hugePages;
+    slab_chunk_t * chunks;
+    slab_free_t * freeList;
+    // Next object not cut yet from the newest chunk, and the end of that chunk
+    char * next;
+    char * end;
+    // Counters for the report
+    long inUse;
+    long peak;
+    long numChunks;
+    long hugeChunks;
+    long long allocations;
+    long long refused;
+} slab_t;
+
+/*
+    Prepare an empty slab for objects of the size indicated
+    Receives the most objects in use at the same time, 0 for no limit,
+    and whether to try to use huge pages
+*/
+slab_t * createSlab(size_t objectSize, long maxObjects, int hugePages);
+
+/*
+    Get an object, reusing a freed one if possible
+    The memory of the object is not cleared
+    Returns NULL if the slab reached its limit or there is no more memory
+*/
+void * slabAlloc(slab_t * slab);
+
+/*
+    Give back an object to be used again
+*/
+void slabFree(slab_t * slab, void * object);
+
+/*
+    Print the objects in use, the memory taken and the bytes used for every object
+*/
+void printSlabStats(slab_t * slab, const char * name);
+
+/*
+    Give back all the chunks to the system
+    The objects can not be used after this
+*/
+void destroySlab(slab_t * slab);
+
+#endif
@@ -47,10 +47,11 @@ void printLocalIPs()
 
 /*
     Prepare and open the listening socket
+    With sharePort, several sockets can listen on the same port and the kernel spreads the connections among them
     Returns the file descriptor for the socket
     Remember to close the socket when finished
 */
-int initServer(char * port, int max_queue)
+int initServer(char * port, int max_queue, int sharePort)
 {
     struct addrinfo hints;
     struct addrinfo * server_info = NULL;
@@ -94,6 +95,13 @@ int initServer(char * port, int max_queue)
         perror("ERROR: setsockopt");
         exit(EXIT_FAILURE);
     }
+    // Every socket bound to the port gets its own queue of connections
+    if (sharePort && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof (int)) == -1)
+    {
+        close(server_fd);
+        perror("ERROR: setsockopt");
+        exit(EXIT_FAILURE);
+    }
 
     // BIND
     // Connect the port with the desired port
@@ -178,43 +186,373 @@ int connectSocket(char * address, char * port)
 }
 
 /*
-    Receive a stream of data from a socket
-    Receive the file descriptor of the socket, a pointer to where to store the data and the maximum size avaliable
+    Receive a complete message from a socket, waiting for all of its parts
+    Receive the file descriptor of the socket, a pointer to where to store the data and the size of the message
     Returns 1 on successful receipt, or 0 if the connection has finished
 */
 int recvData(int connection_fd, void * buffer, int size)
 {
+    char * position = buffer;
     int chars_read;
 
-    // Clear the buffer
-    bzero(buffer, size);
+    // TCP does not keep the limits of the messages, a single read can get only part of one
+    while (size > 0)
+    {
+        chars_read = recv(connection_fd, position, size, 0);
+        // Error when reading
+        if ( chars_read == -1 )
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("ERROR: recv");
+            return 0;
+        }
+        // Connection finished
+        if ( chars_read == 0 )
+        {
+            printf("Connection disconnected\n");
+            return 0;
+        }
+        position += chars_read;
+        size -= chars_read;
+    }
+
+    return 1;
+}
+
+/*
+    Send a message with error validation, repeating until all the bytes are sent
+    Receive the file descriptor, the pointer to the data, and the size of the data to send
+    Returns 1 on success, or 0 if the connection failed
+*/
+int sendData(int connection_fd, void * buffer, int size)
+{
+    struct iovec part;
+
+    part.iov_base = buffer;
+    part.iov_len = size;
+
+    return sendVector(connection_fd, &part, 1);
+}
+
+/*
+    Send several buffers with a single system call, repeating after short writes
+    Returns 1 on success, or 0 if the connection failed
+*/
+int sendVector(int connection_fd, struct iovec * parts, int count)
+{
+    struct msghdr message;
+    ssize_t chars_sent;
+
+    while (count > 0)
+    {
+        bzero(&message, sizeof message);
+        message.msg_iov = parts;
+        message.msg_iovlen = count;
+
+        // Do not get killed by SIGPIPE if the other side closed the connection
+        chars_sent = sendmsg(connection_fd, &message, MSG_NOSIGNAL);
+        if ( chars_sent == -1 )
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("ERROR: send");
+            return 0;
+        }
+
+        // Skip the buffers already sent, and the part sent of the next one
+        while (count > 0 && (size_t) chars_sent >= parts->iov_len)
+        {
+            chars_sent -= parts->iov_len;
+            parts++;
+            count--;
+        }
+        if (count > 0)
+        {
+            parts->iov_base = (char *) parts->iov_base + chars_sent;
+            parts->iov_len -= chars_sent;
+        }
+    }
+
+    return 1;
+}
+
+/*
+    Read all the data available in a non-blocking socket, adding it after the bytes already in the buffer
+    Receive the file descriptor, the buffer, the number of bytes stored in it and its capacity
+    Returns RECV_CLOSED, RECV_AGAIN or RECV_FULL
+*/
+int recvAvailable(int connection_fd, char * buffer, int * length, int capacity)
+{
+    int chars_read;
 
-    // Read the request from the client
-    chars_read = recv(connection_fd, buffer, size, 0);
-    // Error when reading
-    if ( chars_read == -1 )
+    while (*length < capacity)
     {
-        perror("ERROR: recv");
+        chars_read = recv(connection_fd, buffer + *length, capacity - *length, 0);
+        if (chars_read > 0)
+        {
+            *length += chars_read;
+        }
+        // Connection finished
+        else if (chars_read == 0)
+        {
+            return RECV_CLOSED;
+        }
+        else if (errno == EINTR)
+        {
+            continue;
+        }
+        // Nothing else to read for now
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            return RECV_AGAIN;
+        }
+        else
+        {
+            perror("ERROR: recv");
+            return RECV_CLOSED;
+        }
     }
-    // Connection finished
-    if ( chars_read == 0 )
+
+    return RECV_FULL;
+}
+
+/*
+    Prepare an empty outbox using the memory indicated
+*/
+void initOutbox(outbox_t * outbox, char * data, int capacity)
+{
+    outbox->data = data;
+    outbox->capacity = capacity;
+    outbox->start = 0;
+    outbox->length = 0;
+    outbox->sends = 0;
+}
+
+/*
+    Add a message at the end of the outbox
+    Returns 1 on success, or 0 if there is not enough space
+*/
+int queueOutput(outbox_t * outbox, const void * data, int size)
+{
+    int end;
+    int first_part;
+
+    if (size > outboxSpace(outbox))
     {
-        printf("Connection disconnected\n");
         return 0;
     }
 
+    // The message can be split between the end and the start of the array
+    end = (outbox->start + outbox->length) % outbox->capacity;
+    first_part = outbox->capacity - end;
+    if (first_part > size)
+    {
+        first_part = size;
+    }
+    memcpy(outbox->data + end, data, first_part);
+    memcpy(outbox->data, (const char *) data + first_part, size - first_part);
+    outbox->length += size;
+
     return 1;
 }
 
 /*
-    Send a message with error validation
-    Receive the file descriptor, the pointer to the data, and the size of the data to send
+    Get the number of bytes that can still be added to the outbox
 */
-void sendData(int connection_fd, void * buffer, int size)
+int outboxSpace(outbox_t * outbox)
 {
-    // Send a message to the client, including an extra character for the '\0'
-    if ( send(connection_fd, buffer, size, 0) == -1 )
+    return outbox->capacity - outbox->length;
+}
+
+/*
+    Prepare an empty inbox using the memory indicated
+*/
+void initInbox(inbox_t * inbox, char * data, int capacity)
+{
+    inbox->data = data;
+    inbox->capacity = capacity;
+    atomic_init(&inbox->taken, 0);
+    atomic_init(&inbox->stored, 0);
+    atomic_init(&inbox->closed, 0);
+}
+
+/*
+    Add the bytes received at the end of the inbox
+    The bytes are written before the counter is moved, so the reader never sees them incomplete
+    Returns 1 on success, or 0 if there is not enough space
+*/
+int storeInput(inbox_t * inbox, const void * data, int size)
+{
+    unsigned long long stored = atomic_load_explicit(&inbox->stored, memory_order_relaxed);
+    unsigned long long taken = atomic_load_explicit(&inbox->taken, memory_order_acquire);
+    int position = stored % inbox->capacity;
+    int first;
+
+    if (inbox->capacity - (int) (stored - taken) < size)
     {
-        perror("ERROR: send");
+        return 0;
     }
+
+    // The bytes may go around the end of the buffer
+    first = (position + size <= inbox->capacity) ? size : inbox->capacity - position;
+    memcpy(inbox->data + position, data, first);
+    memcpy(inbox->data, (const char *) data + first, size - first);
+
+    atomic_store_explicit(&inbox->stored, stored + size, memory_order_release);
+    return 1;
+}
+
+/*
+    Mark the end of the connection, after the bytes already stored
+*/
+void closeInbox(inbox_t * inbox)
+{
+    atomic_store_explicit(&inbox->closed, 1, memory_order_release);
+}
+
+/*
+    Take all the bytes waiting in the inbox, adding them after the bytes already in the buffer
+    Returns RECV_CLOSED, RECV_AGAIN or RECV_FULL
+*/
+int takeInput(inbox_t * inbox, char * buffer, int * length, int capacity)
+{
+    // Checked first, so all the bytes stored before the end are seen
+    int closed = atomic_load_explicit(&inbox->closed, memory_order_acquire);
+    unsigned long long stored = atomic_load_explicit(&inbox->stored, memory_order_acquire);
+    unsigned long long taken = atomic_load_explicit(&inbox->taken, memory_order_relaxed);
+    int waiting = stored - taken;
+    int size = (waiting < capacity - *length) ? waiting : capacity - *length;
+    int position = taken % inbox->capacity;
+    int first;
+
+    first = (position + size <= inbox->capacity) ? size : inbox->capacity - position;
+    memcpy(buffer + *length, inbox->data + position, first);
+    memcpy(buffer + *length + first, inbox->data, size - first);
+    *length += size;
+    atomic_store_explicit(&inbox->taken, taken + size, memory_order_release);
+
+    if (size < waiting)
+    {
+        return RECV_FULL;
+    }
+    if (closed)
+    {
+        return RECV_CLOSED;
+    }
+    return RECV_AGAIN;
+}
+
+/*
+    Send as much of the outbox as a non-blocking socket accepts, using vectored writes
+    Returns 1 if the connection is still valid, even if there are bytes left, or 0 if it failed
+*/
+int flushOutput(int connection_fd, outbox_t * outbox)
+{
+    struct iovec parts[2];
+    struct msghdr message;
+    ssize_t chars_sent;
+
+    while (outbox->length > 0)
+    {
+        bzero(&message, sizeof message);
+        message.msg_iov = parts;
+
+        // All the messages queued go in the same call, in one or two parts of the array
+        parts[0].iov_base = outbox->data + outbox->start;
+        if (outbox->start + outbox->length <= outbox->capacity)
+        {
+            parts[0].iov_len = outbox->length;
+            message.msg_iovlen = 1;
+        }
+        else
+        {
+            parts[0].iov_len = outbox->capacity - outbox->start;
+            parts[1].iov_base = outbox->data;
+            parts[1].iov_len = outbox->length - parts[0].iov_len;
+            message.msg_iovlen = 2;
+        }
+
+        chars_sent = sendmsg(connection_fd, &message, MSG_NOSIGNAL);
+        if (chars_sent >= 0)
+        {
+            outbox->sends++;
+            outbox->start = (outbox->start + chars_sent) % outbox->capacity;
+            outbox->length -= chars_sent;
+        }
+        else if (errno == EINTR)
+        {
+            continue;
+        }
+        // The socket is full, wait until it can be written again
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            return 1;
+        }
+        else
+        {
+            perror("ERROR: send");
+            return 0;
+        }
+    }
+
+    // Keep the next messages in a single part
+    outbox->start = 0;
+
+    return 1;
+}
+
+/*
+    Change a socket to non-blocking mode, to be used with an event loop
+    Returns 0 on success, -1 on error
+*/
+int setNonBlocking(int socket_fd)
+{
+    int flags;
+
+    flags = fcntl(socket_fd, F_GETFL, 0);
+    if (flags == -1 || fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+        perror("ERROR: fcntl");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+    Send every write as soon as possible, without waiting to join it with the next ones
+    For programs that already join their messages before writing them
+    Returns 0 on success, -1 on error
+*/
+int setNoDelay(int socket_fd)
+{
+    int enabled = 1;
+
+    if (setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof (int)) == -1)
+    {
+        perror("ERROR: setsockopt");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+    Hold the writes of a socket to send them in full packets, or send everything held
+    Returns 0 on success, -1 on error
+*/
+int setCork(int socket_fd, int enabled)
+{
+    if (setsockopt(socket_fd, IPPROTO_TCP, TCP_CORK, &enabled, sizeof (int)) == -1)
+    {
+        perror("ERROR: setsockopt");
+        return -1;
+    }
+
+    return 0;
 }
@@ -22,6 +22,39 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <ifaddrs.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <stdatomic.h>
+
+// Results of reading from a non-blocking socket
+#define RECV_CLOSED 0   // The connection finished or failed
+#define RECV_AGAIN 1    // Everything available was read
+#define RECV_FULL 2     // The buffer is full, there may be more data waiting
+
+// Circular buffer of the bytes waiting to be sent through a non-blocking socket
+typedef struct outbox_struct {
+    char * data;
+    int capacity;
+    // Position of the first byte to send, and number of bytes stored
+    int start;
+    int length;
+    // Number of writes done
+    long long sends;
+} outbox_t;
+
+// Circular buffer of the bytes received for a socket by another thread, that reads them without locks
+// A single thread stores the bytes and a single thread takes them
+typedef struct inbox_struct {
+    char * data;
+    int capacity;
+    // Bytes taken and bytes stored since the start, their difference is the number of bytes waiting
+    atomic_ullong taken;
+    atomic_ullong stored;
+    // The connection finished after the bytes stored
+    atomic_int closed;
+} inbox_t;
 
 /*
 	Show the local IP addresses, to allow testing
@@ -32,10 +65,11 @@ void printLocalIPs();
 
 /*
     Prepare and open the listening socket
+    With sharePort, several sockets can listen on the same port and the kernel spreads the connections among them
     Returns the file descriptor for the socket
     Remember to close the socket when finished
 */
-int initServer(char * port, int max_queue);
+int initServer(char * port, int max_queue, int sharePort);
 
 /*
     Open and connect the socket to the server
@@ -45,16 +79,94 @@ int initServer(char * port, int max_queue);
 int connectSocket(char * address, char * port);
 
 /*
-    Receive a stream of data from a socket
-    Receive the file descriptor of the socket, a pointer to where to store the data and the maximum size avaliable
+    Receive a complete message from a socket, waiting for all of its parts
+    Receive the file descriptor of the socket, a pointer to where to store the data and the size of the message
     Returns 1 on successful receipt, or 0 if the connection has finished
 */
 int recvData(int connection_fd, void * buffer, int size);
 
 /*
-    Send a message with error validation
+    Send a message with error validation, repeating until all the bytes are sent
     Receive the file descriptor, the pointer to the data, and the size of the data to send
+    Returns 1 on success, or 0 if the connection failed
+*/
+int sendData(int connection_fd, void * buffer, int size);
+
+/*
+    Send several buffers with a single system call, repeating after short writes
+    Returns 1 on success, or 0 if the connection failed
+*/
+int sendVector(int connection_fd, struct iovec * parts, int count);
+
+/*
+    Read all the data available in a non-blocking socket, adding it after the bytes already in the buffer
+    Receive the file descriptor, the buffer, the number of bytes stored in it and its capacity
+    Returns RECV_CLOSED, RECV_AGAIN or RECV_FULL
+*/
+int recvAvailable(int connection_fd, char * buffer, int * length, int capacity);
+
+/*
+    Prepare an empty outbox using the memory indicated
+*/
+void initOutbox(outbox_t * outbox, char * data, int capacity);
+
+/*
+    Add a message at the end of the outbox
+    Returns 1 on success, or 0 if there is not enough space
+*/
+int queueOutput(outbox_t * outbox, const void * data, int size);
+
+/*
+    Get the number of bytes that can still be added to the outbox
+*/
+int outboxSpace(outbox_t * outbox);
+
+/*
+    Prepare an empty inbox using the memory indicated
+*/
+void initInbox(inbox_t * inbox, char * data, int capacity);
+
+/*
+    Add the bytes received at the end of the inbox
+    Returns 1 on success, or 0 if there is not enough space
+*/
+int storeInput(inbox_t * inbox, const void * data, int size);
+
+/*
+    Mark the end of the connection, after the bytes already stored
+*/
+void closeInbox(inbox_t * inbox);
+
+/*
+    Take all the bytes waiting in the inbox, adding them after the bytes already in the buffer
+    Works like recvAvailable, for the bytes received by another thread
+    Returns RECV_CLOSED, RECV_AGAIN or RECV_FULL
+*/
+int takeInput(inbox_t * inbox, char * buffer, int * length, int capacity);
+
+/*
+    Send as much of the outbox as a non-blocking socket accepts, using vectored writes
+    Returns 1 if the connection is still valid, even if there are bytes left, or 0 if it failed
+*/
+int flushOutput(int connection_fd, outbox_t * outbox);
+
+/*
+    Change a socket to non-blocking mode, to be used with an event loop
+    Returns 0 on success, -1 on error
+*/
+int setNonBlocking(int socket_fd);
+
+/*
+    Send every write as soon as possible, without waiting to join it with the next ones
+    For programs that already join their messages before writing them
+    Returns 0 on success, -1 on error
+*/
+int setNoDelay(int socket_fd);
+
+/*
+    Hold the writes of a socket to send them in full packets, or send everything held
+    Returns 0 on success, -1 on error
 */
-void sendData(int connection_fd, void * buffer, int size);
+int setCork(int socket_fd, int enabled);
 
 #endif
@@ -0,0 +1,254 @@
+/*
+    Solver of the best decisions of the player
+    For every hand of the player and up card of the dealer it computes
+    the expected value of standing and of taking another card,
+    using the exact outcomes of the dealer, and writes the table used by the other programs.
+
+    The dealer outcomes only count the rounds where the dealer has no natural,
+    because the player only decides when neither of them got one.
+    With a shoe, the cards drawn by the player are taken from the composition of a new shoe.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "dealer.h"
+#include "strategy.h"
+
+///// FUNCTION DECLARATIONS
+void usage(char * program);
+void solveStrategy(strategy_file_t * strategy, int decks);
+double standValue(int total, const double dealer[DEALER_OUTCOMES]);
+void printStrategy(const strategy_file_t * strategy);
+
+///// MAIN FUNCTION
+int main(int argc, char * argv[])
+{
+    strategy_file_t strategy;
+    const char * path = "strategy.bin";
+    struct timespec start;
+    struct timespec end;
+    int decks = 6;
+    int option;
+
+    printf("\n=== SOLVER PROGRAM ===\n");
+
+    while ((option = getopt(argc, argv, "d:o:")) != -1)
+    {
+        switch (option)
+        {
+            case 'd':
+                decks = atoi(optarg);
+                break;
+            case 'o':
+                path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (argc - optind != 0)
+    {
+        usage(argv[0]);
+    }
+    if (decks > MAX_DECKS)
+    {
+        decks = MAX_DECKS;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    solveStrategy(&strategy, decks);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (decks > 0)
+    {
+        printf("Solved for shoes of %d decks", decks);
+    }
+    else
+    {
+        printf("Solved for an infinite deck");
+    }
+    printf(" in %.3f milliseconds\n", (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1e6);
+
+    printStrategy(&strategy);
+
+    if (!writeStrategy(path, &strategy))
+    {
+        exit(EXIT_FAILURE);
+    }
+    printf("Table of %zu bytes written to %s\n", sizeof strategy, path);
+
+    return 0;
+}
+
+///// FUNCTION DEFINITIONS
+
+/*
+    Explanation to the user of the parameters required to run the program
+*/
+void usage(char * program)
+{
+    printf("Usage:\n");
+    printf("\t%s [-d decks] [-o output_file]\n", program);
+    printf("\t-d: number of decks in a shoe, from 1 to %d, 6 by default. Use 0 for an infinite deck\n", MAX_DECKS);
+    printf("\t-o: file where the table is written, strategy.bin by default\n");
+    exit(EXIT_FAILURE);
+}
+
+/*
+    Fill the table with the expected values and the best decision of every hand
+    The hands are solved from the largest hard total down, so the hands reached
+    after taking a card are always solved before
+*/
+void solveStrategy(strategy_file_t * strategy, int decks)
+{
+    dealer_table_t shoeTable;
+    const dealer_table_t * table = NULL;
+    double dealer[DEALER_OUTCOMES];
+    double draw[CARD_VALUES];
+    double best[2][MAX_HARD_TOTAL + 1];
+    double natural;
+    double hit;
+    double next;
+    int counts[CARD_VALUES];
+    int total;
+    int cards = 0;
+
+    bzero(strategy, sizeof (strategy_file_t));
+    memcpy(strategy->header.magic, STRATEGY_MAGIC, sizeof STRATEGY_MAGIC);
+    strategy->header.version = STRATEGY_VERSION;
+    strategy->header.size = sizeof (strategy_file_t);
+    strategy->header.decks = (decks > 0) ? decks : 0;
+
+    // Probability of drawing every value, and the outcomes of the dealer
+    freshComposition(counts, (decks > 0) ? decks : 1);
+    for (int i=0; i<CARD_VALUES; i++)
+    {
+        cards += counts[i];
+    }
+    for (int i=0; i<CARD_VALUES; i++)
+    {
+        draw[i] = (double) counts[i] / cards;
+    }
+    if (decks > 0)
+    {
+        finiteDealerTable(&shoeTable, counts);
+        table = &shoeTable;
+    }
+    else
+    {
+        table = infiniteDealerTable();
+    }
+
+    for (int up=1; up<=CARD_VALUES; up++)
+    {
+        // The player only decides when the dealer has no natural
+        natural = table->outcomes[up - 1][DEALER_NATURAL];
+        for (int k=0; k<DEALER_OUTCOMES; k++)
+        {
+            dealer[k] = (k == DEALER_NATURAL) ? 0 : table->outcomes[up - 1][k] / (1 - natural);
+        }
+
+        for (int hard=MAX_HARD_TOTAL; hard>=0; hard--)
+        {
+            for (int ace=0; ace<2; ace++)
+            {
+                total = bestTotals[ace][hard];
+
+                strategy->standValues[ace][hard][up - 1] = standValue(total, dealer);
+
+                // Reaching 21 finishes the turn, and going over it loses the bet
+                hit = 0;
+                for (int value=1; value<=CARD_VALUES; value++)
+                {
+                    if (hard + value > 21)
+                    {
+                        next = -1;
+                    }
+                    else if (bestTotals[ace || value == 1][hard + value] == 21)
+                    {
+                        next = standValue(21, dealer);
+                    }
+                    else
+                    {
+                        next = best[ace || value == 1][hard + value];
+                    }
+                    hit += draw[value - 1] * next;
+                }
+                strategy->hitValues[ace][hard][up - 1] = hit;
+
+                if (total < 21 && hit > strategy->standValues[ace][hard][up - 1])
+                {
+                    strategy->decisions[ace][hard][up - 1] = HIT;
+                    best[ace][hard] = hit;
+                }
+                else
+                {
+                    strategy->decisions[ace][hard][up - 1] = STAND;
+                    best[ace][hard] = (total > 21) ? -1 : strategy->standValues[ace][hard][up - 1];
+                }
+            }
+        }
+    }
+}
+
+/*
+    Expected value of staying with a total, against the outcomes of the dealer
+    A total under 17 only wins when the dealer busts
+*/
+double standValue(int total, const double dealer[DEALER_OUTCOMES])
+{
+    double value = dealer[DEALER_BUST];
+
+    if (total > 21)
+    {
+        return -1;
+    }
+
+    for (int k=DEALER_17; k<=DEALER_21; k++)
+    {
+        if (total > 17 + k)
+        {
+            value += dealer[k];
+        }
+        else if (total < 17 + k)
+        {
+            value -= dealer[k];
+        }
+    }
+
+    return value;
+}
+
+/*
+    Show the decisions as a chart: H to hit, S to stand
+*/
+void printStrategy(const strategy_file_t * strategy)
+{
+    printf("\nHand   2  3  4  5  6  7  8  9 10  A\n");
+    for (int hard=4; hard<=20; hard++)
+    {
+        printf("H%-4d", hard);
+        for (int up=2; up<=CARD_VALUES + 1; up++)
+        {
+            printf("  %c", (strategy->decisions[0][hard][(up - 1) % CARD_VALUES] == HIT) ? 'H' : 'S');
+        }
+        printf("\n");
+    }
+    // Soft hands, from an ace and a 2 to an ace and a 9
+    for (int hard=3; hard<=10; hard++)
+    {
+        printf("S%-4d", hard + 10);
+        for (int up=2; up<=CARD_VALUES + 1; up++)
+        {
+            printf("  %c", (strategy->decisions[1][hard][(up - 1) % CARD_VALUES] == HIT) ? 'H' : 'S');
+        }
+        printf("\n");
+    }
+    printf("\n");
+}
@@ -0,0 +1,298 @@
+/*
+    Measures of the time spent in every phase of a round, and counters of the games
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "stats.h"
+
+// Size of the reports
+#define STATS_REPORT 4096
+
+// Names used in the reports
+static const char * phaseNames[STAT_PHASES] = {"handshake", "deal", "decision", "dealer", "settle"};
+static const char * counterNames[COUNT_KINDS] = {"rounds", "hands", "busts", "naturals", "sessions", "bytes_in", "bytes_out", "timeouts", "packets_out", "rejected"};
+
+// Measures of the current thread, created with its first measure
+static __thread stats_shard_t * threadShard = NULL;
+// The measures of all the threads, new ones are added at the start
+static _Atomic(stats_shard_t *) shards = NULL;
+
+///// LOCAL FUNCTION DECLARATIONS
+static stats_shard_t * createShard();
+static inline void addValue(atomic_ullong * value, unsigned long long amount);
+static uint64_t bucketLimit(int index);
+
+///// FUNCTION DEFINITIONS
+
+/*
+    Add the time of a phase, in nanoseconds, to its histogram
+*/
+void statsRecord(stat_phase_t phase, uint64_t nanoseconds)
+{
+    stats_shard_t * shard = (threadShard != NULL) ? threadShard : createShard();
+    histogram_t * histogram = &shard->phases[phase];
+
+    addValue(&histogram->buckets[statsBucket(nanoseconds)], 1);
+    addValue(&histogram->count, 1);
+    addValue(&histogram->total, nanoseconds);
+    if (nanoseconds > atomic_load_explicit(&histogram->max, memory_order_relaxed))
+    {
+        atomic_store_explicit(&histogram->max, nanoseconds, memory_order_relaxed);
+    }
+}
+
+/*
+    Add the time elapsed since the start indicated to the histogram of a phase
+*/
+void statsSince(stat_phase_t phase, uint64_t start)
+{
+    statsRecord(phase, statsNow() - start);
+}
+
+/*
+    Add an amount to a counter, negative to decrease it
+*/
+void statsCount(stat_counter_t counter, long long amount)
+{
+    stats_shard_t * shard = (threadShard != NULL) ? threadShard : createShard();
+
+    atomic_store_explicit(&shard->counters[counter], atomic_load_explicit(&shard->counters[counter], memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+/*
+    Write the report of the counters and the percentiles of every phase, in microseconds
+    Returns the length of the report, cut to the size of the buffer
+*/
+int formatStats(char * buffer, size_t size)
+{
+    // Local to every call, the report can be asked by the signal of the main thread and by the socket at the same time
+    unsigned long long buckets[STATS_BUCKETS];
+    long long counters[COUNT_KINDS] = {0};
+    unsigned long long count;
+    unsigned long long total;
+    unsigned long long max;
+    size_t length = 0;
+
+    for (stats_shard_t * shard = atomic_load(&shards); shard != NULL; shard = shard->next)
+    {
+        for (int i=0; i<COUNT_KINDS; i++)
+        {
+            counters[i] += atomic_load_explicit(&shard->counters[i], memory_order_relaxed);
+        }
+    }
+    for (int i=0; i<COUNT_KINDS && length < size; i++)
+    {
+        length += snprintf(buffer + length, size - length, "%s %lld\n", counterNames[i], counters[i]);
+    }
+    // Packets sent for every hand played, the replies of a step should leave together
+    if (length < size)
+    {
+        length += snprintf(buffer + length, size - length, "packets_per_hand %.2f\n",
+            (counters[COUNT_HANDS] > 0) ? (double) counters[COUNT_PACKETS_OUT] / counters[COUNT_HANDS] : 0.0);
+    }
+
+    if (length < size)
+    {
+        length += snprintf(buffer + length, size - length, "%-10s %10s %10s %10s %10s %10s %10s %10s\n", "phase_us", "count", "mean", "p50", "p90", "p99", "p999", "max");
+    }
+    for (int phase=0; phase<STAT_PHASES && length < size; phase++)
+    {
+        // The histograms of all the threads are added
+        bzero(buckets, sizeof buckets);
+        count = 0;
+        total = 0;
+        max = 0;
+        for (stats_shard_t * shard = atomic_load(&shards); shard != NULL; shard = shard->next)
+        {
+            histogram_t * histogram = &shard->phases[phase];
+
+            for (int i=0; i<STATS_BUCKETS; i++)
+            {
+                buckets[i] += atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+            }
+            count += atomic_load_explicit(&histogram->count, memory_order_relaxed);
+            total += atomic_load_explicit(&histogram->total, memory_order_relaxed);
+            if (atomic_load_explicit(&histogram->max, memory_order_relaxed) > max)
+            {
+                max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+            }
+        }
+
+        length += snprintf(buffer + length, size - length, "%-10s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", phaseNames[phase], count,
+            (count > 0) ? total / 1000.0 / count : 0.0,
+            statsPercentile(buckets, count, max, 0.5) / 1000.0, statsPercentile(buckets, count, max, 0.9) / 1000.0,
+            statsPercentile(buckets, count, max, 0.99) / 1000.0, statsPercentile(buckets, count, max, 0.999) / 1000.0, max / 1000.0);
+    }
+
+    return (length < size) ? length : size - 1;
+}
+
+/*
+    Print the report of the stats
+*/
+void printStats()
+{
+    char report[STATS_REPORT];
+
+    formatStats(report, sizeof report);
+    printf("Stats:\n%s", report);
+}
+
+/*
+    Create a Unix socket listening in the path indicated, where the clients get the report
+    Returns the file descriptor of the socket, or -1 if it could not be created
+*/
+int openStatsSocket(const char * path)
+{
+    struct sockaddr_un address;
+    int stats_fd;
+
+    bzero(&address, sizeof address);
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof address.sun_path)
+    {
+        printf("Error: the path of the stats socket is too long\n");
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    stats_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (stats_fd == -1)
+    {
+        perror("ERROR: socket");
+        return -1;
+    }
+    // Remove the socket left by a previous run
+    unlink(path);
+    if (bind(stats_fd, (struct sockaddr *) &address, sizeof address) == -1 || listen(stats_fd, 16) == -1)
+    {
+        perror("ERROR: bind");
+        close(stats_fd);
+        return -1;
+    }
+
+    printf("Sending the stats to the clients of %s\n", path);
+    return stats_fd;
+}
+
+/*
+    Send the report to all the clients waiting in the stats socket, and close their connections
+    The report is small enough to fit in the buffer of the socket
+*/
+void serveStats(int stats_fd)
+{
+    char report[STATS_REPORT];
+    int client_fd;
+    int length;
+
+    while ((client_fd = accept(stats_fd, NULL, NULL)) != -1)
+    {
+        length = formatStats(report, sizeof report);
+        if (send(client_fd, report, length, MSG_DONTWAIT | MSG_NOSIGNAL) == -1)
+        {
+            perror("ERROR: send");
+        }
+        close(client_fd);
+    }
+}
+
+/*
+    Bucket of the histogram where a time is counted
+    The first buckets keep every value, the rest divide every power of 2 in equal parts
+*/
+int statsBucket(uint64_t nanoseconds)
+{
+    int exponent;
+
+    if (nanoseconds < STATS_SUB_BUCKETS)
+    {
+        return nanoseconds;
+    }
+    exponent = 63 - __builtin_clzll(nanoseconds);
+    if (exponent >= STATS_MAX_BITS)
+    {
+        return STATS_BUCKETS - 1;
+    }
+    return (exponent - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS + ((nanoseconds >> (exponent - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1));
+}
+
+/*
+    Time below which the fraction indicated of the values fall
+    The limit of the bucket is never above the largest value measured
+*/
+uint64_t statsPercentile(const unsigned long long * buckets, unsigned long long count, unsigned long long max, double fraction)
+{
+    unsigned long long target = (unsigned long long) (fraction * count + 0.5);
+    unsigned long long seen = 0;
+
+    if (count == 0)
+    {
+        return 0;
+    }
+    if (target < 1)
+    {
+        target = 1;
+    }
+    for (int i=0; i<STATS_BUCKETS; i++)
+    {
+        seen += buckets[i];
+        if (seen >= target)
+        {
+            return (bucketLimit(i) < max) ? bucketLimit(i) : max;
+        }
+    }
+    return max;
+}
+
+/*
+    Create the measures of the current thread and add them to the list
+*/
+static stats_shard_t * createShard()
+{
+    stats_shard_t * shard = NULL;
+
+    shard = calloc(1, sizeof (stats_shard_t));
+    if (shard == NULL)
+    {
+        perror("ERROR: calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    shard->next = atomic_load(&shards);
+    while (!atomic_compare_exchange_weak(&shards, &shard->next, shard));
+
+    threadShard = shard;
+    return shard;
+}
+
+/*
+    Increase a value written only by the current thread
+    The readers can see it at any time, but it does not need an atomic addition
+*/
+static inline void addValue(atomic_ullong * value, unsigned long long amount)
+{
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+/*
+    Largest time counted in a bucket
+*/
+static uint64_t bucketLimit(int index)
+{
+    int exponent;
+
+    if (index < STATS_SUB_BUCKETS)
+    {
+        return index;
+    }
+    exponent = index / STATS_SUB_BUCKETS + STATS_SUB_BITS - 1;
+    return ((uint64_t) (STATS_SUB_BUCKETS + index % STATS_SUB_BUCKETS + 1) << (exponent - STATS_SUB_BITS)) - 1;
+}
@@ -0,0 +1,113 @@
+/*
+    Measures of the time spent in every phase of a round, and counters of the games
+    The times are kept in log-linear histograms: every power of 2 is divided in
+    STATS_SUB_BUCKETS parts, so any value is kept with an error below 1 / STATS_SUB_BUCKETS
+    using a few hundred counters, like the HDR histograms.
+
+    Every thread updates its own copy of the histograms and counters, created with its
+    first measure, without locks or atomic additions. Reading the stats adds the copies
+    of all the threads, so a report never stops the games.
+    The server sends the report to the clients of a Unix socket, and prints it with SIGUSR1.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Bits of the divisions of every power of 2
+#define STATS_SUB_BITS 4
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+// Largest time measured, in nanoseconds, as a power of 2: about 18 minutes
+#define STATS_MAX_BITS 40
+#define STATS_BUCKETS ((STATS_MAX_BITS - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS)
+
+// The phases measured
+typedef enum {STAT_HANDSHAKE, STAT_DEAL, STAT_DECISION, STAT_DEALER, STAT_SETTLE, STAT_PHASES} stat_phase_t;
+
+// The events counted
+typedef enum {COUNT_ROUNDS, COUNT_HANDS, COUNT_BUSTS, COUNT_NATURALS, COUNT_SESSIONS, COUNT_BYTES_IN, COUNT_BYTES_OUT, COUNT_TIMEOUTS, COUNT_PACKETS_OUT, COUNT_REJECTED, COUNT_KINDS} stat_counter_t;
+
+// Number of values measured in every range of times
+typedef struct histogram_struct {
+    atomic_ullong buckets[STATS_BUCKETS];
+    atomic_ullong count;
+    atomic_ullong total;
+    atomic_ullong max;
+} histogram_t;
+
+// Measures of a single thread, written only by it
+typedef struct stats_shard_struct {
+    histogram_t phases[STAT_PHASES];
+    // The sessions are counted up and down by different threads, so the counters can be negative
+    atomic_llong counters[COUNT_KINDS];
+    // Link of the list of all the threads
+    struct stats_shard_struct * next;
+} stats_shard_t;
+
+/*
+    Current time of the monotonic clock, in nanoseconds
+*/
+static inline uint64_t statsNow()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+    Add the time of a phase, in nanoseconds, to its histogram
+*/
+void statsRecord(stat_phase_t phase, uint64_t nanoseconds);
+
+/*
+    Add the time elapsed since the start indicated to the histogram of a phase
+*/
+void statsSince(stat_phase_t phase, uint64_t start);
+
+/*
+    Add an amount to a counter, negative to decrease it
+*/
+void statsCount(stat_counter_t counter, long long amount);
+
+/*
+    Write the report of the counters and the percentiles of every phase, in microseconds
+    Returns the length of the report, cut to the size of the buffer
+*/
+int formatStats(char * buffer, size_t size);
+
+/*
+    Print the report of the stats
+*/
+void printStats();
+
+/*
+    Create a Unix socket listening in the path indicated, where the clients get the report
+    Returns the file descriptor of the socket, or -1 if it could not be created
+*/
+int openStatsSocket(const char * path);
+
+/*
+    Send the report to all the clients waiting in the stats socket, and close their connections
+*/
+void serveStats(int stats_fd);
+
+/*
+    Bucket of the histogram where a time is counted
+    Also used by the programs that keep histograms of their own
+*/
+int statsBucket(uint64_t nanoseconds);
+
+/*
+    Time below which the fraction indicated of the values fall
+    Receives the buckets of a histogram, the number of values and the largest value
+*/
+uint64_t statsPercentile(const unsigned long long * buckets, unsigned long long count, unsigned long long max, double fraction);
+
+#endif
@@ -0,0 +1,113 @@
+/*
+    Table with the best decision of the player for every hand
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "strategy.h"
+
+///// FUNCTION DEFINITIONS
+
+/*
+    Map a strategy file in memory, read only
+    Returns NULL if the file cannot be used
+*/
+const strategy_file_t * loadStrategy(const char * path)
+{
+    const strategy_file_t * strategy = NULL;
+    struct stat status;
+    void * map = NULL;
+    int file_fd;
+
+    file_fd = open(path, O_RDONLY);
+    if (file_fd == -1)
+    {
+        perror("ERROR: open");
+        return NULL;
+    }
+    if (fstat(file_fd, &status) == -1)
+    {
+        perror("ERROR: fstat");
+        close(file_fd);
+        return NULL;
+    }
+    if (status.st_size != sizeof (strategy_file_t))
+    {
+        printf("Error: %s is not a strategy table of this version\n", path);
+        close(file_fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, sizeof (strategy_file_t), PROT_READ, MAP_PRIVATE, file_fd, 0);
+    // The mapping stays valid after closing the file
+    close(file_fd);
+    if (map == MAP_FAILED)
+    {
+        perror("ERROR: mmap");
+        return NULL;
+    }
+
+    strategy = map;
+    if (memcmp(strategy->header.magic, STRATEGY_MAGIC, sizeof STRATEGY_MAGIC) != 0
+        || strategy->header.version != STRATEGY_VERSION || strategy->header.size != sizeof (strategy_file_t))
+    {
+        printf("Error: %s is not a strategy table of this version\n", path);
+        munmap(map, sizeof (strategy_file_t));
+        return NULL;
+    }
+
+    return strategy;
+}
+
+/*
+    Remove the mapping of a strategy file
+*/
+void unloadStrategy(const strategy_file_t * strategy)
+{
+    munmap((void *) strategy, sizeof (strategy_file_t));
+}
+
+/*
+    Store a strategy table in the file indicated
+    The table is written to a temporary file first, so the programs using the old table never see half a file
+    Returns 1 on success, 0 otherwise
+*/
+int writeStrategy(const char * path, const strategy_file_t * strategy)
+{
+    char temporary[FILENAME_MAX];
+    FILE * file = NULL;
+
+    snprintf(temporary, sizeof temporary, "%s.tmp", path);
+
+    file = fopen(temporary, "wb");
+    if (file == NULL)
+    {
+        perror("ERROR: fopen");
+        return 0;
+    }
+    if (fwrite(strategy, sizeof (strategy_file_t), 1, file) != 1)
+    {
+        perror("ERROR: fwrite");
+        fclose(file);
+        return 0;
+    }
+    if (fclose(file) != 0)
+    {
+        perror("ERROR: fclose");
+        return 0;
+    }
+    if (rename(temporary, path) == -1)
+    {
+        perror("ERROR: rename");
+        return 0;
+    }
+
+    return 1;
+}
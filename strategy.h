@@ -0,0 +1,73 @@
+/*
+    Table with the best decision of the player for every hand
+    The table is created by the solver program and stored in a binary file
+    with the same layout used in memory, so the programs that use it
+    only map the file with mmap, without reading or parsing it.
+    The file uses the byte order of the computer that created it.
+
+    A decision is found with the hard total of the hand of the player,
+    whether it has an ace, and the value of the up card of the dealer.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#ifndef STRATEGY_H
+#define STRATEGY_H
+
+#include <stdint.h>
+
+#include "blackjack.h"
+#include "dealer.h"
+
+// Identification of the files of strategy tables
+#define STRATEGY_MAGIC "BJSTRAT"
+// Version of the layout of the file, changes when strategy_file_t changes
+#define STRATEGY_VERSION 1
+
+// First bytes of the file, used to validate it
+typedef struct strategy_header_struct {
+    char magic[8];
+    uint32_t version;
+    // Size of the complete file
+    uint32_t size;
+    // Rules used to solve the table, 0 decks is an infinite deck
+    uint32_t decks;
+    uint32_t reserved;
+} strategy_header_t;
+
+// Complete contents of the file, indexed by [has an ace][hard total][value of the up card - 1]
+typedef struct strategy_file_struct {
+    strategy_header_t header;
+    // HIT or STAND, as code_t values
+    unsigned char decisions[2][MAX_HARD_TOTAL + 1][CARD_VALUES];
+    // Expected value of each decision, per unit bet
+    float standValues[2][MAX_HARD_TOTAL + 1][CARD_VALUES];
+    float hitValues[2][MAX_HARD_TOTAL + 1][CARD_VALUES];
+} strategy_file_t;
+
+/*
+    Map a strategy file in memory, read only
+    Returns NULL if the file cannot be used
+*/
+const strategy_file_t * loadStrategy(const char * path);
+
+/*
+    Remove the mapping of a strategy file
+*/
+void unloadStrategy(const strategy_file_t * strategy);
+
+/*
+    Store a strategy table in the file indicated
+    Returns 1 on success, 0 otherwise
+*/
+int writeStrategy(const char * path, const strategy_file_t * strategy);
+
+/*
+    Get the decision of the table for the current hand of the player
+*/
+static inline code_t strategyDecision(const strategy_file_t * strategy, const game_t * game)
+{
+    return strategy->decisions[game->player.rankCount[ACE] > 0][(game->player.hardTotal < MAX_HARD_TOTAL) ? game->player.hardTotal : MAX_HARD_TOTAL][cardValues[game->dealer.cards[0]] - 1];
+}
+
+#endif
@@ -0,0 +1,692 @@
+/*
+    Tables where several players share the dealer
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "logger.h"
+#include "stats.h"
+#include "table.h"
+
+// Initial number of tables that fit in the list
+#define TABLES_CAPACITY 16
+
+// Smallest starting amount of the players of every stake level
+static const int stakeAmounts[STAKE_LEVELS] = {0, 100, 1000, 10000};
+
+///// LOCAL FUNCTION DECLARATIONS
+static table_t * createTable(tables_t * tables, int stake);
+static int stakeLevel(int amount);
+static void linkTable(lobby_t * lobby, table_t * table);
+static void unlinkTable(lobby_t * lobby, table_t * table);
+static int seatPlayer(lobby_t * lobby, table_t * table, struct session_struct * session, int amount);
+static void unseatPlayer(lobby_t * lobby, table_t * table, int seat);
+static void advanceTable(table_t * table, int caller);
+static int startRound(table_t * table);
+static int playDealer(table_t * table);
+static void wakeSeats(table_t * table, seat_state_t state, int caller);
+
+///// FUNCTION DEFINITIONS
+
+/*
+    Prepare the list of tables, with the number of seats indicated
+    Without a shuffler the tables deal from an infinite deck
+*/
+tables_t * createTables(int seats, shuffler_t * shuffler, uint64_t seed, void (* wake)(struct session_struct * session))
+{
+    tables_t * tables = NULL;
+
+    tables = malloc(sizeof (tables_t));
+    if (tables == NULL)
+    {
+        perror("ERROR: malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    tables->seats = (seats < 1) ? 1 : (seats > MAX_SEATS) ? MAX_SEATS : seats;
+    tables->shuffler = shuffler;
+    tables->seed = seed;
+    tables->wake = wake;
+    tables->count = 0;
+    tables->capacity = TABLES_CAPACITY;
+    tables->list = malloc(tables->capacity * sizeof (table_t *));
+    if (tables->list == NULL)
+    {
+        perror("ERROR: malloc");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&tables->tables_mutex, NULL);
+
+    bzero(tables->lobbies, sizeof tables->lobbies);
+    for (int i=0; i<STAKE_LEVELS; i++)
+    {
+        pthread_mutex_init(&tables->lobbies[i].lobby_mutex, NULL);
+    }
+
+    logInfo("Playing at tables of %d seats\n", tables->seats);
+
+    return tables;
+}
+
+/*
+    Seat a session at the fullest table of its stake level with a free seat, opening a new table if all are full
+    A player arriving in the middle of a round plays from the next one
+    Returns the table, and the number of the seat in the variable seat
+*/
+table_t * joinTable(tables_t * tables, struct session_struct * session, int amount, const struct timespec * arrival, int * seat)
+{
+    lobby_t * lobby = &tables->lobbies[stakeLevel(amount)];
+    table_t * table = NULL;
+    struct timespec now;
+    long long waited;
+
+    pthread_mutex_lock(&lobby->lobby_mutex);
+    if (lobby->freeMask == 0)
+    {
+        table = createTable(tables, lobby - tables->lobbies);
+        lobby->tables++;
+    }
+    else
+    {
+        // The list with the fewest free seats has the fullest tables
+        table = lobby->free[__builtin_ctz(lobby->freeMask)];
+    }
+    *seat = seatPlayer(lobby, table, session, amount);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    waited = (now.tv_sec - arrival->tv_sec) * 1000000000LL + (now.tv_nsec - arrival->tv_nsec);
+    lobby->seatings++;
+    lobby->waitTotal += waited;
+    if (waited > lobby->waitMax)
+    {
+        lobby->waitMax = waited;
+    }
+    pthread_mutex_unlock(&lobby->lobby_mutex);
+
+    return table;
+}
+
+/*
+    Remove a player from its table
+    The rest of the players continue without waiting for it
+*/
+void leaveTable(table_t * table, int seat)
+{
+    lobby_t * lobby = &table->tables->lobbies[table->stake];
+
+    pthread_mutex_lock(&lobby->lobby_mutex);
+    unseatPlayer(lobby, table, seat);
+    pthread_mutex_unlock(&lobby->lobby_mutex);
+}
+
+/*
+    Register the bet of a player for the next round
+    Deals the round if it was the last player to bet
+*/
+void placeBet(table_t * table, int seat, int bet)
+{
+    pthread_mutex_lock(&table->table_mutex);
+    table->seats[seat].bet = bet;
+    table->seats[seat].state = SEAT_READY;
+    advanceTable(table, seat);
+    pthread_mutex_unlock(&table->table_mutex);
+}
+
+/*
+    Copy the cards dealt to the player and the dealer in the current round
+    Returns 0 if the round has not been dealt yet
+*/
+int takeDeal(table_t * table, int seat, game_t * game)
+{
+    seat_t * player = &table->seats[seat];
+
+    pthread_mutex_lock(&table->table_mutex);
+    if (player->state != SEAT_PLAYING && player->state != SEAT_DONE && player->state != SEAT_SETTLED)
+    {
+        pthread_mutex_unlock(&table->table_mutex);
+        return 0;
+    }
+
+    game->player = player->hand;
+    game->playerStatus = player->status;
+    game->playerBet = player->bet;
+    // The dealer only has two cards at the start of the round
+    resetHand(&game->dealer);
+    addCard(&game->dealer, table->house.dealer.cards[0]);
+    addCard(&game->dealer, table->house.dealer.cards[1]);
+    game->dealerStatus = isNatural(&game->dealer) ? NATURAL : START;
+    pthread_mutex_unlock(&table->table_mutex);
+
+    return 1;
+}
+
+/*
+    Apply a decision of the player, stored in game->playerStatus, drawing from the shoe of the table
+    When the turn of the player finishes, the dealer plays if it was the last one
+*/
+void tableDecision(table_t * table, int seat, game_t * game)
+{
+    seat_t * player = &table->seats[seat];
+
+    pthread_mutex_lock(&table->table_mutex);
+    playerTurn(game);
+
+    player->hand = game->player;
+    player->status = game->playerStatus;
+    if (game->playerStatus != HIT)
+    {
+        player->state = SEAT_DONE;
+        advanceTable(table, seat);
+    }
+    pthread_mutex_unlock(&table->table_mutex);
+}
+
+/*
+    Copy the final hand of the dealer and add the result of the round to the amount of the player
+    Returns 0 if the round has not been settled yet
+*/
+int takeResult(table_t * table, int seat, game_t * game)
+{
+    seat_t * player = &table->seats[seat];
+
+    pthread_mutex_lock(&table->table_mutex);
+    if (player->state != SEAT_SETTLED)
+    {
+        pthread_mutex_unlock(&table->table_mutex);
+        return 0;
+    }
+
+    game->dealer = table->house.dealer;
+    game->dealerStatus = table->house.dealerStatus;
+    game->playerAmount += player->result;
+    // The player is ready for the next bet
+    player->state = SEAT_BETTING;
+    pthread_mutex_unlock(&table->table_mutex);
+
+    return 1;
+}
+
+/*
+    Move a player between rounds from a table with few players to a fuller one of the same lobby
+    Every move leaves the players more concentrated, so the players of a sparse table
+    end at other tables and it stays empty, to be used only when the others are full
+    Returns the table where the player is seated, and its seat in the variable seat
+*/
+table_t * rebalanceTable(table_t * table, struct session_struct * session, int amount, int * seat)
+{
+    lobby_t * lobby = &table->tables->lobbies[table->stake];
+    table_t * target = NULL;
+    unsigned int mask;
+
+    pthread_mutex_lock(&lobby->lobby_mutex);
+    // Only the tables with at most half of the seats taken give away their players
+    if (table->seated * 2 > table->numSeats)
+    {
+        pthread_mutex_unlock(&lobby->lobby_mutex);
+        return table;
+    }
+
+    // The fullest table with a free seat, other than this one
+    for (mask = lobby->freeMask; mask != 0 && target == NULL; mask &= mask - 1)
+    {
+        target = lobby->free[__builtin_ctz(mask)];
+        if (target == table)
+        {
+            target = table->next;
+        }
+    }
+    // Moving to a table with fewer players would spread them instead
+    if (target == NULL || target->seated < table->seated)
+    {
+        pthread_mutex_unlock(&lobby->lobby_mutex);
+        return table;
+    }
+
+    logInfo("The player at the table %d, seat %d moves to the table %d with %d players\n", table->id, *seat, target->id, target->seated);
+    unseatPlayer(lobby, table, *seat);
+    *seat = seatPlayer(lobby, target, session, amount);
+    lobby->moves++;
+    pthread_mutex_unlock(&lobby->lobby_mutex);
+
+    return target;
+}
+
+/*
+    Print the counters of all the tables, and the fill of the seats and the time to get one of every lobby
+*/
+void printTablesStats(tables_t * tables)
+{
+    long rounds = 0;
+    long hands = 0;
+    int seated = 0;
+    int count;
+
+    pthread_mutex_lock(&tables->tables_mutex);
+    count = tables->count;
+    for (int i=0; i<count; i++)
+    {
+        pthread_mutex_lock(&tables->list[i]->table_mutex);
+        seated += tables->list[i]->seated;
+        rounds += tables->list[i]->rounds;
+        hands += tables->list[i]->hands;
+        pthread_mutex_unlock(&tables->list[i]->table_mutex);
+    }
+    pthread_mutex_unlock(&tables->tables_mutex);
+
+    printf("Tables: %d with %d players seated, %ld rounds dealt for %ld hands (%.2f hands per dealer hand)\n", count, seated, rounds, hands, (rounds > 0) ? (double) hands / rounds : 0.0);
+
+    for (int i=0; i<STAKE_LEVELS; i++)
+    {
+        lobby_t * lobby = &tables->lobbies[i];
+
+        pthread_mutex_lock(&lobby->lobby_mutex);
+        if (lobby->tables > 0)
+        {
+            printf("\tStakes from %d: %d tables, %d in use with %d players (%.1f%% of the seats filled), ", stakeAmounts[i], lobby->tables, lobby->openTables, lobby->players, (lobby->openTables > 0) ? 100.0 * lobby->players / (lobby->openTables * tables->seats) : 0.0);
+            printf("%ld seated in %.1f us on average (%.1f us at most), %ld moved\n", lobby->seatings, (lobby->seatings > 0) ? lobby->waitTotal / 1000.0 / lobby->seatings : 0.0, lobby->waitMax / 1000.0, lobby->moves);
+        }
+        pthread_mutex_unlock(&lobby->lobby_mutex);
+    }
+}
+
+/*
+    Free the memory of all the tables
+*/
+void destroyTables(tables_t * tables)
+{
+    for (int i=0; i<tables->count; i++)
+    {
+        releaseShoe(&tables->list[i]->house);
+        pthread_mutex_destroy(&tables->list[i]->table_mutex);
+        free(tables->list[i]);
+    }
+    pthread_mutex_destroy(&tables->tables_mutex);
+    for (int i=0; i<STAKE_LEVELS; i++)
+    {
+        pthread_mutex_destroy(&tables->lobbies[i].lobby_mutex);
+    }
+    free(tables->list);
+    free(tables);
+}
+
+/*
+    Allocate an empty table of a stake level, dealing from the shuffler of the list
+    Each table has its own stream of the seed for an infinite deck
+    Must be called with the lock of the lobby
+*/
+static table_t * createTable(tables_t * tables, int stake)
+{
+    table_t * table = NULL;
+
+    table = malloc(sizeof (table_t));
+    if (table == NULL)
+    {
+        perror("ERROR: malloc");
+        exit(EXIT_FAILURE);
+    }
+    bzero(table, sizeof (table_t));
+
+    table->stake = stake;
+    table->tables = tables;
+    table->numSeats = tables->seats;
+    table->phase = TABLE_BETTING;
+    table->viuda_data.lowestAmount = INT_MAX;
+    table->house.shuffler = tables->shuffler;
+    pthread_mutex_init(&table->table_mutex, NULL);
+
+    // The number of the table is its place in the list of all the tables
+    pthread_mutex_lock(&tables->tables_mutex);
+    if (tables->count == tables->capacity)
+    {
+        tables->capacity *= 2;
+        tables->list = realloc(tables->list, tables->capacity * sizeof (table_t *));
+        if (tables->list == NULL)
+        {
+            perror("ERROR: realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    table->id = tables->count;
+    tables->list[tables->count++] = table;
+    pthread_mutex_unlock(&tables->tables_mutex);
+
+    seedRandom(&table->house.rng, tables->seed, TABLE_STREAMS | table->id);
+    logInfo("Opened the table %d for stakes from %d, dealing with the stream %d of the seed\n", table->id, stakeAmounts[stake], table->id);
+
+    return table;
+}
+
+/*
+    Stake level of a player with the amount indicated
+*/
+static int stakeLevel(int amount)
+{
+    int stake = 0;
+
+    while (stake + 1 < STAKE_LEVELS && amount >= stakeAmounts[stake + 1])
+    {
+        stake++;
+    }
+    return stake;
+}
+
+/*
+    Add a table to the list of the lobby for its number of free seats
+    A full table is not in any list
+    Must be called with the lock of the lobby
+*/
+static void linkTable(lobby_t * lobby, table_t * table)
+{
+    int freeSeats = table->numSeats - table->seated;
+
+    if (freeSeats == 0)
+    {
+        return;
+    }
+    table->prev = NULL;
+    table->next = lobby->free[freeSeats];
+    if (table->next != NULL)
+    {
+        table->next->prev = table;
+    }
+    lobby->free[freeSeats] = table;
+    lobby->freeMask |= 1u << freeSeats;
+}
+
+/*
+    Remove a table from the list of the lobby for its number of free seats
+    Must be called with the lock of the lobby
+*/
+static void unlinkTable(lobby_t * lobby, table_t * table)
+{
+    int freeSeats = table->numSeats - table->seated;
+
+    if (freeSeats == 0)
+    {
+        return;
+    }
+    if (table->prev != NULL)
+    {
+        table->prev->next = table->next;
+    }
+    else
+    {
+        lobby->free[freeSeats] = table->next;
+    }
+    if (table->next != NULL)
+    {
+        table->next->prev = table->prev;
+    }
+    if (lobby->free[freeSeats] == NULL)
+    {
+        lobby->freeMask &= ~(1u << freeSeats);
+    }
+    table->prev = NULL;
+    table->next = NULL;
+}
+
+/*
+    Give the first free seat of a table to a session
+    Returns the number of the seat
+    Must be called with the lock of the lobby
+*/
+static int seatPlayer(lobby_t * lobby, table_t * table, struct session_struct * session, int amount)
+{
+    int seat;
+
+    pthread_mutex_lock(&table->table_mutex);
+    unlinkTable(lobby, table);
+    seat = __builtin_ctz(~table->occupied);
+    table->occupied |= 1u << seat;
+    bzero(&table->seats[seat], sizeof (seat_t));
+    table->seats[seat].session = session;
+    table->seats[seat].state = SEAT_BETTING;
+    table->seated++;
+    linkTable(lobby, table);
+
+    if (table->seated == 1)
+    {
+        lobby->openTables++;
+    }
+    lobby->players++;
+
+    if(table->viuda_data.lowestAmount > amount) {
+        table->viuda_data.lowestAmount = amount;
+    }
+    logDebug("The player sits at the table %d, seat %d. The players can bet at most %d.\n", table->id, seat, table->viuda_data.lowestAmount);
+    pthread_mutex_unlock(&table->table_mutex);
+
+    return seat;
+}
+
+/*
+    Free the seat of a player, and continue the round of the others
+    Must be called with the lock of the lobby
+*/
+static void unseatPlayer(lobby_t * lobby, table_t * table, int seat)
+{
+    pthread_mutex_lock(&table->table_mutex);
+    unlinkTable(lobby, table);
+    table->occupied &= ~(1u << seat);
+    table->seats[seat].state = SEAT_EMPTY;
+    table->seats[seat].session = NULL;
+    table->seated--;
+    linkTable(lobby, table);
+
+    lobby->players--;
+    if (table->seated == 0)
+    {
+        lobby->openTables--;
+        // The next players start with a new limit
+        table->viuda_data.lowestAmount = INT_MAX;
+    }
+    logDebug("The player leaves the table %d, seat %d\n", table->id, seat);
+
+    // The others could be waiting only for this player
+    advanceTable(table, seat);
+    pthread_mutex_unlock(&table->table_mutex);
+}
+
+/*
+    Move the round to the next phase while every player has done its part of the current one
+    The players moved to a new phase are woken up, except the caller that is already running
+    Must be called with the lock of the table
+*/
+static void advanceTable(table_t * table, int caller)
+{
+    while (1)
+    {
+        if (table->phase == TABLE_BETTING)
+        {
+            if (!startRound(table))
+            {
+                return;
+            }
+            table->phase = TABLE_PLAYING;
+            wakeSeats(table, SEAT_PLAYING, caller);
+            wakeSeats(table, SEAT_DONE, caller);
+        }
+        else
+        {
+            if (!playDealer(table))
+            {
+                return;
+            }
+            table->phase = TABLE_BETTING;
+            wakeSeats(table, SEAT_SETTLED, caller);
+        }
+    }
+}
+
+/*
+    Deal the first cards to every player and the dealer, if all the players seated have bet
+    Returns 0 if some player has not bet yet
+    Must be called with the lock of the table
+*/
+static int startRound(table_t * table)
+{
+    game_t * house = &table->house;
+    uint64_t start;
+    int players = 0;
+
+    for (int i=0; i<table->numSeats; i++)
+    {
+        if (table->seats[i].state == SEAT_READY)
+        {
+            players++;
+        }
+        else if (table->seats[i].state != SEAT_EMPTY)
+        {
+            return 0;
+        }
+    }
+    if (players == 0)
+    {
+        return 0;
+    }
+
+    table->round++;
+    table->rounds++;
+    table->hands += players;
+    statsCount(COUNT_ROUNDS, 1);
+    statsCount(COUNT_HANDS, players);
+    logDebug("\n|||||||||||||||TABLE %d, ROUND %d WITH %d PLAYERS|||||||||||||||\n", table->id, table->round, players);
+
+    start = statsNow();
+    checkShoe(house);
+    resetHand(&house->dealer);
+    house->dealerStatus = START;
+    for (int i=0; i<table->numSeats; i++)
+    {
+        if (table->seats[i].state == SEAT_READY)
+        {
+            resetHand(&table->seats[i].hand);
+        }
+    }
+
+    //Every player gets a card and then the dealer, twice
+    for (int card=0; card<2; card++)
+    {
+        for (int i=0; i<table->numSeats; i++)
+        {
+            if (table->seats[i].state == SEAT_READY)
+            {
+                addCard(&table->seats[i].hand, dealCard(house));
+            }
+        }
+        addCard(&house->dealer, dealCard(house));
+    }
+
+    if (isNatural(&house->dealer)) {
+        house->dealerStatus = NATURAL;
+        logDebug("The dealer got a Natural Blackjack with the cards [%s] and [%s]!\n", cardName(house->dealer.cards[0]), cardName(house->dealer.cards[1]));
+    }
+
+    for (int i=0; i<table->numSeats; i++)
+    {
+        seat_t * player = &table->seats[i];
+
+        if (player->state != SEAT_READY)
+        {
+            continue;
+        }
+        player->status = START;
+        player->state = SEAT_PLAYING;
+        if (isNatural(&player->hand)) {
+            logDebug("The player at the seat %d got a Natural Blackjack!\n", i);
+            player->status = NATURAL;
+            statsCount(COUNT_NATURALS, 1);
+        }
+        //A natural of anyone finishes the turn of the player
+        if (player->status == NATURAL || house->dealerStatus == NATURAL)
+        {
+            player->state = SEAT_DONE;
+        }
+    }
+    statsSince(STAT_DEAL, start);
+
+    return 1;
+}
+
+/*
+    Play the hand of the dealer and settle the bets, if all the players finished their turns
+    Returns 0 if some player is still playing
+    Must be called with the lock of the table
+*/
+static int playDealer(table_t * table)
+{
+    game_t * house = &table->house;
+    game_t settlement;
+    uint64_t start;
+    int standing = 0;
+
+    for (int i=0; i<table->numSeats; i++)
+    {
+        if (table->seats[i].state == SEAT_PLAYING)
+        {
+            return 0;
+        }
+        if (table->seats[i].state == SEAT_DONE && (table->seats[i].status == STAND || table->seats[i].status == TWENTYONE))
+        {
+            standing++;
+        }
+    }
+
+    //The dealer only plays if some player is waiting for it
+    if (house->dealerStatus != NATURAL && standing > 0)
+    {
+        logDebug("\n/////DEALER'S TURN AT THE TABLE %d/////\n", table->id);
+        house->playerStatus = STAND;
+        start = statsNow();
+        dealerTurn(house);
+        statsSince(STAT_DEALER, start);
+    }
+
+    for (int i=0; i<table->numSeats; i++)
+    {
+        seat_t * player = &table->seats[i];
+
+        if (player->state != SEAT_DONE)
+        {
+            continue;
+        }
+
+        bzero(&settlement, sizeof settlement);
+        settlement.player = player->hand;
+        settlement.playerStatus = player->status;
+        settlement.dealer = house->dealer;
+        settlement.dealerStatus = house->dealerStatus;
+        settlement.playerBet = player->bet;
+        start = statsNow();
+        player->result = calculateResults(&settlement);
+        statsSince(STAT_SETTLE, start);
+        player->state = SEAT_SETTLED;
+        if (player->status == BUST)
+        {
+            statsCount(COUNT_BUSTS, 1);
+        }
+    }
+
+    return 1;
+}
+
+/*
+    Make the workers attend the sessions of the players in the state indicated
+    The sessions cannot leave the table while its lock is held, so none of them has been freed
+    Must be called with the lock of the table
+*/
+static void wakeSeats(table_t * table, seat_state_t state, int caller)
+{
+    for (int i=0; i<table->numSeats; i++)
+    {
+        if (i != caller && table->seats[i].state == state)
+        {
+            table->tables->wake(table->seats[i].session);
+        }
+    }
+}
@@ -0,0 +1,183 @@
+/*
+    Tables where several players share the dealer
+    Up to MAX_SEATS sessions sit at a table, and every round they bet,
+    get their cards from the same shoe, and play against a single hand of the dealer.
+
+    A round advances in phases, like a barrier: it is dealt when every player seated has bet,
+    and the dealer plays when every player has finished its turn.
+    The last player to arrive does the work of the phase with the lock of the table,
+    and then wakes up the sessions of the other players.
+    The lock only protects the cards and the seats, the sessions send their own replies
+    after copying the data of the table, so it is never held while using the network.
+
+    The tables are grouped in a lobby for every stake level, chosen by the starting amount
+    of the player, each one with its own lock. A lobby keeps its tables with free seats
+    in a list for every number of free seats, and a mask of the lists that are not empty,
+    so a player is sent to the fullest table with a free seat without searching.
+    Between rounds, the players of a table with few players move to a fuller one.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "blackjack.h"
+#include "shoe.h"
+
+// Largest number of players at a table
+#define MAX_SEATS 8
+// Streams of the master seed used by the tables, apart from the ones of the shuffles
+#define TABLE_STREAMS 0x4000000000000000ULL
+// Number of lobbies, the players are grouped by the amount they bring
+#define STAKE_LEVELS 4
+
+// The steps of a player in the round of a table
+typedef enum {SEAT_EMPTY, SEAT_BETTING, SEAT_READY, SEAT_PLAYING, SEAT_DONE, SEAT_SETTLED} seat_state_t;
+
+// The phases of a round: waiting for the bets, or waiting for the players to finish their turns
+typedef enum {TABLE_BETTING, TABLE_PLAYING} table_phase_t;
+
+// Data shared by all the players of a table
+typedef struct viuda_struct {
+
+    int bet;
+    int betAgreement;
+    int lowestAmount;
+
+} viuda_t;
+
+// A player at the table
+typedef struct seat_struct {
+    struct session_struct * session;
+    seat_state_t state;
+    int bet;
+    // The cards of the player in the current round, and its status
+    hand_t hand;
+    code_t status;
+    // Chips won or lost in the last round
+    int result;
+} seat_t;
+
+// A table, with the shoe and the hand of the dealer in its house game
+typedef struct table_struct {
+    int id;
+    int stake;
+    pthread_mutex_t table_mutex;
+    table_phase_t phase;
+    int round;
+    int numSeats;
+    int seated;
+    // Bit i is set when the seat i is taken
+    unsigned int occupied;
+    seat_t seats[MAX_SEATS];
+    game_t house;
+    viuda_t viuda_data;
+    struct tables_struct * tables;
+    // Links of the list of the lobby for its number of free seats, protected by the lock of the lobby
+    struct table_struct * prev;
+    struct table_struct * next;
+    // Counters for the reports
+    long rounds;
+    long hands;
+} table_t;
+
+// The tables of a stake level
+typedef struct lobby_struct {
+    pthread_mutex_t lobby_mutex;
+    // Tables with free seats, in a list for every number of free seats
+    table_t * free[MAX_SEATS + 1];
+    // Bit i is set when the list of i free seats has tables
+    unsigned int freeMask;
+    // Counters for the reports
+    int tables;
+    int openTables;
+    int players;
+    long seatings;
+    long moves;
+    // Nanoseconds from the arrival of the players until they got a seat
+    long long waitTotal;
+    long long waitMax;
+} lobby_t;
+
+// All the tables of the server
+typedef struct tables_struct {
+    lobby_t lobbies[STAKE_LEVELS];
+    // List of every table, to find them by number
+    pthread_mutex_t tables_mutex;
+    table_t ** list;
+    int count;
+    int capacity;
+    // Seats of every table
+    int seats;
+    shuffler_t * shuffler;
+    uint64_t seed;
+    // Function that makes a worker attend a session that has news from its table
+    void (* wake)(struct session_struct * session);
+} tables_t;
+
+/*
+    Prepare the list of tables, with the number of seats indicated
+    Without a shuffler the tables deal from an infinite deck
+*/
+tables_t * createTables(int seats, shuffler_t * shuffler, uint64_t seed, void (* wake)(struct session_struct * session));
+
+/*
+    Seat a session at the fullest table of its stake level with a free seat, opening a new table if all are full
+    A player arriving in the middle of a round plays from the next one
+    Returns the table, and the number of the seat in the variable seat
+*/
+table_t * joinTable(tables_t * tables, struct session_struct * session, int amount, const struct timespec * arrival, int * seat);
+
+/*
+    Remove a player from its table
+    The rest of the players continue without waiting for it
+*/
+void leaveTable(table_t * table, int seat);
+
+/*
+    Register the bet of a player for the next round
+    Deals the round if it was the last player to bet
+*/
+void placeBet(table_t * table, int seat, int bet);
+
+/*
+    Copy the cards dealt to the player and the dealer in the current round
+    Returns 0 if the round has not been dealt yet
+*/
+int takeDeal(table_t * table, int seat, game_t * game);
+
+/*
+    Apply a decision of the player, stored in game->playerStatus, drawing from the shoe of the table
+    When the turn of the player finishes, the dealer plays if it was the last one
+*/
+void tableDecision(table_t * table, int seat, game_t * game);
+
+/*
+    Copy the final hand of the dealer and add the result of the round to the amount of the player
+    Returns 0 if the round has not been settled yet
+*/
+int takeResult(table_t * table, int seat, game_t * game);
+
+/*
+    Move a player between rounds from a table with few players to a fuller one of the same lobby
+    Returns the table where the player is seated, and its seat in the variable seat
+*/
+table_t * rebalanceTable(table_t * table, struct session_struct * session, int amount, int * seat);
+
+/*
+    Print the counters of all the tables, and the fill of the seats and the time to get one of every lobby
+*/
+void printTablesStats(tables_t * tables);
+
+/*
+    Free the memory of all the tables
+    The sessions must not be using them anymore
+*/
+void destroyTables(tables_t * tables);
+
+#endif
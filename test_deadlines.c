@@ -0,0 +1,327 @@
+/*
+    Test of the deadlines of the server
+    Starts the server with a short time to decide, lets the time of a turn pass,
+    and checks that a decision sent after the turn was played for the player
+    is ignored instead of being taken as the next bet.
+    Done with both the compact protocol and the original messages.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+// Sockets libraries
+#include <netdb.h>
+#include <arpa/inet.h>
+// Custom libraries
+#include "codes.h"
+#include "sockets.h"
+#include "protocol.h"
+
+// Seconds given to the player to decide, passed to the server
+#define DECISION_SECONDS "0.3"
+// Milliseconds waited for the turn to be played for the player
+#define TURN_WAIT 3000
+// Milliseconds waited for an answer that must not arrive
+#define SILENCE_WAIT 500
+// Times to try to connect while the server starts
+#define CONNECT_TRIES 50
+
+///// FUNCTION DECLARATIONS
+void usage(char * program);
+pid_t startServer(char * program, char * port);
+void stopServer(pid_t server);
+int connectServer(char * port);
+int waitForData(int connection_fd, int milliseconds);
+int testLateDecision(char * port, int protocol);
+int playUntilDecision(int connection_fd, int protocol, message_t * message);
+
+///// MAIN FUNCTION
+int main(int argc, char * argv[])
+{
+    char * program = "./server";
+    char * port = "8999";
+    pid_t server;
+    int failures = 0;
+    int option;
+
+    printf("\n=== TEST OF THE DEADLINES ===\n");
+
+    while ((option = getopt(argc, argv, "s:")) != -1)
+    {
+        switch (option)
+        {
+            case 's':
+                program = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (argc - optind > 1)
+    {
+        usage(argv[0]);
+    }
+    if (argc - optind == 1)
+    {
+        port = argv[optind];
+    }
+
+    // A connection closed by the server must fail the test, not finish it
+    signal(SIGPIPE, SIG_IGN);
+    server = startServer(program, port);
+
+    printf("Late decision with the compact protocol: ");
+    fflush(stdout);
+    if (testLateDecision(port, PROTOCOL_VERSION))
+    {
+        printf("passed\n");
+    }
+    else
+    {
+        failures++;
+    }
+
+    printf("Late decision with the original messages: ");
+    fflush(stdout);
+    if (testLateDecision(port, PROTOCOL_LEGACY))
+    {
+        printf("passed\n");
+    }
+    else
+    {
+        failures++;
+    }
+
+    stopServer(server);
+
+    printf("%d tests failed\n", failures);
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+///// FUNCTION DEFINITIONS
+
+/*
+    Explanation to the user of the parameters required to run the program
+*/
+void usage(char * program)
+{
+    printf("Usage:\n");
+    printf("\t%s [-s server_program] [port_number]\n", program);
+    printf("\t-s: path of the server to test, ./server by default\n");
+    printf("\tThe server is started on the port indicated, 8999 by default\n");
+    exit(EXIT_FAILURE);
+}
+
+/*
+    Run the server in another process, with a single seat at every table and a short time to decide
+    Its output is discarded, except the errors
+    Returns the id of the process
+*/
+pid_t startServer(char * program, char * port)
+{
+    pid_t server;
+
+    // The new process must not print again what is waiting in the buffer
+    fflush(stdout);
+    server = fork();
+    if (server == -1)
+    {
+        perror("ERROR: fork");
+        exit(EXIT_FAILURE);
+    }
+    if (server == 0)
+    {
+        if (freopen("/dev/null", "w", stdout) == NULL)
+        {
+            perror("ERROR: freopen");
+            exit(EXIT_FAILURE);
+        }
+        execl(program, program, "-L", "error", "-T", "1", "-D", DECISION_SECONDS, port, (char *) NULL);
+        perror("ERROR: execl");
+        exit(EXIT_FAILURE);
+    }
+
+    return server;
+}
+
+/*
+    Interrupt the server and wait for it to finish
+*/
+void stopServer(pid_t server)
+{
+    kill(server, SIGINT);
+    waitpid(server, NULL, 0);
+}
+
+/*
+    Connect to the server in this computer, trying again while it starts
+    Returns the socket, or -1 if the server never answered
+*/
+int connectServer(char * port)
+{
+    struct addrinfo hints;
+    struct addrinfo * address_info = NULL;
+    int connection_fd;
+
+    bzero(&hints, sizeof hints);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo("127.0.0.1", port, &hints, &address_info) != 0)
+    {
+        return -1;
+    }
+
+    for (int i=0; i<CONNECT_TRIES; i++)
+    {
+        connection_fd = socket(address_info->ai_family, address_info->ai_socktype, address_info->ai_protocol);
+        if (connection_fd == -1)
+        {
+            break;
+        }
+        if (connect(connection_fd, address_info->ai_addr, address_info->ai_addrlen) == 0)
+        {
+            freeaddrinfo(address_info);
+            return connection_fd;
+        }
+        close(connection_fd);
+        usleep(100000);
+    }
+
+    freeaddrinfo(address_info);
+    return -1;
+}
+
+/*
+    Wait until the socket has data to read
+    Returns 1 if there is data, 0 if the time finished first
+*/
+int waitForData(int connection_fd, int milliseconds)
+{
+    struct pollfd test_fd;
+
+    test_fd.fd = connection_fd;
+    test_fd.events = POLLIN;
+
+    return poll(&test_fd, 1, milliseconds) > 0;
+}
+
+/*
+    Bet until a round starts where the player has to decide, that is without naturals
+    Returns 1 when the player is waiting to decide, 0 if the connection failed
+*/
+int playUntilDecision(int connection_fd, int protocol, message_t * message)
+{
+    while (1)
+    {
+        message->msg_code = BET;
+        message->playerStatus = START;
+        message->dealerStatus = START;
+        message->playerBet = 10;
+        sendMessage(connection_fd, protocol, FRAME_BET, message);
+        if (!receiveMessage(connection_fd, protocol, message))
+        {
+            return 0;
+        }
+        if (message->playerStatus != NATURAL && message->dealerStatus != NATURAL)
+        {
+            return 1;
+        }
+        // The round finished after the deal, get the result and bet again
+        if (!receiveMessage(connection_fd, protocol, message))
+        {
+            return 0;
+        }
+    }
+}
+
+/*
+    Let the time to decide pass, then send a decision
+    The server must ignore it and still take the next bet
+    Returns 1 if the test passed, 0 otherwise, after printing the reason
+*/
+int testLateDecision(char * port, int protocol)
+{
+    message_t message;
+    int connection_fd;
+    int passed = 0;
+
+    connection_fd = connectServer(port);
+    if (connection_fd == -1)
+    {
+        printf("failed, could not connect to the server\n");
+        return 0;
+    }
+
+    bzero(&message, sizeof message);
+    message.msg_code = PLAY;
+    sendMessage(connection_fd, protocol, FRAME_HELLO, &message);
+    if (!receiveMessage(connection_fd, protocol, &message) || message.msg_code != AMOUNT)
+    {
+        printf("failed, the server did not welcome the player\n");
+        close(connection_fd);
+        return 0;
+    }
+    message.playerAmount = 1000;
+    sendMessage(connection_fd, protocol, FRAME_AMOUNT, &message);
+    if (!receiveMessage(connection_fd, protocol, &message))
+    {
+        printf("failed, the server did not take the amount\n");
+        close(connection_fd);
+        return 0;
+    }
+
+    if (!playUntilDecision(connection_fd, protocol, &message))
+    {
+        printf("failed, the connection finished before the player could decide\n");
+        close(connection_fd);
+        return 0;
+    }
+
+    // Do not decide, the server stands for the player and sends the result
+    if (!waitForData(connection_fd, TURN_WAIT) || !receiveMessage(connection_fd, protocol, &message))
+    {
+        printf("failed, the turn was not played after the deadline\n");
+    }
+    else
+    {
+        // The original clients keep the last code sent, that was BET
+        message.msg_code = BET;
+        message.playerStatus = HIT;
+        sendMessage(connection_fd, protocol, FRAME_HIT, &message);
+
+        if (waitForData(connection_fd, SILENCE_WAIT))
+        {
+            printf("failed, the late decision was answered\n");
+        }
+        else
+        {
+            message.msg_code = BET;
+            message.playerStatus = START;
+            message.playerBet = 10;
+            sendMessage(connection_fd, protocol, FRAME_BET, &message);
+            message.numPlayerCards = 0;
+            if (!waitForData(connection_fd, TURN_WAIT) || !receiveMessage(connection_fd, protocol, &message) || message.numPlayerCards != 2)
+            {
+                printf("failed, the bet after the late decision was not dealt\n");
+            }
+            else
+            {
+                passed = 1;
+            }
+        }
+    }
+
+    message.msg_code = BYE;
+    sendMessage(connection_fd, protocol, FRAME_BYE, &message);
+    receiveMessage(connection_fd, protocol, &message);
+    close(connection_fd);
+
+    return passed;
+}
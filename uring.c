@@ -0,0 +1,489 @@
+/*
+    Asynchronous I/O of the sockets with io_uring, used by the event loop instead of epoll
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+// Features required from the kernel: a single mapping for both queues, no completions lost, and waits with a time limit
+#define RING_FEATURES (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG)
+
+///// LOCAL FUNCTION DECLARATIONS
+static struct io_uring_sqe * nextRequest(ring_t * ring);
+static int queueFull(ring_t * ring);
+static struct io_uring_sqe * queueEntry(ring_t * ring);
+static struct io_uring_sqe * deferRequest(ring_t * ring);
+static void queueDeferred(ring_t * ring);
+static int enterRing(ring_t * ring, unsigned waitFor, unsigned flags, void * argument, size_t size);
+static int registerBuffers(ring_t * ring);
+static void releaseRing(ring_t * ring);
+
+///// FUNCTION DEFINITIONS
+
+/*
+    Create a ring with its queues and the buffers for the data received
+    Returns NULL if the system does not support io_uring or the requests used
+*/
+ring_t * createRing()
+{
+    struct io_uring_params params;
+    ring_t * ring = NULL;
+    char * memory = NULL;
+
+    ring = malloc(sizeof (ring_t));
+    if (ring == NULL)
+    {
+        perror("ERROR: malloc");
+        exit(EXIT_FAILURE);
+    }
+    bzero(ring, sizeof (ring_t));
+    ring->ring_fd = -1;
+    ring->sqMemory = MAP_FAILED;
+    ring->sqes = MAP_FAILED;
+    ring->buffers = MAP_FAILED;
+
+    // Only this thread submits, and the kernel does the work when it is asked for completions
+    bzero(&params, sizeof params);
+    params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+    ring->ring_fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    if (ring->ring_fd == -1 && errno == EINVAL)
+    {
+        bzero(&params, sizeof params);
+        ring->ring_fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    }
+    if (ring->ring_fd == -1)
+    {
+        perror("ERROR: io_uring_setup");
+        releaseRing(ring);
+        return NULL;
+    }
+    if ((params.features & RING_FEATURES) != RING_FEATURES)
+    {
+        printf("Error: the io_uring of the system is too old\n");
+        releaseRing(ring);
+        return NULL;
+    }
+
+    // Both queues are in the same mapping
+    ring->sqSize = params.sq_off.array + params.sq_entries * sizeof (unsigned);
+    if (params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe) > ring->sqSize)
+    {
+        ring->sqSize = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+    }
+    ring->sqMemory = mmap(NULL, ring->sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    ring->sqesSize = params.sq_entries * sizeof (struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqMemory == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        perror("ERROR: mmap");
+        releaseRing(ring);
+        return NULL;
+    }
+
+    memory = ring->sqMemory;
+    ring->sqHead = (unsigned *) (memory + params.sq_off.head);
+    ring->sqTail = (unsigned *) (memory + params.sq_off.tail);
+    ring->sqMask = *(unsigned *) (memory + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned *) (memory + params.sq_off.array);
+    ring->cqHead = (unsigned *) (memory + params.cq_off.head);
+    ring->cqTail = (unsigned *) (memory + params.cq_off.tail);
+    ring->cqMask = *(unsigned *) (memory + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (memory + params.cq_off.cqes);
+
+    if (!registerBuffers(ring))
+    {
+        releaseRing(ring);
+        return NULL;
+    }
+
+    return ring;
+}
+
+/*
+    Accept connections on a listening socket until the request is cancelled
+    The sockets accepted are already in non-blocking mode
+*/
+void ringAccept(ring_t * ring, int server_fd, uint64_t user_data)
+{
+    struct io_uring_sqe * sqe = nextRequest(ring);
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = server_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = user_data;
+}
+
+/*
+    Receive the data of a socket in the buffers of the ring, until the connection finishes
+    The request also stops when there are no buffers left, and must be done again
+*/
+void ringRecv(ring_t * ring, int connection_fd, uint64_t user_data)
+{
+    struct io_uring_sqe * sqe = nextRequest(ring);
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = connection_fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RING_BUFFER_GROUP;
+    sqe->user_data = user_data;
+}
+
+/*
+    Read a single time from a file into the memory indicated
+*/
+void ringRead(ring_t * ring, int fd, void * buffer, unsigned size, uint64_t user_data)
+{
+    struct io_uring_sqe * sqe = nextRequest(ring);
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buffer;
+    sqe->len = size;
+    // Read from the current position
+    sqe->off = (uint64_t) -1;
+    sqe->user_data = user_data;
+}
+
+/*
+    Wait until a file has the events indicated, a single time or until the request is cancelled
+*/
+void ringPoll(ring_t * ring, int fd, unsigned events, int multishot, uint64_t user_data)
+{
+    struct io_uring_sqe * sqe = nextRequest(ring);
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = user_data;
+}
+
+/*
+    Cancel the request with the data indicated, the cancellation completes with its own data
+*/
+void ringCancel(ring_t * ring, uint64_t target, uint64_t user_data)
+{
+    struct io_uring_sqe * sqe = nextRequest(ring);
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = user_data;
+}
+
+/*
+    Submit the requests prepared and wait for at least one completion, or for the milliseconds indicated
+    The requests that did not fit in the submission queue are submitted first
+    Does not wait if there are completions not seen yet, or requests still deferred
+    Returns 0, or a negative error like -EINTR or -ETIME
+*/
+int ringWait(ring_t * ring, int milliseconds)
+{
+    struct io_uring_getevents_arg argument;
+    struct __kernel_timespec timeout;
+    unsigned waitFor = 1;
+    int result;
+
+    // Keep submitting while the kernel takes the requests and makes space for the rest
+    while (ring->deferredCount > 0)
+    {
+        queueDeferred(ring);
+        if (ring->deferredCount == 0 || enterRing(ring, 0, 0, NULL, 0) < 0 || queueFull(ring))
+        {
+            break;
+        }
+    }
+
+    if (ring->deferredCount > 0 || *ring->cqHead != atomic_load_explicit((_Atomic unsigned *) ring->cqTail, memory_order_acquire))
+    {
+        waitFor = 0;
+    }
+
+    bzero(&argument, sizeof argument);
+    if (milliseconds >= 0)
+    {
+        timeout.tv_sec = milliseconds / 1000;
+        timeout.tv_nsec = (milliseconds % 1000) * 1000000LL;
+        argument.ts = (uint64_t) (uintptr_t) &timeout;
+    }
+
+    result = enterRing(ring, waitFor, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &argument, sizeof argument);
+    // The kernel takes more requests after the completions are seen, the ones left are submitted in the next wait
+    if (result == -EBUSY || result == -EAGAIN)
+    {
+        return 0;
+    }
+    return result;
+}
+
+/*
+    Get the next completion, or NULL if there is none
+    It must be marked as seen with ringSeen after using it
+*/
+struct io_uring_cqe * ringNext(ring_t * ring)
+{
+    unsigned head = *ring->cqHead;
+    struct io_uring_cqe * cqe = NULL;
+
+    if (head == atomic_load_explicit((_Atomic unsigned *) ring->cqTail, memory_order_acquire))
+    {
+        return NULL;
+    }
+
+    cqe = &ring->cqes[head & ring->cqMask];
+    if (cqe->res == -ENOBUFS)
+    {
+        ring->exhausted++;
+    }
+    return cqe;
+}
+
+/*
+    Free the space of the completion taken with ringNext
+*/
+void ringSeen(ring_t * ring)
+{
+    atomic_store_explicit((_Atomic unsigned *) ring->cqHead, *ring->cqHead + 1, memory_order_release);
+    ring->completions++;
+}
+
+/*
+    Get the buffer where the data of a completion was received, and its identifier
+    Returns NULL if the completion has no buffer
+*/
+char * ringBuffer(ring_t * ring, struct io_uring_cqe * cqe, int * id)
+{
+    if (!(cqe->flags & IORING_CQE_F_BUFFER))
+    {
+        return NULL;
+    }
+
+    *id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    if (cqe->res > 0)
+    {
+        ring->received += cqe->res;
+    }
+    return ring->bufferMemory + *id * RING_BUFFER_SIZE;
+}
+
+/*
+    Give back a buffer to the kernel, to receive more data
+*/
+void ringRecycle(ring_t * ring, int id)
+{
+    struct io_uring_buf * entry = &ring->buffers->bufs[ring->bufferTail & (RING_BUFFERS - 1)];
+
+    entry->addr = (uint64_t) (uintptr_t) (ring->bufferMemory + id * RING_BUFFER_SIZE);
+    entry->len = RING_BUFFER_SIZE;
+    entry->bid = id;
+    ring->bufferTail++;
+    atomic_store_explicit((_Atomic unsigned short *) &ring->buffers->tail, ring->bufferTail, memory_order_release);
+}
+
+/*
+    Print the system calls done, the completions for every call and the data received
+*/
+void printRingStats(ring_t * ring)
+{
+    printf("Ring: %lld system calls, %lld requests submitted, %lld completions, %.1f completions per call\n",
+        ring->enters, ring->submitted, ring->completions, ring->enters > 0 ? (double) ring->completions / ring->enters : 0.0);
+    printf("\t%lld KB received in %d buffers of %d bytes, %lld times without buffers, %lld requests deferred with the queue full\n",
+        ring->received / 1024, RING_BUFFERS, RING_BUFFER_SIZE, ring->exhausted, ring->deferrals);
+}
+
+/*
+    Close the ring, cancelling all its requests
+*/
+void destroyRing(ring_t * ring)
+{
+    releaseRing(ring);
+}
+
+/*
+    Get space for a new request in the submission queue
+    If the queue is full, the requests prepared are submitted first
+    When the kernel does not take them all, the new request is kept in memory until the next wait,
+    instead of replacing one that was not submitted
+*/
+static struct io_uring_sqe * nextRequest(ring_t * ring)
+{
+    struct io_uring_sqe * sqe = NULL;
+
+    if (ring->deferredCount == 0 && queueFull(ring))
+    {
+        enterRing(ring, 0, 0, NULL, 0);
+    }
+
+    // Behind the requests already deferred, to keep the order in which they were made
+    if (ring->deferredCount > 0 || queueFull(ring))
+    {
+        sqe = deferRequest(ring);
+    }
+    else
+    {
+        sqe = queueEntry(ring);
+    }
+    bzero(sqe, sizeof (struct io_uring_sqe));
+
+    return sqe;
+}
+
+/*
+    Check if every entry of the submission queue has a request not taken by the kernel
+*/
+static int queueFull(ring_t * ring)
+{
+    return *ring->sqTail - atomic_load_explicit((_Atomic unsigned *) ring->sqHead, memory_order_acquire) > ring->sqMask;
+}
+
+/*
+    Take the next entry of the submission queue, that must have space
+*/
+static struct io_uring_sqe * queueEntry(ring_t * ring)
+{
+    unsigned tail = *ring->sqTail;
+    unsigned index = tail & ring->sqMask;
+
+    ring->sqArray[index] = index;
+    ring->prepared++;
+    // The kernel sees the request only after it is complete, when it is submitted
+    atomic_store_explicit((_Atomic unsigned *) ring->sqTail, tail + 1, memory_order_release);
+
+    return &ring->sqes[index];
+}
+
+/*
+    Get space for a request after the ones that wait for the submission queue
+*/
+static struct io_uring_sqe * deferRequest(ring_t * ring)
+{
+    if (ring->deferredCount == ring->deferredCapacity)
+    {
+        ring->deferredCapacity = (ring->deferredCapacity > 0) ? ring->deferredCapacity * 2 : RING_ENTRIES;
+        ring->deferred = realloc(ring->deferred, ring->deferredCapacity * sizeof (struct io_uring_sqe));
+        if (ring->deferred == NULL)
+        {
+            perror("ERROR: realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    ring->deferrals++;
+    return &ring->deferred[ring->deferredCount++];
+}
+
+/*
+    Move to the submission queue as many deferred requests as fit, in the order they were made
+*/
+static void queueDeferred(ring_t * ring)
+{
+    unsigned moved = 0;
+
+    while (moved < ring->deferredCount && !queueFull(ring))
+    {
+        memcpy(queueEntry(ring), &ring->deferred[moved], sizeof (struct io_uring_sqe));
+        moved++;
+    }
+
+    ring->deferredCount -= moved;
+    memmove(ring->deferred, ring->deferred + moved, ring->deferredCount * sizeof (struct io_uring_sqe));
+}
+
+/*
+    Submit the requests prepared, and wait for the completions indicated
+    Returns 0, or a negative error
+*/
+static int enterRing(ring_t * ring, unsigned waitFor, unsigned flags, void * argument, size_t size)
+{
+    int result;
+
+    result = syscall(__NR_io_uring_enter, ring->ring_fd, ring->prepared, waitFor, flags, argument, size);
+    ring->enters++;
+    if (result == -1)
+    {
+        return -errno;
+    }
+
+    ring->prepared -= result;
+    ring->submitted += result;
+    return 0;
+}
+
+/*
+    Give the buffers for the data received to the kernel, in a ring of buffers
+    Returns 1 on success, or 0 if the system does not support it
+*/
+static int registerBuffers(ring_t * ring)
+{
+    struct io_uring_buf_reg registration;
+
+    ring->buffersSize = RING_BUFFERS * sizeof (struct io_uring_buf);
+    ring->buffers = mmap(NULL, ring->buffersSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->buffers == MAP_FAILED)
+    {
+        perror("ERROR: mmap");
+        return 0;
+    }
+
+    bzero(&registration, sizeof registration);
+    registration.ring_addr = (uint64_t) (uintptr_t) ring->buffers;
+    registration.ring_entries = RING_BUFFERS;
+    registration.bgid = RING_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ring->ring_fd, IORING_REGISTER_PBUF_RING, &registration, 1) == -1)
+    {
+        perror("ERROR: io_uring_register");
+        return 0;
+    }
+
+    ring->bufferMemory = malloc(RING_BUFFERS * RING_BUFFER_SIZE);
+    if (ring->bufferMemory == NULL)
+    {
+        perror("ERROR: malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i=0; i<RING_BUFFERS; i++)
+    {
+        ringRecycle(ring, i);
+    }
+
+    return 1;
+}
+
+/*
+    Free all the parts of the ring created so far
+*/
+static void releaseRing(ring_t * ring)
+{
+    if (ring->ring_fd != -1)
+    {
+        close(ring->ring_fd);
+    }
+    if (ring->sqes != MAP_FAILED)
+    {
+        munmap(ring->sqes, ring->sqesSize);
+    }
+    if (ring->sqMemory != MAP_FAILED)
+    {
+        munmap(ring->sqMemory, ring->sqSize);
+    }
+    if (ring->buffers != MAP_FAILED)
+    {
+        munmap(ring->buffers, ring->buffersSize);
+    }
+    free(ring->bufferMemory);
+    free(ring->deferred);
+    free(ring);
+}
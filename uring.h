@@ -0,0 +1,142 @@
+/*
+    Asynchronous I/O of the sockets with io_uring, used by the event loop instead of epoll
+    The requests are written in a submission queue shared with the kernel, and all the
+    requests prepared while attending the completions go together in the next wait,
+    so a single system call submits the work of many sessions and waits for more.
+    The listening socket has a single accept request that keeps producing connections,
+    and every connection has a single receive request that keeps producing data. The data
+    arrives in buffers registered once with the kernel, that are given back after it is used.
+
+    The system calls are done directly, with the definitions of <linux/io_uring.h>.
+    Needs Linux 6.0 or newer; createRing fails on older systems, so the server can use epoll.
+    A ring must be used by a single thread.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+// Requests that can be prepared before submitting them
+#define RING_ENTRIES 1024
+// Buffers registered for the data received, and the size of each one
+#define RING_BUFFERS 4096
+#define RING_BUFFER_SIZE 512
+// Identifier of the group of the buffers
+#define RING_BUFFER_GROUP 0
+
+// The queues shared with the kernel, and the buffers for the data received
+typedef struct ring_struct {
+    int ring_fd;
+    // Submission queue: the indices of the requests and the requests themselves
+    unsigned * sqHead;
+    unsigned * sqTail;
+    unsigned sqMask;
+    unsigned * sqArray;
+    struct io_uring_sqe * sqes;
+    // Requests prepared and not submitted yet
+    unsigned prepared;
+    // Requests that did not fit in the submission queue, they go to it in the next wait
+    struct io_uring_sqe * deferred;
+    unsigned deferredCount;
+    unsigned deferredCapacity;
+    // Completion queue
+    unsigned * cqHead;
+    unsigned * cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe * cqes;
+    // Memory mapped from the kernel, with both queues
+    void * sqMemory;
+    size_t sqSize;
+    size_t sqesSize;
+    // Buffers given to the kernel for the data received
+    struct io_uring_buf_ring * buffers;
+    char * bufferMemory;
+    size_t buffersSize;
+    unsigned short bufferTail;
+    // Counters for the report
+    long long enters;
+    long long submitted;
+    long long completions;
+    long long received;
+    long long exhausted;
+    long long deferrals;
+} ring_t;
+
+/*
+    Create a ring with its queues and the buffers for the data received
+    Returns NULL if the system does not support io_uring or the requests used
+*/
+ring_t * createRing();
+
+/*
+    Accept connections on a listening socket until the request is cancelled
+    The sockets accepted are already in non-blocking mode
+*/
+void ringAccept(ring_t * ring, int server_fd, uint64_t user_data);
+
+/*
+    Receive the data of a socket in the buffers of the ring, until the connection finishes
+*/
+void ringRecv(ring_t * ring, int connection_fd, uint64_t user_data);
+
+/*
+    Read a single time from a file into the memory indicated
+*/
+void ringRead(ring_t * ring, int fd, void * buffer, unsigned size, uint64_t user_data);
+
+/*
+    Wait until a file has the events indicated, a single time or until the request is cancelled
+*/
+void ringPoll(ring_t * ring, int fd, unsigned events, int multishot, uint64_t user_data);
+
+/*
+    Cancel the request with the data indicated, the cancellation completes with its own data
+*/
+void ringCancel(ring_t * ring, uint64_t target, uint64_t user_data);
+
+/*
+    Submit the requests prepared and wait for at least one completion, or for the milliseconds indicated
+    The requests that did not fit in the submission queue are submitted first, and while some are left it does not wait
+    A negative time waits without limit
+    Returns 0, or a negative error like -EINTR or -ETIME
+*/
+int ringWait(ring_t * ring, int milliseconds);
+
+/*
+    Get the next completion, or NULL if there is none
+    It must be marked as seen with ringSeen after using it
+*/
+struct io_uring_cqe * ringNext(ring_t * ring);
+
+/*
+    Free the space of the completion taken with ringNext
+*/
+void ringSeen(ring_t * ring);
+
+/*
+    Get the buffer where the data of a completion was received, and its identifier
+    Returns NULL if the completion has no buffer
+*/
+char * ringBuffer(ring_t * ring, struct io_uring_cqe * cqe, int * id);
+
+/*
+    Give back a buffer to the kernel, to receive more data
+*/
+void ringRecycle(ring_t * ring, int id);
+
+/*
+    Print the system calls done, the completions for every call and the data received
+*/
+void printRingStats(ring_t * ring);
+
+/*
+    Close the ring, cancelling all its requests
+*/
+void destroyRing(ring_t * ring);
+
+#endif
@@ -0,0 +1,244 @@
+/*
+    Hierarchical timer wheel, for the deadlines of many sessions
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "wheel.h"
+
+#define SLOT_MASK (WHEEL_SLOTS - 1)
+#define TICK_NANOSECONDS (WHEEL_TICK * 1000000ULL)
+
+///// LOCAL FUNCTION DECLARATIONS
+static uint64_t clockNanoseconds();
+static void linkTimer(wheel_t * wheel, wheel_timer_t * timer);
+static void unlinkTimer(wheel_timer_t * timer);
+static void cascade(wheel_t * wheel, int level, int slot);
+
+///// FUNCTION DEFINITIONS
+
+/*
+    Create an empty wheel starting at the current time
+*/
+wheel_t * createWheel(void (* expire)(void * data))
+{
+    wheel_t * wheel = NULL;
+
+    wheel = malloc(sizeof (wheel_t));
+    if (wheel == NULL)
+    {
+        perror("ERROR: malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_init(&wheel->wheel_mutex, NULL);
+    for (int level=0; level<WHEEL_LEVELS; level++)
+    {
+        for (int slot=0; slot<WHEEL_SLOTS; slot++)
+        {
+            wheel->slots[level][slot].prev = &wheel->slots[level][slot];
+            wheel->slots[level][slot].next = &wheel->slots[level][slot];
+        }
+    }
+    wheel->current = clockNanoseconds() / TICK_NANOSECONDS;
+    wheel->expire = expire;
+    wheel->pending = 0;
+    wheel->added = 0;
+    wheel->cancelled = 0;
+    wheel->expired = 0;
+
+    return wheel;
+}
+
+/*
+    Prepare a timer that is not pending, with the data given to the function of the wheel
+*/
+void initTimer(wheel_timer_t * timer, void * data)
+{
+    timer->prev = NULL;
+    timer->next = NULL;
+    timer->expires = 0;
+    timer->data = data;
+}
+
+/*
+    Make the timer expire after the milliseconds indicated, replacing its previous time
+    The time is rounded up to the next tick
+*/
+void addTimer(wheel_t * wheel, wheel_timer_t * timer, uint64_t milliseconds)
+{
+    uint64_t expires = (clockNanoseconds() + milliseconds * 1000000ULL + TICK_NANOSECONDS - 1) / TICK_NANOSECONDS;
+
+    pthread_mutex_lock(&wheel->wheel_mutex);
+    if (timer->prev != NULL)
+    {
+        unlinkTimer(timer);
+        wheel->pending--;
+    }
+    timer->expires = expires;
+    linkTimer(wheel, timer);
+    wheel->pending++;
+    wheel->added++;
+    pthread_mutex_unlock(&wheel->wheel_mutex);
+}
+
+/*
+    Stop a timer, if it is pending
+*/
+void cancelTimer(wheel_t * wheel, wheel_timer_t * timer)
+{
+    pthread_mutex_lock(&wheel->wheel_mutex);
+    if (timer->prev != NULL)
+    {
+        unlinkTimer(timer);
+        wheel->pending--;
+        wheel->cancelled++;
+    }
+    pthread_mutex_unlock(&wheel->wheel_mutex);
+}
+
+/*
+    Expire all the timers that reached their tick, calling the function of the wheel for each one
+    Returns the number of timers expired
+*/
+int advanceWheel(wheel_t * wheel)
+{
+    uint64_t target = clockNanoseconds() / TICK_NANOSECONDS;
+    wheel_timer_t * head = NULL;
+    wheel_timer_t * timer = NULL;
+    void * data = NULL;
+    int count = 0;
+
+    pthread_mutex_lock(&wheel->wheel_mutex);
+    while (wheel->current < target)
+    {
+        wheel->current++;
+
+        // At the end of a turn of a level, bring down the next slot of the level above
+        for (int level=1; level<WHEEL_LEVELS; level++)
+        {
+            if (((wheel->current >> (WHEEL_BITS * (level - 1))) & SLOT_MASK) != 0)
+            {
+                break;
+            }
+            cascade(wheel, level, (wheel->current >> (WHEEL_BITS * level)) & SLOT_MASK);
+        }
+
+        // The timers added meanwhile always go to later ticks, so this slot ends empty
+        head = &wheel->slots[0][wheel->current & SLOT_MASK];
+        while (head->next != head)
+        {
+            timer = head->next;
+            unlinkTimer(timer);
+            wheel->pending--;
+            wheel->expired++;
+            data = timer->data;
+
+            pthread_mutex_unlock(&wheel->wheel_mutex);
+            wheel->expire(data);
+            count++;
+            pthread_mutex_lock(&wheel->wheel_mutex);
+        }
+    }
+    pthread_mutex_unlock(&wheel->wheel_mutex);
+
+    return count;
+}
+
+/*
+    Print the timers pending, added, cancelled and expired
+*/
+void printWheelStats(wheel_t * wheel)
+{
+    pthread_mutex_lock(&wheel->wheel_mutex);
+    printf("Timers: %ld pending, %lld added, %lld cancelled, %lld expired, ticks of %d ms\n",
+        wheel->pending, wheel->added, wheel->cancelled, wheel->expired, WHEEL_TICK);
+    pthread_mutex_unlock(&wheel->wheel_mutex);
+}
+
+/*
+    Free the wheel, the pending timers are forgotten
+*/
+void destroyWheel(wheel_t * wheel)
+{
+    pthread_mutex_destroy(&wheel->wheel_mutex);
+    free(wheel);
+}
+
+/*
+    Current time of the monotonic clock, in nanoseconds
+*/
+static uint64_t clockNanoseconds()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+    Add the timer to the slot of its tick, in the lowest level that reaches it
+    The timers of past ticks expire in the next one, and the ones beyond the last level
+    wait in the last slot reached
+    Must be called with the lock of the wheel
+*/
+static void linkTimer(wheel_t * wheel, wheel_timer_t * timer)
+{
+    wheel_timer_t * head = NULL;
+    uint64_t delta;
+    int level = 0;
+
+    if (timer->expires <= wheel->current)
+    {
+        timer->expires = wheel->current + 1;
+    }
+    delta = timer->expires - wheel->current;
+    if (delta >= (1ULL << (WHEEL_BITS * WHEEL_LEVELS)))
+    {
+        timer->expires = wheel->current + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+        delta = timer->expires - wheel->current;
+    }
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ULL << (WHEEL_BITS * (level + 1))))
+    {
+        level++;
+    }
+
+    head = &wheel->slots[level][(timer->expires >> (WHEEL_BITS * level)) & SLOT_MASK];
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+/*
+    Remove the timer from its slot, leaving it as not pending
+    Must be called with the lock of the wheel
+*/
+static void unlinkTimer(wheel_timer_t * timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = NULL;
+    timer->next = NULL;
+}
+
+/*
+    Move the timers of a slot to the lower levels, now that their ticks are closer
+    Must be called with the lock of the wheel
+*/
+static void cascade(wheel_t * wheel, int level, int slot)
+{
+    wheel_timer_t * head = &wheel->slots[level][slot];
+    wheel_timer_t * timer = NULL;
+
+    while (head->next != head)
+    {
+        timer = head->next;
+        unlinkTimer(timer);
+        linkTimer(wheel, timer);
+    }
+}
@@ -0,0 +1,95 @@
+/*
+    Hierarchical timer wheel, for the deadlines of many sessions
+    Time is counted in ticks of WHEEL_TICK milliseconds. The first level has a slot
+    for each of the next WHEEL_SLOTS ticks, and every next level has slots that cover
+    WHEEL_SLOTS times more ticks. A timer is linked in the slot of its tick in the lowest
+    level that reaches it, so adding or cancelling a timer does not depend on how many
+    timers exist. When the first level completes a turn, the timers of the next slot
+    of the level above are moved down, closer to their tick.
+
+    The timers are added and cancelled by any thread, and expired by a single one,
+    that calls a function for every timer that reached its tick.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+// Milliseconds of every tick
+#define WHEEL_TICK 100
+// Bits of the slots of every level, and number of levels
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+
+// A deadline, kept inside the object that waits for it
+typedef struct wheel_timer_struct {
+    // Links of the list of the slot, the timer is pending while it is linked
+    struct wheel_timer_struct * prev;
+    struct wheel_timer_struct * next;
+    // Tick when the timer expires
+    uint64_t expires;
+    // Data given to the function of the wheel
+    void * data;
+} wheel_timer_t;
+
+// The slots of all the levels, and the function called when a timer expires
+typedef struct wheel_struct {
+    pthread_mutex_t wheel_mutex;
+    // Every slot is a circular list, headed by a timer that never expires
+    wheel_timer_t slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    // Last tick processed, counted from the start of the clock
+    uint64_t current;
+    void (* expire)(void * data);
+    // Counters for the report
+    long pending;
+    long long added;
+    long long cancelled;
+    long long expired;
+} wheel_t;
+
+/*
+    Create an empty wheel starting at the current time
+    Receives the function called with the data of every timer that expires
+*/
+wheel_t * createWheel(void (* expire)(void * data));
+
+/*
+    Prepare a timer that is not pending, with the data given to the function of the wheel
+*/
+void initTimer(wheel_timer_t * timer, void * data);
+
+/*
+    Make the timer expire after the milliseconds indicated, replacing its previous time
+*/
+void addTimer(wheel_t * wheel, wheel_timer_t * timer, uint64_t milliseconds);
+
+/*
+    Stop a timer, if it is pending
+    The function of the wheel can still be running for it, if it expired at the same time
+*/
+void cancelTimer(wheel_t * wheel, wheel_timer_t * timer);
+
+/*
+    Expire all the timers that reached their tick, calling the function of the wheel for each one
+    The function is called without the lock of the wheel, so it can add timers again
+    Must be called always by the same thread
+    Returns the number of timers expired
+*/
+int advanceWheel(wheel_t * wheel);
+
+/*
+    Print the timers pending, added, cancelled and expired
+*/
+void printWheelStats(wheel_t * wheel);
+
+/*
+    Free the wheel, the pending timers are forgotten
+*/
+void destroyWheel(wheel_t * wheel);
+
+#endif
@@ -0,0 +1,334 @@
+/*
+    Fixed pool of worker threads with work stealing
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "workers.h"
+
+// Index of the worker running in the current thread
+static __thread int current_worker = -1;
+
+///// LOCAL FUNCTION DECLARATIONS
+static void initDeque(deque_t * queue);
+static void pushBottom(deque_t * queue, void * item);
+static void * popTop(deque_t * queue);
+static void * popBottom(deque_t * queue);
+static void * takeItem(worker_t * worker);
+static void * workerThread(void * arg);
+
+///// FUNCTION DEFINITIONS
+
+/*
+    Start a pool with the number of threads indicated
+    A size of 0 or less uses one thread per processor available
+    The threads get stacks of the bytes indicated, or the default of the system with 0
+*/
+pool_t * createPool(int size, size_t stackSize, void (* run)(void * item))
+{
+    pool_t * pool = NULL;
+    pthread_attr_t attributes;
+    int status;
+
+    if (size <= 0)
+    {
+        size = sysconf(_SC_NPROCESSORS_ONLN);
+        if (size <= 0)
+        {
+            size = 1;
+        }
+    }
+
+    pool = malloc(sizeof (pool_t));
+    if (pool == NULL)
+    {
+        perror("ERROR: malloc");
+        exit(EXIT_FAILURE);
+    }
+    pool->size = size;
+    pool->run = run;
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->sleepers, 0);
+    atomic_init(&pool->running, 1);
+    pthread_mutex_init(&pool->idle_mutex, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+
+    pool->workers = malloc(size * sizeof (worker_t));
+    if (pool->workers == NULL)
+    {
+        perror("ERROR: malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i=0; i<size; i++)
+    {
+        pool->workers[i].id = i;
+        pool->workers[i].pool = pool;
+        atomic_init(&pool->workers[i].executed, 0);
+        atomic_init(&pool->workers[i].stolen, 0);
+        initDeque(&pool->workers[i].queue);
+    }
+
+    // The workers never go deep in the stack, small stacks keep the memory of many threads low
+    pthread_attr_init(&attributes);
+    if (stackSize > 0)
+    {
+        if (stackSize < PTHREAD_STACK_MIN)
+        {
+            stackSize = PTHREAD_STACK_MIN;
+        }
+        status = pthread_attr_setstacksize(&attributes, stackSize);
+        if (status != 0)
+        {
+            fprintf(stderr, "ERROR: pthread_attr_setstacksize: %s\n", strerror(status));
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_attr_getstacksize(&attributes, &stackSize);
+
+    for (int i=0; i<size; i++)
+    {
+        status = pthread_create(&pool->workers[i].tid, &attributes, workerThread, &pool->workers[i]);
+        if (status != 0)
+        {
+            fprintf(stderr, "ERROR: pthread_create: %s\n", strerror(status));
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_attr_destroy(&attributes);
+
+    printf("Started a pool of %d workers with stacks of %zu KB\n", size, stackSize / 1024);
+
+    return pool;
+}
+
+/*
+    Add an item ready to be processed to the queue of a worker
+*/
+void poolSubmit(pool_t * pool, int worker, void * item)
+{
+    if (worker < 0)
+    {
+        worker = (current_worker >= 0) ? current_worker : 0;
+    }
+
+    // Count the item before it is visible, so the counter never goes below zero
+    atomic_fetch_add(&pool->pending, 1);
+    pushBottom(&pool->workers[worker % pool->size].queue, item);
+
+    // Only take the lock when there is someone to wake up
+    if (atomic_load(&pool->sleepers) > 0)
+    {
+        pthread_mutex_lock(&pool->idle_mutex);
+        pthread_cond_signal(&pool->idle_cond);
+        pthread_mutex_unlock(&pool->idle_mutex);
+    }
+}
+
+/*
+    Get the index of the worker running the calling thread, or -1 if it is not a worker
+*/
+int poolCurrentWorker()
+{
+    return current_worker;
+}
+
+/*
+    Print the depth of the queue and the counters of every worker
+*/
+void printPoolStats(pool_t * pool)
+{
+    int depth;
+
+    printf("Pool of %d workers, %d items pending, %d workers idle\n", pool->size, atomic_load(&pool->pending), atomic_load(&pool->sleepers));
+    for (int i=0; i<pool->size; i++)
+    {
+        pthread_mutex_lock(&pool->workers[i].queue.lock);
+        depth = pool->workers[i].queue.size;
+        pthread_mutex_unlock(&pool->workers[i].queue.lock);
+        printf("\tWorker %d: queue depth %d, executed %ld, stolen %ld\n", i, depth, atomic_load(&pool->workers[i].executed), atomic_load(&pool->workers[i].stolen));
+    }
+}
+
+/*
+    Stop all the workers, wait for them to finish and free the memory
+*/
+void destroyPool(pool_t * pool)
+{
+    pthread_mutex_lock(&pool->idle_mutex);
+    atomic_store(&pool->running, 0);
+    pthread_cond_broadcast(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_mutex);
+
+    for (int i=0; i<pool->size; i++)
+    {
+        pthread_join(pool->workers[i].tid, NULL);
+        pthread_mutex_destroy(&pool->workers[i].queue.lock);
+        free(pool->workers[i].queue.items);
+    }
+
+    pthread_mutex_destroy(&pool->idle_mutex);
+    pthread_cond_destroy(&pool->idle_cond);
+    free(pool->workers);
+    free(pool);
+}
+
+/*
+    Prepare an empty queue
+*/
+static void initDeque(deque_t * queue)
+{
+    pthread_mutex_init(&queue->lock, NULL);
+    queue->items = malloc(DEQUE_CAPACITY * sizeof (void *));
+    if (queue->items == NULL)
+    {
+        perror("ERROR: malloc");
+        exit(EXIT_FAILURE);
+    }
+    queue->capacity = DEQUE_CAPACITY;
+    queue->top = 0;
+    queue->size = 0;
+}
+
+/*
+    Add the newest item, doubling the array when it is full
+*/
+static void pushBottom(deque_t * queue, void * item)
+{
+    void ** items = NULL;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->size == queue->capacity)
+    {
+        // Copy the items in order to the new array
+        items = malloc(2 * queue->capacity * sizeof (void *));
+        if (items == NULL)
+        {
+            perror("ERROR: malloc");
+            exit(EXIT_FAILURE);
+        }
+        for (int i=0; i<queue->size; i++)
+        {
+            items[i] = queue->items[(queue->top + i) % queue->capacity];
+        }
+        free(queue->items);
+        queue->items = items;
+        queue->capacity *= 2;
+        queue->top = 0;
+    }
+    queue->items[(queue->top + queue->size) % queue->capacity] = item;
+    queue->size++;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/*
+    Take the oldest item, used by the owner of the queue to be fair with the sessions
+    Returns NULL if the queue is empty
+*/
+static void * popTop(deque_t * queue)
+{
+    void * item = NULL;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->size > 0)
+    {
+        item = queue->items[queue->top];
+        queue->top = (queue->top + 1) % queue->capacity;
+        queue->size--;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return item;
+}
+
+/*
+    Take the newest item, used by the thieves so they do not compete with the owner
+    Returns NULL if the queue is empty
+*/
+static void * popBottom(deque_t * queue)
+{
+    void * item = NULL;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->size > 0)
+    {
+        queue->size--;
+        item = queue->items[(queue->top + queue->size) % queue->capacity];
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return item;
+}
+
+/*
+    Get the next item for a worker, first from its own queue and then from the others
+    Returns NULL when there is no work anywhere
+*/
+static void * takeItem(worker_t * worker)
+{
+    pool_t * pool = worker->pool;
+    void * item = NULL;
+    int victim;
+
+    item = popTop(&worker->queue);
+    if (item != NULL)
+    {
+        return item;
+    }
+
+    // Start with the next worker, so the thieves do not all go to the same queue
+    for (int i=1; i<pool->size; i++)
+    {
+        victim = (worker->id + i) % pool->size;
+        item = popBottom(&pool->workers[victim].queue);
+        if (item != NULL)
+        {
+            atomic_fetch_add(&worker->stolen, 1);
+            return item;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+    Main loop of every worker
+    Sleeps only when there are no items pending in any queue
+*/
+static void * workerThread(void * arg)
+{
+    worker_t * worker = arg;
+    pool_t * pool = worker->pool;
+    void * item = NULL;
+
+    current_worker = worker->id;
+
+    while (atomic_load(&pool->running))
+    {
+        item = takeItem(worker);
+        if (item != NULL)
+        {
+            atomic_fetch_sub(&pool->pending, 1);
+            pool->run(item);
+            atomic_fetch_add(&worker->executed, 1);
+            continue;
+        }
+
+        // Wait until an item is submitted
+        pthread_mutex_lock(&pool->idle_mutex);
+        atomic_fetch_add(&pool->sleepers, 1);
+        while (atomic_load(&pool->pending) == 0 && atomic_load(&pool->running))
+        {
+            pthread_cond_wait(&pool->idle_cond, &pool->idle_mutex);
+        }
+        atomic_fetch_sub(&pool->sleepers, 1);
+        pthread_mutex_unlock(&pool->idle_mutex);
+    }
+
+    pthread_exit(NULL);
+}
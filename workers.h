@@ -0,0 +1,85 @@
+/*
+    Fixed pool of worker threads with work stealing
+    Every worker has its own double ended queue of items ready to be processed.
+    A worker takes the oldest item of its own queue, and when it is empty
+    it steals the newest item from the queue of another worker.
+
+    Raziel Nicolás Martínez Castillo A01410695
+*/
+
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Initial number of items that fit in the queue of a worker
+#define DEQUE_CAPACITY 64
+
+// Double ended queue of pending items, stored in a circular array
+typedef struct deque_struct {
+    pthread_mutex_t lock;
+    void ** items;
+    int capacity;
+    // Position of the oldest item, and number of items stored
+    int top;
+    int size;
+} deque_t;
+
+// Data of a single thread of the pool
+typedef struct worker_struct {
+    pthread_t tid;
+    int id;
+    struct pool_struct * pool;
+    deque_t queue;
+    // Counters for the reports
+    atomic_long executed;
+    atomic_long stolen;
+} worker_t;
+
+// The collection of workers and the function they apply to every item
+typedef struct pool_struct {
+    int size;
+    worker_t * workers;
+    void (* run)(void * item);
+    // Items submitted that no worker has taken yet
+    atomic_int pending;
+    // Workers waiting for new items
+    atomic_int sleepers;
+    pthread_mutex_t idle_mutex;
+    pthread_cond_t idle_cond;
+    atomic_int running;
+} pool_t;
+
+/*
+    Start a pool with the number of threads indicated
+    A size of 0 or less uses one thread per processor available
+    The threads get stacks of the bytes indicated, or the default of the system with 0
+*/
+pool_t * createPool(int size, size_t stackSize, void (* run)(void * item));
+
+/*
+    Add an item ready to be processed to the queue of a worker
+    A negative worker uses the queue of the calling thread when it belongs to the pool,
+    and the first queue otherwise
+*/
+void poolSubmit(pool_t * pool, int worker, void * item);
+
+/*
+    Get the index of the worker running the calling thread, or -1 if it is not a worker
+*/
+int poolCurrentWorker();
+
+/*
+    Print the depth of the queue and the counters of every worker
+*/
+void printPoolStats(pool_t * pool);
+
+/*
+    Stop all the workers, wait for them to finish and free the memory
+    Items still waiting in the queues are discarded
+*/
+void destroyPool(pool_t * pool);
+
+#endif